@@ -0,0 +1,624 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * gen-image: write synthetic firmware images, for benchmarking sunxi-fw
+ *
+ * The images are made up of valid headers (with correct checksums) and
+ * pseudo random payloads, so that neither the scanner nor a compressor gets
+ * an easy time. The layouts follow what real SD card images and vendor
+ * PhoenixSuite images look like:
+ *
+ *	spl-fit:   eGON SPL at 0, FIT with embedded data at 32KB, and
+ *	           hash nodes like mkimage writes them
+ *	boot0-mbr: MBR, boot0 at 8KB, one partition from 1MB to the end
+ *	gpt:       protective MBR, GPT, SPL and FIT at 128KB, one partition
+ *	wty:       PhoenixSuite image with many entries, boot0 and U-Boot
+ *
+ * The bad-* kinds are hostile images instead, with headers claiming sizes
+ * and counts that the parsers must refuse, rather than allocate or read
+ * for, padded to @size with zeroes:
+ *
+ *	bad-spl:   eGON SPL of almost 4GB
+ *	bad-spl0:  eGON SPL of 0 bytes, shorter than its own header
+ *	bad-fit:   FIT of almost 4GB, with 4GB of strings
+ *	bad-gpt:   GPT with 2^31 partition entries
+ *	bad-wty:   PhoenixSuite image with 2^31 files
+ *	bad-nodes: FIT of a million empty nodes
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>			/* for crc32() */
+
+#include "../sunxi-fw.h"
+
+#define KB		1024ULL
+#define MB		(1024 * KB)
+#define CHUNK		(1 * MB)
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64, fast enough to produce GBs */
+static void fill_random(void *buf, size_t len)
+{
+	uint64_t *words = buf, x = rng_state;
+	size_t i;
+
+	for (i = 0; i < len / 8; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		words[i] = x;
+	}
+	rng_state = x;
+}
+
+static void put_le32(void *buf, size_t offset, uint32_t value)
+{
+	memcpy(buf + offset, &value, 4);
+}
+
+static uint32_t get_le32(const void *buf, size_t offset)
+{
+	uint32_t value;
+
+	memcpy(&value, buf + offset, 4);
+
+	return value;
+}
+
+static void put_be32(void *buf, size_t offset, uint32_t value)
+{
+	value = __builtin_bswap32(value);
+	memcpy(buf + offset, &value, 4);
+}
+
+static uint64_t out_pos;
+
+static void out_write(FILE *outf, const void *data, size_t len)
+{
+	if (fwrite(data, 1, len, outf) != len) {
+		perror("write");
+		exit(1);
+	}
+	out_pos += len;
+}
+
+/* pad the output with random data up to @end */
+static void out_random(FILE *outf, uint64_t end)
+{
+	static uint64_t buf[CHUNK / 8];
+	size_t len;
+
+	while (out_pos < end) {
+		len = end - out_pos > CHUNK ? CHUNK : end - out_pos;
+		fill_random(buf, sizeof(buf));
+		out_write(outf, buf, len);
+	}
+}
+
+static void out_zero(FILE *outf, uint64_t end)
+{
+	static const char zero[4096];
+	size_t len;
+
+	while (out_pos < end) {
+		len = end - out_pos > sizeof(zero) ? sizeof(zero) : end - out_pos;
+		out_write(outf, zero, len);
+	}
+}
+
+/* an eGON image of @size bytes, either boot0 or an SPLv2 with a DT name */
+static void *make_egon(size_t size, bool boot0)
+{
+	void *img = calloc(1, size);
+	static const uint32_t dram[] = {
+		0x288, 3, 0x3b3bfb, 1, 0x10e40000, 0x1000, 0x1c70, 0x42, 0x18,
+		0, 0x4a2195, 0x2423190, 0x8b061, 0xb4787896, 0, 0x48484848,
+		0x48, 0x1620121e, 0, 0, 0, 0x870000, 0x24, 0x34050100,
+	};
+	unsigned int i;
+
+	if (!img)
+		exit(1);
+
+	fill_random(img + 0x800, size - 0x800);
+	put_le32(img, 0, 0xea000016);
+	memcpy(img + 4, "eGON.BT0", 8);
+	put_le32(img, 16, size);
+	if (boot0) {
+		put_le32(img, 20, 0x30);
+		memcpy(img + 24, "4000", 4);
+		put_le32(img, 0x30, 0x80);
+		memcpy(img + 0x34, "3000", 4);
+		for (i = 0; i < sizeof(dram) / sizeof(dram[0]); i++)
+			put_le32(img, 0x38 + i * 4, dram[i]);
+	} else {
+		put_le32(img, 20, SPL_MAGIC | (2U << 24));
+		put_le32(img, 32, 0x100);
+		strcpy(img + 0x100, "sun50i-a64-pine64-plus");
+		strcpy(img + 0x400, "U-Boot SPL 2024.01 (Jan 01 2024)");
+	}
+	put_le32(img, 12, egon_checksum(img, size));
+
+	return img;
+}
+
+/* a minimal flattened devicetree writer, just enough for a FIT */
+struct fdt_buf {
+	char *strct, *strings;
+	size_t strct_len, strings_len;
+};
+
+static void fdt_append(char **buf, size_t *len, const void *data, size_t n)
+{
+	size_t padded = (n + 3) & ~3;
+
+	*buf = realloc(*buf, *len + padded);
+	if (!*buf)
+		exit(1);
+	memcpy(*buf + *len, data, n);
+	memset(*buf + *len + n, 0, padded - n);
+	*len += padded;
+}
+
+static void fdt_token(struct fdt_buf *fdt, uint32_t token)
+{
+	token = __builtin_bswap32(token);
+	fdt_append(&fdt->strct, &fdt->strct_len, &token, 4);
+}
+
+static void fdt_begin_node(struct fdt_buf *fdt, const char *name)
+{
+	fdt_token(fdt, 1);
+	fdt_append(&fdt->strct, &fdt->strct_len, name, strlen(name) + 1);
+}
+
+static void fdt_prop(struct fdt_buf *fdt, const char *name, const void *value,
+		     size_t len)
+{
+	uint32_t head[2];
+	size_t nameoff = fdt->strings_len;
+
+	/* no string deduplication, we don't care about a few bytes */
+	fdt->strings = realloc(fdt->strings, nameoff + strlen(name) + 1);
+	if (!fdt->strings)
+		exit(1);
+	strcpy(fdt->strings + nameoff, name);
+	fdt->strings_len += strlen(name) + 1;
+
+	fdt_token(fdt, 3);
+	head[0] = __builtin_bswap32(len);
+	head[1] = __builtin_bswap32(nameoff);
+	fdt_append(&fdt->strct, &fdt->strct_len, head, 8);
+	if (len)
+		fdt_append(&fdt->strct, &fdt->strct_len, value, len);
+}
+
+static void fdt_prop_string(struct fdt_buf *fdt, const char *name,
+			    const char *value)
+{
+	fdt_prop(fdt, name, value, strlen(value) + 1);
+}
+
+static void fdt_prop_u32(struct fdt_buf *fdt, const char *name, uint32_t value)
+{
+	value = __builtin_bswap32(value);
+	fdt_prop(fdt, name, &value, 4);
+}
+
+/* a hash-1 node over @data, with @algo being "crc32", "sha1" or "sha256" */
+static void fdt_hash(struct fdt_buf *fdt, const char *algo, const void *data,
+		     size_t size)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	struct sha_ctx sha;
+	uint32_t crc;
+
+	fdt_begin_node(fdt, "hash-1");
+	fdt_prop_string(fdt, "algo", algo);
+	if (!strcmp(algo, "crc32")) {
+		crc = crc32(0, data, size);
+		fdt_prop_u32(fdt, "value", crc);
+	} else {
+		sha_init(&sha, strcmp(algo, "sha1") ? 256 : 1);
+		sha_update(&sha, data, size);
+		sha_final(&sha, digest);
+		fdt_prop(fdt, "value", digest, sha.digest_len);
+	}
+	fdt_token(fdt, 2);
+}
+
+static void fdt_image(struct fdt_buf *fdt, const char *name, const char *desc,
+		      size_t size, const char *algo)
+{
+	void *data = malloc(size);
+
+	if (!data)
+		exit(1);
+	fill_random(data, size);
+
+	fdt_begin_node(fdt, name);
+	fdt_prop_string(fdt, "description", desc);
+	fdt_prop_string(fdt, "type", "firmware");
+	fdt_prop_string(fdt, "arch", "arm64");
+	fdt_prop_string(fdt, "compression", "none");
+	fdt_prop_u32(fdt, "load", 0x4a000000);
+	fdt_prop(fdt, "data", data, size);
+	fdt_hash(fdt, algo, data, size);
+	fdt_token(fdt, 2);
+
+	free(data);
+}
+
+/* FIT with embedded data: U-Boot of @uboot_size, ATF and @nr_dtbs DTBs */
+static void out_fit(FILE *outf, size_t uboot_size, int nr_dtbs)
+{
+	struct fdt_buf fdt = { };
+	uint32_t header[10];
+	char name[32];
+	size_t off_struct;
+	int i;
+
+	fdt_begin_node(&fdt, "");
+	fdt_prop_string(&fdt, "description", "synthetic FIT image");
+	fdt_begin_node(&fdt, "images");
+	fdt_image(&fdt, "uboot", "U-Boot (64-bit)", uboot_size, "sha256");
+	fdt_image(&fdt, "atf", "ARM Trusted Firmware", 64 * KB, "sha1");
+	for (i = 1; i <= nr_dtbs; i++) {
+		snprintf(name, sizeof(name), "fdt-%d", i);
+		fdt_image(&fdt, name, "sun50i-a64-pine64-plus", 32 * KB,
+			  "crc32");
+	}
+	fdt_token(&fdt, 2);
+	fdt_begin_node(&fdt, "configurations");
+	for (i = 1; i <= nr_dtbs; i++) {
+		snprintf(name, sizeof(name), "config-%d", i);
+		fdt_begin_node(&fdt, name);
+		snprintf(name, sizeof(name), "board-%d", i);
+		fdt_prop_string(&fdt, "description", name);
+		fdt_prop_string(&fdt, "firmware", "uboot");
+		snprintf(name, sizeof(name), "fdt-%d", i);
+		fdt_prop_string(&fdt, "fdt", name);
+		fdt_token(&fdt, 2);
+	}
+	fdt_token(&fdt, 2);
+	fdt_token(&fdt, 2);
+	fdt_token(&fdt, 9);
+
+	/* header, and an empty memory reservation map */
+	off_struct = sizeof(header) + 16;
+	put_be32(header, 0, FDT_MAGIC);
+	put_be32(header, 4, off_struct + fdt.strct_len + fdt.strings_len);
+	put_be32(header, 8, off_struct);
+	put_be32(header, 12, off_struct + fdt.strct_len);
+	put_be32(header, 16, sizeof(header));
+	put_be32(header, 20, 17);
+	put_be32(header, 24, 16);
+	put_be32(header, 28, 0);
+	put_be32(header, 32, fdt.strings_len);
+	put_be32(header, 36, fdt.strct_len);
+
+	out_write(outf, header, sizeof(header));
+	out_zero(outf, out_pos + 16);
+	out_write(outf, fdt.strct, fdt.strct_len);
+	out_write(outf, fdt.strings, fdt.strings_len);
+
+	free(fdt.strct);
+	free(fdt.strings);
+}
+
+static void out_egon(FILE *outf, size_t size, bool boot0)
+{
+	void *img = make_egon(size, boot0);
+
+	out_write(outf, img, size);
+	free(img);
+}
+
+static void make_mbr(void *sector, uint8_t type, uint32_t lba, uint32_t count)
+{
+	unsigned char *mbr = sector;
+
+	memset(mbr, 0, 512);
+	mbr[446 + 4] = type;
+	put_le32(mbr, 446 + 8, lba);
+	put_le32(mbr, 446 + 12, count);
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+}
+
+static void gen_spl_fit(FILE *outf, uint64_t size)
+{
+	out_egon(outf, 32 * KB, false);
+	out_fit(outf, size > 2 * MB ? size - 2 * MB : MB, 16);
+}
+
+static void gen_boot0_mbr(FILE *outf, uint64_t size)
+{
+	char mbr[512];
+
+	if (size < 2 * MB)
+		size = 2 * MB;
+	make_mbr(mbr, 0x83, 2048, (size - MB) / 512);
+	out_write(outf, mbr, sizeof(mbr));
+	out_zero(outf, 8 * KB);
+	out_egon(outf, 64 * KB, true);
+	out_zero(outf, MB);
+	out_random(outf, size);
+}
+
+/* the GPT CRCs are not checked by sunxi-fw, so they are left at 0 */
+static void gen_gpt(FILE *outf, uint64_t size)
+{
+	char sector[512], entries[128 * 128] = { };
+
+	if (size < 4 * MB)
+		size = 4 * MB;
+	size &= ~(512ULL - 1);
+
+	make_mbr(sector, 0xee, 1, size / 512 - 1);
+	out_write(outf, sector, sizeof(sector));
+
+	memset(sector, 0, sizeof(sector));
+	memcpy(sector, "EFI PART", 8);
+	put_le32(sector, 8, 0x10000);		/* revision 1.0 */
+	put_le32(sector, 12, 92);		/* header size */
+	put_le32(sector, 24, 1);		/* current LBA */
+	put_le32(sector, 32, size / 512 - 1);	/* backup LBA */
+	put_le32(sector, 40, 34);		/* first usable LBA */
+	put_le32(sector, 48, size / 512 - 34);	/* last usable LBA */
+	put_le32(sector, 72, 2);		/* partition entries LBA */
+	put_le32(sector, 80, 128);		/* number of entries */
+	put_le32(sector, 84, 128);		/* entry size */
+	out_write(outf, sector, sizeof(sector));
+
+	/* one Linux partition ("0FC63DAF-..."), from 2MB to the end */
+	memcpy(entries, "\xaf\x3d\xc6\x0f\x83\x84\x72\x47"
+			"\x8e\x79\x3d\x69\xd8\x47\x7d\xe4", 16);
+	memset(entries + 16, 0x5a, 16);
+	put_le32(entries, 32, 2 * MB / 512);
+	put_le32(entries, 40, size / 512 - 34);
+	out_write(outf, entries, sizeof(entries));
+
+	out_zero(outf, 128 * KB);
+	out_egon(outf, 32 * KB, false);
+	out_fit(outf, MB, 4);
+	out_zero(outf, 2 * MB);
+	out_random(outf, size);
+}
+
+/* a PhoenixSuite image, @nr_entries files spread over @size bytes */
+static void gen_wty(FILE *outf, uint64_t size, int nr_entries)
+{
+	uint64_t data_start, offset, file_size, small = 64 * KB;
+	char *header, *entries, *entry;
+	int i;
+
+	if (nr_entries < 3)
+		nr_entries = 3;
+	if (size > 0xffffffffULL)
+		size = 0xffffffffULL & ~(MB - 1);
+
+	data_start = (KB + nr_entries * KB + 64 * KB - 1) & ~(64 * KB - 1);
+	/* the last entry, "rootfs.fex", takes whatever is left */
+	if (size < data_start + 2 * MB + (nr_entries + 1) * small)
+		size = data_start + 2 * MB + (nr_entries + 1) * small;
+
+	header = calloc(1, KB);
+	entries = calloc(nr_entries, KB);
+	if (!header || !entries)
+		exit(1);
+
+	memcpy(header, "IMAGEWTY", 8);
+	put_le32(header, 8, 0x300);
+	put_le32(header, 24, size);
+	put_le32(header, 60, nr_entries);
+
+	offset = data_start;
+	for (i = 0; i < nr_entries; i++) {
+		entry = entries + i * KB;
+		if (i == 0) {
+			strcpy(entry + 36, "boot0_sdcard.fex");
+			file_size = 64 * KB;
+		} else if (i == 1) {
+			strcpy(entry + 36, "u-boot.fex");
+			file_size = 2 * MB;
+		} else if (i == nr_entries - 1) {
+			strcpy(entry + 36, "rootfs.fex");
+			file_size = size - offset;
+		} else {
+			snprintf(entry + 36, 256, "file%04d.fex", i);
+			file_size = small - 512 * (i % 16);
+		}
+		memcpy(entry + 8, "COMMON  ", 8);
+		memcpy(entry + 16, "FEX00000000000000", 16);
+		put_le32(entry, 292, (file_size + 511) & ~511);
+		put_le32(entry, 300, file_size);
+		put_le32(entry, 308, offset);
+		offset += (file_size + 511) & ~511;
+	}
+
+	out_write(outf, header, KB);
+	out_write(outf, entries, nr_entries * KB);
+	out_zero(outf, data_start);
+
+	for (i = 0; i < nr_entries; i++) {
+		entry = entries + i * KB;
+		offset = get_le32(entry, 308);
+		out_zero(outf, offset);
+		if (i == 0) {
+			out_egon(outf, 64 * KB, true);
+		} else if (i == 1) {
+			out_egon(outf, 32 * KB, false);
+			out_fit(outf, MB, 4);
+		}
+		out_random(outf, offset + get_le32(entry, 300));
+	}
+	out_zero(outf, size);
+
+	free(header);
+	free(entries);
+}
+
+/* the headers of the hostile images, all starting at 0 */
+static void gen_bad_spl(FILE *outf, uint64_t size, uint32_t length)
+{
+	void *img = make_egon(32 * KB, false);
+
+	put_le32(img, 16, length);
+	out_write(outf, img, 32 * KB);
+	free(img);
+	out_zero(outf, size);
+}
+
+static void gen_bad_fit(FILE *outf, uint64_t size)
+{
+	uint32_t header[10] = { };
+
+	put_be32(header, 0, FDT_MAGIC);
+	put_be32(header, 4, 0xfffffff0);	/* totalsize */
+	put_be32(header, 8, 56);		/* off_dt_struct */
+	put_be32(header, 12, 64);		/* off_dt_strings */
+	put_be32(header, 16, 40);		/* off_mem_rsvmap */
+	put_be32(header, 20, 17);
+	put_be32(header, 24, 16);
+	put_be32(header, 32, 0xffffff00);	/* size_dt_strings */
+	put_be32(header, 36, 8);		/* size_dt_struct */
+	out_write(outf, header, sizeof(header));
+	out_zero(outf, 512);
+	out_zero(outf, size);
+}
+
+static void gen_bad_gpt(FILE *outf, uint64_t size)
+{
+	char sector[512];
+
+	make_mbr(sector, 0xee, 1, 0xffffffff);
+	out_write(outf, sector, sizeof(sector));
+
+	memset(sector, 0, sizeof(sector));
+	memcpy(sector, "EFI PART", 8);
+	put_le32(sector, 8, 0x10000);
+	put_le32(sector, 12, 92);
+	put_le32(sector, 24, 1);
+	put_le32(sector, 72, 2);
+	put_le32(sector, 80, 0x80000000);	/* number of entries */
+	put_le32(sector, 84, 128);
+	out_write(outf, sector, sizeof(sector));
+	out_zero(outf, size);
+}
+
+static void gen_bad_wty(FILE *outf, uint64_t size)
+{
+	char header[KB] = { };
+
+	memcpy(header, "IMAGEWTY", 8);
+	put_le32(header, 8, 0x300);
+	put_le32(header, 24, 0xffffffff);	/* image size */
+	put_le32(header, 60, 0x7fffffff);	/* number of files */
+	out_write(outf, header, KB);
+	out_zero(outf, size);
+}
+
+/* nested 16 deep, so the depth limit isn't what stops the parser */
+static void gen_bad_nodes(FILE *outf, uint64_t size)
+{
+	struct fdt_buf fdt = { };
+	uint32_t header[10];
+	size_t off_struct;
+	int i, j;
+
+	fdt_begin_node(&fdt, "");
+	for (i = 0; i < 1024 * 1024 / 16; i++) {
+		for (j = 0; j < 16; j++)
+			fdt_begin_node(&fdt, "n");
+		for (j = 0; j < 16; j++)
+			fdt_token(&fdt, 2);
+	}
+	fdt_token(&fdt, 2);
+	fdt_token(&fdt, 9);
+
+	off_struct = sizeof(header) + 16;
+	put_be32(header, 0, FDT_MAGIC);
+	put_be32(header, 4, off_struct + fdt.strct_len);
+	put_be32(header, 8, off_struct);
+	put_be32(header, 12, off_struct + fdt.strct_len);
+	put_be32(header, 16, sizeof(header));
+	put_be32(header, 20, 17);
+	put_be32(header, 24, 16);
+	put_be32(header, 28, 0);
+	put_be32(header, 32, 0);
+	put_be32(header, 36, fdt.strct_len);
+
+	out_write(outf, header, sizeof(header));
+	out_zero(outf, out_pos + 16);
+	out_write(outf, fdt.strct, fdt.strct_len);
+	free(fdt.strct);
+	out_zero(outf, size);
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s <spl-fit|boot0-mbr|gpt|wty|bad-spl|bad-spl0|"
+		"bad-fit|bad-gpt|bad-wty|bad-nodes> <output> [size in MB] "
+		"[WTY entries]\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = 64 * MB;
+	int nr_entries = 300;
+	FILE *outf;
+
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (argc > 3)
+		size = strtoull(argv[3], NULL, 0) * MB;
+	if (argc > 4)
+		nr_entries = atoi(argv[4]);
+
+	outf = fopen(argv[2], "wb");
+	if (!outf) {
+		perror(argv[2]);
+		return 2;
+	}
+
+	if (!strcmp(argv[1], "spl-fit"))
+		gen_spl_fit(outf, size);
+	else if (!strcmp(argv[1], "boot0-mbr"))
+		gen_boot0_mbr(outf, size);
+	else if (!strcmp(argv[1], "gpt"))
+		gen_gpt(outf, size);
+	else if (!strcmp(argv[1], "wty"))
+		gen_wty(outf, size, nr_entries);
+	else if (!strcmp(argv[1], "bad-spl"))
+		gen_bad_spl(outf, size, 0xfffffe00);
+	else if (!strcmp(argv[1], "bad-spl0"))
+		gen_bad_spl(outf, size, 0);
+	else if (!strcmp(argv[1], "bad-fit"))
+		gen_bad_fit(outf, size);
+	else if (!strcmp(argv[1], "bad-gpt"))
+		gen_bad_gpt(outf, size);
+	else if (!strcmp(argv[1], "bad-wty"))
+		gen_bad_wty(outf, size);
+	else if (!strcmp(argv[1], "bad-nodes"))
+		gen_bad_nodes(outf, size);
+	else {
+		usage(argv[0]);
+		fclose(outf);
+		return 1;
+	}
+
+	if (fclose(outf)) {
+		perror(argv[2]);
+		return 2;
+	}
+
+	return 0;
+}
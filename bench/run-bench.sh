@@ -0,0 +1,166 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0
+#
+# run-bench.sh: time sunxi-fw on synthetic images, see "make bench"
+#
+# Every action is run against the image as a regular file, through a pipe,
+# and (when run as root, with losetup available) as a loop block device.
+# The best of $BENCH_RUNS runs is reported, as a throughput relative to the
+# image size. Caches are not dropped, so this measures the CPU side of
+# things, which is where the parsers differ.
+#
+# Knobs, as environment variables:
+#	BENCH_DIR	  where to put the images (bench/images)
+#	BENCH_SIZE	  size of the SD card style images in MB (256)
+#	BENCH_WTY_SIZE	  size of the PhoenixSuite image in MB (2048)
+#	BENCH_WTY_ENTRIES number of files in the PhoenixSuite image (300)
+#	BENCH_RUNS	  runs per measurement (3)
+#	BENCH_BLOCKDEV	  set to 0 to skip the block device runs
+#	BENCH_BUDGET_MS	  time allowed for a hostile image (1000)
+#	BENCH_MEM_MB	  memory allowed for a hostile image (256)
+#
+# The hostile images (gen-image bad-*) come last: "info -v", "list-dt-names",
+# "extract -n spl" and "extract -n fit" have to turn each of them down, as a
+# file and through a pipe, within the time and memory budget. Anything else,
+# like a crash or a hang, fails the benchmark.
+
+FW=${FW:-./sunxi-fw}
+GEN=${GEN:-bench/gen-image}
+DIR=${BENCH_DIR:-bench/images}
+SIZE=${BENCH_SIZE:-256}
+WTY_SIZE=${BENCH_WTY_SIZE:-2048}
+WTY_ENTRIES=${BENCH_WTY_ENTRIES:-300}
+RUNS=${BENCH_RUNS:-3}
+BUDGET_MS=${BENCH_BUDGET_MS:-1000}
+MEM_MB=${BENCH_MEM_MB:-256}
+FAILED=0
+LOOPDEV=
+
+mkdir -p "$DIR" || exit 1
+
+cleanup() {
+	[ -n "$LOOPDEV" ] && losetup -d "$LOOPDEV"
+	rm -f "$DIR/extract.out"
+}
+trap cleanup EXIT INT TERM
+
+now_ns() {
+	date +%s%N
+}
+
+# best of $RUNS, in nanoseconds
+time_cmd() {
+	best=
+	i=0
+	while [ $i -lt "$RUNS" ]; do
+		start=$(now_ns)
+		sh -c "$1" >/dev/null 2>&1
+		end=$(now_ns)
+		t=$((end - start))
+		if [ -z "$best" ] || [ $t -lt "$best" ]; then
+			best=$t
+		fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+report() {
+	# $1: image, $2: input kind, $3: action, $4: bytes, $5: nanoseconds
+	awk -v img="$1" -v kind="$2" -v action="$3" -v bytes="$4" -v ns="$5" \
+		'BEGIN { printf "%-10s %-6s %-40s %10.1f ms %10.1f MB/s\n",
+			 img, kind, action, ns / 1e6,
+			 bytes / 1048576 / (ns / 1e9) }'
+}
+
+# bench <name> <image> <actions...>, each action is an argument list
+bench() {
+	name=$1
+	img=$2
+	shift 2
+	bytes=$(stat -c %s "$img")
+
+	if [ "$(id -u)" = 0 ] && [ "${BENCH_BLOCKDEV:-1}" != 0 ] &&
+	   command -v losetup >/dev/null; then
+		LOOPDEV=$(losetup --find --show --read-only "$img" 2>/dev/null)
+	fi
+
+	for action in "$@"; do
+		t=$(time_cmd "$FW $action $img")
+		report "$name" file "$action" "$bytes" "$t"
+		t=$(time_cmd "cat $img | $FW $action")
+		report "$name" pipe "$action" "$bytes" "$t"
+		if [ -n "$LOOPDEV" ]; then
+			t=$(time_cmd "$FW $action $LOOPDEV")
+			report "$name" blkdev "$action" "$bytes" "$t"
+		fi
+	done
+
+	if [ -n "$LOOPDEV" ]; then
+		losetup -d "$LOOPDEV"
+		LOOPDEV=
+	fi
+}
+
+# images are only generated once per size
+gen() {
+	out="$DIR/$2-$3M.img"
+	if [ ! -f "$out" ]; then
+		echo "generating $out" >&2
+		"$GEN" "$1" "$out" "$3" ${4:+"$4"} || exit 1
+	fi
+	echo "$out"
+}
+
+OUT="-o $DIR/extract.out"
+
+SPL_FIT=$(gen spl-fit spl-fit 64)
+BOOT0_MBR=$(gen boot0-mbr boot0-mbr "$SIZE")
+GPT=$(gen gpt gpt "$SIZE")
+WTY=$(gen wty "wty-$WTY_ENTRIES" "$WTY_SIZE" "$WTY_ENTRIES")
+
+bench spl-fit "$SPL_FIT" info "info -a -v" "extract -n fit:uboot $OUT" \
+	list-dt-names
+bench boot0-mbr "$BOOT0_MBR" info "info -a -v" "extract -n boot0 $OUT"
+bench gpt "$GPT" info "info -a -v" "extract -n spl $OUT" list-dt-names
+bench wty "$WTY" info "info -a -v" "extract -n wty:boot0_sdcard.fex $OUT" \
+	"extract -n wty:rootfs.fex $OUT"
+
+# hostile <kind> <action>: refused, without crashing, within the budget
+hostile() {
+	img=$(gen "$1" "$1" 64)
+
+	for kind in file pipe; do
+		if [ $kind = file ]; then
+			cmd="$FW $2 $img"
+		else
+			cmd="cat $img | $FW $2"
+		fi
+		start=$(now_ns)
+		# the CPU limit ends a loop that never gets anywhere
+		(ulimit -v $((MEM_MB * 1024)); ulimit -t $((BUDGET_MS / 1000 + 5))
+		 sh -c "$cmd") >/dev/null 2>&1
+		status=$?
+		end=$(now_ns)
+		ms=$(((end - start) / 1000000))
+
+		result=ok
+		if [ $status -gt 2 ]; then
+			result="FAIL (exit status $status)"
+		elif [ $ms -gt "$BUDGET_MS" ]; then
+			result="FAIL (over ${BUDGET_MS} ms)"
+		fi
+		[ "$result" = ok ] || FAILED=1
+		printf "%-10s %-6s %-40s %10d ms %s\n" "$1" $kind "$2" \
+			$ms "$result"
+	done
+}
+
+for bad in bad-spl bad-spl0 bad-fit bad-gpt bad-wty bad-nodes; do
+	hostile $bad "info -v"
+	hostile $bad list-dt-names
+	hostile $bad "extract -n spl $OUT"
+	hostile $bad "extract -n fit $OUT"
+done
+
+exit $FAILED
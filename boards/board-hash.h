@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * board-hash.h: the hash function of the board database, shared by
+ * boards/gen-boards, which builds the table, and sunxi-board.c
+ */
+
+#ifndef __BOARD_HASH_H__
+#define __BOARD_HASH_H__
+
+#include <stdint.h>
+
+/* FNV-1a, with the seed mixed in, and the murmur3 finalizer */
+static inline uint32_t board_hash(const char *key, uint32_t seed)
+{
+	uint32_t h = 2166136261U ^ (seed * 0x9e3779b9U);
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619U;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h;
+}
+
+#endif
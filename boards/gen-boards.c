@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * gen-boards: turn boards/boards.txt into the tables of sunxi-board.c
+ *
+ * The DT names of the boards, and the DT prefixes of the SoCs, end up in a
+ * minimal perfect hash table ("hash, displace"): the keys are put into
+ * buckets by board_hash(key, 0), and the buckets, largest first, each get
+ * the first displacement d for which board_hash(key, d) moves all of
+ * their keys into free slots. A lookup then is two hashes and a strcmp().
+ *
+ * This runs on the build host, it doesn't link against libsunxi-fw.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "board-hash.h"
+
+#define MAX_OFFSETS	3
+#define MAX_DISPLACE	(1U << 24)
+
+struct soc {
+	char *prefix, *name, *dram;
+	uint32_t offsets[MAX_OFFSETS];
+	int nr_offsets;
+};
+
+struct key {
+	char *dt_name;
+	char *model;			/* NULL for a SoC */
+	int soc;
+	uint32_t bucket;
+};
+
+static struct soc *socs;
+static struct key *keys;
+static int nr_socs, nr_keys;
+
+static void *grow(void *array, int nr, size_t size)
+{
+	array = realloc(array, (nr + 1) * size);
+	if (!array) {
+		perror("gen-boards");
+		exit(1);
+	}
+
+	return array;
+}
+
+static char *dup(const char *str)
+{
+	char *copy = strdup(str);
+
+	if (!copy) {
+		perror("gen-boards");
+		exit(1);
+	}
+
+	return copy;
+}
+
+static void add_key(const char *dt_name, const char *model, int soc)
+{
+	int i;
+
+	for (i = 0; i < nr_keys; i++) {
+		if (!strcmp(keys[i].dt_name, dt_name)) {
+			fprintf(stderr, "duplicate DT name \"%s\"\n", dt_name);
+			exit(1);
+		}
+	}
+
+	keys = grow(keys, nr_keys, sizeof(*keys));
+	keys[nr_keys].dt_name = dup(dt_name);
+	keys[nr_keys].model = model ? dup(model) : NULL;
+	keys[nr_keys].soc = soc;
+	nr_keys++;
+}
+
+/* soc <DT prefix> <name> <DRAM layout> <offset[,offset...]> */
+static int parse_soc(char *line)
+{
+	char *prefix, *name, *dram, *offsets, *offset, *end;
+	struct soc *soc;
+
+	strtok(line, " \t");
+	prefix = strtok(NULL, " \t");
+	name = strtok(NULL, " \t");
+	dram = strtok(NULL, " \t");
+	offsets = strtok(NULL, " \t");
+	if (!offsets || strtok(NULL, " \t"))
+		return -EINVAL;
+	if (strcmp(dram, "a10") && strcmp(dram, "a31") &&
+	    strcmp(dram, "h6") && strcmp(dram, "h616") && strcmp(dram, "-"))
+		return -EINVAL;
+
+	socs = grow(socs, nr_socs, sizeof(*socs));
+	soc = &socs[nr_socs];
+	soc->prefix = dup(prefix);
+	soc->name = dup(name);
+	soc->dram = strcmp(dram, "-") ? dup(dram) : NULL;
+	soc->nr_offsets = 0;
+	for (offset = strtok(offsets, ","); offset;
+	     offset = strtok(NULL, ",")) {
+		if (soc->nr_offsets == MAX_OFFSETS)
+			return -EINVAL;
+		soc->offsets[soc->nr_offsets++] = strtoul(offset, &end, 10) * 1024;
+		if (*end || end == offset)
+			return -EINVAL;
+	}
+	add_key(prefix, NULL, nr_socs);
+	nr_socs++;
+
+	return 0;
+}
+
+/* <DT name> <model...>, the SoC is the one with the DT prefix */
+static int parse_board(char *line)
+{
+	char *dt_name, *model;
+	size_t len;
+	int i;
+
+	dt_name = strtok(line, " \t");
+	model = strtok(NULL, "");
+	if (!model)
+		return -EINVAL;
+	model += strspn(model, " \t");
+
+	for (i = 0; i < nr_socs; i++) {
+		len = strlen(socs[i].prefix);
+		if (!strncmp(dt_name, socs[i].prefix, len) &&
+		    dt_name[len] == '-')
+			break;
+	}
+	if (i == nr_socs || !*model)
+		return -EINVAL;
+
+	add_key(dt_name, model, i);
+
+	return 0;
+}
+
+static int read_boards(FILE *inf, const char *filename)
+{
+	char *line = NULL, *hash;
+	size_t size = 0;
+	ssize_t len;
+	int nr = 0, ret;
+
+	while ((len = getline(&line, &size, inf)) > 0) {
+		nr++;
+		hash = strchr(line, '#');
+		if (hash)
+			*hash = 0;
+		len = strcspn(line, "\r\n");
+		/* trailing white space, so models end with their last word */
+		while (len && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+			len--;
+		line[len] = 0;
+		if (!line[strspn(line, " \t")])
+			continue;
+
+		if (!strncmp(line, "soc", 3) && (line[3] == ' ' || line[3] == '\t'))
+			ret = parse_soc(line);
+		else
+			ret = parse_board(line);
+		if (ret) {
+			fprintf(stderr, "%s:%d: invalid line\n", filename, nr);
+			free(line);
+			return ret;
+		}
+	}
+	free(line);
+
+	return 0;
+}
+
+/* builds the displacements, and the key of each slot */
+static int build_table(uint32_t nr_buckets, uint32_t *displace, int *slots)
+{
+	int *order, *bucket_keys, *sizes, nr, i, j, k;
+	uint32_t d, slot[64];
+	bool ok;
+
+	order = calloc(nr_buckets, sizeof(*order));
+	sizes = calloc(nr_buckets, sizeof(*sizes));
+	bucket_keys = calloc(nr_keys, sizeof(*bucket_keys));
+	if (!order || !sizes || !bucket_keys)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_keys; i++) {
+		keys[i].bucket = board_hash(keys[i].dt_name, 0) % nr_buckets;
+		sizes[keys[i].bucket]++;
+	}
+	for (i = 0; i < (int)nr_buckets; i++)
+		order[i] = i;
+	/* largest buckets first, while there are many free slots */
+	for (i = 1; i < (int)nr_buckets; i++)
+		for (j = i; j > 0 && sizes[order[j]] > sizes[order[j - 1]]; j--) {
+			k = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = k;
+		}
+
+	for (i = 0; i < nr_keys; i++)
+		slots[i] = -1;
+
+	for (i = 0; i < (int)nr_buckets && sizes[order[i]]; i++) {
+		nr = 0;
+		for (k = 0; k < nr_keys; k++)
+			if (keys[k].bucket == (uint32_t)order[i])
+				bucket_keys[nr++] = k;
+		if (nr > 64)
+			return -E2BIG;
+
+		for (d = 1; d < MAX_DISPLACE; d++) {
+			ok = true;
+			for (j = 0; ok && j < nr; j++) {
+				slot[j] = board_hash(keys[bucket_keys[j]].dt_name,
+						     d) % nr_keys;
+				ok = slots[slot[j]] < 0;
+				for (k = 0; ok && k < j; k++)
+					ok = slot[k] != slot[j];
+			}
+			if (ok)
+				break;
+		}
+		if (d == MAX_DISPLACE)
+			return -EAGAIN;
+
+		displace[order[i]] = d;
+		for (j = 0; j < nr; j++)
+			slots[slot[j]] = bucket_keys[j];
+	}
+
+	free(order);
+	free(sizes);
+	free(bucket_keys);
+
+	return 0;
+}
+
+static void print_string(const char *str)
+{
+	if (!str) {
+		printf("NULL");
+		return;
+	}
+
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			putchar('\\');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+/* the enum dram_layout_id name: "h616" is DRAM_H616 */
+static void print_layout(const char *dram)
+{
+	printf("DRAM_");
+	for (; *dram; dram++)
+		putchar(*dram >= 'a' && *dram <= 'z' ? *dram - 'a' + 'A' : *dram);
+}
+
+static void print_tables(uint32_t nr_buckets, const uint32_t *displace,
+			 const int *slots)
+{
+	const struct soc *soc;
+	const struct key *key;
+	uint32_t i;
+	int j;
+
+	printf("/* generated from boards/boards.txt by boards/gen-boards, do not edit */\n\n");
+
+	printf("static const struct sunxi_soc board_socs[%d] = {\n", nr_socs);
+	for (j = 0; j < nr_socs; j++) {
+		soc = &socs[j];
+		printf("\t{ ");
+		print_string(soc->name);
+		printf(", ");
+		print_string(soc->dram);
+		printf(", ");
+		if (soc->dram)
+			print_layout(soc->dram);
+		else
+			printf("-1");
+		printf(", { ");
+		for (i = 0; i < (uint32_t)soc->nr_offsets; i++)
+			printf("%s%u", i ? ", " : "", soc->offsets[i]);
+		printf(" } },\n");
+	}
+	printf("};\n\n");
+
+	printf("#define BOARD_BUCKETS\t%u\n", nr_buckets);
+	printf("#define BOARD_SLOTS\t%d\n\n", nr_keys);
+
+	printf("static const uint32_t board_displace[BOARD_BUCKETS] = {");
+	for (i = 0; i < nr_buckets; i++)
+		printf("%s%u,", i % 8 ? " " : "\n\t", displace[i]);
+	printf("\n};\n\n");
+
+	printf("static const struct sunxi_board board_table[BOARD_SLOTS] = {\n");
+	for (j = 0; j < nr_keys; j++) {
+		key = &keys[slots[j]];
+		printf("\t{ ");
+		print_string(key->dt_name);
+		printf(", ");
+		print_string(key->model);
+		printf(", &board_socs[%d] },\n", key->soc);
+	}
+	printf("};\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t nr_buckets, *displace;
+	int *slots, ret;
+	FILE *inf;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <boards.txt>\n", argv[0]);
+		return 1;
+	}
+
+	inf = fopen(argv[1], "r");
+	if (!inf) {
+		perror(argv[1]);
+		return 1;
+	}
+	ret = read_boards(inf, argv[1]);
+	fclose(inf);
+	if (ret)
+		return 1;
+	if (!nr_keys) {
+		fprintf(stderr, "%s: no boards\n", argv[1]);
+		return 1;
+	}
+
+	/* about two keys per bucket */
+	nr_buckets = nr_keys / 2 + 1;
+	displace = calloc(nr_buckets, sizeof(*displace));
+	slots = calloc(nr_keys, sizeof(*slots));
+	if (!displace || !slots)
+		return 1;
+
+	ret = build_table(nr_buckets, displace, slots);
+	if (ret) {
+		fprintf(stderr, "%s: no perfect hash: %s\n", argv[1],
+			strerror(-ret));
+		return 1;
+	}
+
+	print_tables(nr_buckets, displace, slots);
+
+	return fflush(stdout) ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fuzz-decoder: one of the component decoders on its own
+ *
+ * Built once per decoder, with FUZZ_DECODER set to its name (see the
+ * Makefile): the input is the component, starting with its header sector,
+ * as if the scanner had just found it there.
+ */
+
+#include "fuzz.h"
+
+#ifndef FUZZ_DECODER
+#error "FUZZ_DECODER is not set"
+#endif
+
+/* the partition table is read by the scanner as well */
+static int fuzz_mbr(struct sunxi_ctx *ctx, void *sector)
+{
+	output_mbr_info(ctx, sector);
+	mbr_partitions(ctx, sector);
+
+	return 0;
+}
+
+static int fuzz_gpt(struct sunxi_ctx *ctx, void *sector)
+{
+	return gpt_partitions(ctx, sector);
+}
+
+static const struct {
+	const char *name;
+	int (*decode)(struct sunxi_ctx *ctx, void *sector);
+} decoders[] = {
+	{ "boot0",	output_boot0_info },
+	{ "spl",	output_spl_info },
+	{ "toc0",	output_toc0_info },
+	{ "uboot",	output_uboot_info },
+	{ "fit",	dump_dt_info },
+	{ "mbr",	fuzz_mbr },
+	{ "gpt",	fuzz_gpt },
+	{ "wty",	output_wty_info },
+};
+
+#define STR(x)		#x
+#define XSTR(x)		STR(x)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static int decoder = -1;
+	struct sunxi_ctx *ctx;
+	char buffer[512];
+	void *sector;
+	int i, mapped;
+
+	if (decoder < 0) {
+		for (i = 0; i < (int)(sizeof(decoders) / sizeof(decoders[0]));
+		     i++)
+			if (!strcmp(decoders[i].name, XSTR(FUZZ_DECODER)))
+				decoder = i;
+		if (decoder < 0)
+			abort();
+	}
+
+	for (mapped = 0; mapped < 2; mapped++) {
+		ctx = fuzz_ctx(data, size, mapped);
+		if (!ctx)
+			return 0;
+		sector = input_read(ctx, buffer, 512);
+		if (sector)
+			decoders[decoder].decode(ctx, sector);
+		fuzz_ctx_free(ctx);
+	}
+
+	return 0;
+}
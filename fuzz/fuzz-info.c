@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fuzz-info: "info -v" over a whole image, the scanner with all decoders
+ *
+ * The first byte of the input picks the options, the rest is the image:
+ * bit 0 scans all of it (-a), bit 1 only the gap before the first
+ * partition (-g), bit 2 the partitions as well (-p).
+ */
+
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct sunxi_ctx *ctx;
+	int mapped;
+
+	if (size < 2)
+		return 0;
+
+	for (mapped = 0; mapped < 2; mapped++) {
+		ctx = fuzz_ctx(data + 1, size - 1, mapped);
+		if (!ctx)
+			return 0;
+		ctx->gap_only = data[0] & 2;
+		ctx->scan_parts = data[0] & 4;
+		output_image_info(ctx, data[0] & 1);
+		fuzz_ctx_free(ctx);
+	}
+
+	return 0;
+}
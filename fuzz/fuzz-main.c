@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fuzz-main: run a fuzz target on files, without libFuzzer
+ *
+ * For AFL, for compilers without -fsanitize=fuzzer, and for a crash to
+ * reproduce in a debugger: each file named on the command line is handed
+ * to LLVMFuzzerTestOneInput(), or stdin if there is none.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int run_file(const char *filename)
+{
+	FILE *inf = filename ? fopen(filename, "rb") : stdin;
+	size_t size = 0, alloc = 0, len;
+	uint8_t *data = NULL, *tmp;
+
+	if (!inf) {
+		perror(filename);
+		return -errno;
+	}
+
+	do {
+		if (size == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			tmp = realloc(data, alloc);
+			if (!tmp) {
+				free(data);
+				if (filename)
+					fclose(inf);
+				return -ENOMEM;
+			}
+			data = tmp;
+		}
+		len = fread(data + size, 1, alloc - size, inf);
+		size += len;
+	} while (len);
+
+	if (filename)
+		fclose(inf);
+
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, ret = 0;
+
+	if (argc < 2)
+		return run_file(NULL) ? 1 : 0;
+
+	for (i = 1; i < argc; i++)
+		if (run_file(argv[i]))
+			ret = 1;
+
+	return ret;
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * fuzz.h: what the fuzz targets share, a context over the fuzzer's input
+ *
+ * Every input is parsed twice: read through a stream, the way pipes are,
+ * and as a mapping, the way files and block devices are. The two take
+ * different paths through input_window() and pseek() in the decoders.
+ */
+
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sunxi-fw.h"
+
+/* the reports go nowhere, parsing them is what counts */
+static inline FILE *fuzz_null(void)
+{
+	static FILE *null;
+
+	if (!null)
+		null = fopen("/dev/null", "w");
+
+	return null;
+}
+
+/*
+ * fuzz_ctx() - a context for the fuzzer input
+ * @data: the input, as handed to LLVMFuzzerTestOneInput()
+ * @size: its size
+ * @mapped: map (a writable copy of) @data, rather than stream it
+ *
+ * Return: the context, to be released with fuzz_ctx_free(), or NULL
+ */
+static inline struct sunxi_ctx *fuzz_ctx(const uint8_t *data, size_t size,
+					 bool mapped)
+{
+	struct sunxi_ctx *ctx;
+	FILE *inf;
+
+	if (!size)
+		return NULL;
+
+	ctx = malloc(sizeof(*ctx));
+	inf = fmemopen((void *)data, size, "rb");
+	if (!ctx || !inf) {
+		free(ctx);
+		if (inf)
+			fclose(inf);
+		return NULL;
+	}
+
+	/* fmemopen() has no file descriptor, so this is a stream */
+	sunxi_ctx_init(ctx, inf, fuzz_null(), true);
+
+	if (mapped) {
+		ctx->map_base = malloc(size);
+		if (!ctx->map_base) {
+			fclose(inf);
+			free(ctx);
+			return NULL;
+		}
+		memcpy(ctx->map_base, data, size);
+		ctx->map_size = size;
+	}
+
+	return ctx;
+}
+
+static inline void fuzz_ctx_free(struct sunxi_ctx *ctx)
+{
+	/* not an mmap() of our own, see fuzz_ctx() */
+	free(ctx->map_base);
+	ctx->map_base = NULL;
+
+	sunxi_ctx_release(ctx);
+	fclose(ctx->inf);
+	free(ctx);
+}
+
+#endif
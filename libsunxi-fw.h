@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * libsunxi-fw: public interface to the sunxi-fw firmware image parsers
+ *
+ * A typical user walks over all components of an image like this:
+ *
+ *	struct sunxi_component comp;
+ *	struct sunxi_iter *iter = sunxi_iter_new(inf, SUNXI_ITER_CHECKSUM);
+ *
+ *	while (sunxi_iter_next(iter, &comp) > 0)
+ *		printf("%s @ 0x%llx\n", comp.name, comp.offset);
+ *	sunxi_iter_free(iter);
+ */
+
+#ifndef __LIBSUNXI_FW_H__
+#define __LIBSUNXI_FW_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define SUNXI_API	__attribute__((visibility("default")))
+
+enum image_type {
+	IMAGE_ERROR,
+	IMAGE_SHORT,
+	IMAGE_UNKNOWN,
+	IMAGE_BOOT0,
+	IMAGE_SPL1,
+	IMAGE_SPL2,
+	IMAGE_SPLx,
+	IMAGE_TOC0,
+	IMAGE_UBOOT,
+	IMAGE_FIT,
+	IMAGE_MBR,
+	IMAGE_GPT,
+	IMAGE_ROCKCHIP,
+	IMAGE_AML,
+	IMAGE_PHOENIX,
+};
+
+/* "wty:" plus the longest WTY file name, plus the terminating NUL */
+#define SUNXI_NAME_LEN		(4 + 256 + 1)
+
+#define SUNXI_DESC_LEN		64
+
+enum sunxi_checksum {
+	SUNXI_CHECKSUM_NONE,		/* not checked, or no checksum */
+	SUNXI_CHECKSUM_OK,
+	SUNXI_CHECKSUM_BAD,
+};
+
+/*
+ * struct sunxi_component - one firmware component found in an image
+ * @type: component type, for nested components the type of the container
+ * @offset: absolute offset in the input, in bytes
+ * @size: size in bytes, 0 if unknown
+ * @name: component name, as accepted by "sunxi-fw extract -n"
+ * @depth: 0 for top level components, 1 for images inside a FIT or WTY
+ * @checksum: result of the checksum verification
+ * @checksum_value: the computed checksum, if @checksum is not NONE
+ * @description: FIT image description, U-Boot image name or SPL DT name
+ * @header: first sector of a top level component, NULL for nested ones.
+ *          Only valid until the next call to sunxi_iter_next().
+ */
+struct sunxi_component {
+	enum image_type type;
+	uint64_t offset;
+	uint64_t size;
+	char name[SUNXI_NAME_LEN];
+	int depth;
+	enum sunxi_checksum checksum;
+	uint32_t checksum_value;
+	char description[SUNXI_DESC_LEN];
+	const void *header;
+};
+
+/* flags for sunxi_iter_new() */
+#define SUNXI_ITER_CHECKSUM	(1U << 0)	/* verify checksums and CRCs */
+#define SUNXI_ITER_SCAN_ALL	(1U << 1)	/* don't stop after U-Boot */
+#define SUNXI_ITER_GAP_ONLY	(1U << 2)	/* stop at the first partition */
+#define SUNXI_ITER_SCAN_PARTS	(1U << 3)	/* look inside partitions too */
+
+struct sunxi_iter;
+
+/*
+ * sunxi_iter_new() - start iterating over the components in @inf
+ * @inf: input file, read from the current position, must stay open
+ * @flags: SUNXI_ITER_* flags
+ *
+ * Return: iterator, or NULL if out of memory
+ */
+SUNXI_API struct sunxi_iter *sunxi_iter_new(FILE *inf, unsigned int flags);
+
+/*
+ * sunxi_iter_next() - get the next component
+ * @iter: iterator from sunxi_iter_new()
+ * @comp: filled with the component information
+ *
+ * Components are returned in the order they are found, the images inside a
+ * FIT or WTY image follow right after their container.
+ *
+ * Return: 1 if @comp was filled, 0 at the end of the image, negative error
+ *         value otherwise
+ */
+SUNXI_API int sunxi_iter_next(struct sunxi_iter *iter,
+			      struct sunxi_component *comp);
+
+SUNXI_API void sunxi_iter_free(struct sunxi_iter *iter);
+
+/* check a given sector-sized buffer for magic numbers */
+SUNXI_API enum image_type identify_image(const void *buffer);
+
+#endif
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-batch: run "info" over many image files, using a pool of worker
+ *              threads. Each file's report is collected in its own memory
+ *              buffer, and printed in input order.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sunxi-fw.h"
+
+struct batch_job {
+	const char *filename;
+	char *output;
+	size_t size;
+	int ret;			/* from info_file() */
+	bool done;
+};
+
+struct batch {
+	struct batch_job *jobs;
+	int nr_jobs;
+	int next;			/* first job not yet picked up */
+	const struct info_options *opts;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+/*
+ * info_file() - "info" for one file, as run by the batch and serve workers
+ * @filename: image file or block device
+ * @outf: where the report goes, errors included
+ * @opts: "info" options, --stats are part of the report
+ *
+ * Return: 0 if successful, negative error value if the file can't be read,
+ *         or its records can't be made
+ */
+int info_file(const char *filename, FILE *outf,
+	      const struct info_options *opts)
+{
+	struct sunxi_stats stats = { 0 };
+	struct sunxi_cache *cache = NULL;
+	struct sunxi_ctx *ctx;
+	FILE *inf, *report;
+	int ret = 0;
+
+	/* input_unpack() closes the file if it fails, nothing to clean up */
+	inf = input_open(filename, opts->direct);
+	if (inf)
+		inf = input_unpack(inf, opts->readahead);
+	if (!inf) {
+		ret = -errno;
+		if (opts->format == FORMAT_TEXT)
+			fprintf(outf, "%s: %s\n", filename, strerror(-ret));
+		else
+			output_error_record(outf, filename, opts->format, ret);
+		return ret;
+	}
+
+	if (opts->cache && !opts->stats)
+		cache = cache_open(opts->cache, inf, filename, opts);
+	if (!cache_replay(cache, outf)) {
+		fclose(inf);
+		goto out;
+	}
+	report = cache_capture(cache, outf);
+
+	if (opts->format != FORMAT_TEXT) {
+		ret = output_image_records(inf, report, filename, opts, cache);
+		fclose(inf);
+	} else {
+		/* the scratch buffer is better off on the heap, per thread */
+		ctx = malloc(sizeof(*ctx));
+		if (!ctx)
+			ret = -ENOMEM;
+		if (ctx) {
+			sunxi_ctx_init(ctx, inf, report, opts->verbose);
+			ctx->cache = cache;
+			ctx->gap_only = opts->gap_only;
+			ctx->scan_parts = opts->scan_parts;
+			ctx->only = opts->only;
+			ctx->board = board_lookup(opts->board);
+			if (opts->stats)
+				ctx->stats = &stats;
+			output_image_info(ctx, opts->scan_all);
+			/* part of the report, to keep it next to the file name */
+			stats_report(ctx, report);
+			sunxi_ctx_release(ctx);
+			free(ctx);
+		}
+		fclose(inf);
+	}
+
+out:
+	cache_close(cache, outf);
+
+	return ret;
+}
+
+static void batch_run_job(struct batch *batch, struct batch_job *job)
+{
+	FILE *outf;
+
+	outf = open_memstream(&job->output, &job->size);
+	if (!outf) {
+		job->ret = -ENOMEM;
+		return;
+	}
+
+	job->ret = info_file(job->filename, outf, batch->opts);
+	fclose(outf);
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+	struct batch_job *job;
+
+	do {
+		pthread_mutex_lock(&batch->lock);
+		if (batch->next < batch->nr_jobs)
+			job = &batch->jobs[batch->next++];
+		else
+			job = NULL;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (!job)
+			break;
+
+		batch_run_job(batch, job);
+
+		pthread_mutex_lock(&batch->lock);
+		job->done = true;
+		pthread_cond_broadcast(&batch->done);
+		pthread_mutex_unlock(&batch->lock);
+	} while (1);
+
+	return NULL;
+}
+
+/*
+ * batch_image_info() - output_image_info() for a list of files
+ * @filenames: list of image files
+ * @nr_files: number of entries in @filenames
+ * @nr_threads: number of worker threads
+ * @outf: where to print the reports to, each preceded by the file name
+ * @opts: "info" options, machine readable records carry the file name
+ *
+ * Return: 0 if successful, the error of the first file that failed otherwise
+ */
+int batch_image_info(const char **filenames, int nr_files, int nr_threads,
+		     FILE *outf, const struct info_options *opts)
+{
+	struct batch batch = {
+		.nr_jobs = nr_files,
+		.opts = opts,
+	};
+	pthread_t *threads;
+	int i, nr_started, ret = 0;
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > nr_files)
+		nr_threads = nr_files;
+
+	batch.jobs = calloc(nr_files, sizeof(*batch.jobs));
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!batch.jobs || !threads) {
+		free(batch.jobs);
+		free(threads);
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr_files; i++)
+		batch.jobs[i].filename = filenames[i];
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.done, NULL);
+
+	for (nr_started = 0; nr_started < nr_threads; nr_started++)
+		if (pthread_create(&threads[nr_started], NULL, batch_worker,
+				   &batch))
+			break;
+	/* no threads at all? Do the work ourselves then. */
+	if (!nr_started)
+		batch_worker(&batch);
+
+	/* flush the reports in input order, as soon as they are ready */
+	for (i = 0; i < nr_files; i++) {
+		struct batch_job *job = &batch.jobs[i];
+
+		pthread_mutex_lock(&batch.lock);
+		while (!job->done)
+			pthread_cond_wait(&batch.done, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+
+		if (opts->format == FORMAT_TEXT)
+			fprintf(outf, "%s:\n", job->filename);
+		if (job->output)
+			fwrite(job->output, 1, job->size, outf);
+		free(job->output);
+		if (job->ret && !ret)
+			ret = job->ret;
+	}
+
+	for (i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&batch.done);
+	pthread_mutex_destroy(&batch.lock);
+	free(threads);
+	free(batch.jobs);
+
+	return ret;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-board: what the devicetree name of a board tells about it
+ *
+ * SPL headers and FIT configurations name the board by its DT name, which
+ * is looked up in a table generated from boards/boards.txt at build time:
+ * a minimal perfect hash table (see boards/gen-boards.c), so a lookup is
+ * two hashes of the name and one strcmp(), without probing. Boards which
+ * aren't in the table still tell the SoC, by the "sun50i-a64" part of the
+ * name, which has an entry of its own.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sunxi-fw.h"
+#include "boards/board-hash.h"
+#include "boards/boards.h"
+
+#define BOARD_MAX_PREFIX	32
+
+static const struct sunxi_board *board_find(const char *key)
+{
+	const struct sunxi_board *board;
+	uint32_t bucket;
+
+	bucket = board_hash(key, 0) % BOARD_BUCKETS;
+	board = &board_table[board_hash(key, board_displace[bucket]) %
+			     BOARD_SLOTS];
+
+	return strcmp(board->dt_name, key) ? NULL : board;
+}
+
+/*
+ * board_lookup() - find a board, or at least its SoC, by the DT name
+ * @dt_name: as in the SPL header, e.g. "sun50i-a64-pine64-plus", or NULL
+ *
+ * Return: the board, the SoC only (with a NULL ->model) if the board is
+ *         unknown, or NULL if not even the SoC is
+ */
+const struct sunxi_board *board_lookup(const char *dt_name)
+{
+	const struct sunxi_board *board;
+	char prefix[BOARD_MAX_PREFIX];
+	const char *dash;
+
+	if (!dt_name)
+		return NULL;
+
+	board = board_find(dt_name);
+	if (board)
+		return board;
+
+	/* "sun50i-a64-foo" is an A64, for the boot offsets and DRAM */
+	dash = strchr(dt_name, '-');
+	if (dash)
+		dash = strchr(dash + 1, '-');
+	if (!dash || dash - dt_name >= BOARD_MAX_PREFIX)
+		return NULL;
+	memcpy(prefix, dt_name, dash - dt_name);
+	prefix[dash - dt_name] = 0;
+
+	return board_find(prefix);
+}
+
+/*
+ * board_check_offset() - warn about a boot image the boot ROM won't find
+ * @ctx: context, the warning goes to ctx->out
+ * @board: the board the image is for, NULL to skip the check
+ * @offset: of the boot0, SPL or TOC0 header, 0 for a file of its own
+ */
+void board_check_offset(struct sunxi_ctx *ctx, const struct sunxi_board *board,
+			uint64_t offset)
+{
+	int i;
+
+	if (!board || !offset)
+		return;
+
+	for (i = 0; i < SUNXI_BOOT_OFFSETS && board->soc->boot_offsets[i]; i++)
+		if (board->soc->boot_offsets[i] == offset)
+			return;
+
+	fprintf(ctx->out, "\tWARNING: the %s boot ROM doesn't look at %llu KB\n",
+		board->soc->name, (unsigned long long)offset / 1024);
+}
+
+/* "board: Pine64+ (A64)", and with @verbose where it boots from */
+void output_board_info(FILE *stream, const char *indent,
+		       const struct sunxi_board *board, bool verbose)
+{
+	const struct sunxi_soc *soc = board->soc;
+	int i;
+
+	if (board->model)
+		fprintf(stream, "%sboard: %s (%s)\n", indent, board->model,
+			soc->name);
+	else
+		fprintf(stream, "%sSoC: %s\n", indent, soc->name);
+
+	if (!verbose)
+		return;
+
+	fprintf(stream, "%sboot offsets:", indent);
+	for (i = 0; i < SUNXI_BOOT_OFFSETS && soc->boot_offsets[i]; i++)
+		fprintf(stream, "%s %u KB", i ? "," : "",
+			soc->boot_offsets[i] / 1024);
+	fprintf(stream, "\n");
+	if (soc->dram)
+		fprintf(stream, "%sboot0 DRAM layout: %s\n", indent, soc->dram);
+}
@@ -25,7 +25,6 @@ struct egon_header {
 #define EGON_MAGIC_0 "eGON.BT0"
 #define EGON_MAGIC_1 "eGON.BT1"
 	char magic[8];
-#define EGON_CHECKSUM_SEED 0x5f0a6c39
 	uint32_t checksum;
 #define EGON_FILESIZE_ALIGN 4096
 	uint32_t filesize;
@@ -71,37 +70,18 @@ egon_header_print(FILE *stream, struct egon_header *header)
 }
 
 static int
-egon_checksum_verify(FILE *stream, struct egon_header *header,
-		     uint32_t *sector0, FILE *inf)
+egon_checksum_verify(struct sunxi_ctx *ctx, struct egon_header *header,
+		     uint32_t *sector0)
 {
-#define BUFFER_COUNT (SECTOR_SIZE / sizeof(uint32_t))
-	uint32_t buffer[BUFFER_COUNT];
-	uint32_t checksum = EGON_CHECKSUM_SEED;
-	off_t checksum_offset =
-		offsetof(struct egon_header, checksum) / sizeof(uint32_t);
-	off_t offset;
-	int i;
-
-	/* handle the already read sector separately */
-	for (i = 0; i < BUFFER_COUNT; i++) {
-		if (i == checksum_offset)
-			continue;
-		checksum += sector0[i];
-	}
-	offset = SECTOR_SIZE;
-
-	for (; offset < header->filesize; offset += SECTOR_SIZE) {
-		int ret;
-
-		ret = fread(buffer, sizeof(uint32_t), BUFFER_COUNT, inf);
-		if (ret != BUFFER_COUNT) {
-			fprintf(stream,	"Error: %s(): fread failed: %s (%d)\n",
-				__func__, strerror(errno), ret);
-			return ret;
-		}
+	FILE *stream = ctx->out;
+	uint32_t checksum;
+	int ret;
 
-		for (i = 0; i < BUFFER_COUNT; i++)
-			checksum += buffer[i];
+	ret = egon_checksum_input(ctx, sector0, header->filesize, &checksum);
+	if (ret) {
+		fprintf(stream,	"Error: %s(): %s\n", __func__,
+			ret == -EINVAL ? "invalid size" : "read failed");
+		return ret;
 	}
 
 	if (checksum != header->checksum)
@@ -146,456 +126,557 @@ egon_header_secondary_print(FILE *stream,
 }
 
 /*
- * should work for A10, A10s, A13 and A20.
+ * DRAM parameter layouts
+ *
+ * boot0 carries the DRAM parameters of the board, in a layout that depends
+ * on the SoC generation. There is no version field, so the layout is told
+ * from the values: each layout comes with a few rules on the typical
+ * fields (clock, type, ODT), and the first layout whose rules all pass is
+ * taken. All rules live in one table, which is run through once for all
+ * layouts, so additional SoCs only add rules, not another pass.
+ *
+ * The fields of a layout double as the sys_config.fex style dump, and are
+ * emitted by name in the machine readable output.
  */
-#define DRAM_PARAM_A10_MATCHES "A10/A10s/A13/A20"
-
-struct dram_param_a10 {
-	uint32_t baseaddr;
-	uint32_t clk;
-	uint32_t type;
-	uint32_t rank_num;
-	uint32_t chip_density;
-	uint32_t io_width;
-	uint32_t bus_width;
-	uint32_t cas;
-	uint32_t zq;
-	uint32_t odt_en;
-	uint32_t size;
-	uint32_t tpr0;
-	uint32_t tpr1;
-	uint32_t tpr2;
-	uint32_t tpr3;
-	uint32_t tpr4;
-	uint32_t tpr5;
-	uint32_t emr1;
-	uint32_t emr2;
-	uint32_t emr3;
+
+enum dram_rule_kind {
+	DRAM_RANGE,			/* @a <= value <= @b */
+	DRAM_ONE_OF,			/* bit (value) set in @a */
+	DRAM_CLEAR,			/* no bits of @a set in value */
 };
 
-static int
-dram_param_a10_validate(FILE *stream, void *raw)
-{
-	struct dram_param_a10 *param = raw;
-	char *message = "Invalid structure for " DRAM_PARAM_A10_MATCHES;
+struct dram_rule {
+	int layout;			/* enum dram_layout_id */
+	int index;			/* of the parameter word */
+	const char *name;
+	enum dram_rule_kind kind;
+	uint64_t a, b;
+};
 
-	/* This is a base address, should be 0x40000000 */
-	if (param->baseaddr & 0x0FFFFFFF) {
-		fprintf(stream, "%s: wrong baseaddr: 0x%08X\n", message,
-		       param->baseaddr);
-		return -1;
-	}
+struct dram_field {
+	int index;
+	const char *name;
+	const char *format;		/* for the dump, with the value */
+};
 
-	/* MHz */
-	if ((param->clk < 100) || (param->clk > 1000)) {
-		fprintf(stream, "%s: wrong clk: 0x%08X\n", message,
-		       param->clk);
-		return -1;
-	}
+struct dram_layout {
+	const char *socs;
+	const char *title;		/* format for the dump, with @socs */
+	int clk, type;			/* parameter word indices */
+	const struct dram_field *fields;
+	int nr_fields;
+};
+
+#define BIT64(n)	(1ULL << (n))
 
+static const struct dram_rule dram_rules[] = {
+	/* A10: the base address should be 0x40000000 */
+	{ DRAM_A10, 0, "baseaddr", DRAM_CLEAR, 0x0FFFFFFF },
+	{ DRAM_A10, 1, "clk", DRAM_RANGE, 100, 1000 },	/* MHz */
 	/* 2: DDR2, 3: DDR3 */
-	if ((param->type != 2) && (param->type != 3)) {
-		fprintf(stream, "%s: wrong type: 0x%08X\n", message,
-		       param->type);
-		return -1;
-	}
+	{ DRAM_A10, 2, "type", DRAM_ONE_OF, BIT64(2) | BIT64(3) },
+	{ DRAM_A10, 9, "odt_en", DRAM_ONE_OF, BIT64(0) | BIT64(1) },
 
-	if ((param->odt_en != 0) && (param->odt_en != 1)) {
-		fprintf(stream, "%s: wrong odt_en: 0x%08X\n", message,
-		       param->odt_en);
-		return -1;
-	}
+	{ DRAM_H6, 0, "clk", DRAM_RANGE, 100, 1000 },
+	/* 2: DDR2, 3: DDR3, 6: LPDDR2, 7: LPDDR3 */
+	{ DRAM_H6, 1, "type", DRAM_ONE_OF,
+	  BIT64(2) | BIT64(3) | BIT64(6) | BIT64(7) },
+	{ DRAM_H6, 3, "odt_en", DRAM_ONE_OF, BIT64(0) | BIT64(1) },
+	{ DRAM_H6, 27, "bits", DRAM_ONE_OF, BIT64(16) | BIT64(32) },
+
+	{ DRAM_A31, 0, "clk", DRAM_RANGE, 100, 1000 },
+	{ DRAM_A31, 1, "type", DRAM_ONE_OF,
+	  BIT64(2) | BIT64(3) | BIT64(6) | BIT64(7) },
+	{ DRAM_A31, 3, "odt_en", DRAM_ONE_OF, BIT64(0) | BIT64(1) },
+
+	{ DRAM_H616, 0, "clk", DRAM_RANGE, 100, 1200 },
+	/* 2: DDR2, 3: DDR3, 4: DDR4, 6: LPDDR2, 7: LPDDR3, 8: LPDDR4 */
+	{ DRAM_H616, 1, "type", DRAM_ONE_OF,
+	  BIT64(2) | BIT64(3) | BIT64(4) | BIT64(6) | BIT64(7) | BIT64(8) },
+	{ DRAM_H616, 2, "dx_odt", DRAM_CLEAR, 0xF0F0F0F0 },
+	{ DRAM_H616, 3, "dx_dri", DRAM_CLEAR, 0xF0F0F0F0 },
+};
 
-	fprintf(stream, "Parameters seem valid for %s.\n",
-		DRAM_PARAM_A10_MATCHES);
-	return 0;
-}
+/* should work for A10, A10s, A13 and A20 */
+static const struct dram_field dram_fields_a10[] = {
+	{  0, "baseaddr",	"dram_baseaddr\t   = 0x%x\n" },
+	{  1, "clk",		"dram_clk\t   = %d\n" },
+	{  2, "type",		"dram_type\t   = %d\n" },
+	{  3, "rank_num",	"dram_rank_num\t   = 0x%x\n" },
+	{  4, "chip_density",	"dram_chip_density  = 0x%x\n" },
+	{  5, "io_width",	"dram_io_width\t   = 0x%x\n" },
+	{  6, "bus_width",	"dram_bus_width\t   = 0x%x\n" },
+	{  7, "cas",		"dram_cas\t   = 0x%x\n" },
+	{  8, "zq",		"dram_zq\t\t   = 0x%x\n" },
+	{  9, "odt_en",		"dram_odt_en\t   = %d\n" },
+	{ 10, "size",		"dram_size\t   = 0x%x\n" },
+	{ 11, "tpr0",		"dram_tpr0\t   = 0x%x\n" },
+	{ 12, "tpr1",		"dram_tpr1\t   = 0x%x\n" },
+	{ 13, "tpr2",		"dram_tpr2\t   = 0x%x\n" },
+	{ 14, "tpr3",		"dram_tpr3\t   = 0x%x\n" },
+	{ 15, "tpr4",		"dram_tpr4\t   = 0x%x\n" },
+	{ 16, "tpr5",		"dram_tpr5\t   = 0x%x\n" },
+	{ 17, "emr1",		"dram_emr1\t   = 0x%x\n" },
+	{ 18, "emr2",		"dram_emr2\t   = 0x%x\n" },
+	{ 19, "emr3",		"dram_emr3\t   = 0x%x\n" },
+};
+
+/* should work for A31 and relations */
+static const struct dram_field dram_fields_a31[] = {
+	{  0, "clk",		"dram_clk\t= %d\n" },
+	{  1, "type",		"dram_type\t= %d\n" },
+	{  2, "zq",		"dram_zq\t\t= 0x%x\n" },
+	{  3, "odt_en",		"dram_odt_en\t= %d\n" },
+	{  4, "para1",		"dram_para1\t= 0x%x\n" },
+	{  5, "para2",		"dram_para2\t= 0x%x\n" },
+	{  6, "mr0",		"dram_mr0\t= 0x%x\n" },
+	{  7, "mr1",		"dram_mr1\t= 0x%x\n" },
+	{  8, "mr2",		"dram_mr2\t= 0x%x\n" },
+	{  9, "mr3",		"dram_mr3\t= 0x%x\n" },
+	{ 10, "tpr0",		"dram_tpr0\t= 0x%08x\n" },
+	{ 11, "tpr1",		"dram_tpr1\t= 0x%08x\n" },
+	{ 12, "tpr2",		"dram_tpr2\t= 0x%08x\n" },
+	{ 13, "tpr3",		"dram_tpr3\t= 0x%08x\n" },
+	{ 14, "tpr4",		"dram_tpr4\t= 0x%x\n" },
+	{ 15, "tpr5",		"dram_tpr5\t= 0x%x\n" },
+	{ 16, "tpr6",		"dram_tpr6\t= 0x%x\n" },
+	{ 17, "tpr7",		"dram_tpr7\t= 0x%x\n" },
+	{ 18, "tpr8",		"dram_tpr8\t= 0x%x\n" },
+	{ 19, "tpr9",		"dram_tpr9\t= 0x%x\n" },
+	{ 20, "tpr10",		"dram_tpr10\t= 0x%x\n" },
+	{ 21, "tpr11",		"dram_tpr11\t= 0x%08x\n" },
+	{ 22, "tpr12",		"dram_tpr12\t= 0x%08x\n" },
+	{ 23, "tpr13",		"dram_tpr13\t= 0x%08x\n" },
+};
+
+/* should work for H6 */
+static const struct dram_field dram_fields_h6[] = {
+	{  0, "clk",		"dram_clk\t= %d\n" },
+	{  1, "type",		"dram_type\t= %d\n" },
+	{  2, "zq",		"dram_zq\t\t= 0x%x\n" },
+	{  3, "odt_en",		"dram_odt_en\t= %d\n" },
+	{  4, "para1",		"dram_para1\t= 0x%x\n" },
+	{  5, "para2",		"dram_para2\t= 0x%x\n" },
+	{  6, "mr0",		"dram_mr0\t= 0x%x\n" },
+	{  7, "mr1",		"dram_mr1\t= 0x%x\n" },
+	{  8, "mr2",		"dram_mr2\t= 0x%x\n" },
+	{  9, "mr3",		"dram_mr3\t= 0x%x\n" },
+	{ 10, "mr4",		"dram_mr4\t= 0x%x\n" },
+	{ 11, "mr5",		"dram_mr5\t= 0x%x\n" },
+	{ 12, "mr6",		"dram_mr6\t= 0x%x\n" },
+	{ 13, "tpr0",		"dram_tpr0\t= 0x%08x\n" },
+	{ 14, "tpr1",		"dram_tpr1\t= 0x%08x\n" },
+	{ 15, "tpr2",		"dram_tpr2\t= 0x%08x\n" },
+	{ 16, "tpr3",		"dram_tpr3\t= 0x%08x\n" },
+	{ 17, "tpr4",		"dram_tpr4\t= 0x%x\n" },
+	{ 18, "tpr5",		"dram_tpr5\t= 0x%x\n" },
+	{ 19, "tpr6",		"dram_tpr6\t= 0x%x\n" },
+	{ 20, "tpr7",		"dram_tpr7\t= 0x%x\n" },
+	{ 21, "tpr8",		"dram_tpr8\t= 0x%x\n" },
+	{ 22, "tpr9",		"dram_tpr9\t= 0x%x\n" },
+	{ 23, "tpr10",		"dram_tpr10\t= 0x%x\n" },
+	{ 24, "tpr11",		"dram_tpr11\t= 0x%08x\n" },
+	{ 25, "tpr12",		"dram_tpr12\t= 0x%08x\n" },
+	{ 26, "tpr13",		"dram_tpr13\t= 0x%08x\n" },
+	{ 27, "bits",		"dram_bits\t= %d\n" },
+};
+
+/* should work for H616/A523/H700, on H616/H700 tpr14 should be zero */
+static const struct dram_field dram_fields_h616[] = {
+	{  0, "clk",		"dram_clk\t   = %d,\n" },
+	{  1, "type",		"dram_type\t   = %d,\n" },
+	{  2, "dx_odt",		"dram_dx_odt\t   = 0x%08X,\n" },
+	{  3, "dx_dri",		"dram_dx_dri\t   = 0x%08X,\n" },
+	{  4, "ca_dri",		"dram_ca_dri\t   = 0x%08X,\n" },
+	{  5, "para0",		"dram_para0\t   = 0x%08X, ; aka odt_en on H616/H700\n" },
+	{  6, "para1",		"dram_para1\t   = 0x%08X,\n" },
+	{  7, "para2",		"dram_para2\t   = 0x%08X,\n" },
+	{  8, "mr0",		"dram_mr0\t   = 0x%X,\n" },
+	{  9, "mr1",		"dram_mr1\t   = 0x%X,\n" },
+	{ 10, "mr2",		"dram_mr2\t   = 0x%X,\n" },
+	{ 11, "mr3",		"dram_mr3\t   = 0x%X,\n" },
+	{ 12, "mr4",		"dram_mr4\t   = 0x%X,\n" },
+	{ 13, "mr5",		"dram_mr5\t   = 0x%X,\n" },
+	{ 14, "mr6",		"dram_mr6\t   = 0x%X,\n" },
+	{ 15, "mr11",		"dram_mr11\t   = 0x%X,\n" },
+	{ 16, "mr12",		"dram_mr12\t   = 0x%X,\n" },
+	{ 17, "mr13",		"dram_mr13\t   = 0x%X,\n" },
+	{ 18, "mr14",		"dram_mr14\t   = 0x%X,\n" },
+	{ 19, "mr16",		"dram_mr16\t   = 0x%X,\n" },
+	{ 20, "mr17",		"dram_mr17\t   = 0x%X,\n" },
+	{ 21, "mr22",		"dram_mr22\t   = 0x%X,\n" },
+	{ 22, "tpr0",		"dram_tpr0\t   = 0x%08X,\n" },
+	{ 23, "tpr1",		"dram_tpr1\t   = 0x%X,\n" },
+	{ 24, "tpr2",		"dram_tpr2\t   = 0x%X,\n" },
+	{ 25, "tpr3",		"dram_tpr3\t   = 0x%X,\n" },
+	{ 26, "tpr6",		"dram_tpr6\t   = 0x%08X,\n" },
+	{ 27, "tpr10",		"dram_tpr10\t   = 0x%08X,\n" },
+	{ 28, "tpr11",		"dram_tpr11\t   = 0x%08X,\n" },
+	{ 29, "tpr12",		"dram_tpr12\t   = 0x%08X,\n" },
+	{ 30, "tpr13",		"dram_tpr13\t   = 0x%X,\n" },
+	{ 31, "tpr14",		"dram_tpr14\t   = 0x%X, ; unused and 0 on anything but A523\n" },
+};
+
+#define DRAM_FIELDS(f)	.fields = f, .nr_fields = sizeof(f) / sizeof(f[0])
+
+static const struct dram_layout dram_layouts[NR_DRAM_LAYOUTS] = {
+	[DRAM_A10] = {
+		"A10/A10s/A13/A20", "\n; %s\n", 1, 2,
+		DRAM_FIELDS(dram_fields_a10),
+	},
+	[DRAM_H6] = {
+		"H6", "\n; For %s\n", 0, 1,
+		DRAM_FIELDS(dram_fields_h6),
+	},
+	[DRAM_A31] = {
+		"A31/A23/A33/A83T/A64/H3", "\n; For %s\n", 0, 1,
+		DRAM_FIELDS(dram_fields_a31),
+	},
+	[DRAM_H616] = {
+		"H616/H700/A523", "\n; For %s\n", 0, 1,
+		DRAM_FIELDS(dram_fields_h616),
+	},
+};
 
-static void
-dram_param_a10_print(FILE *stream, void *raw)
+static bool dram_rule_passes(const struct dram_rule *rule, uint32_t value)
 {
-	struct dram_param_a10 *param = raw;
+	switch (rule->kind) {
+	case DRAM_RANGE:
+		return value >= rule->a && value <= rule->b;
+	case DRAM_ONE_OF:
+		return value < 64 && (rule->a & BIT64(value));
+	case DRAM_CLEAR:
+		return !(value & rule->a);
+	}
 
-	fprintf(stream, "\n; %s\n", DRAM_PARAM_A10_MATCHES);
-	fprintf(stream, "[dram para]\n\n");
-	fprintf(stream, "dram_baseaddr\t   = 0x%x\n", param->baseaddr);
-	fprintf(stream, "dram_clk\t   = %d\n", param->clk);
-	fprintf(stream, "dram_type\t   = %d\n", param->type);
-	fprintf(stream, "dram_rank_num\t   = 0x%x\n", param->rank_num);
-	fprintf(stream, "dram_chip_density  = 0x%x\n", param->chip_density);
-	fprintf(stream, "dram_io_width\t   = 0x%x\n", param->io_width);
-	fprintf(stream, "dram_bus_width\t   = 0x%x\n", param->bus_width);
-	fprintf(stream, "dram_cas\t   = 0x%x\n", param->cas);
-	fprintf(stream, "dram_zq\t\t   = 0x%x\n", param->zq);
-	fprintf(stream, "dram_odt_en\t   = %d\n", param->odt_en);
-	fprintf(stream, "dram_size\t   = 0x%x\n", param->size);
-	fprintf(stream, "dram_tpr0\t   = 0x%x\n", param->tpr0);
-	fprintf(stream, "dram_tpr1\t   = 0x%x\n", param->tpr1);
-	fprintf(stream, "dram_tpr2\t   = 0x%x\n", param->tpr2);
-	fprintf(stream, "dram_tpr3\t   = 0x%x\n", param->tpr3);
-	fprintf(stream, "dram_tpr4\t   = 0x%x\n", param->tpr4);
-	fprintf(stream, "dram_tpr5\t   = 0x%x\n", param->tpr5);
-	fprintf(stream, "dram_emr1\t   = 0x%x\n", param->emr1);
-	fprintf(stream, "dram_emr2\t   = 0x%x\n", param->emr2);
-	fprintf(stream, "dram_emr3\t   = 0x%x\n", param->emr3);
-	fprintf(stream, "\n");
+	return false;
 }
 
 /*
- * should work for A31 and relations
+ * dram_classify() - find the DRAM parameter layout, in one pass
+ * @param: the DRAM parameter words
+ * @expected: layout of the board's SoC, which is all that is checked if
+ *            its rules pass, or -1
+ * @failed: filled with the first rule each layout failed, NULL if none or
+ *          not checked
+ *
+ * Return: @expected if its rules pass, otherwise the preferred layout whose
+ *         rules all pass, or -1
  */
-#define DRAM_PARAM_A31_MATCHES "A31/A23/A33/A83T/A64/H3"
-
-struct dram_param_a31 {
-	uint32_t clk;
-	uint32_t type;
-	uint32_t zq;
-	uint32_t odt_en;
-	uint32_t para1;
-	uint32_t para2;
-	uint32_t mr0;
-	uint32_t mr1;
-	uint32_t mr2;
-	uint32_t mr3;
-	uint32_t tpr0;
-	uint32_t tpr1;
-	uint32_t tpr2;
-	uint32_t tpr3;
-	uint32_t tpr4;
-	uint32_t tpr5;
-	uint32_t tpr6;
-	uint32_t tpr7;
-	uint32_t tpr8;
-	uint32_t tpr9;
-	uint32_t tpr10;
-	uint32_t tpr11;
-	uint32_t tpr12;
-	uint32_t tpr13;
-	uint32_t bits;
-};
-
-static int
-dram_param_a31_validate(FILE *stream, void *raw)
+static int dram_classify(const uint32_t *param, int expected,
+			 const struct dram_rule *failed[NR_DRAM_LAYOUTS])
 {
-	struct dram_param_a31 *param = raw;
-	char *message = "Invalid structure for " DRAM_PARAM_A31_MATCHES;
-
-	/* MHz */
-	if ((param->clk < 100) || (param->clk > 1000)) {
-		fprintf(stream, "%s: wrong clk: 0x%08X\n", message,
-		       param->clk);
-		return -1;
+	const struct dram_rule *rule;
+	unsigned int i;
+	int layout;
+
+	for (layout = 0; layout < NR_DRAM_LAYOUTS; layout++)
+		failed[layout] = NULL;
+
+	for (i = 0; expected >= 0 &&
+		    i < sizeof(dram_rules) / sizeof(dram_rules[0]); i++) {
+		rule = &dram_rules[i];
+		if (rule->layout == expected &&
+		    !dram_rule_passes(rule, param[rule->index])) {
+			failed[expected] = rule;
+			break;
+		}
 	}
-
-	/* 2: DDR2, 3: DDR3, 6: LPDDR2, 7: LPDDR3 */
-	if ((param->type != 2) && (param->type != 3) &&
-	    (param->type != 6) && (param->type != 7)) {
-		fprintf(stream, "%s: wrong type: 0x%08X\n", message,
-		       param->type);
-		return -1;
+	if (expected >= 0 && !failed[expected])
+		return expected;
+
+	for (i = 0; i < sizeof(dram_rules) / sizeof(dram_rules[0]); i++) {
+		rule = &dram_rules[i];
+		if (!failed[rule->layout] &&
+		    !dram_rule_passes(rule, param[rule->index]))
+			failed[rule->layout] = rule;
 	}
 
-	if ((param->odt_en != 0) && (param->odt_en != 1)) {
-		fprintf(stream, "%s: wrong odt_en: 0x%08X\n", message,
-		       param->odt_en);
-		return -1;
+	for (layout = 0; layout < NR_DRAM_LAYOUTS; layout++)
+		if (!failed[layout])
+			return layout;
+
+	return -1;
+}
+
+/* the verdicts, the expected layout first, then in order of preference */
+static void dram_report(FILE *stream, const uint32_t *param, int match,
+			const struct sunxi_board *board,
+			const struct dram_rule *failed[NR_DRAM_LAYOUTS])
+{
+	int layout, expected = board ? board->soc->dram_layout : -1;
+
+	if (expected >= 0 && match == expected) {
+		fprintf(stream, "Parameters are valid for %s, as expected for %s boards.\n",
+			dram_layouts[match].socs, board->soc->name);
+		return;
 	}
+	if (expected >= 0)
+		fprintf(stream, "Invalid structure for %s boards: wrong %s: 0x%08X\n",
+			board->soc->name, failed[expected]->name,
+			param[failed[expected]->index]);
 
-	fprintf(stream, "Parameters seem valid for %s.\n",
-		DRAM_PARAM_A31_MATCHES);
-	return 0;
+	for (layout = 0; layout < NR_DRAM_LAYOUTS; layout++) {
+		if (layout == expected)
+			continue;
+		if (layout == match) {
+			fprintf(stream, "Parameters seem valid for %s.\n",
+				dram_layouts[layout].socs);
+			return;
+		}
+		fprintf(stream, "Invalid structure for %s: wrong %s: 0x%08X\n",
+			dram_layouts[layout].socs, failed[layout]->name,
+			param[failed[layout]->index]);
+	}
 }
 
-static void
-dram_param_a31_print(FILE *stream, void *raw)
+static void dram_param_print(FILE *stream, const uint32_t *param, int match)
 {
-	struct dram_param_a31 *param = raw;
+	const struct dram_layout *layout;
+	int i;
+
+	if (match < 0) {
+		fprintf(stream, "; Unknown structure\n");
+		for (i = 0; i < EGON_DRAM_PARAM_COUNT; i++)
+			fprintf(stream, "dram_%02d\t= 0x%08X\n", i, param[i]);
+		return;
+	}
 
-	fprintf(stream, "\n; For %s\n", DRAM_PARAM_A31_MATCHES);
+	layout = &dram_layouts[match];
+	fprintf(stream, layout->title, layout->socs);
 	fprintf(stream, "[dram para]\n\n");
-	fprintf(stream, "dram_clk\t= %d\n", param->clk);
-	fprintf(stream, "dram_type\t= %d\n", param->type);
-	fprintf(stream, "dram_zq\t\t= 0x%x\n", param->zq);
-	fprintf(stream, "dram_odt_en\t= %d\n", param->odt_en);
-	fprintf(stream, "dram_para1\t= 0x%x\n", param->para1);
-	fprintf(stream, "dram_para2\t= 0x%x\n", param->para2);
-	fprintf(stream, "dram_mr0\t= 0x%x\n", param->mr0);
-	fprintf(stream, "dram_mr1\t= 0x%x\n", param->mr1);
-	fprintf(stream, "dram_mr2\t= 0x%x\n", param->mr2);
-	fprintf(stream, "dram_mr3\t= 0x%x\n", param->mr3);
-	fprintf(stream, "dram_tpr0\t= 0x%08x\n", param->tpr0);
-	fprintf(stream, "dram_tpr1\t= 0x%08x\n", param->tpr1);
-	fprintf(stream, "dram_tpr2\t= 0x%08x\n", param->tpr2);
-	fprintf(stream, "dram_tpr3\t= 0x%08x\n", param->tpr3);
-	fprintf(stream, "dram_tpr4\t= 0x%x\n", param->tpr4);
-	fprintf(stream, "dram_tpr5\t= 0x%x\n", param->tpr5);
-	fprintf(stream, "dram_tpr6\t= 0x%x\n", param->tpr6);
-	fprintf(stream, "dram_tpr7\t= 0x%x\n", param->tpr7);
-	fprintf(stream, "dram_tpr8\t= 0x%x\n", param->tpr8);
-	fprintf(stream, "dram_tpr9\t= 0x%x\n", param->tpr9);
-	fprintf(stream, "dram_tpr10\t= 0x%x\n", param->tpr10);
-	fprintf(stream, "dram_tpr11\t= 0x%08x\n", param->tpr11);
-	fprintf(stream, "dram_tpr12\t= 0x%08x\n", param->tpr12);
-	fprintf(stream, "dram_tpr13\t= 0x%08x\n", param->tpr13);
+	for (i = 0; i < layout->nr_fields; i++)
+		fprintf(stream, layout->fields[i].format,
+			param[layout->fields[i].index]);
 	fprintf(stream, "\n");
 }
 
-/*
- * should work for H6
- */
-#define DRAM_PARAM_H6_MATCHES "H6"
-
-struct dram_param_h6 {
-	uint32_t clk;
-	uint32_t type;
-	uint32_t zq;
-	uint32_t odt_en;
-	uint32_t para1;
-	uint32_t para2;
-	uint32_t mr0;
-	uint32_t mr1;
-	uint32_t mr2;
-	uint32_t mr3;
-	uint32_t mr4;
-	uint32_t mr5;
-	uint32_t mr6;
-	uint32_t tpr0;
-	uint32_t tpr1;
-	uint32_t tpr2;
-	uint32_t tpr3;
-	uint32_t tpr4;
-	uint32_t tpr5;
-	uint32_t tpr6;
-	uint32_t tpr7;
-	uint32_t tpr8;
-	uint32_t tpr9;
-	uint32_t tpr10;
-	uint32_t tpr11;
-	uint32_t tpr12;
-	uint32_t tpr13;
-	uint32_t bits;
-};
-
-/*
- * Call this before a31_validate, so .bits can trigger invalidation.
- */
-static int
-dram_param_h6_validate(FILE *stream, void *raw)
+/* Returns the name of field @i of the layout found, or NULL. */
+const char *boot0_dram_field(const struct boot0_dram *dram, int i,
+			     uint32_t *value)
 {
-	struct dram_param_h6 *param = raw;
-	char *message = "Invalid structure for " DRAM_PARAM_H6_MATCHES;
+	const struct dram_layout *layout;
 
-	/* MHz */
-	if ((param->clk < 100) || (param->clk > 1000)) {
-		fprintf(stream, "%s: wrong clk: 0x%08X\n", message,
-		       param->clk);
-		return -1;
-	}
+	if (dram->layout < 0)
+		return NULL;
 
-	/* 2: DDR2, 3: DDR3, 6: LPDDR2, 7: LPDDR3 */
-	if ((param->type != 2) && (param->type != 3) &&
-	    (param->type != 6) && (param->type != 7)) {
-		fprintf(stream, "%s: wrong type: 0x%08X\n", message,
-		       param->type);
-		return -1;
-	}
+	layout = &dram_layouts[dram->layout];
+	if (i < 0 || i >= layout->nr_fields)
+		return NULL;
 
-	if ((param->odt_en != 0) && (param->odt_en != 1)) {
-		fprintf(stream, "%s: wrong odt_en: 0x%08X\n", message,
-		       param->odt_en);
-		return -1;
-	}
+	*value = dram->params[layout->fields[i].index];
 
-	if ((param->bits != 16) && (param->bits != 32)) {
-		fprintf(stream, "%s: wrong bits: 0x%08X\n", message,
-		       param->bits);
-		return -1;
+	return layout->fields[i].name;
+}
+
+/*
+ * boot0_dram_params() - find out which DRAM parameter layout boot0 uses
+ * @sector: first sector of the boot0 image
+ * @board: the board boot0 is for, its SoC's layout is tried first, or NULL
+ * @dram: filled with the decoded parameters
+ *
+ * Return: 0 if the layout is known, -ENOENT otherwise. @dram->params
+ *         is set in both cases.
+ */
+int boot0_dram_params(const void *sector, const struct sunxi_board *board,
+		      struct boot0_dram *dram)
+{
+	const struct dram_rule *failed[NR_DRAM_LAYOUTS];
+	const struct egon_header *header = sector;
+	struct egon_header_secondary *secondary;
+	const struct dram_layout *layout;
+
+	if (header->header_size != sizeof(struct egon_header))
+		return -EINVAL;
+
+	secondary = (void *)header + header->header_size;
+	dram->params = secondary->dram_param;
+	dram->nr_params = EGON_DRAM_PARAM_COUNT;
+
+	dram->layout = dram_classify(dram->params,
+				     board ? board->soc->dram_layout : -1,
+				     failed);
+	if (dram->layout < 0) {
+		dram->socs = NULL;
+		return -ENOENT;
 	}
 
-	fprintf(stream, "Parameters seem valid for %s.\n",
-		DRAM_PARAM_H6_MATCHES);
+	layout = &dram_layouts[dram->layout];
+	dram->socs = layout->socs;
+	dram->clk = dram->params[layout->clk];
+	dram->type = dram->params[layout->type];
+
 	return 0;
 }
 
-static void
-dram_param_h6_print(FILE *stream, void *raw)
+/* Returns the parameter word index for @key, or -1 if @layout has none. */
+static int dram_param_index(int layout, const char *key, size_t len)
 {
-	struct dram_param_h6 *param = raw;
+	const struct dram_layout *l;
+	unsigned long index;
+	char *end;
+	int i;
 
-	fprintf(stream, "\n; For %s\n", DRAM_PARAM_H6_MATCHES);
-	fprintf(stream, "[dram para]\n\n");
-	fprintf(stream, "dram_clk\t= %d\n", param->clk);
-	fprintf(stream, "dram_type\t= %d\n", param->type);
-	fprintf(stream, "dram_zq\t\t= 0x%x\n", param->zq);
-	fprintf(stream, "dram_odt_en\t= %d\n", param->odt_en);
-	fprintf(stream, "dram_para1\t= 0x%x\n", param->para1);
-	fprintf(stream, "dram_para2\t= 0x%x\n", param->para2);
-	fprintf(stream, "dram_mr0\t= 0x%x\n", param->mr0);
-	fprintf(stream, "dram_mr1\t= 0x%x\n", param->mr1);
-	fprintf(stream, "dram_mr2\t= 0x%x\n", param->mr2);
-	fprintf(stream, "dram_mr3\t= 0x%x\n", param->mr3);
-	fprintf(stream, "dram_mr4\t= 0x%x\n", param->mr4);
-	fprintf(stream, "dram_mr5\t= 0x%x\n", param->mr5);
-	fprintf(stream, "dram_mr6\t= 0x%x\n", param->mr6);
-	fprintf(stream, "dram_tpr0\t= 0x%08x\n", param->tpr0);
-	fprintf(stream, "dram_tpr1\t= 0x%08x\n", param->tpr1);
-	fprintf(stream, "dram_tpr2\t= 0x%08x\n", param->tpr2);
-	fprintf(stream, "dram_tpr3\t= 0x%08x\n", param->tpr3);
-	fprintf(stream, "dram_tpr4\t= 0x%x\n", param->tpr4);
-	fprintf(stream, "dram_tpr5\t= 0x%x\n", param->tpr5);
-	fprintf(stream, "dram_tpr6\t= 0x%x\n", param->tpr6);
-	fprintf(stream, "dram_tpr7\t= 0x%x\n", param->tpr7);
-	fprintf(stream, "dram_tpr8\t= 0x%x\n", param->tpr8);
-	fprintf(stream, "dram_tpr9\t= 0x%x\n", param->tpr9);
-	fprintf(stream, "dram_tpr10\t= 0x%x\n", param->tpr10);
-	fprintf(stream, "dram_tpr11\t= 0x%08x\n", param->tpr11);
-	fprintf(stream, "dram_tpr12\t= 0x%08x\n", param->tpr12);
-	fprintf(stream, "dram_tpr13\t= 0x%08x\n", param->tpr13);
-	fprintf(stream, "dram_bits\t= %d\n", param->bits);
-	fprintf(stream, "\n");
+	/* as in the dump of an unknown structure */
+	if (len > 5 && !strncmp(key, "dram_", 5)) {
+		index = strtoul(key + 5, &end, 10);
+		if (end == key + len && index < EGON_DRAM_PARAM_COUNT)
+			return index;
+	}
+
+	if (layout < 0)
+		return -1;
+
+	l = &dram_layouts[layout];
+	for (i = 0; i < l->nr_fields; i++)
+		if (strlen(l->fields[i].name) == len &&
+		    !strncmp(l->fields[i].name, key, len))
+			return l->fields[i].index;
+
+	return -1;
 }
 
 /*
- * Should work for H616/A523/H700
- * On H616/H700, tpr14 should be zero.
+ * boot0_patch_dram() - change DRAM parameters in a boot0 header, in memory
+ * @sector: first sector of the boot0 image
+ * @settings: "key=value" strings, the keys being the field names of the
+ *            layout the parameters fit (see boot0_dram_field()), or
+ *            "dram_NN" for parameter word NN, for any layout
+ * @nr_settings: number of entries in @settings
+ * @log: stream to report the changes on, or NULL
+ *
+ * The parameters have to fit the same layout afterwards, so a mistyped
+ * clock or DRAM type is refused instead of being written. The eGON checksum
+ * is corrected for the changed parameter words, see egon_checksum_update().
+ *
+ * Return: 0 if successful, -EINVAL if this is no boot0 header or a setting
+ *         is invalid, -ENOENT if a key is unknown
  */
-#define DRAM_PARAM_H616_MATCHES "H616/H700/A523"
-
-struct dram_param_h616 {
-	uint32_t clk;
-	uint32_t type;
-	uint32_t dx_odt;
-	uint32_t dx_dri;
-	uint32_t ca_dri;
-	uint32_t para0;
-	uint32_t para1;
-	uint32_t para2;
-	uint32_t mr0;
-	uint32_t mr1;
-	uint32_t mr2;
-	uint32_t mr3;
-	uint32_t mr4;
-	uint32_t mr5;
-	uint32_t mr6;
-	uint32_t mr11;
-	uint32_t mr12;
-	uint32_t mr13;
-	uint32_t mr14;
-	uint32_t mr16;
-	uint32_t mr17;
-	uint32_t mr22;
-	uint32_t tpr0;
-	uint32_t tpr1;
-	uint32_t tpr2;
-	uint32_t tpr3;
-	uint32_t tpr6;
-	uint32_t tpr10;
-	uint32_t tpr11;
-	uint32_t tpr12;
-	uint32_t tpr13;
-	uint32_t tpr14;
-};
-
-static int
-dram_param_h616_validate(FILE *stream, void *raw)
+int boot0_patch_dram(void *sector, const char **settings, int nr_settings,
+		     FILE *log)
 {
-	struct dram_param_h616 *param = raw;
-	char *message = "Invalid structure for " DRAM_PARAM_H616_MATCHES;
-
-	/* MHz */
-	if ((param->clk < 100) || (param->clk > 1200)) {
-		fprintf(stream, "%s: wrong clk: 0x%08X\n", message,
-		       param->clk);
-		return -1;
+	const struct dram_rule *failed[NR_DRAM_LAYOUTS];
+	uint32_t old[EGON_DRAM_PARAM_COUNT], *param;
+	struct egon_header *header = sector;
+	struct egon_header_secondary *secondary;
+	int i, index, layout, match;
+	unsigned long value;
+	const char *equals;
+	char *end;
+
+	if (identify_image(sector) != IMAGE_BOOT0 ||
+	    header->header_size != sizeof(struct egon_header)) {
+		fprintf(stderr, "expecting an Allwinner boot0 image\n");
+		return -EINVAL;
 	}
 
-	/* 2: DDR2, 3: DDR3, 4: DDR4,
-	   6: LPDDR2, 7: LPDDR3, 8: LPDDR4 */
-	if ((param->type != 2) && (param->type != 3) &&
-	    (param->type != 4) && (param->type != 6) &&
-	    (param->type != 7) && (param->type != 8)) {
-		fprintf(stream, "%s: wrong type: 0x%08X\n", message,
-		       param->type);
-		return -1;
-	}
+	secondary = (void *)header + header->header_size;
+	param = secondary->dram_param;
+	memcpy(old, param, sizeof(old));
+	layout = dram_classify(param, -1, failed);
+
+	for (i = 0; i < nr_settings; i++) {
+		equals = strchr(settings[i], '=');
+		if (!equals || equals == settings[i]) {
+			fprintf(stderr, "expecting key=value, not \"%s\"\n",
+				settings[i]);
+			return -EINVAL;
+		}
 
-	if (param->dx_odt & 0xF0F0F0F0) {
-		fprintf(stream, "%s: wrong dx_odt: 0x%08X\n", message,
-		       param->dx_odt);
-		return -1;
+		index = dram_param_index(layout, settings[i],
+					 equals - settings[i]);
+		if (index < 0) {
+			fprintf(stderr, "unknown DRAM parameter \"%.*s\" for %s\n",
+				(int)(equals - settings[i]), settings[i],
+				layout < 0 ? "an unknown layout, use dram_NN" :
+					     dram_layouts[layout].socs);
+			return -ENOENT;
+		}
+
+		errno = 0;
+		value = strtoul(equals + 1, &end, 0);
+		if (errno || end == equals + 1 || *end || value > UINT32_MAX) {
+			fprintf(stderr, "invalid value in \"%s\"\n",
+				settings[i]);
+			return -EINVAL;
+		}
+
+		param[index] = value;
 	}
 
-	if (param->dx_dri & 0xF0F0F0F0) {
-		fprintf(stream, "%s: wrong dx_dri: 0x%08X\n", message,
-		       param->dx_dri);
-		return -1;
+	match = dram_classify(param, layout, failed);
+	if (layout >= 0 && match != layout) {
+		fprintf(stderr, "wrong %s 0x%08X for %s, not changing anything\n",
+			failed[layout]->name, param[failed[layout]->index],
+			dram_layouts[layout].socs);
+		memcpy(param, old, sizeof(old));
+		return -EINVAL;
 	}
 
-	fprintf(stream, "Parameters seem valid for %s.\n",
-		DRAM_PARAM_H616_MATCHES);
+	for (i = 0; log && i < EGON_DRAM_PARAM_COUNT; i++)
+		if (param[i] != old[i])
+			fprintf(log, "dram_%02d: 0x%08X -> 0x%08X\n", i,
+				old[i], param[i]);
+
+	header->checksum = egon_checksum_update(header->checksum, old, param,
+						sizeof(old));
+
 	return 0;
 }
 
-static void
-dram_param_h616_print(FILE *stream, void *raw)
+struct boot0_settings {
+	const char **settings;
+	int nr_settings;
+	FILE *log;
+};
+
+static int boot0_patch(void *sector, void *arg)
 {
-	struct dram_param_h616 *param = raw;
+	struct boot0_settings *s = arg;
 
-	fprintf(stream, "\n; For %s\n", DRAM_PARAM_H616_MATCHES);
-	fprintf(stream, "[dram para]\n\n");
+	return boot0_patch_dram(sector, s->settings, s->nr_settings, s->log);
+}
 
-	fprintf(stream, "dram_clk\t   = %d,\n", param->clk);
-	fprintf(stream, "dram_type\t   = %d,\n", param->type);
-	fprintf(stream, "dram_dx_odt\t   = 0x%08X,\n", param->dx_odt);
-	fprintf(stream, "dram_dx_dri\t   = 0x%08X,\n", param->dx_dri);
-	fprintf(stream, "dram_ca_dri\t   = 0x%08X,\n", param->ca_dri);
-	fprintf(stream, "dram_para0\t   = 0x%08X, ; aka odt_en on H616/H700\n",
-		param->para0);
-	fprintf(stream, "dram_para1\t   = 0x%08X,\n", param->para1);
-	fprintf(stream, "dram_para2\t   = 0x%08X,\n", param->para2);
-	fprintf(stream, "dram_mr0\t   = 0x%X,\n", param->mr0);
-	fprintf(stream, "dram_mr1\t   = 0x%X,\n", param->mr1);
-	fprintf(stream, "dram_mr2\t   = 0x%X,\n", param->mr2);
-	fprintf(stream, "dram_mr3\t   = 0x%X,\n", param->mr3);
-	fprintf(stream, "dram_mr4\t   = 0x%X,\n", param->mr4);
-	fprintf(stream, "dram_mr5\t   = 0x%X,\n", param->mr5);
-	fprintf(stream, "dram_mr6\t   = 0x%X,\n", param->mr6);
-	fprintf(stream, "dram_mr11\t   = 0x%X,\n", param->mr11);
-	fprintf(stream, "dram_mr12\t   = 0x%X,\n", param->mr12);
-	fprintf(stream, "dram_mr13\t   = 0x%X,\n", param->mr13);
-	fprintf(stream, "dram_mr14\t   = 0x%X,\n", param->mr14);
-	fprintf(stream, "dram_mr16\t   = 0x%X,\n", param->mr16);
-	fprintf(stream, "dram_mr17\t   = 0x%X,\n", param->mr17);
-	fprintf(stream, "dram_mr22\t   = 0x%X,\n", param->mr22);
-	fprintf(stream, "dram_tpr0\t   = 0x%08X,\n", param->tpr0);
-	fprintf(stream, "dram_tpr1\t   = 0x%X,\n", param->tpr1);
-	fprintf(stream, "dram_tpr2\t   = 0x%X,\n", param->tpr2);
-	fprintf(stream, "dram_tpr3\t   = 0x%X,\n", param->tpr3);
-	fprintf(stream, "dram_tpr6\t   = 0x%08X,\n", param->tpr6);
-	fprintf(stream, "dram_tpr10\t   = 0x%08X,\n", param->tpr10);
-	fprintf(stream, "dram_tpr11\t   = 0x%08X,\n", param->tpr11);
-	fprintf(stream, "dram_tpr12\t   = 0x%08X,\n", param->tpr12);
-	fprintf(stream, "dram_tpr13\t   = 0x%X,\n", param->tpr13);
-	fprintf(stream, "dram_tpr14\t   = 0x%X, ; "
-		"unused and 0 on anything but A523\n", param->tpr14);
-	fprintf(stream, "\n");
+/*
+ * boot0_set_dram() - change DRAM parameters of boot0 in a file, in place
+ * @filename: image file or block device, see patch_in_place()
+ * @settings: "key=value" strings, see boot0_patch_dram()
+ * @nr_settings: number of entries in @settings
+ * @log: stream to report the changes on, or NULL
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int boot0_set_dram(const char *filename, const char **settings,
+		   int nr_settings, FILE *log)
+{
+	struct boot0_settings s = { settings, nr_settings, log };
+
+	return patch_in_place(filename, boot0_patch, &s);
 }
 
-static void
-dram_param_raw_print(FILE *stream, void *raw)
+/*
+ * boot0_copy_dram() - copy the input, with DRAM parameters of boot0 changed
+ * @ctx: context with the input file, which can be a pipe
+ * @settings: "key=value" strings, see boot0_patch_dram()
+ * @nr_settings: number of entries in @settings
+ * @outf: output file, gets all of the input
+ * @log: stream to report the changes on, or NULL
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int boot0_copy_dram(struct sunxi_ctx *ctx, const char **settings,
+		    int nr_settings, FILE *outf, FILE *log)
 {
-	uint32_t *param = raw;
-	int i;
+	struct boot0_settings s = { settings, nr_settings, log };
 
-	fprintf(stream, "; Unknown structure\n");
-	for (i = 0; i < EGON_DRAM_PARAM_COUNT; i++)
-		fprintf(stream, "dram_%02d\t= 0x%08X\n", i, param[i]);
+	return patch_copy(ctx, IMAGE_BOOT0, boot0_patch, &s, outf);
 }
 
-int output_boot0_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+int output_boot0_info(struct sunxi_ctx *ctx, void *sector)
 {
 	struct egon_header *header = sector;
-	size_t ret;
+	FILE *stream = ctx->out;
+	int ret;
 
 	/*
 	 * This might be superfluous as the upper level already checks for
@@ -608,58 +689,63 @@ int output_boot0_info(void *sector, FILE *inf, FILE *stream, bool verbose)
 			header->magic[2], header->magic[3],
 			header->magic[4], header->magic[5],
 			header->magic[6], header->magic[7]);
-		return 0;
+		return -EINVAL;
 	}
 
 	if (header->header_size != sizeof(struct egon_header)) {
 		fprintf(stream, "\tERROR: egon header size mismatch: %d\n",
 			header->header_size);
-		return 0;
+		return -EINVAL;
 	}
 
 	if (header->filesize & (EGON_FILESIZE_ALIGN - 1)) {
 		fprintf(stream, "\tERROR: boot0 file size not a multiple of "
 			"%d: %d bytes (0x%04X).\n", EGON_FILESIZE_ALIGN,
 			header->filesize, header->filesize);
-		return 0;
+		return -EINVAL;
 	}
 
 	if (!header->filesize) {
 		fprintf(stream, "\tERROR: boot0 file is supposedly empty: "
 			"0x%04X.\n", header->filesize);
-		return 0;
+		return -EINVAL;
+	}
+
+	if (header->filesize > EGON_MAX_SIZE) {
+		fprintf(stream, "\tERROR: boot0 file size too large: "
+			"%u bytes.\n", header->filesize);
+		return -EINVAL;
 	}
 
-	if (verbose) {
+	board_check_offset(ctx, ctx->board, ctx->pos - SECTOR_SIZE);
+
+	if (ctx->verbose) {
+		const struct dram_rule *failed[NR_DRAM_LAYOUTS];
 		struct egon_header_secondary *secondary =
 			(void *) header + header->header_size;
-		void *dram_param = secondary->dram_param;
+		const uint32_t *dram_param = secondary->dram_param;
+		int match;
 
 		fprintf(stream, "Found eGON header.\n");
 		fprintf(stream, "Boot0 Filesize is %dkB.\n",
 			header->filesize >> 10);
 
-		ret = egon_checksum_verify(stream, header, sector, inf);
+		ret = egon_checksum_verify(ctx, header, sector);
 		if (ret)
-			return 0;
+			return ret;
 
 		fprintf(stream,
 			"\nLooking for a valid dram parameter structure...\n");
-		if (!dram_param_a10_validate(stream, dram_param))
-			dram_param_a10_print(stream, dram_param);
-		else if (!dram_param_h6_validate(stream, dram_param))
-			dram_param_h6_print(stream, dram_param);
-		else if (!dram_param_a31_validate(stream, dram_param))
-			dram_param_a31_print(stream, dram_param);
-		else if (!dram_param_h616_validate(stream, dram_param))
-			dram_param_h616_print(stream, dram_param);
-		else
-			dram_param_raw_print(stream, dram_param);
+		match = dram_classify(dram_param, ctx->board ?
+				      ctx->board->soc->dram_layout : -1,
+				      failed);
+		dram_report(stream, dram_param, match, ctx->board, failed);
+		dram_param_print(stream, dram_param, match);
 	} else {
-		ret = pseek(inf, header->filesize - SECTOR_SIZE);
+		ret = pseek(ctx, header->filesize - SECTOR_SIZE);
 		if (ret)
-			return 0;
+			return ret;
 	}
 
-	return (header->filesize / SECTOR_SIZE) - 1;
+	return 0;
 }
@@ -0,0 +1,470 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-cache: remember "info" reports, so unchanged images are not parsed
+ *              over and over again
+ *
+ * The cache is a directory with one entry per image content and set of
+ * options. An entry holds the report as it was printed, plus the offset,
+ * length and hash of every component header found while scanning. Before
+ * an entry is used, those headers are hashed again, so rewriting boot0 or
+ * a new partition table invalidates it, even on a block device that keeps
+ * its timestamps. The payloads are never looked at, which is where the
+ * time goes otherwise, and changes to them alone go unnoticed: the eGON
+ * checksum, the FIT hashes and the PhoenixSuite directory live in the
+ * headers, so any regular rewrite of a component changes those as well.
+ *
+ * Entries are found in one of two ways:
+ * - by device, inode, size and modification time, through a symlink named
+ *   after them, which costs nothing but a readlink() and the header check
+ * - by a hash of the content, over the first CACHE_HEAD bytes and a few
+ *   sampled blocks, for copies of an image seen before under another name
+ *
+ * Only inputs that can be memory mapped are cached, not pipes or compressed
+ * images. The cache is not cleaned up, just remove the directory now and
+ * then, and after upgrading sunxi-fw.
+ */
+
+#define _GNU_SOURCE			/* for struct stat.st_mtim */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>			/* for ntohl() */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>			/* for BLKGETSIZE64 */
+
+#include "sunxi-fw.h"
+
+#define CACHE_MAGIC	"sunxi-fw cache v1\n"
+
+#define CACHE_HEAD		(1024 * 1024)	/* boot area of SD images */
+#define CACHE_SAMPLES		64
+#define CACHE_SAMPLE_SIZE	4096
+#define CACHE_HEADER_MAX	(4 * 1024 * 1024)
+#define CACHE_FIT_MAX		(64 * 1024)
+
+struct cache_header {
+	uint64_t offset;
+	uint64_t length;
+	uint64_t hash;
+};
+
+struct sunxi_cache {
+	const char *dir;
+	const uint8_t *map;
+	uint64_t size;
+	char key[17];			/* hash of the options, hex */
+	char link[128];			/* name after device, inode, mtime */
+	char entry[64];			/* name after key and content hash */
+	struct cache_header *headers;
+	int nr_headers;
+	bool failed;			/* don't store, a header is missing */
+	FILE *report;			/* capturing, see cache_capture() */
+	char *buffer;
+	size_t length;
+};
+
+/* hash the regions of @cache->headers from the input, in place */
+static bool cache_headers_match(const struct sunxi_cache *cache,
+				const struct cache_header *headers, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (headers[i].offset > cache->size ||
+		    headers[i].length > cache->size - headers[i].offset)
+			return false;
+		if (xxh64(cache->map + headers[i].offset, headers[i].length,
+			  0) != headers[i].hash)
+			return false;
+	}
+
+	return true;
+}
+
+/* the start of the image, and blocks spread evenly over the rest */
+static uint64_t cache_content_hash(const struct sunxi_cache *cache)
+{
+	uint64_t hash, offset, length;
+	int i;
+
+	length = cache->size < CACHE_HEAD ? cache->size : CACHE_HEAD;
+	hash = xxh64(cache->map, length, cache->size);
+
+	if (cache->size <= CACHE_HEAD)
+		return hash;
+
+	for (i = 0; i < CACHE_SAMPLES; i++) {
+		offset = CACHE_HEAD +
+			 (cache->size - CACHE_HEAD) / CACHE_SAMPLES * i;
+		length = cache->size - offset;
+		if (length > CACHE_SAMPLE_SIZE)
+			length = CACHE_SAMPLE_SIZE;
+		hash = xxh64(cache->map + offset, length, hash);
+	}
+
+	return hash;
+}
+
+/* anything that changes what the report looks like */
+static void cache_key(struct sunxi_cache *cache, const char *filename,
+		      const struct info_options *opts)
+{
+	char options[64 + 2 * 4096];
+
+	snprintf(options, sizeof(options), "%d:%d:%d:%d:%d:%x:%x:%s:%s",
+		 opts->format, opts->verbose, opts->scan_all, opts->gap_only,
+		 opts->scan_parts,
+		 opts->only, opts->fields, opts->board ? opts->board : "",
+		 /* records name the file they are from */
+		 filename && opts->format != FORMAT_TEXT ? filename : "");
+
+	snprintf(cache->key, sizeof(cache->key), "%016llx",
+		 (unsigned long long)xxh64(options, strlen(options), 0));
+}
+
+/*
+ * cache_open() - look up an input in the result cache
+ * @dir: cache directory, created when needed
+ * @inf: input stream, at its start
+ * @filename: name of the input in batch mode, NULL otherwise
+ * @opts: "info" options, see cache_key()
+ *
+ * Return: cache state for cache_replay() and cache_capture(), or NULL if
+ *         the input cannot be cached. Release with cache_close().
+ */
+struct sunxi_cache *cache_open(const char *dir, FILE *inf,
+			       const char *filename,
+			       const struct info_options *opts)
+{
+	struct sunxi_cache *cache;
+	int fd = fileno(inf);
+	struct stat st;
+	uint64_t size;
+	void *map;
+
+	if (fd < 0 || fstat(fd, &st) || ftello(inf) != 0)
+		return NULL;
+
+	if (S_ISREG(st.st_mode))
+		size = st.st_size;
+	else if (!S_ISBLK(st.st_mode) || ioctl(fd, BLKGETSIZE64, &size))
+		return NULL;
+	if (size == 0 || size > SIZE_MAX)
+		return NULL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->dir = dir;
+	cache->map = map;
+	cache->size = size;
+	cache_key(cache, filename, opts);
+	snprintf(cache->link, sizeof(cache->link),
+		 "%s-%llx-%llx-%llx-%llx.%09ld", cache->key,
+		 (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+		 (unsigned long long)size,
+		 (unsigned long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+	return cache;
+}
+
+/* read the entry @name, if it is for an image with our size */
+static char *cache_load(const struct sunxi_cache *cache, const char *name,
+			size_t *length)
+{
+	char path[4096], magic[sizeof(CACHE_MAGIC)], *report = NULL;
+	struct cache_header *headers = NULL;
+	uint64_t size, hash, report_len;
+	uint32_t nr_headers;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", cache->dir, name);
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, CACHE_MAGIC, sizeof(magic)) ||
+	    fread(&size, sizeof(size), 1, f) != 1 || size != cache->size ||
+	    fread(&hash, sizeof(hash), 1, f) != 1 ||
+	    fread(&nr_headers, sizeof(nr_headers), 1, f) != 1 ||
+	    nr_headers > 65536)
+		goto out;
+
+	headers = calloc(nr_headers ? nr_headers : 1, sizeof(*headers));
+	if (!headers ||
+	    fread(headers, sizeof(*headers), nr_headers, f) != nr_headers ||
+	    !cache_headers_match(cache, headers, nr_headers))
+		goto out;
+
+	if (fread(&report_len, sizeof(report_len), 1, f) != 1 ||
+	    report_len > SIZE_MAX - 1)
+		goto out;
+	report = malloc(report_len + 1);
+	if (!report)
+		goto out;
+	if (fread(report, 1, report_len, f) != report_len) {
+		free(report);
+		report = NULL;
+		goto out;
+	}
+	*length = report_len;
+
+out:
+	free(headers);
+	fclose(f);
+
+	return report;
+}
+
+/* point the device/inode name at @cache->entry */
+static void cache_link(const struct sunxi_cache *cache)
+{
+	char path[4096], tmp[4096];
+	int fd;
+
+	/*
+	 * A name of our own, batch and serve workers are threads of one
+	 * process: mkstemp() picks it, and the symlink takes its place.
+	 */
+	snprintf(path, sizeof(path), "%s/%s", cache->dir, cache->link);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.XXXXXX", cache->dir, cache->link);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+	close(fd);
+	unlink(tmp);
+
+	/* if someone else got the name in between, it's their link */
+	if (symlink(cache->entry, tmp))
+		return;
+	if (rename(tmp, path))
+		unlink(tmp);
+}
+
+/*
+ * cache_replay() - print the cached report of an input, if there is one
+ * @cache: from cache_open(), NULL is fine
+ * @outf: where to print the report to
+ *
+ * Return: 0 if the report was printed, -ENOENT if it has to be made
+ */
+int cache_replay(struct sunxi_cache *cache, FILE *outf)
+{
+	char path[4096], target[64];
+	size_t length;
+	char *report;
+	ssize_t ret;
+
+	if (!cache)
+		return -ENOENT;
+
+	/* the same file as before, most likely */
+	snprintf(path, sizeof(path), "%s/%s", cache->dir, cache->link);
+	ret = readlink(path, target, sizeof(target) - 1);
+	if (ret > 0) {
+		target[ret] = 0;
+		report = cache_load(cache, target, &length);
+		if (report)
+			goto found;
+	}
+
+	/* a copy, or the timestamp was touched */
+	snprintf(cache->entry, sizeof(cache->entry), "%s-%016llx",
+		 cache->key, (unsigned long long)cache_content_hash(cache));
+	report = cache_load(cache, cache->entry, &length);
+	if (!report)
+		return -ENOENT;
+	cache_link(cache);
+
+found:
+	fwrite(report, 1, length, outf);
+	free(report);
+
+	return 0;
+}
+
+/*
+ * cache_capture() - get the stream to print a report to, for the cache
+ * @cache: from cache_open(), NULL is fine
+ * @outf: where the report is supposed to go
+ *
+ * Return: a stream that collects the report, to be printed to @outf and
+ *         stored by cache_close(), or @outf itself if not caching
+ */
+FILE *cache_capture(struct sunxi_cache *cache, FILE *outf)
+{
+	if (!cache)
+		return outf;
+
+	cache->report = open_memstream(&cache->buffer, &cache->length);
+
+	return cache->report ? cache->report : outf;
+}
+
+/*
+ * cache_component() - note a component header, in the context's cache
+ * @ctx: context, positioned right behind @sector
+ * @type: the component type, as returned by identify_image()
+ * @sector: first sector of the component
+ *
+ * The header is the part the decoders take the report from: the first
+ * sector for most components, the devicetree of a FIT image (or the start
+ * of it), the directory of a PhoenixSuite image, the partition entries of
+ * a GPT, and all of a legacy U-Boot image.
+ */
+void cache_component(struct sunxi_ctx *ctx, enum image_type type,
+		     const void *sector)
+{
+	struct sunxi_cache *cache = ctx->cache;
+	const uint32_t *header = sector;
+	struct cache_header *tmp;
+	uint64_t length;
+
+	if (!cache || !cache->report)
+		return;
+
+	switch (type) {
+	case IMAGE_FIT:
+		/*
+		 * Mainline FIT images keep the data outside of the devicetree,
+		 * those with embedded data get the start of it hashed only.
+		 */
+		length = ntohl(header[1]);	/* totalsize */
+		if (length > CACHE_FIT_MAX)
+			length = CACHE_FIT_MAX;
+		break;
+	case IMAGE_PHOENIX:
+		length = 1024 + (uint64_t)header[15] * 1024;
+		break;
+	case IMAGE_GPT:
+		length = 512 + 16384;		/* the usual 128 entries */
+		break;
+	case IMAGE_UBOOT:
+		/* the data CRC is reported with -v */
+		length = 64 + (uint64_t)ntohl(header[3]);	/* ih_size */
+		break;
+	default:
+		length = 512;
+		break;
+	}
+	if (length > CACHE_HEADER_MAX)
+		length = CACHE_HEADER_MAX;
+
+	tmp = realloc(cache->headers,
+		      (cache->nr_headers + 1) * sizeof(*cache->headers));
+	if (!tmp) {
+		cache->failed = true;
+		return;
+	}
+	cache->headers = tmp;
+
+	cache->headers[cache->nr_headers].offset = ctx->pos - 512;
+	cache->headers[cache->nr_headers].length = length;
+	cache->nr_headers++;
+}
+
+static int cache_store(struct sunxi_cache *cache)
+{
+	uint64_t size = cache->size, hash, report_len = cache->length;
+	uint32_t nr_headers = cache->nr_headers;
+	char path[4096], tmp[4096];
+	int fd, i, ret = 0;
+	FILE *f;
+
+	/* regions running off the end of the image are not headers */
+	for (i = 0; i < cache->nr_headers; i++) {
+		struct cache_header *h = &cache->headers[i];
+
+		if (h->offset > cache->size)
+			return -EINVAL;
+		if (h->length > cache->size - h->offset)
+			h->length = cache->size - h->offset;
+		h->hash = xxh64(cache->map + h->offset, h->length, 0);
+	}
+	hash = cache_content_hash(cache);
+	if (!cache->entry[0])
+		snprintf(cache->entry, sizeof(cache->entry), "%s-%016llx",
+			 cache->key, (unsigned long long)hash);
+
+	if (mkdir(cache->dir, 0777) && errno != EEXIST)
+		return -errno;
+
+	/* written aside and renamed, batch mode might race for the same entry */
+	snprintf(path, sizeof(path), "%s/%s", cache->dir, cache->entry);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.XXXXXX", cache->dir, cache->entry);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -errno;
+	f = fdopen(fd, "wb");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return -ENOMEM;
+	}
+
+	if (fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, f) != 1 ||
+	    fwrite(&size, sizeof(size), 1, f) != 1 ||
+	    fwrite(&hash, sizeof(hash), 1, f) != 1 ||
+	    fwrite(&nr_headers, sizeof(nr_headers), 1, f) != 1 ||
+	    fwrite(cache->headers, sizeof(*cache->headers), nr_headers, f) !=
+	    nr_headers ||
+	    fwrite(&report_len, sizeof(report_len), 1, f) != 1 ||
+	    fwrite(cache->buffer, 1, report_len, f) != report_len)
+		ret = -EIO;
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret) {
+		unlink(tmp);
+		return ret;
+	}
+
+	cache_link(cache);
+
+	return 0;
+}
+
+/*
+ * cache_close() - finish up with the cache of an input
+ * @cache: from cache_open(), NULL is fine
+ * @outf: where the report goes, as given to cache_capture()
+ *
+ * A report captured with cache_capture() is printed to @outf, and stored
+ * in the cache unless the scan failed.
+ */
+void cache_close(struct sunxi_cache *cache, FILE *outf)
+{
+	if (!cache)
+		return;
+
+	if (cache->report) {
+		fclose(cache->report);
+		if (cache->buffer)
+			fwrite(cache->buffer, 1, cache->length, outf);
+		if (!cache->failed && cache->buffer && cache_store(cache))
+			fprintf(stderr, "WARNING: cannot write to cache %s\n",
+				cache->dir);
+		free(cache->buffer);
+	}
+
+	munmap((void *)cache->map, cache->size);
+	free(cache->headers);
+	free(cache);
+}
@@ -0,0 +1,487 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-checksum: checksum routines shared by the decoders
+ *
+ * The eGON checksum (also used by TOC0) is the sum of all 32-bit words of
+ * an image, with the checksum word itself replaced by a fixed seed value.
+ * Since addition is commutative, this can be done with wide vector
+ * accumulators, and the checksum word is corrected for afterwards.
+ *
+ * The CRC32 of legacy U-Boot images (and FIT hash nodes) is the zlib one,
+ * which folds 64 bytes at a time with carry-less multiplies where the CPU
+ * has them, or uses the CRC32 instructions of ARMv8.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include <zlib.h>			/* for crc32() */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
+#include "sunxi-fw.h"
+
+/* word index of the checksum in both the eGON and the TOC0 header */
+#define CHECKSUM_WORD	3
+
+static uint32_t sum_words_scalar(const uint32_t *data, size_t words)
+{
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < words; i++)
+		sum += data[i];
+
+	return sum;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static uint32_t sum_words_sse2(const uint32_t *data, size_t words)
+{
+	__m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+	const __m128i *vec = (const __m128i *)data;
+	uint32_t lanes[4];
+	size_t i;
+
+	for (i = 0; i + 8 <= words; i += 8, vec += 2) {
+		acc0 = _mm_add_epi32(acc0, _mm_loadu_si128(vec));
+		acc1 = _mm_add_epi32(acc1, _mm_loadu_si128(vec + 1));
+	}
+	_mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(acc0, acc1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+	       sum_words_scalar(data + i, words - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t sum_words_avx2(const uint32_t *data, size_t words)
+{
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+	__m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+	const __m256i *vec = (const __m256i *)data;
+	uint32_t lanes[8], sum = 0;
+	size_t i, j;
+
+	for (i = 0; i + 32 <= words; i += 32, vec += 4) {
+		acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256(vec));
+		acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256(vec + 1));
+		acc2 = _mm256_add_epi32(acc2, _mm256_loadu_si256(vec + 2));
+		acc3 = _mm256_add_epi32(acc3, _mm256_loadu_si256(vec + 3));
+	}
+	acc0 = _mm256_add_epi32(_mm256_add_epi32(acc0, acc1),
+				_mm256_add_epi32(acc2, acc3));
+	_mm256_storeu_si256((__m256i *)lanes, acc0);
+
+	for (j = 0; j < 8; j++)
+		sum += lanes[j];
+
+	return sum + sum_words_scalar(data + i, words - i);
+}
+#elif defined(__ARM_NEON)
+static uint32_t sum_words_neon(const uint32_t *data, size_t words)
+{
+	uint32x4_t acc0 = vdupq_n_u32(0), acc1 = vdupq_n_u32(0);
+	uint32_t lanes[4];
+	size_t i;
+
+	for (i = 0; i + 8 <= words; i += 8) {
+		acc0 = vaddq_u32(acc0, vld1q_u32(data + i));
+		acc1 = vaddq_u32(acc1, vld1q_u32(data + i + 4));
+	}
+	vst1q_u32(lanes, vaddq_u32(acc0, acc1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+	       sum_words_scalar(data + i, words - i);
+}
+#endif
+
+typedef uint32_t (*sum_words_fn)(const uint32_t *data, size_t words);
+
+static sum_words_fn sum_words = sum_words_scalar;
+
+/*
+ * egon_sum() - add 32-bit little endian words to a running sum
+ * @sum: sum so far
+ * @data: buffer to add, alignment does not matter
+ * @length: length of @data in bytes, a trailing partial word is ignored
+ *
+ * Return: the new sum
+ */
+uint32_t egon_sum(uint32_t sum, const void *data, size_t length)
+{
+	return sum + sum_words(data, length / 4);
+}
+
+/*
+ * egon_checksum() - compute the eGON/TOC0 checksum of a complete image
+ * @data: image, starting with the eGON or TOC0 header
+ * @length: image length in bytes, as stored in the header
+ *
+ * Return: the checksum, to be compared against the one in the header
+ */
+uint32_t egon_checksum(const void *data, size_t length)
+{
+	uint32_t word;
+
+	if (length < (CHECKSUM_WORD + 1) * 4)
+		return egon_sum(EGON_CHECKSUM_SEED, data, length);
+
+	memcpy(&word, data + CHECKSUM_WORD * 4, sizeof(word));
+
+	return egon_sum(EGON_CHECKSUM_SEED, data, length) - word;
+}
+
+/*
+ * egon_checksum_update() - correct an eGON/TOC0 checksum for changed words
+ * @chksum: the checksum of the image before the change, as in the header
+ * @old: the previous content of the changed range
+ * @new: the new content of the range
+ * @length: length of the range in bytes, a multiple of 4
+ *
+ * The range has to start at a word offset in the image, and must not cover
+ * the checksum word itself. Since the checksum is a plain sum, this takes
+ * time in the size of the range only, not in that of the image. A checksum
+ * that was wrong before stays wrong by the same amount.
+ *
+ * Return: the checksum of the changed image
+ */
+uint32_t egon_checksum_update(uint32_t chksum, const void *old,
+			      const void *new, size_t length)
+{
+	return chksum - egon_sum(0, old, length) + egon_sum(0, new, length);
+}
+
+/*
+ * egon_checksum_input() - checksum an eGON/TOC0 image from the input
+ * @ctx: context, positioned right behind the first sector of the image
+ * @sector: the first sector of the image, as read already
+ * @length: image length in bytes, as stored in the header
+ * @chksum: set to the checksum, to be compared against the one in the header
+ *
+ * Consumes the rest of the image. Mapped images are checksummed in place,
+ * other inputs are read in chunks of SCRATCH_SIZE.
+ *
+ * Return: 0 if successful, -EIO if the image is truncated, -EINVAL if
+ *         @length is not a multiple of 4 between 512 and EGON_MAX_SIZE,
+ *         leaving the input alone
+ */
+int egon_checksum_input(struct sunxi_ctx *ctx, const void *sector,
+			uint32_t length, uint32_t *chksum)
+{
+	const void *data;
+	uint32_t offset, chunk, sum;
+
+	if (length < 512 || length % 4 || length > EGON_MAX_SIZE)
+		return -EINVAL;
+
+	data = input_window(ctx, -512, length);
+	if (data) {
+		*chksum = egon_checksum(data, length);
+		return pseek(ctx, length - 512);
+	}
+
+	/* the first sector has the checksum word, so handle it separately */
+	sum = egon_checksum(sector, 512);
+	for (offset = 512; offset < length; offset += chunk) {
+		chunk = length - offset;
+		if (chunk > SCRATCH_SIZE)
+			chunk = SCRATCH_SIZE;
+
+		data = input_read(ctx, ctx->scratch, chunk);
+		if (!data)
+			return -EIO;
+
+		sum = egon_sum(sum, data, chunk);
+	}
+	*chksum = sum;
+
+	return 0;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Folding with PCLMULQDQ, as in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction", with the constants for the
+ * bit-reflected zlib polynomial. @crc is not inverted, and @length must be
+ * a multiple of 16, and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t length)
+{
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = {
+		0x0154442bd4, 0x01c6e41596,
+	};
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = {
+		0x01751997d0, 0x00ccaa009e,
+	};
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = {
+		0x0163cd6124, 0x0000000000,
+	};
+	static const uint64_t poly[2] __attribute__((aligned(16))) = {
+		0x01db710641, 0x01f7011641,
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	length -= 64;
+
+	/* four lanes of 128 bits, folded 512 bits ahead */
+	for (; length >= 64; p += 64, length -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				   _mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				   _mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				   _mm_loadu_si128((const __m128i *)(p + 0x30)));
+	}
+
+	/* fold the lanes into one, then the remaining 16 byte blocks */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	for (; length >= 16; p += 16, length -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *)p));
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+/* larger blocks with PCLMULQDQ, the rest with zlib */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_x86(uint32_t crc, const uint8_t *p, size_t length)
+{
+	size_t bulk = length & ~(size_t)15;
+
+	if (bulk >= 64) {
+		crc = ~crc32_pclmul(~crc, p, bulk);
+		p += bulk;
+		length -= bulk;
+	}
+
+	return crc32(crc, p, length);
+}
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t length)
+{
+	uint64_t word;
+
+	crc = ~crc;
+	for (; length >= 8; p += 8, length -= 8) {
+		memcpy(&word, p, sizeof(word));
+		crc = __crc32d(crc, word);
+	}
+	for (; length; p++, length--)
+		crc = __crc32b(crc, *p);
+
+	return ~crc;
+}
+#endif
+
+static uint32_t crc32_zlib(uint32_t crc, const uint8_t *p, size_t length)
+{
+	return crc32(crc, p, length);
+}
+
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *p, size_t length);
+
+static crc32_fn crc32_update = crc32_zlib;
+
+/*
+ * crc32_ieee() - the CRC32 of zlib, of U-Boot images and FIT hash nodes
+ * @crc: CRC so far, 0 to start with
+ * @data: buffer to add, alignment does not matter
+ * @length: length of @data in bytes
+ *
+ * Gives the same results as crc32() of zlib, which is the fallback for CPUs
+ * without carry-less multiplies or CRC instructions.
+ *
+ * Return: the new CRC
+ */
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t length)
+{
+	return crc32_update(crc, data, length);
+}
+
+/*
+ * select_checksums() - pick the checksum routines for the CPU
+ *
+ * Called once at startup, by the constructor that picks the sector test of
+ * scan_sectors() as well (see sunxi-scan.c), after __builtin_cpu_init().
+ * Until then, the portable versions are used.
+ */
+void select_checksums(void)
+{
+#ifdef HAVE_X86_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		sum_words = sum_words_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		sum_words = sum_words_sse2;
+	if (__builtin_cpu_supports("pclmul") &&
+	    __builtin_cpu_supports("sse4.1"))
+		crc32_update = crc32_x86;
+#elif defined(__ARM_NEON)
+	sum_words = sum_words_neon;
+#endif
+#ifdef __ARM_FEATURE_CRC32
+	crc32_update = crc32_armv8;
+#endif
+}
+
+#define XXH_PRIME64_1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3	0x165667B19E3779F9ULL
+#define XXH_PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5	0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+
+	return rotl64(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/*
+ * xxh64() - XXH64 hash of a buffer, not a checksum of any image format
+ * @data: buffer to hash, alignment does not matter
+ * @length: length of @data in bytes
+ * @seed: seed value, can be used to chain several buffers
+ *
+ * Used to recognise image content that was seen before, see sunxi-cache.c.
+ * Like the eGON checksum, this assumes a little endian host.
+ *
+ * Return: the hash value
+ */
+uint64_t xxh64(const void *data, size_t length, uint64_t seed)
+{
+	const uint8_t *p = data, *end = p + length;
+	uint64_t v1, v2, v3, v4, h;
+	uint32_t word;
+
+	if (length >= 32) {
+		v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+		v2 = seed + XXH_PRIME64_2;
+		v3 = seed;
+		v4 = seed - XXH_PRIME64_1;
+
+		for (; p + 32 <= end; p += 32) {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p + 8));
+			v3 = xxh64_round(v3, read64(p + 16));
+			v4 = xxh64_round(v4, read64(p + 24));
+		}
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) +
+		    rotl64(v4, 18);
+		h = xxh64_merge(h, v1);
+		h = xxh64_merge(h, v2);
+		h = xxh64_merge(h, v3);
+		h = xxh64_merge(h, v4);
+	} else {
+		h = seed + XXH_PRIME64_5;
+	}
+
+	h += length;
+
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, read64(p));
+		h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (p + 4 <= end) {
+		memcpy(&word, p, sizeof(word));
+		h ^= word * XXH_PRIME64_1;
+		h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_PRIME64_5;
+		h = rotl64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
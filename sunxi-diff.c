@@ -0,0 +1,407 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-diff: compare a flashed device against the image it was written from
+ *
+ * Instead of reading back the whole device, the firmware components are
+ * looked up in the reference image (see sunxi-layout.c), and just those
+ * ranges are compared. A container (a FIT or a PhoenixSuite image) only
+ * counts for the bytes outside of its images, which are compared and
+ * reported on their own. Both sides are read at the same time, the device
+ * in a thread of its own, in large aligned chunks, so --direct works, and
+ * a component is left as soon as its first difference has been found.
+ */
+
+#define _GNU_SOURCE			/* for O_DIRECT */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sunxi-fw.h"
+
+#define DIFF_CHUNK	(1024 * 1024)
+#define DIFF_ALIGN	4096		/* for O_DIRECT */
+
+struct diff_extent {
+	uint64_t start, end;
+};
+
+struct diff_comp {
+	char name[SUNXI_NAME_LEN];
+	enum image_type type;
+	uint64_t offset, size;
+	int depth;
+};
+
+/* one side of the comparison, reading [offset, offset + length) */
+struct diff_side {
+	const char *filename;
+	int fd;
+	void *buffer;
+	uint64_t offset;
+	size_t length, got;
+	int error;
+};
+
+struct diff {
+	struct diff_side ref, dev;
+	pthread_t reader;
+	pthread_barrier_t start, done;
+	bool stop;
+	uint64_t compared;
+};
+
+static uint64_t diff_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void diff_read(struct diff_side *side)
+{
+	ssize_t ret;
+
+	side->got = 0;
+	side->error = 0;
+	while (side->got < side->length) {
+		ret = pread(side->fd, side->buffer + side->got,
+			    side->length - side->got, side->offset + side->got);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			side->error = -errno;
+		if (ret <= 0)
+			break;
+		side->got += ret;
+	}
+}
+
+/* reads the device side, while the main thread reads the reference */
+static void *diff_reader(void *arg)
+{
+	struct diff *d = arg;
+
+	for (;;) {
+		pthread_barrier_wait(&d->start);
+		if (d->stop)
+			break;
+		diff_read(&d->dev);
+		pthread_barrier_wait(&d->done);
+	}
+
+	return NULL;
+}
+
+/*
+ * Compares [@start, @end) of both sides, and returns 1 with the offset of
+ * the first difference in @where, 0 if the range is the same, or a negative
+ * error value. A device that ends early differs where it ends.
+ */
+static int diff_range(struct diff *d, uint64_t start, uint64_t end,
+		      uint64_t *where)
+{
+	const unsigned char *a, *b;
+	struct diff_side *side;
+	uint64_t pos = start, aligned;
+	size_t skip, len, i;
+
+	while (pos < end) {
+		aligned = pos & ~(DIFF_ALIGN - 1ULL);
+		skip = pos - aligned;
+		len = (end - aligned + DIFF_ALIGN - 1) & ~(DIFF_ALIGN - 1ULL);
+		if (len > DIFF_CHUNK)
+			len = DIFF_CHUNK;
+
+		d->ref.offset = d->dev.offset = aligned;
+		d->ref.length = d->dev.length = len;
+		pthread_barrier_wait(&d->start);
+		diff_read(&d->ref);
+		pthread_barrier_wait(&d->done);
+
+		side = d->ref.error ? &d->ref : &d->dev;
+		if (side->error) {
+			fprintf(stderr, "%s: %s\n", side->filename,
+				strerror(-side->error));
+			return side->error;
+		}
+		if (d->ref.got <= skip) {
+			fprintf(stderr, "%s: ends at 0x%"PRIx64"\n",
+				d->ref.filename, aligned + d->ref.got);
+			return -EIO;
+		}
+
+		len = d->ref.got - skip;
+		if (len > end - pos)
+			len = end - pos;
+		a = d->ref.buffer + skip;
+		b = d->dev.buffer + skip;
+
+		/* the device may be shorter, but not the reference */
+		if (d->dev.got < skip + len || memcmp(a, b, len)) {
+			for (i = 0; i < len && skip + i < d->dev.got; i++)
+				if (a[i] != b[i])
+					break;
+			d->compared += i;
+			*where = pos + i;
+			return 1;
+		}
+
+		d->compared += len;
+		pos += len;
+	}
+
+	return 0;
+}
+
+static int diff_extent_compare(const void *x, const void *y)
+{
+	const struct diff_extent *a = x, *b = y;
+
+	return a->start < b->start ? -1 : a->start > b->start;
+}
+
+/*
+ * Compares what is not covered by one of the @nr children of a container,
+ * or the whole component if it has none. Components of unknown size get
+ * their first sector compared.
+ */
+static int diff_component(struct diff *d, const struct diff_comp *comp,
+			  const struct diff_comp *children, int nr,
+			  uint64_t *where)
+{
+	uint64_t pos = comp->offset, end, next;
+	struct diff_extent *extents;
+	int i, ret = 0;
+
+	end = comp->offset + (comp->size ? comp->size : 512);
+	if (!nr)
+		return diff_range(d, pos, end, where);
+
+	extents = malloc(nr * sizeof(*extents));
+	if (!extents)
+		return -ENOMEM;
+	for (i = 0; i < nr; i++) {
+		extents[i].start = children[i].offset;
+		extents[i].end = children[i].offset + children[i].size;
+	}
+	qsort(extents, nr, sizeof(*extents), diff_extent_compare);
+
+	/* the gaps before, between and after the children */
+	for (i = 0; !ret && i <= nr && pos < end; i++) {
+		next = end;
+		if (i < nr && extents[i].start < end)
+			next = extents[i].start;
+		if (next > pos)
+			ret = diff_range(d, pos, next, where);
+		if (i < nr && extents[i].end > pos)
+			pos = extents[i].end;
+	}
+	free(extents);
+
+	return ret;
+}
+
+/* which entry of the partition table @where is in */
+static void diff_table_entry(struct diff *d, const struct diff_comp *comp,
+			     uint64_t where, FILE *stream)
+{
+	uint64_t rel = where - comp->offset;
+	const uint32_t *gpt;
+	size_t skip;
+
+	if (comp->type == IMAGE_MBR) {
+		if (rel >= 0x1be && rel < 0x1fe)
+			fprintf(stream, ", partition %d",
+				(int)(rel - 0x1be) / 16 + 1);
+		return;
+	}
+
+	if (comp->type != IMAGE_GPT)
+		return;
+	if (rel < 512) {
+		fprintf(stream, ", GPT header");
+		return;
+	}
+	/* the entry size comes from the header, which is the same */
+	skip = comp->offset & (DIFF_ALIGN - 1);
+	gpt = d->ref.buffer + skip;
+	if (pread(d->ref.fd, d->ref.buffer, DIFF_ALIGN,
+		  comp->offset - skip) == DIFF_ALIGN && gpt[21])
+		fprintf(stream, ", entry %"PRIu64, (rel - 512) / gpt[21] + 1);
+}
+
+static int diff_open(struct diff_side *side, bool direct)
+{
+	side->fd = -1;
+	if (direct)
+		side->fd = open(side->filename, O_RDONLY | O_DIRECT);
+	/* not every file system does O_DIRECT */
+	if (side->fd < 0)
+		side->fd = open(side->filename, O_RDONLY);
+	if (side->fd < 0) {
+		perror(side->filename);
+		return -errno;
+	}
+
+	if (posix_memalign(&side->buffer, DIFF_ALIGN, DIFF_CHUNK)) {
+		side->buffer = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int diff_layout(const char *filename, unsigned int flags,
+		       struct diff_comp **comps, int *nr_comps)
+{
+	struct sunxi_component comp;
+	struct sunxi_iter *iter;
+	struct diff_comp *c;
+	FILE *inf;
+	int ret;
+
+	inf = fopen(filename, "rb");
+	if (!inf) {
+		perror(filename);
+		return -errno;
+	}
+
+	iter = sunxi_iter_new(inf, flags);
+	if (!iter) {
+		fclose(inf);
+		return -ENOMEM;
+	}
+
+	while ((ret = sunxi_iter_next(iter, &comp)) > 0) {
+		c = realloc(*comps, (*nr_comps + 1) * sizeof(*c));
+		if (!c) {
+			ret = -ENOMEM;
+			break;
+		}
+		*comps = c;
+		c += (*nr_comps)++;
+		memcpy(c->name, comp.name, sizeof(c->name));
+		c->type = comp.type;
+		c->offset = comp.offset;
+		c->size = comp.size;
+		c->depth = comp.depth;
+	}
+
+	sunxi_iter_free(iter);
+	fclose(inf);
+
+	return ret;
+}
+
+/*
+ * diff_images() - compare the firmware components of a device with an image
+ * @reference: the image that was written, uncompressed
+ * @device: device or file to compare against @reference
+ * @flags: SUNXI_ITER_* flags, for finding the components in @reference
+ * @direct: read both with O_DIRECT, if possible
+ * @stream: where the report goes
+ *
+ * Every component is reported as the same, or with the offset of its first
+ * difference, and which partition table entry that is in, for an MBR or a
+ * GPT. The rest of the device is not looked at.
+ *
+ * Return: 0 if all components are the same, -EINVAL if any differs, or
+ *         another negative error value
+ */
+int diff_images(const char *reference, const char *device,
+		unsigned int flags, bool direct, FILE *stream)
+{
+	struct diff d = {
+		.ref.filename = reference,
+		.dev.filename = device,
+		.ref.fd = -1,
+		.dev.fd = -1,
+	};
+	struct diff_comp *comps = NULL;
+	int i, nr, nr_comps = 0, nr_diff = 0, ret;
+	uint64_t start = diff_now(), where, ns;
+
+	ret = diff_layout(reference, flags, &comps, &nr_comps);
+	/* a broken component still leaves those found before it */
+	if (ret < 0 && nr_comps) {
+		fprintf(stderr, "%s: %s, after %d components\n", reference,
+			strerror(-ret), nr_comps);
+		ret = 0;
+	}
+	if (!ret && !nr_comps) {
+		fprintf(stderr, "%s: no firmware components found\n",
+			reference);
+		ret = -ENOENT;
+	}
+	if (!ret)
+		ret = diff_open(&d.ref, direct);
+	if (!ret)
+		ret = diff_open(&d.dev, direct);
+	if (ret)
+		goto out;
+
+	pthread_barrier_init(&d.start, NULL, 2);
+	pthread_barrier_init(&d.done, NULL, 2);
+	if (pthread_create(&d.reader, NULL, diff_reader, &d)) {
+		ret = -EAGAIN;
+		goto out_barrier;
+	}
+
+	for (i = 0; i < nr_comps; i++) {
+		/* the images of a container follow right after it */
+		for (nr = 0; i + 1 + nr < nr_comps &&
+			     comps[i + 1 + nr].depth > comps[i].depth; nr++)
+			;
+
+		ret = diff_component(&d, &comps[i], &comps[i + 1], nr,
+				     &where);
+		if (ret < 0)
+			break;
+
+		if (ret) {
+			nr_diff++;
+			fprintf(stream, "%s: differs at 0x%08"PRIx64,
+				comps[i].name, where);
+			diff_table_entry(&d, &comps[i], where, stream);
+			fputc('\n', stream);
+		} else {
+			fprintf(stream, "%s: same\n", comps[i].name);
+		}
+		ret = 0;
+	}
+
+	d.stop = true;
+	pthread_barrier_wait(&d.start);
+	pthread_join(d.reader, NULL);
+
+	ns = diff_now() - start;
+	fprintf(stream, "%d components, %d differ, %"PRIu64" bytes compared, %.1f MB/s\n",
+		nr_comps, nr_diff, d.compared,
+		ns ? d.compared * 1000.0 / ns : 0.0);
+	if (!ret && nr_diff)
+		ret = -EINVAL;
+
+out_barrier:
+	pthread_barrier_destroy(&d.start);
+	pthread_barrier_destroy(&d.done);
+out:
+	if (d.ref.fd >= 0)
+		close(d.ref.fd);
+	if (d.dev.fd >= 0)
+		close(d.dev.fd);
+	free(d.ref.buffer);
+	free(d.dev.buffer);
+	free(comps);
+
+	return ret;
+}
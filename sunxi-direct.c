@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-direct: read block devices with O_DIRECT, bypassing the page cache
+ *
+ * Scanning a whole SD card on a board with little RAM would otherwise push
+ * the running system's working set out of the page cache. With O_DIRECT,
+ * the device is read in large aligned blocks into one buffer, which is
+ * reused for the whole run, and the sector sized reads of the decoders are
+ * served from there. Like sunxi-unpack.c, this is a stdio stream (see
+ * fopencookie(3)), so the decoders don't know the difference.
+ */
+
+#define _GNU_SOURCE			/* for O_DIRECT, fopencookie() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>			/* for BLKGETSIZE64, BLKSSZGET */
+
+#include "sunxi-fw.h"
+
+#define DIRECT_BLOCK	(4 * 1024 * 1024)
+#define DIRECT_ALIGN	4096
+
+struct direct {
+	int fd;
+	uint64_t size;			/* of the device */
+	uint64_t pos;
+	unsigned int align;		/* of offsets and lengths */
+	void *block;			/* DIRECT_BLOCK bytes, aligned */
+	uint64_t block_start;		/* device offset of block */
+	size_t block_len;		/* valid bytes in block */
+};
+
+/* read the aligned block containing @pos, unless we have it already */
+static int direct_fill(struct direct *d)
+{
+	ssize_t ret;
+
+	if (d->pos >= d->block_start && d->pos < d->block_start + d->block_len)
+		return 0;
+
+	d->block_start = d->pos & ~(uint64_t)(d->align - 1);
+	d->block_len = 0;
+	do {
+		ret = pread(d->fd, d->block, DIRECT_BLOCK, d->block_start);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	d->block_len = ret;
+
+	return 0;
+}
+
+static ssize_t direct_read(void *cookie, char *buf, size_t size)
+{
+	struct direct *d = cookie;
+	size_t done = 0, len;
+
+	while (done < size && d->pos < d->size) {
+		if (direct_fill(d))
+			return done ? (ssize_t)done : -1;
+		if (d->pos >= d->block_start + d->block_len)
+			break;			/* short device */
+
+		len = d->block_start + d->block_len - d->pos;
+		if (len > size - done)
+			len = size - done;
+		memcpy(buf + done, d->block + (d->pos - d->block_start), len);
+		d->pos += len;
+		done += len;
+	}
+
+	return done;
+}
+
+static int direct_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct direct *d = cookie;
+	int64_t target;
+
+	switch (whence) {
+	case SEEK_SET:
+		target = *offset;
+		break;
+	case SEEK_CUR:
+		target = d->pos + *offset;
+		break;
+	case SEEK_END:
+		target = d->size + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	if (target < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* nothing is read until it's needed */
+	d->pos = target;
+	*offset = target;
+
+	return 0;
+}
+
+static int direct_close(void *cookie)
+{
+	struct direct *d = cookie;
+	int ret;
+
+	ret = close(d->fd);
+	free(d->block);
+	free(d);
+
+	return ret;
+}
+
+/*
+ * input_open() - open an input image
+ * @filename: file to open
+ * @direct: read block devices with O_DIRECT, into one reused buffer
+ *
+ * Regular files, and block devices that refuse O_DIRECT, are opened with
+ * fopen(), and get memory mapped later on (see input_map()).
+ *
+ * Return: input stream, or NULL with errno set
+ */
+FILE *input_open(const char *filename, bool direct)
+{
+	static const cookie_io_functions_t direct_io = {
+		.read = direct_read,
+		.seek = direct_seek,
+		.close = direct_close,
+	};
+	struct direct *d;
+	struct stat st;
+	int ssize;
+	FILE *f;
+
+	if (!direct)
+		return fopen(filename, "rb");
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	d->fd = open(filename, O_RDONLY | O_DIRECT);
+	if (d->fd < 0 || fstat(d->fd, &st) || !S_ISBLK(st.st_mode) ||
+	    ioctl(d->fd, BLKGETSIZE64, &d->size))
+		goto fallback;
+
+	d->align = DIRECT_ALIGN;
+	if (!ioctl(d->fd, BLKSSZGET, &ssize) && ssize > DIRECT_ALIGN &&
+	    !(ssize & (ssize - 1)) && ssize <= DIRECT_BLOCK)
+		d->align = ssize;
+
+	if (posix_memalign(&d->block, d->align, DIRECT_BLOCK))
+		goto fallback;
+
+	f = fopencookie(d, "rb", direct_io);
+	if (f)
+		return f;
+
+fallback:
+	if (d->fd >= 0)
+		close(d->fd);
+	free(d->block);
+	free(d);
+
+	return fopen(filename, "rb");
+}
@@ -0,0 +1,559 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-emit: machine readable "info" output, as JSON or CBOR
+ *
+ * Every component is one record: a JSON object on a line of its own, or a
+ * CBOR map (so the output is a CBOR sequence, RFC 8742). Offsets and sizes
+ * are in bytes, and absolute to the start of the input.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sunxi-fw.h"
+
+#define CBOR_UINT	0
+#define CBOR_BYTES	2
+#define CBOR_TEXT	3
+#define CBOR_ARRAY	4
+#define CBOR_MAP_START	0xbf		/* indefinite length map */
+#define CBOR_BREAK	0xff
+
+struct emitter {
+	FILE *out;
+	enum output_format format;
+	unsigned int fields;		/* FIELD_* to emit */
+	const struct sunxi_board *board;	/* for boot0, see emit_component() */
+	bool first;			/* no JSON comma before the next key */
+};
+
+static const char *type_names[] = {
+	[IMAGE_BOOT0]	 = "boot0",
+	[IMAGE_SPL1]	 = "spl",
+	[IMAGE_SPL2]	 = "spl",
+	[IMAGE_SPLx]	 = "spl",
+	[IMAGE_TOC0]	 = "toc0",
+	[IMAGE_UBOOT]	 = "u-boot",
+	[IMAGE_FIT]	 = "fit",
+	[IMAGE_MBR]	 = "mbr",
+	[IMAGE_GPT]	 = "gpt",
+	[IMAGE_ROCKCHIP] = "rockchip",
+	[IMAGE_AML]	 = "amlogic",
+	[IMAGE_PHOENIX]	 = "wty",
+};
+
+static const char *field_names[] = {
+	"file", "name", "type", "offset", "size", "depth", "checksum",
+	"description", "dram", "board",
+};
+
+static const char *checksum_names[] = {
+	[SUNXI_CHECKSUM_NONE]	= "none",
+	[SUNXI_CHECKSUM_OK]	= "ok",
+	[SUNXI_CHECKSUM_BAD]	= "bad",
+};
+
+int parse_output_format(const char *name, enum output_format *format)
+{
+	if (!strcmp(name, "text"))
+		*format = FORMAT_TEXT;
+	else if (!strcmp(name, "json"))
+		*format = FORMAT_JSON;
+	else if (!strcmp(name, "cbor"))
+		*format = FORMAT_CBOR;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * parse_list() - turn a comma separated list of names into a bit mask
+ * @list: the list, as given on the command line
+ * @names: known names, the bit number is the index, NULL entries are skipped
+ * @nr_names: number of entries in @names
+ * @mask: set to the bits of all names in @list
+ */
+static int parse_list(const char *list, const char **names, int nr_names,
+		      unsigned int *mask)
+{
+	const char *end;
+	size_t len;
+	bool found;
+	int i;
+
+	*mask = 0;
+	for (; *list; list = *end ? end + 1 : end) {
+		end = strchr(list, ',');
+		if (!end)
+			end = list + strlen(list);
+		len = end - list;
+
+		found = false;
+		for (i = 0; i < nr_names; i++) {
+			if (names[i] && strlen(names[i]) == len &&
+			    !strncmp(names[i], list, len)) {
+				*mask |= 1U << i;
+				found = true;
+			}
+		}
+		if (!found)
+			return -EINVAL;
+	}
+
+	return *mask ? 0 : -EINVAL;
+}
+
+/* component type names, as used in the records, to a ctx->only mask */
+int parse_type_list(const char *list, unsigned int *mask)
+{
+	int ret;
+
+	ret = parse_list(list, type_names,
+			 sizeof(type_names) / sizeof(type_names[0]), mask);
+	/* "spl" has matched all SPL versions, IMAGE_SPLx stands for them */
+	*mask &= ~((1U << IMAGE_SPL1) | (1U << IMAGE_SPL2));
+
+	return ret;
+}
+
+int parse_field_list(const char *list, unsigned int *mask)
+{
+	return parse_list(list, field_names,
+			  sizeof(field_names) / sizeof(field_names[0]), mask);
+}
+
+/* parse a size in bytes, with an optional K, M or G suffix */
+int parse_size(const char *str, size_t *size)
+{
+	unsigned long long value;
+	char *end;
+
+	errno = 0;
+	value = strtoull(str, &end, 0);
+	if (errno || end == str)
+		return -EINVAL;
+
+	switch (*end) {
+	case 'G': case 'g':
+		value <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		value <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		value <<= 10;
+		end++;
+		break;
+	}
+	if (*end)
+		return -EINVAL;
+
+	*size = value;
+
+	return 0;
+}
+
+/* CBOR data item head: major type plus the shortest encoding of @value */
+static void cbor_head(FILE *out, int major, uint64_t value)
+{
+	int bytes, i;
+
+	major <<= 5;
+	if (value < 24) {
+		fputc(major | value, out);
+		return;
+	}
+
+	if (value <= 0xff) {
+		fputc(major | 24, out);
+		bytes = 1;
+	} else if (value <= 0xffff) {
+		fputc(major | 25, out);
+		bytes = 2;
+	} else if (value <= 0xffffffff) {
+		fputc(major | 26, out);
+		bytes = 4;
+	} else {
+		fputc(major | 27, out);
+		bytes = 8;
+	}
+
+	for (i = bytes - 1; i >= 0; i--)
+		fputc((value >> (i * 8)) & 0xff, out);
+}
+
+/*
+ * Returns the length of the UTF-8 sequence at @str, or 0 if it's not a
+ * valid one: overlong, a surrogate, beyond U+10FFFF or cut short.
+ */
+static int utf8_length(const unsigned char *str)
+{
+	uint32_t code;
+	int len, i;
+
+	if (str[0] < 0x80)
+		return 1;
+	if (str[0] >= 0xc2 && str[0] <= 0xdf)
+		len = 2;
+	else if (str[0] >= 0xe0 && str[0] <= 0xef)
+		len = 3;
+	else if (str[0] >= 0xf0 && str[0] <= 0xf4)
+		len = 4;
+	else
+		return 0;
+
+	code = str[0] & (0x3f >> (len - 1));
+	for (i = 1; i < len; i++) {
+		if ((str[i] & 0xc0) != 0x80)
+			return 0;
+		code = (code << 6) | (str[i] & 0x3f);
+	}
+	if ((len == 3 && code < 0x800) || (len == 4 && code < 0x10000) ||
+	    (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff)
+		return 0;
+
+	return len;
+}
+
+static bool utf8_valid(const char *str)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	int len;
+
+	for (; *s; s += len) {
+		len = utf8_length(s);
+		if (!len)
+			return false;
+	}
+
+	return true;
+}
+
+/* strings from the image aren't always UTF-8: other bytes are Latin-1 */
+static void json_string(FILE *out, const char *str)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	int len;
+
+	fputc('"', out);
+	for (; *s; s += len) {
+		len = utf8_length(s);
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if (*s < 0x20 || !len)
+			fprintf(out, "\\u%04x", *s);
+		else
+			fwrite(s, 1, len, out);
+		if (!len)
+			len = 1;
+	}
+	fputc('"', out);
+}
+
+/* a CBOR text string must be UTF-8, anything else goes as byte string */
+static void emit_string_value(struct emitter *e, const char *str)
+{
+	if (e->format == FORMAT_JSON) {
+		json_string(e->out, str);
+	} else {
+		cbor_head(e->out, utf8_valid(str) ? CBOR_TEXT : CBOR_BYTES,
+			  strlen(str));
+		fputs(str, e->out);
+	}
+}
+
+static void emit_key(struct emitter *e, const char *key)
+{
+	if (e->format == FORMAT_JSON && !e->first)
+		fputc(',', e->out);
+	emit_string_value(e, key);
+	if (e->format == FORMAT_JSON)
+		fputc(':', e->out);
+	e->first = false;
+}
+
+static void emit_begin_map(struct emitter *e, const char *key)
+{
+	if (key)
+		emit_key(e, key);
+	if (e->format == FORMAT_JSON)
+		fputc('{', e->out);
+	else
+		fputc(CBOR_MAP_START, e->out);
+	e->first = true;
+}
+
+static void emit_end_map(struct emitter *e)
+{
+	if (e->format == FORMAT_JSON)
+		fputc('}', e->out);
+	else
+		fputc(CBOR_BREAK, e->out);
+	e->first = false;
+}
+
+static void emit_uint(struct emitter *e, const char *key, uint64_t value)
+{
+	emit_key(e, key);
+	if (e->format == FORMAT_JSON)
+		fprintf(e->out, "%llu", (unsigned long long)value);
+	else
+		cbor_head(e->out, CBOR_UINT, value);
+}
+
+static void emit_string(struct emitter *e, const char *key, const char *str)
+{
+	emit_key(e, key);
+	emit_string_value(e, str);
+}
+
+static void emit_uint_array(struct emitter *e, const char *key,
+			    const uint32_t *values, int nr_values)
+{
+	int i;
+
+	emit_key(e, key);
+	if (e->format == FORMAT_JSON) {
+		fputc('[', e->out);
+		for (i = 0; i < nr_values; i++)
+			fprintf(e->out, "%s%u", i ? "," : "", values[i]);
+		fputc(']', e->out);
+	} else {
+		cbor_head(e->out, CBOR_ARRAY, nr_values);
+		for (i = 0; i < nr_values; i++)
+			cbor_head(e->out, CBOR_UINT, values[i]);
+	}
+}
+
+static void emit_dram(struct emitter *e, const void *header)
+{
+	struct boot0_dram dram;
+	const char *name;
+	uint32_t value;
+	int i;
+
+	if (boot0_dram_params(header, e->board, &dram) == -EINVAL)
+		return;
+
+	emit_begin_map(e, "dram");
+	if (dram.socs) {
+		emit_string(e, "socs", dram.socs);
+		emit_uint(e, "clk", dram.clk);
+		emit_uint(e, "type", dram.type);
+
+		/* by the names of the layout found, like in sys_config.fex */
+		emit_begin_map(e, "fields");
+		for (i = 0; (name = boot0_dram_field(&dram, i, &value)); i++)
+			emit_uint(e, name, value);
+		emit_end_map(e);
+	}
+	emit_uint_array(e, "params", dram.params, dram.nr_params);
+	emit_end_map(e);
+}
+
+static void emit_board(struct emitter *e, const struct sunxi_board *board)
+{
+	const struct sunxi_soc *soc = board->soc;
+	int nr;
+
+	emit_begin_map(e, "board");
+	if (board->model)
+		emit_string(e, "model", board->model);
+	emit_string(e, "soc", soc->name);
+	if (soc->dram)
+		emit_string(e, "dram", soc->dram);
+	for (nr = 0; nr < SUNXI_BOOT_OFFSETS && soc->boot_offsets[nr]; nr++)
+		;
+	emit_uint_array(e, "boot_offsets", soc->boot_offsets, nr);
+	emit_end_map(e);
+}
+
+static void emit_component(struct emitter *e, const char *filename,
+			   const struct sunxi_component *comp)
+{
+	const struct sunxi_board *board = NULL;
+	const char *type = NULL;
+
+	/*
+	 * The board of an SPL DT name or a FIT image description. boot0 has
+	 * no DT name, it gets the one of --board, or of the first SPL.
+	 */
+	if (comp->type == IMAGE_BOOT0)
+		board = e->board;
+	else if (comp->description[0])
+		board = board_lookup(comp->description);
+	if (!e->board && comp->depth == 0 && (comp->type == IMAGE_SPL1 ||
+	    comp->type == IMAGE_SPL2 || comp->type == IMAGE_SPLx))
+		e->board = board;
+
+	if (comp->type < sizeof(type_names) / sizeof(type_names[0]))
+		type = type_names[comp->type];
+
+	emit_begin_map(e, NULL);
+	if (filename && (e->fields & FIELD_FILE))
+		emit_string(e, "file", filename);
+	if (e->fields & FIELD_NAME)
+		emit_string(e, "name", comp->name);
+	if (e->fields & FIELD_TYPE)
+		emit_string(e, "type", type ? type : "unknown");
+	if (e->fields & FIELD_OFFSET)
+		emit_uint(e, "offset", comp->offset);
+	if (e->fields & FIELD_SIZE)
+		emit_uint(e, "size", comp->size);
+	if (e->fields & FIELD_DEPTH)
+		emit_uint(e, "depth", comp->depth);
+	if (comp->checksum != SUNXI_CHECKSUM_NONE &&
+	    (e->fields & FIELD_CHECKSUM)) {
+		emit_string(e, "checksum", checksum_names[comp->checksum]);
+		emit_uint(e, "checksum_value", comp->checksum_value);
+	}
+	if (comp->description[0] && (e->fields & FIELD_DESCRIPTION))
+		emit_string(e, "description", comp->description);
+	if (comp->type == IMAGE_BOOT0 && comp->header &&
+	    (e->fields & FIELD_DRAM))
+		emit_dram(e, comp->header);
+	if (board && (e->fields & FIELD_BOARD))
+		emit_board(e, board);
+	emit_end_map(e);
+
+	if (e->format == FORMAT_JSON)
+		fputc('\n', e->out);
+}
+
+/*
+ * output_stats_record() - the statistics of a context, as one more record
+ * @outf: output stream
+ * @filename: added to the record if not NULL, for batch mode
+ * @format: FORMAT_JSON or FORMAT_CBOR
+ * @ctx: context with the statistics, the current phase is closed first
+ *
+ * The record has a "stats" map, with a map of counters for every phase
+ * that has seen any activity (see struct io_stats).
+ */
+void output_stats_record(FILE *outf, const char *filename,
+			 enum output_format format, struct sunxi_ctx *ctx)
+{
+	struct emitter e = { .out = outf, .format = format };
+	const struct io_stats *phase;
+	int i;
+
+	if (!ctx->stats)
+		return;
+
+	stats_phase(ctx, IMAGE_UNKNOWN);
+
+	emit_begin_map(&e, NULL);
+	if (filename)
+		emit_string(&e, "file", filename);
+	emit_begin_map(&e, "stats");
+	for (i = 0; i < NR_STATS_PHASES; i++) {
+		phase = &ctx->stats->phase[i];
+		if (!stats_phase_name(i) || !stats_phase_used(phase))
+			continue;
+
+		emit_begin_map(&e, stats_phase_name(i));
+		emit_uint(&e, "bytes_read", phase->bytes_read);
+		emit_uint(&e, "bytes_copied", phase->bytes_copied);
+		emit_uint(&e, "skipped_seek", phase->skipped_seek);
+		emit_uint(&e, "skipped_read", phase->skipped_read);
+		emit_uint(&e, "calls", phase->calls);
+		emit_uint(&e, "allocs", phase->allocs);
+		emit_uint(&e, "alloc_bytes", phase->alloc_bytes);
+		emit_uint(&e, "wall_ns", phase->wall_ns);
+		emit_uint(&e, "cpu_ns", phase->cpu_ns);
+		emit_end_map(&e);
+	}
+	emit_end_map(&e);
+	emit_end_map(&e);
+
+	if (format == FORMAT_JSON)
+		fputc('\n', outf);
+}
+
+/*
+ * output_error_record() - a file that can't be read, as a record of its own
+ * @outf: output stream
+ * @filename: the file, as given on the command line
+ * @format: FORMAT_JSON or FORMAT_CBOR
+ * @error: negative error value
+ *
+ * Batch mode keeps a failing file in the record stream, with an "error"
+ * message and its "errno", rather than a line of text in between.
+ */
+void output_error_record(FILE *outf, const char *filename,
+			 enum output_format format, int error)
+{
+	struct emitter e = { .out = outf, .format = format };
+
+	emit_begin_map(&e, NULL);
+	emit_string(&e, "file", filename);
+	emit_string(&e, "error", strerror(-error));
+	emit_uint(&e, "errno", -error);
+	emit_end_map(&e);
+
+	if (format == FORMAT_JSON)
+		fputc('\n', outf);
+}
+
+/*
+ * output_image_records() - "info" in a machine readable format
+ * @inf: input file
+ * @outf: output stream
+ * @filename: added to each record if not NULL, for batch mode
+ * @opts: FORMAT_JSON or FORMAT_CBOR, with verbose adding verified checksums,
+ *        and stats adding a final record with the I/O statistics. Only the
+ *        component types in opts->only are decoded, and only the record
+ *        fields in opts->fields are emitted. Checksums are verified if
+ *        they are asked for explicitly, even without verbose.
+ * @cache: notes the component headers, see cache_capture(), or NULL
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int output_image_records(FILE *inf, FILE *outf, const char *filename,
+			 const struct info_options *opts,
+			 struct sunxi_cache *cache)
+{
+	struct emitter e = {
+		.out = outf,
+		.format = opts->format,
+		.fields = opts->fields ? opts->fields : ~0U,
+		.board = board_lookup(opts->board),
+	};
+	struct sunxi_stats stats = { 0 };
+	struct sunxi_component comp;
+	struct sunxi_iter *iter;
+	unsigned int flags = 0;
+	int ret;
+
+	if ((opts->verbose && (e.fields & FIELD_CHECKSUM)) ||
+	    (opts->fields & FIELD_CHECKSUM))
+		flags |= SUNXI_ITER_CHECKSUM;
+	if (opts->scan_all)
+		flags |= SUNXI_ITER_SCAN_ALL;
+	if (opts->gap_only)
+		flags |= SUNXI_ITER_GAP_ONLY;
+	if (opts->scan_parts)
+		flags |= SUNXI_ITER_SCAN_PARTS;
+
+	iter = sunxi_iter_new(inf, flags);
+	if (!iter)
+		return -ENOMEM;
+	if (opts->stats)
+		sunxi_iter_ctx(iter)->stats = &stats;
+	sunxi_iter_ctx(iter)->only = opts->only;
+	sunxi_iter_ctx(iter)->cache = cache;
+
+	while ((ret = sunxi_iter_next(iter, &comp)) > 0)
+		emit_component(&e, filename, &comp);
+
+	output_stats_record(outf, filename, opts->format, sunxi_iter_ctx(iter));
+
+	sunxi_iter_free(iter);
+
+	return ret;
+}
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-fdt: streaming walker over a flattened devicetree, as used by FIT
+ *
+ * Instead of reading the whole blob, only the structure and the strings
+ * block are read, front to back, and turned into a small tree of nodes and
+ * properties. Large property values (the embedded images of a FIT) are not
+ * kept, but skipped over, or handed to a callback that can stream them to
+ * their destination while they pass by. This works on pipes, and keeps
+ * memory usage low on FIT images with tens of MBs of embedded data.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>			/* for ntohl() */
+
+#include "sunxi-fw.h"
+
+#define FDT_BEGIN_NODE	1
+#define FDT_END_NODE	2
+#define FDT_PROP	3
+#define FDT_NOP		4
+#define FDT_END		9
+
+#define FDT_HEADER_SIZE	40
+#define DT_MAX_NAME	256
+#define DT_MAX_DEPTH	32
+
+struct dt_walk {
+	struct sunxi_ctx *ctx;
+	const void *sector;		/* first 512 bytes, already consumed */
+	struct dt_tree *tree;
+	dt_payload_fn payload;
+	void *arg;
+	uint32_t size_strings;
+	int stack[DT_MAX_DEPTH];	/* open nodes */
+	int last_child[DT_MAX_DEPTH];
+	int depth;
+};
+
+/*
+ * dt_fetch() - read @len bytes at offset @rel of the blob
+ *
+ * Data within the first sector comes from the copy the caller has, the rest
+ * is read from the input, which must not have passed it already.
+ */
+static int dt_fetch(struct dt_walk *w, uint32_t rel, void *buf, uint32_t len)
+{
+	struct sunxi_ctx *ctx = w->ctx;
+	uint64_t pos = w->tree->start + rel;
+	uint32_t chunk;
+	int ret;
+
+	if (rel > w->tree->size || len > w->tree->size - rel)
+		return -EINVAL;
+
+	if (rel < 512) {
+		chunk = len < 512 - rel ? len : 512 - rel;
+		memcpy(buf, w->sector + rel, chunk);
+		buf += chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+	if (!len)
+		return 0;
+
+	if (pos < ctx->pos)
+		return -EINVAL;
+	if (pos > ctx->pos) {
+		ret = pseek(ctx, pos - ctx->pos);
+		if (ret)
+			return ret;
+	}
+
+	return input_fread(ctx, buf, len) == len ? 0 : -EIO;
+}
+
+static int dt_fetch_u32(struct dt_walk *w, uint32_t rel, uint32_t *value)
+{
+	int ret;
+
+	ret = dt_fetch(w, rel, value, sizeof(*value));
+	*value = ntohl(*value);
+
+	return ret;
+}
+
+static void dt_resolve_name(struct dt_walk *w, struct dt_prop *prop)
+{
+	if (w->tree->strings && prop->nameoff < w->size_strings)
+		prop->name = w->tree->strings + prop->nameoff;
+}
+
+static int dt_read_strings(struct dt_walk *w, uint32_t offset)
+{
+	struct dt_tree *tree = w->tree;
+	int i, ret;
+
+	/* NUL terminated, even if the blob isn't */
+	tree->strings = calloc(1, w->size_strings + 1);
+	if (!tree->strings)
+		return -ENOMEM;
+	stats_alloc(w->ctx, w->size_strings + 1);
+
+	ret = dt_fetch(w, offset, tree->strings, w->size_strings);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < tree->nr_props; i++)
+		dt_resolve_name(w, &tree->props[i]);
+
+	return 0;
+}
+
+/* doubles the array, growing it by one entry at a time is quadratic */
+static int dt_grow(void **array, int *max, size_t size)
+{
+	int nr = *max ? *max * 2 : 16;
+	void *grown;
+
+	grown = realloc(*array, nr * size);
+	if (!grown)
+		return -ENOMEM;
+	*array = grown;
+	*max = nr;
+
+	return 0;
+}
+
+static int dt_begin_node(struct dt_walk *w, uint32_t *rel)
+{
+	struct dt_tree *tree = w->tree;
+	char name[DT_MAX_NAME + 4];
+	struct dt_node *node;
+	int len = 0, index, ret;
+
+	/* the name is padded to 4 bytes, so read it in words */
+	do {
+		if (len >= DT_MAX_NAME)
+			return -EINVAL;
+		ret = dt_fetch(w, *rel + len, name + len, 4);
+		if (ret)
+			return ret;
+		len += 4;
+	} while (!memchr(name + len - 4, 0, 4));
+	*rel += len;
+
+	if (w->depth == DT_MAX_DEPTH || tree->nr_nodes == DT_MAX_NODES)
+		return -EINVAL;
+
+	if (tree->nr_nodes == tree->max_nodes) {
+		ret = dt_grow((void **)&tree->nodes, &tree->max_nodes,
+			      sizeof(*node));
+		if (ret)
+			return ret;
+		stats_alloc(w->ctx, tree->max_nodes * sizeof(*node));
+	}
+	index = tree->nr_nodes++;
+	node = &tree->nodes[index];
+
+	node->name = strdup(name);
+	if (!node->name)
+		return -ENOMEM;
+	stats_alloc(w->ctx, strlen(name) + 1);
+	node->depth = w->depth;
+	node->parent = w->depth ? w->stack[w->depth - 1] : -1;
+	node->first_child = node->next_sibling = -1;
+	node->first_prop = tree->nr_props;
+	node->nr_props = 0;
+
+	if (w->depth) {
+		int prev = w->last_child[w->depth - 1];
+
+		if (prev < 0)
+			tree->nodes[node->parent].first_child = index;
+		else
+			tree->nodes[prev].next_sibling = index;
+		w->last_child[w->depth - 1] = index;
+	}
+
+	w->stack[w->depth] = index;
+	w->last_child[w->depth] = -1;
+	w->depth++;
+
+	return 0;
+}
+
+static int dt_prop(struct dt_walk *w, uint32_t *rel)
+{
+	struct dt_tree *tree = w->tree;
+	struct sunxi_ctx *ctx = w->ctx;
+	uint32_t length, nameoff, head_len = 0;
+	const void *head = NULL;
+	struct dt_node *node;
+	struct dt_prop *prop;
+	uint64_t end;
+	int ret;
+
+	ret = dt_fetch_u32(w, *rel, &length);
+	if (!ret)
+		ret = dt_fetch_u32(w, *rel + 4, &nameoff);
+	if (ret)
+		return ret;
+	*rel += 8;
+
+	if (!w->depth || length > tree->size - *rel)
+		return -EINVAL;
+	/* properties come before the subnodes, so they are contiguous */
+	node = &tree->nodes[w->stack[w->depth - 1]];
+	if (node->first_prop + node->nr_props != tree->nr_props ||
+	    tree->nr_props == DT_MAX_PROPS)
+		return -EINVAL;
+
+	if (tree->nr_props == tree->max_props) {
+		ret = dt_grow((void **)&tree->props, &tree->max_props,
+			      sizeof(*prop));
+		if (ret)
+			return ret;
+		stats_alloc(ctx, tree->max_props * sizeof(*prop));
+	}
+	prop = &tree->props[tree->nr_props++];
+	node->nr_props++;
+
+	prop->name = NULL;
+	prop->nameoff = nameoff;
+	prop->length = length;
+	prop->offset = tree->start + *rel;
+	prop->value = NULL;
+	dt_resolve_name(w, prop);
+
+	if (length <= DT_INLINE_MAX) {
+		prop->value = calloc(1, length + 1);
+		if (!prop->value)
+			return -ENOMEM;
+		stats_alloc(ctx, length + 1);
+		ret = dt_fetch(w, *rel, prop->value, length);
+		if (ret)
+			return ret;
+	} else if (w->payload) {
+		/* a value starting in the first sector has partly been read */
+		if (*rel < 512) {
+			head = w->sector + *rel;
+			head_len = 512 - *rel;
+		} else if (prop->offset > ctx->pos) {
+			ret = pseek(ctx, prop->offset - ctx->pos);
+			if (ret)
+				return ret;
+		}
+		if (ctx->pos != prop->offset + head_len)
+			return -EINVAL;
+
+		ret = w->payload(ctx, tree, w->stack[w->depth - 1], prop,
+				 head, head_len, w->arg);
+		if (ret)
+			return ret;
+
+		end = prop->offset + length;
+		if (ctx->pos > end)
+			return -EIO;
+	}
+
+	*rel += (length + 3) & ~3;
+
+	return 0;
+}
+
+static int dt_walk_struct(struct dt_walk *w, uint32_t rel)
+{
+	uint32_t token;
+	int ret;
+
+	do {
+		ret = dt_fetch_u32(w, rel, &token);
+		if (ret)
+			return ret;
+		rel += 4;
+
+		switch (token) {
+		case FDT_BEGIN_NODE:
+			ret = dt_begin_node(w, &rel);
+			break;
+		case FDT_END_NODE:
+			if (!w->depth)
+				return -EINVAL;
+			w->depth--;
+			break;
+		case FDT_PROP:
+			ret = dt_prop(w, &rel);
+			break;
+		case FDT_NOP:
+			break;
+		case FDT_END:
+			return w->depth || !w->tree->nr_nodes ? -EINVAL : 0;
+		default:
+			return -EINVAL;
+		}
+	} while (!ret);
+
+	return ret;
+}
+
+/*
+ * dt_walk() - read the nodes and properties of a devicetree blob
+ * @ctx: context, positioned right behind @sector
+ * @sector: the first sector of the blob, already read
+ * @tree: filled with the nodes and properties, release with dt_free()
+ * @payload: called for property values longer than DT_INLINE_MAX, when the
+ *           input is at the start of the value (minus @head_len bytes). It
+ *           may consume up to the whole value, the rest is skipped. The
+ *           property name is not known yet if the strings block follows
+ *           the structure block, as it usually does. Can be NULL.
+ * @arg: passed on to @payload
+ *
+ * The input is left at the end of the blob.
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int dt_walk(struct sunxi_ctx *ctx, const void *sector, struct dt_tree *tree,
+	    dt_payload_fn payload, void *arg)
+{
+	struct dt_walk w = {
+		.ctx = ctx,
+		.sector = sector,
+		.tree = tree,
+		.payload = payload,
+		.arg = arg,
+	};
+	const uint32_t *header = sector;
+	uint32_t off_struct, off_strings;
+	uint64_t end;
+	int ret;
+
+	memset(tree, 0, sizeof(*tree));
+	tree->start = ctx->pos - 512;
+	tree->size = ntohl(header[1]);
+	off_struct = ntohl(header[2]);
+	off_strings = ntohl(header[3]);
+	w.size_strings = ntohl(header[8]);
+
+	if (ntohl(header[0]) != FDT_MAGIC || tree->size < FDT_HEADER_SIZE ||
+	    tree->size > FDT_MAX_SIZE || ntohl(header[5]) < 16 ||
+	    w.size_strings > DT_MAX_STRINGS)
+		return -EINVAL;
+	if (off_strings > tree->size ||
+	    w.size_strings > tree->size - off_strings)
+		return -EINVAL;
+
+	/* the input only goes forward, so read the blocks in file order */
+	if (off_strings < off_struct) {
+		ret = dt_read_strings(&w, off_strings);
+		if (!ret)
+			ret = dt_walk_struct(&w, off_struct);
+	} else {
+		ret = dt_walk_struct(&w, off_struct);
+		if (!ret)
+			ret = dt_read_strings(&w, off_strings);
+	}
+	if (ret)
+		return ret;
+
+	end = tree->start + tree->size;
+	if (ctx->pos < end)
+		return pseek(ctx, end - ctx->pos);
+
+	return 0;
+}
+
+void dt_free(struct dt_tree *tree)
+{
+	int i;
+
+	for (i = 0; i < tree->nr_nodes; i++)
+		free(tree->nodes[i].name);
+	for (i = 0; i < tree->nr_props; i++)
+		free(tree->props[i].value);
+	free(tree->nodes);
+	free(tree->props);
+	free(tree->strings);
+	memset(tree, 0, sizeof(*tree));
+}
+
+/* Returns the index of the child of @parent called @name, or -1. */
+int dt_subnode(const struct dt_tree *tree, int parent, const char *name)
+{
+	int node;
+
+	if (parent < 0 || parent >= tree->nr_nodes)
+		return -1;
+
+	for (node = tree->nodes[parent].first_child; node >= 0;
+	     node = tree->nodes[node].next_sibling)
+		if (!strcmp(tree->nodes[node].name, name))
+			return node;
+
+	return -1;
+}
+
+const struct dt_prop *dt_getprop(const struct dt_tree *tree, int node,
+				 const char *name)
+{
+	const struct dt_node *n;
+	int i;
+
+	if (node < 0 || node >= tree->nr_nodes)
+		return NULL;
+
+	n = &tree->nodes[node];
+	for (i = n->first_prop; i < n->first_prop + n->nr_props; i++)
+		if (tree->props[i].name && !strcmp(tree->props[i].name, name))
+			return &tree->props[i];
+
+	return NULL;
+}
+
+/* Returns the original string, or NULL if it's too long to be kept in memory. */
+const char *dt_getprop_string(const struct dt_tree *tree, int node,
+			      const char *name)
+{
+	const struct dt_prop *prop = dt_getprop(tree, node, name);
+
+	return prop ? prop->value : NULL;
+}
+
+bool dt_getprop_u32(const struct dt_tree *tree, int node, const char *name,
+		    uint32_t *value)
+{
+	const struct dt_prop *prop = dt_getprop(tree, node, name);
+
+	if (!prop || !prop->value || prop->length < 4)
+		return false;
+
+	*value = ntohl(*(uint32_t *)prop->value);
+
+	return true;
+}
@@ -6,253 +6,227 @@
  */
 
 #include <stdio.h>
-#include <libfdt.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include "sunxi-fw.h"
 
-static ssize_t read_dt(void *sector, FILE *stream, void **fdt)
+static void dump_property(const struct dt_tree *tree, int node,
+			  const char *propname, FILE *outf)
 {
-	uint32_t head;
-	void *blob;
-	ssize_t size;
-
-	memcpy(&head, sector + 4, 4);
-	size = ntohl(head);
-	if (size < 4)
-		return -size;
-
-	blob = malloc(size);
-	if (blob == NULL)
-		return -8;
-
-	memcpy(blob, sector, size < 512 ? size : 512);
-	if (size > 512) {
-		if (fread(blob + 512, 1, size - 512, stream) < size - 512) {
-			free(blob);
-			return -size;
-		}
-	}
-
-	*fdt = blob;
-	return size;
-}
-
-static void dump_property(void *fdt, int node, const char *propname, FILE *outf)
-{
-	const struct fdt_property *prop;
+	const char *value = dt_getprop_string(tree, node, propname);
 
-	prop = fdt_get_property(fdt, node, propname, NULL);
-	if (prop)
-		fprintf(outf, "\t\t%s: %s\n", propname, prop->data);
+	if (value)
+		fprintf(outf, "\t\t%s: %s\n", propname, value);
 }
 
-static void dump_image_info(void *fdt, int node, FILE *outf, bool verbose)
+static void dump_image_info(const struct dt_tree *tree, int node, FILE *outf,
+			    bool verbose)
 {
-	const char *nodename = fdt_get_name(fdt, node, NULL);
-	const struct fdt_property *prop;
+	const char *desc = dt_getprop_string(tree, node, "description");
+	const struct dt_prop *prop;
 	uint32_t reg32;
-	int length;
 
-	prop = fdt_get_property(fdt, node, "description", NULL);
-	fprintf(outf, "%s: \"%s\"\n", nodename,
-		prop ? prop->data : "<no description>");
+	fprintf(outf, "%s: \"%s\"\n", tree->nodes[node].name,
+		desc ? desc : "<no description>");
 
 	if (!verbose)
 		return;
 
-	dump_property(fdt, node, "type", outf);
-	dump_property(fdt, node, "arch", outf);
-	dump_property(fdt, node, "compression", outf);
+	dump_property(tree, node, "type", outf);
+	dump_property(tree, node, "arch", outf);
+	dump_property(tree, node, "compression", outf);
 
-	prop = fdt_get_property(fdt, node, "data-size", NULL);
-	if (prop) {
-		reg32 = ntohl(*(uint32_t *)prop->data);
+	if (dt_getprop_u32(tree, node, "data-size", &reg32)) {
 		fprintf(outf, "\t\tsize: %u bytes\n", reg32);
 	} else {
-		prop = fdt_get_property(fdt, node, "data", &length);
+		prop = dt_getprop(tree, node, "data");
 		if (prop) {
 			fprintf(outf, "\t\tembedded data size: %u bytes\n",
-				length);
+				prop->length);
 		}
 	}
-	prop = fdt_get_property(fdt, node, "load", NULL);
-	if (prop) {
-		reg32 = ntohl(*(uint32_t *)prop->data);
+	if (dt_getprop_u32(tree, node, "load", &reg32))
 		fprintf(outf, "\t\tload address: 0x%08x\n", reg32);
-	}
 }
 
-static void dump_config_info(void *fdt, int node, FILE *outf, bool verbose)
+static void dump_config_info(const struct dt_tree *tree, int node, FILE *outf,
+			     bool verbose)
 {
-	const struct fdt_property *prop;
+	const char *desc = dt_getprop_string(tree, node, "description");
+	const struct sunxi_board *board;
 
-	prop = fdt_get_property(fdt, node, "description", NULL);
-	fprintf(outf, "%s\n", prop->data);
+	fprintf(outf, "%s\n", desc ? desc : "<no description>");
 
 	if (!verbose)
 		return;
 
-	dump_property(fdt, node, "firmware", outf);
-	dump_property(fdt, node, "loadables", outf);
-	dump_property(fdt, node, "fdt", outf);
+	/* the description is the DT name, with mkimage -f auto */
+	board = board_lookup(desc);
+	if (board)
+		output_board_info(outf, "\t\t", board, false);
+
+	dump_property(tree, node, "firmware", outf);
+	dump_property(tree, node, "loadables", outf);
+	dump_property(tree, node, "fdt", outf);
 }
 
-int dump_dt_info(void *sector, FILE *inf, FILE *outf, bool verbose)
+int dump_dt_info(struct sunxi_ctx *ctx, void *sector)
 {
-	void *fdt = NULL;
-	ssize_t size;
+	uint64_t start = ctx->pos - 512, end;
+	bool verbose = ctx->verbose;
+	FILE *outf = ctx->out;
+	struct dt_tree tree;
 	int node, subnode;
-	const char *nodename;
 	bool is_config;
 
-	size = read_dt(sector, inf, &fdt);
-	if (size < 0) {
-		fprintf(stderr, "invalid FIT image\n");
-		return 0;
+	if (dt_walk(ctx, sector, &tree, NULL, NULL)) {
+		fprintf(outf, "\tERROR: invalid FIT image\n");
+		dt_free(&tree);
+		return -EINVAL;
 	}
 
-	for (node = fdt_first_subnode(fdt, 0);
-	     node != -FDT_ERR_NOTFOUND;
-	     node = fdt_next_subnode(fdt, node)) {
-		nodename = fdt_get_name(fdt, node, NULL);
-		is_config = !strcmp(nodename, "configurations");
-		for (subnode = fdt_first_subnode(fdt, node);
-		     subnode != -FDT_ERR_NOTFOUND;
-		     subnode = fdt_next_subnode(fdt, subnode)) {
+	for (node = tree.nodes[0].first_child; node >= 0;
+	     node = tree.nodes[node].next_sibling) {
+		is_config = !strcmp(tree.nodes[node].name, "configurations");
+		for (subnode = tree.nodes[node].first_child; subnode >= 0;
+		     subnode = tree.nodes[subnode].next_sibling) {
 			if (is_config) {
 				fprintf(outf, "\tconfiguration: ");
-				dump_config_info(fdt, subnode, outf, verbose);
+				dump_config_info(&tree, subnode, outf, verbose);
 			} else {
 				fprintf(outf, "\tfit:");
-				dump_image_info(fdt, subnode, outf, verbose);
+				dump_image_info(&tree, subnode, outf, verbose);
 			}
 		}
 	}
 
-	if (fdt)
-		free(fdt);
+	/* continue at the next sector boundary */
+	end = start + ((tree.size + 511) & ~511);
+	dt_free(&tree);
+	if (ctx->pos < end)
+		return pseek(ctx, end - ctx->pos);
 
-	pseek(inf, 512 - (size % 512));
-
-	return (size - 1) / 512;
+	return 0;
 }
 
-int dump_dt_names(FILE *inf, FILE *outf)
+int dump_dt_names(struct sunxi_ctx *ctx, FILE *outf)
 {
-	void *fdt = NULL;
-	ssize_t size;
+	struct dt_tree tree;
 	char sector[512];
+	const char *desc;
 	int node, ret;
-	const char *nodename;
-	const struct fdt_property *prop;
 
-	ret = find_firmware_image(inf, IMAGE_FIT, sector, NULL);
+	ret = find_firmware_image(ctx, IMAGE_FIT, sector, NULL);
 	if (ret)
 		return ret;
 
-	size = read_dt(sector, inf, &fdt);
-	if (size < 0 || !fdt) {
+	if (dt_walk(ctx, sector, &tree, NULL, NULL)) {
 		fprintf(stderr, "invalid FIT image\n");
-		if (fdt)
-			free(fdt);
+		dt_free(&tree);
 		return -EINVAL;
 	}
 
-	for (node = fdt_first_subnode(fdt, 0);
-	     node != -FDT_ERR_NOTFOUND;
-	     node = fdt_next_subnode(fdt, node)) {
-		nodename = fdt_get_name(fdt, node, NULL);
-		if (!strcmp(nodename, "configurations"))
-			break;
-	}
-	if (node == -FDT_ERR_NOTFOUND) {
-		free(fdt);
+	node = dt_subnode(&tree, 0, "configurations");
+	if (node < 0) {
+		dt_free(&tree);
 		return -ENOENT;
 	}
 
-	for (node = fdt_first_subnode(fdt, node);
-	     node != -FDT_ERR_NOTFOUND;
-	     node = fdt_next_subnode(fdt, node)) {
-		prop = fdt_get_property(fdt, node, "description", NULL);
-		if (prop)
-			fprintf(outf, "%s\n", prop->data);
+	for (node = tree.nodes[node].first_child; node >= 0;
+	     node = tree.nodes[node].next_sibling) {
+		desc = dt_getprop_string(&tree, node, "description");
+		if (desc)
+			fprintf(outf, "%s\n", desc);
 	}
 
-	free(fdt);
+	dt_free(&tree);
 
 	return 0;
 }
 
-void extract_fit_image(void *sector, FILE *inf, FILE *outf, const char *imgname)
+struct fit_extract {
+	const char *name;		/* image node name, without "fit:" */
+	FILE *outf;
+	int prop;			/* property written to outf, or -1 */
+};
+
+/* streams the embedded data of the wanted image, while it passes by */
+static int fit_stream_data(struct sunxi_ctx *ctx, const struct dt_tree *tree,
+			   int node, const struct dt_prop *prop,
+			   const void *head, uint32_t head_len, void *arg)
 {
-	void *fdt = NULL;
-	ssize_t size;
-	int node, length;
-	const char *nodename;
-	const struct fdt_property *prop;
-	uint32_t offset, imgsize;
-
-	size = read_dt(sector, inf, &fdt);
-	if (size < 0 || !fdt) {
-		fprintf(stderr, "invalid FIT image\n");
-		if (fdt)
-			free(fdt);
-		return;
-	}
+	const struct dt_node *n = &tree->nodes[node];
+	struct fit_extract *x = arg;
+
+	/* "data" is the only large property of an image node */
+	if (x->prop >= 0 || n->depth != 2 || strcmp(n->name, x->name) ||
+	    strcmp(tree->nodes[n->parent].name, "images"))
+		return 0;
+
+	if (head_len)
+		fwrite(head, 1, head_len, x->outf);
+	if (copy_file(ctx, x->outf, prop->length - head_len) <
+	    prop->length - head_len)
+		return -EIO;
+	x->prop = prop - tree->props;
+
+	return 0;
+}
+
+void extract_fit_image(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       const char *imgname)
+{
+	struct fit_extract x = { .name = imgname + 4, .outf = outf, .prop = -1 };
+	const struct dt_prop *prop;
+	uint32_t size, offset, imgsize;
+	struct dt_tree tree;
+	uint64_t pos;
+	int node;
 
 	if (!strcmp(imgname, "fit")) {
-		fwrite(fdt, size, 1, outf);
-		free(fdt);
+		size = ntohl(((uint32_t *)sector)[1]);
+		fwrite(sector, 1, size < 512 ? size : 512, outf);
+		if (size > 512)
+			copy_file(ctx, outf, size - 512);
 		return;
 	}
 
 	if (strncmp(imgname, "fit:", 4))
 		return;
 
-	for (node = fdt_first_subnode(fdt, 0);
-	     node != -FDT_ERR_NOTFOUND;
-	     node = fdt_next_subnode(fdt, node)) {
-		nodename = fdt_get_name(fdt, node, NULL);
-		if (!strcmp(nodename, "images"))
-			break;
-	}
-	if (node == -FDT_ERR_NOTFOUND) {
-		free(fdt);
-		return;
+	if (dt_walk(ctx, sector, &tree, fit_stream_data, &x)) {
+		fprintf(stderr, "invalid FIT image\n");
+		goto out;
 	}
 
-	for (node = fdt_first_subnode(fdt, node);
-	     node != -FDT_ERR_NOTFOUND;
-	     node = fdt_next_subnode(fdt, node)) {
-		nodename = fdt_get_name(fdt, node, NULL);
-		if (!strcmp(nodename, imgname + 4))
-			break;
-	}
-	if (node == -FDT_ERR_NOTFOUND) {
-		free(fdt);
-		return;
-	}
+	node = dt_subnode(&tree, dt_subnode(&tree, 0, "images"), x.name);
+	if (node < 0)
+		goto out;
 
-	prop = fdt_get_property(fdt, node, "data", &length);
+	prop = dt_getprop(&tree, node, "data");
 	if (prop) {
-		fwrite(prop->data, 1, length, outf);
-		return;
+		if (prop->value)
+			fwrite(prop->value, 1, prop->length, outf);
+		goto out;
+	}
+	if (x.prop >= 0) {
+		fprintf(stderr, "unexpected large property in \"%s\"\n",
+			imgname);
+		goto out;
 	}
 
-	prop = fdt_get_property(fdt, node, "data-offset", NULL);
-	if (!prop)
-		return;
-	offset = ntohl(*(uint32_t *)prop->data);
+	if (!dt_getprop_u32(&tree, node, "data-offset", &offset) ||
+	    !dt_getprop_u32(&tree, node, "data-size", &imgsize))
+		goto out;
 
-	prop = fdt_get_property(fdt, node, "data-size", NULL);
-	if (!prop)
-		return;
-	imgsize = ntohl(*(uint32_t *)prop->data);
-	pseek(inf, offset);
-	copy_file(inf, outf, imgsize);
+	/* external data, relative to the end of the FIT */
+	pos = tree.start + tree.size + offset;
+	if (ctx->pos <= pos && !pseek(ctx, pos - ctx->pos))
+		copy_file(ctx, outf, imgsize);
 
-	free(fdt);
+out:
+	dt_free(&tree);
 }
@@ -15,87 +15,56 @@
 
 #include "sunxi-fw.h"
 
-/*
- * pseek() - forward-only seek, that works on pipes as well
- * @stream: file to seek in
- * @offset: number of bytes to skip
- *
- * pseek() works like fseek(), with @whence fixed to SEEK_CUR. But it also
- * support pipes (or other non-seekable file descriptors), by dummy-reading
- * the respective number of bytes if fseek() does not work.
- *
- * Return: 0 if successful, negative error value otherwise
- */
-#define BUFSIZE 1024
-int pseek(FILE *stream, long offset)
+/* read a list of file names from @stream, one per line */
+static int read_file_list(FILE *stream, char ***list)
 {
-	static char buffer[BUFSIZE] = {};
-	int chunk, ret;
-
-	ret = fseek(stream, offset, SEEK_CUR);
-	if (!ret)
-		return ret;
+	char *line = NULL, **names = NULL, **tmp;
+	size_t size = 0;
+	ssize_t len;
+	int nr = 0;
 
-	if (ret < 0 && errno != ESPIPE)
-		return -errno;
+	while ((len = getline(&line, &size, stream)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = 0;
+		if (!len)
+			continue;
 
-	while (offset) {
-		chunk = (offset > BUFSIZE ? BUFSIZE : offset);
-		ret = fread(buffer, 1, chunk, stream);
-		if (ret < chunk)
-			return -errno;
-
-		offset -= ret;
+		tmp = realloc(names, (nr + 1) * sizeof(*names));
+		if (!tmp)
+			break;
+		names = tmp;
+		names[nr++] = strdup(line);
 	}
+	free(line);
 
-	return 0;
+	*list = names;
+	return nr;
 }
 
-/*
- * copy_file(): copy content of one FILE to another
- * @inf: input file pointer
- * @outf: output file pointer
- * @length: length to copy, or -1 for "the rest of @inf"
- *
- * Copies the content of @inf from the current position to @outf.
- * Copies @length bytes, unless @length is -1, in this case copies till EOF.
- *
- * Return: number of bytes copied, could be 0.
- */
-#define BLOCKSIZE 4096
-off_t copy_file(FILE *inf, FILE *outf, off_t length)
+/* "info" for multiple files, given on the command line or on stdin */
+static int batch_info(int nr_files, char **files, int nr_jobs,
+		      const struct info_options *opts)
 {
-	void *buffer;
-	off_t counter = 0;
-	size_t ret;
+	char **list = NULL;
+	int i, ret;
 
-	buffer = malloc(BLOCKSIZE);
-	if (!buffer)
+	if (!nr_files) {
+		nr_files = read_file_list(stdin, &list);
+		files = list;
+	}
+	if (!nr_files)
 		return 0;
 
-	while (length > 0 || length == -1) {
-		size_t toread;
-
-		if (length == -1)
-			toread = BLOCKSIZE;
-		else
-			toread = length > BLOCKSIZE ? BLOCKSIZE : length;
-
-		ret = fread(buffer, 1, toread, inf);
-		if (ret <= 0)
-			break;
-		ret = fwrite(buffer, 1, ret, outf);
-		if (ret <= 0)
-			break;
+	ret = batch_image_info((const char **)files, nr_files, nr_jobs,
+			       stdout, opts);
 
-		if (length > 0)
-			length -= ret;
-		counter += ret;
+	if (list) {
+		for (i = 0; i < nr_files; i++)
+			free(list[i]);
+		free(list);
 	}
 
-	free(buffer);
-
-	return counter;
+	return ret;
 }
 
 /* open a file for writing, returning NULL and "-" as "stdout" */
@@ -118,42 +87,186 @@ static FILE *open_output_file(const char *outfn, const char *action)
 
 static void usage(FILE *stream, const char *progname)
 {
-	fprintf(stream, "usage: %s <action> [-vah] [-n name] [-o outputfile] [inputfile]\n",
+	fprintf(stream, "usage: %s <action> [-vagh] [-n name] [-o outputfile] [-O outputdir] [-j jobs] [-f format] [inputfile...]\n",
 		progname);
 	fprintf(stream, "\tinfo: print information about the image\n");
+	fprintf(stream, "\t\tmultiple input files are scanned in parallel with -j\n");
 	fprintf(stream, "\textract -n <id>: extract part of image\n");
+	fprintf(stream, "\t\t-n can be given multiple times, and can be a wildcard\n");
 	fprintf(stream, "\tdt-name: print name of board devicetree in SPL header\n");
+	fprintf(stream, "\tset-dt-name -n <name>: change the DT name in the SPL header,\n");
+	fprintf(stream, "\t\tof the input file in place, or of a copy with -o\n");
+	fprintf(stream, "\tpatch-boot0 --dram-param <key=value>: change the DRAM\n");
+	fprintf(stream, "\t\tparameters of boot0, in place or in a copy with -o\n");
+	fprintf(stream, "\tpack -o <outputfile> <manifest>: lay out the boot components\n");
+	fprintf(stream, "\t\tlisted in the manifest, fixing their checksums\n");
+	fprintf(stream, "\tdiff <reference> <device>: compare the firmware components of\n");
+	fprintf(stream, "\t\ta device with the image that was written to it\n");
+	fprintf(stream, "\tserve <socket>: answer info, verify and extract requests on a\n");
+	fprintf(stream, "\t\tUnix socket, -j of them at a time, until SIGTERM\n");
 	fprintf(stream, "\tlist-dt-names: list all DT names in FIT image\n");
+	fprintf(stream, "\tverify: check the hashes of FIT images and the CRCs of U-Boot\n");
+	fprintf(stream, "\t\timages, all or those given with -n\n");
 	fprintf(stream, "\t-o filename: output file name for extract\n");
+	fprintf(stream, "\t-O dirname: output directory for extracting multiple parts\n");
 	fprintf(stream, "\t-v: more verbose output\n");
 	fprintf(stream, "\t-a: scan all of input file for parts\n");
+	fprintf(stream, "\t-g, --gap-only: stop scanning at the first partition\n");
+	fprintf(stream, "\t-p, --partitions: look inside partitions too, instead of\n");
+	fprintf(stream, "\t\tskipping over them\n");
+	fprintf(stream, "\t-j jobs: number of worker threads for multiple files,\n");
+	fprintf(stream, "\t\treads the list of files from stdin if none given\n");
+	fprintf(stream, "\t-f, --format=text|json|cbor: output format for info\n");
+	fprintf(stream, "\t--only=type[,type...]: only decode these components, e.g. spl,fit\n");
+	fprintf(stream, "\t--fields=field[,field...]: only emit these record fields, e.g.\n");
+	fprintf(stream, "\t\tname,offset,size (with -f json|cbor)\n");
+	fprintf(stream, "\t--index=file: cache the PhoenixSuite directory in file\n");
+	fprintf(stream, "\t--cache=dir: keep info reports in dir, and reuse them for\n");
+	fprintf(stream, "\t\timages with unchanged component headers\n");
+	fprintf(stream, "\t--stats: report I/O counters and timings per component type\n");
+	fprintf(stream, "\t\ton stderr, or as a last record with -f json|cbor\n");
+	fprintf(stream, "\t--readahead=size[K|M]: buffer for reading pipes and compressed\n");
+	fprintf(stream, "\t\timages ahead, in a separate thread (16M, 0 to disable)\n");
+	fprintf(stream, "\t--direct: read block devices with O_DIRECT, bypassing the page cache\n");
+	fprintf(stream, "\t\t(and write them, for pack, or read both sides, for diff)\n");
+	fprintf(stream, "\t--sparse[=holes|android]: write zero blocks of extracted parts\n");
+	fprintf(stream, "\t\tas holes, or write Android sparse images\n");
+	fprintf(stream, "\t--board=dt-name: the board the image is for, e.g. sun50i-a64-pine64,\n");
+	fprintf(stream, "\t\tfor the boot0 DRAM layout and the boot offsets of its SoC\n");
+	fprintf(stream, "\t--dram-param=key=value: a DRAM parameter for patch-boot0, by\n");
+	fprintf(stream, "\t\tits name in info -v, or as dram_NN, can be given multiple times\n");
 	fprintf(stream, "\t-h: this help screen\n");
 }
 
+static char input_buffer[1024 * 1024];
+
+static const struct option long_options[] = {
+	{ "format", required_argument, NULL, 'f' },
+	{ "gap-only", no_argument, NULL, 'g' },
+	{ "partitions", no_argument, NULL, 'p' },
+	{ "index", required_argument, NULL, 'I' },
+	{ "stats", no_argument, NULL, 'S' },
+	{ "readahead", required_argument, NULL, 'R' },
+	{ "direct", no_argument, NULL, 'D' },
+	{ "only", required_argument, NULL, 'T' },
+	{ "fields", required_argument, NULL, 'F' },
+	{ "cache", required_argument, NULL, 'C' },
+	{ "dram-param", required_argument, NULL, 'P' },
+	{ "sparse", optional_argument, NULL, 'Z' },
+	{ "board", required_argument, NULL, 'B' },
+	{ NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char **argv)
 {
-	FILE *inf, *outf = NULL;
-	int option;
-	char *action, *outfn = NULL;
-	char *name = NULL;
-	bool verbose = false, scan_all = false;
+	struct info_options opts = {
+		.format = FORMAT_TEXT,
+		.readahead = DEFAULT_READAHEAD,
+	};
+	struct sunxi_stats stats = { 0 };
+	struct sunxi_cache *cache = NULL;
+	struct sunxi_ctx ctx;
+	FILE *inf, *outf = NULL, *report;
+	int option, ret = 0;
+	char *action, *outfn = NULL, *outdir = NULL;
+	char *name = NULL, *index = NULL;
+	const char **names, **dram_params;
+	int nr_names = 0, nr_jobs = 0, nr_dram_params = 0;
+
+	/* both are free()d together, dram_params points into names */
+	names = calloc(2 * argc, sizeof(*names));
+	if (!names)
+		return 2;
+	dram_params = names + argc;
 
-	while ((option = getopt(argc, argv, "n:o:hva")) != -1) {
+	while ((option = getopt_long(argc, argv, "n:o:O:j:f:hvagp",
+				     long_options, NULL)) != -1) {
 		switch (option) {
 		case 'o':
 			outfn = optarg;
 			break;
+		case 'O':
+			outdir = optarg;
+			break;
 		case 'h':
 			usage(stdout, argv[0]);
 			return 0;
 		case 'n':
 			name = optarg;
+			names[nr_names++] = optarg;
 			break;
 		case 'v':
-			verbose = true;
+			opts.verbose = true;
 			break;
 		case 'a':
-			scan_all = true;
+			opts.scan_all = true;
+			break;
+		case 'g':
+			opts.gap_only = true;
+			break;
+		case 'p':
+			opts.scan_parts = true;
+			break;
+		case 'I':
+			index = optarg;
+			break;
+		case 'S':
+			opts.stats = true;
+			break;
+		case 'C':
+			opts.cache = optarg;
+			break;
+		case 'P':
+			dram_params[nr_dram_params++] = optarg;
+			break;
+		case 'D':
+			opts.direct = true;
+			break;
+		case 'B':
+			if (!board_lookup(optarg)) {
+				fprintf(stderr, "unknown board or SoC \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			opts.board = optarg;
+			break;
+		case 'Z':
+			if (parse_sparse_format(optarg, &opts.sparse)) {
+				fprintf(stderr, "unknown sparse format \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'T':
+			if (parse_type_list(optarg, &opts.only)) {
+				fprintf(stderr, "unknown component type in \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'F':
+			if (parse_field_list(optarg, &opts.fields)) {
+				fprintf(stderr, "unknown field in \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'R':
+			if (parse_size(optarg, &opts.readahead)) {
+				fprintf(stderr, "invalid size \"%s\"\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'j':
+			nr_jobs = atoi(optarg);
+			break;
+		case 'f':
+			if (parse_output_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format \"%s\"\n",
+					optarg);
+				return 1;
+			}
 			break;
 		case '?':
 			break;
@@ -167,9 +280,100 @@ int main(int argc, char **argv)
 	}
 	action = argv[optind];
 
+	if (opts.fields && opts.format == FORMAT_TEXT) {
+		fprintf(stderr, "--fields needs -f json or -f cbor\n");
+		return 1;
+	}
+
+	/* More than one input file, or -j: batch mode */
+	if (!strcmp(action, "info") && (nr_jobs || optind + 2 < argc)) {
+		ret = batch_info(argc - optind - 1, argv + optind + 1, nr_jobs,
+				 &opts);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
+	if (!strcmp(action, "patch-boot0") && !nr_dram_params) {
+		fprintf(stderr, "%s requires --dram-param <key=value>\n", action);
+		free(names);
+		return 1;
+	}
+
+	/* pack writes -o, and reads the components the manifest names */
+	if (!strcmp(action, "pack")) {
+		if (!outfn) {
+			fprintf(stderr, "%s requires -o <outputfile>, - for stdout\n",
+				action);
+			free(names);
+			return 1;
+		}
+		ret = pack_image(optind + 1 < argc && strcmp(argv[optind + 1], "-") ?
+				 argv[optind + 1] : NULL, outfn, opts.direct,
+				 opts.verbose);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
+	/* serve opens the files of every request itself */
+	if (!strcmp(action, "serve")) {
+		if (optind + 1 >= argc) {
+			fprintf(stderr, "%s requires a socket path\n", action);
+			free(names);
+			return 1;
+		}
+		ret = serve_requests(argv[optind + 1], nr_jobs, &opts);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
+	/* diff opens both sides itself, the device maybe with O_DIRECT */
+	if (!strcmp(action, "diff")) {
+		if (optind + 2 >= argc) {
+			fprintf(stderr, "%s requires a reference image and a device\n",
+				action);
+			free(names);
+			return 1;
+		}
+		ret = diff_images(argv[optind + 1], argv[optind + 2],
+				  (opts.scan_all ? SUNXI_ITER_SCAN_ALL : 0) |
+				  (opts.gap_only ? SUNXI_ITER_GAP_ONLY : 0) |
+				  (opts.scan_parts ? SUNXI_ITER_SCAN_PARTS : 0),
+				  opts.direct, stdout);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
+	/* Without -o, the boot0 header is patched in the file itself. */
+	if (!strcmp(action, "patch-boot0") && !outfn) {
+		if (optind + 1 >= argc) {
+			fprintf(stderr, "%s requires a file, or -o <outputfile>\n",
+				action);
+			free(names);
+			return 1;
+		}
+		ret = boot0_set_dram(argv[optind + 1], dram_params,
+				     nr_dram_params,
+				     opts.verbose ? stderr : NULL);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
+	/* Without -o, the SPL header is patched in the file itself. */
+	if (!strcmp(action, "set-dt-name") && !outfn) {
+		if (!name || optind + 1 >= argc) {
+			fprintf(stderr, "%s requires -n <name> and a file, or -o <outputfile>\n",
+				action);
+			free(names);
+			return 1;
+		}
+		ret = spl_set_dtname(argv[optind + 1], name);
+		free(names);
+		return ret ? 2 : 0;
+	}
+
 	/* The second non-option argument is the (optional) input file. */
 	if (optind + 1 < argc) {
-		inf = fopen(argv[optind + 1], "rb");
+		inf = input_open(argv[optind + 1], opts.direct);
 		if (!inf) {
 			perror(argv[optind + 1]);
 			return 2;
@@ -178,32 +382,104 @@ int main(int argc, char **argv)
 		inf = stdin;
 	}
 
-	if (!strcmp(action, "info")) {
-		output_image_info(inf, stdout, verbose, scan_all);
+	/*
+	 * gzip or xz compressed images are decompressed on the fly, and
+	 * pipes are read ahead by a thread of their own
+	 */
+	inf = input_unpack(inf, opts.readahead);
+	if (!inf) {
+		fprintf(stderr, "cannot read compressed input\n");
+		return 2;
+	}
+
+	/* read pipes in large blocks, this is not used for mapped files */
+	setvbuf(inf, input_buffer, _IOFBF, sizeof(input_buffer));
+
+	sunxi_ctx_init(&ctx, inf, stdout, opts.verbose);
+	ctx.gap_only = opts.gap_only;
+	ctx.scan_parts = opts.scan_parts;
+	ctx.wty_index = index;
+	ctx.only = opts.only;
+	ctx.board = board_lookup(opts.board);
+	if (opts.stats)
+		ctx.stats = &stats;
+
+	/* the statistics would be those of the first run */
+	if (!strcmp(action, "info") && opts.cache && !opts.stats) {
+		cache = cache_open(opts.cache, inf, NULL, &opts);
+		if (!cache_replay(cache, stdout))
+			goto out;
+	}
+
+	if (!strcmp(action, "info") && opts.format != FORMAT_TEXT) {
+		report = cache_capture(cache, stdout);
+		ret = output_image_records(inf, report, NULL, &opts, cache);
+	} else if (!strcmp(action, "info")) {
+		ctx.out = cache_capture(cache, stdout);
+		ctx.cache = cache;
+		output_image_info(&ctx, opts.scan_all);
 	} else if (!strcmp(action, "extract")) {
 		if (!name) {
 			fprintf(stderr, "%s requires -n <name>\n", action);
 			return 2;
 		}
+		/* Multiple or wildcard names are extracted in one go. */
+		if (outdir || nr_names > 1 || strpbrk(name, "*?[")) {
+			if (outfn) {
+				fprintf(stderr, "use -O <dir> for multiple names\n");
+				return 2;
+			}
+			ret = extract_images(&ctx, names, nr_names,
+					     outdir ? outdir : ".", opts.sparse);
+			goto out;
+		}
 		outf = open_output_file(outfn, action);
+		if (outf)
+			outf = sparse_open(outf, opts.sparse);
 		if (!outf)
 			return 2;
 
-		extract_image(inf, outf, name);
+		ret = extract_image(&ctx, outf, name);
 	} else if (!strcmp(action, "dt-name")) {
-		handle_dt_name(inf, name, stdout);
+		handle_dt_name(&ctx, name, stdout);
+	} else if (!strcmp(action, "set-dt-name")) {
+		if (!name) {
+			fprintf(stderr, "%s requires -n <name>\n", action);
+			return 2;
+		}
+		outf = open_output_file(outfn, action);
+		if (!outf)
+			return 2;
+
+		ret = spl_copy_dtname(&ctx, name, outf);
+	} else if (!strcmp(action, "patch-boot0")) {
+		outf = open_output_file(outfn, action);
+		if (!outf)
+			return 2;
+
+		ret = boot0_copy_dram(&ctx, dram_params, nr_dram_params, outf,
+				      opts.verbose ? stderr : NULL);
 	} else if (!strcmp(action, "list-dt-names")) {
-		dump_dt_names(inf, stdout);
+		dump_dt_names(&ctx, stdout);
+	} else if (!strcmp(action, "verify")) {
+		ret = verify_images(&ctx, names, nr_names);
 	} else {
 		fprintf(stderr, "unknown action verb \"%s\"\n", action);
 		usage(stderr, argv[0]);
 		return 1;
 	}
 
+out:
+	cache_close(cache, stdout);
+	/* the records carry their own statistics */
+	if (opts.format == FORMAT_TEXT || strcmp(action, "info"))
+		stats_report(&ctx, stderr);
+	free(names);
+	sunxi_ctx_release(&ctx);
 	if (inf)
 		fclose(inf);
 	if (outf)
 		fclose(outf);
 
-	return 0;
+	return ret ? 2 : 0;
 }
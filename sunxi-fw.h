@@ -1,76 +1,532 @@
 #ifndef __SUNXI_FW_H__
 #define __SUNXI_FW_H__
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
-enum image_type {
-	IMAGE_ERROR,
-	IMAGE_SHORT,
-	IMAGE_UNKNOWN,
-	IMAGE_BOOT0,
-	IMAGE_SPL1,
-	IMAGE_SPL2,
-	IMAGE_SPLx,
-	IMAGE_TOC0,
-	IMAGE_UBOOT,
-	IMAGE_FIT,
-	IMAGE_MBR,
-	IMAGE_GPT,
-	IMAGE_ROCKCHIP,
-	IMAGE_AML,
-	IMAGE_PHOENIX,
+#include "libsunxi-fw.h"
+
+/* magic numbers, as used by identify_image() */
+#define EGON_MAGIC1	0x4e4f4765		// "eGON"
+#define EGON_MAGIC2	0x3054422e		// ".BT0"
+#define SPL_MAGIC	0x004c5053		// "SPL\0"
+#define IH_MAGIC	0x27051956
+#define FDT_MAGIC	0xd00dfeed
+#define TOC0_MAGIC1	0x30434f54		// "TOC0"
+#define TOC0_MAGIC2	0x484c472e		// ".GLH"
+#define RK_IDBL_RC4	0xfcdc8c3b		// RC4 encoded magic
+#define RK_SIG_RK32	0x32334b52		// "RK32"
+#define RK_SIG_RK33	0x33334b52		// "RK33"
+#define AML_MAGIC	0x4c4d4140		// "@AML"
+#define IMAGEWTY_MAGIC1	0x494d4147		// "IMAG"
+#define IMAGEWTY_MAGIC2	0x45575459		// "EWTY"
+
+#define EGON_CHECKSUM_SEED	0x5f0a6c39
+
+/*
+ * Limits for the sizes and counts in image headers, which come straight
+ * from the input. Anything beyond is taken as a corrupt header, so that a
+ * broken or hostile image doesn't make a parser allocate gigabytes, or
+ * read on through the rest of a pipe, for a single component.
+ */
+#define EGON_MAX_SIZE		(32 * 1024 * 1024)	/* boot0, SPL, TOC0 */
+#define FDT_MAX_SIZE		(256 * 1024 * 1024)	/* a FIT, with data */
+#define DT_MAX_STRINGS		(1024 * 1024)
+#define DT_MAX_NODES		65536
+#define DT_MAX_PROPS		(4 * DT_MAX_NODES)
+#define WTY_MAX_IMAGES		65536
+#define GPT_MAX_ENTRIES		(1024 * 1024)		/* in bytes */
+
+#define SCRATCH_SIZE		4096
+
+enum output_format {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_CBOR,
+};
+
+/* how extract writes zero blocks, see sunxi-sparse.c */
+enum sparse_format {
+	SPARSE_NONE,
+	SPARSE_HOLES,			/* as holes in the output file */
+	SPARSE_ANDROID,			/* Android sparse image */
+};
+
+/* command line options of "info", also used for batch mode */
+struct info_options {
+	enum output_format format;
+	bool verbose;			/* verify checksums, more details */
+	bool scan_all;			/* don't stop after U-Boot */
+	bool gap_only;			/* stop at the first partition */
+	bool scan_parts;		/* look inside partitions too */
+	bool stats;			/* report I/O counters and timings */
+	size_t readahead;		/* for pipes, see input_unpack() */
+	bool direct;			/* O_DIRECT for block devices */
+	unsigned int only;		/* component types, see sunxi_ctx */
+	unsigned int fields;		/* FIELD_* of the records, 0: all */
+	const char *cache;		/* result cache directory, or NULL */
+	enum sparse_format sparse;	/* for extract */
+	const char *board;		/* DT name of the board, or NULL */
+};
+
+/* record fields, for --fields */
+#define FIELD_FILE		(1U << 0)
+#define FIELD_NAME		(1U << 1)
+#define FIELD_TYPE		(1U << 2)
+#define FIELD_OFFSET		(1U << 3)
+#define FIELD_SIZE		(1U << 4)
+#define FIELD_DEPTH		(1U << 5)
+#define FIELD_CHECKSUM		(1U << 6)
+#define FIELD_DESCRIPTION	(1U << 7)
+#define FIELD_DRAM		(1U << 8)
+#define FIELD_BOARD		(1U << 9)
+
+/* [@start, @end) of a partition, in bytes */
+struct part_extent {
+	uint64_t start, end;
+};
+
+/*
+ * struct io_stats - what the input primitives did for one decoder
+ * @bytes_read: data handed out by input_*() and scan_sectors()
+ * @bytes_copied: data written out by copy_file()
+ * @skipped_seek: bytes skipped by pseek() without reading them
+ * @skipped_read: bytes skipped by pseek() by reading and dropping them
+ * @calls: calls into stdio or the kernel, mapped input needs none
+ * @allocs: number of allocations made by the decoder
+ * @alloc_bytes: their total size
+ * @wall_ns: elapsed time
+ * @cpu_ns: CPU time of the thread doing the decoding
+ */
+struct io_stats {
+	uint64_t bytes_read;
+	uint64_t bytes_copied;
+	uint64_t skipped_seek;
+	uint64_t skipped_read;
+	uint64_t calls;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+};
+
+/* one phase per component type, IMAGE_UNKNOWN is the scan in between */
+#define NR_STATS_PHASES		(IMAGE_PHOENIX + 1)
+
+struct sunxi_stats {
+	struct io_stats phase[NR_STATS_PHASES];
+	int current;
+	uint64_t wall_start, cpu_start;	/* of the current phase */
 };
 
+#define STATS_ADD(ctx, field, n)				\
+	do {							\
+		struct sunxi_stats *_s = (ctx)->stats;		\
+								\
+		if (_s)						\
+			_s->phase[_s->current].field += (n);	\
+	} while (0)
+
+/*
+ * struct sunxi_ctx - state of one run over an input image
+ * @inf: input stream
+ * @out: output sink for the information dump
+ * @verbose: whether to output more elaborate information
+ * @pos: absolute read position in @inf, maintained by the input_*()
+ *       functions, pseek() and copy_file()
+ * @map_base: start of the memory mapped input, if any (see input_map())
+ * @map_size: size of the mapping
+ * @bounce: bounce buffer for copy_file() and copy_file_crc(), allocated on
+ *          first use
+ * @parts: partitions from the partition table at the start of the input,
+ *         which scan_sectors() skips over
+ * @nr_parts: number of entries in @parts
+ * @first_part: absolute offset of the first partition, 0 if unknown
+ * @gap_only: stop scanning at @first_part
+ * @scan_parts: scan the data of the partitions as well, instead of
+ *              skipping over them
+ * @only: bit mask of the component types (1 << enum image_type) to decode,
+ *        the others are skipped by their header (see skip_component()).
+ *        0 decodes everything. IMAGE_SPLx stands for all SPL versions.
+ * @wty_index: file to cache the directory of a PhoenixSuite image in, to
+ *             save reading it again (see wty_dir_read()), or NULL
+ * @stats: I/O counters, maintained if not NULL (see sunxi-stats.c)
+ * @board: the board the image is for, from --board or the first SPL DT
+ *         name, picks the boot0 DRAM layout (see board_lookup()), or NULL
+ * @tap: if set, called with all data read or skipped over by the input_*()
+ *       helpers and pseek(), at the absolute offset @pos (see sunxi-plan.c)
+ * @tap_arg: passed on to @tap
+ * @scratch: scratch buffer for the decoders, contents are not preserved
+ *           across calls to other functions
+ */
+struct sunxi_ctx {
+	FILE *inf;
+	FILE *out;
+	bool verbose;
+	uint64_t pos;
+	void *map_base;
+	uint64_t map_size;
+	void *bounce;
+	struct part_extent *parts;
+	int nr_parts;
+	uint64_t first_part;
+	bool gap_only;
+	bool scan_parts;
+	unsigned int only;
+	const char *wty_index;
+	struct sunxi_stats *stats;
+	struct sunxi_cache *cache;	/* notes the headers, see sunxi-cache.c */
+	const struct sunxi_board *board;
+	void (*tap)(void *arg, const void *data, uint64_t pos, size_t len);
+	void *tap_arg;
+	char scratch[SCRATCH_SIZE];
+};
+
+/* sunxi-input.c */
+void sunxi_ctx_init(struct sunxi_ctx *ctx, FILE *inf, FILE *out, bool verbose);
+void sunxi_ctx_release(struct sunxi_ctx *ctx);
+int input_map(struct sunxi_ctx *ctx);
+void *input_window(struct sunxi_ctx *ctx, long offset, size_t length);
+size_t input_fread(struct sunxi_ctx *ctx, void *buffer, size_t length);
+void *input_read(struct sunxi_ctx *ctx, void *buffer, size_t length);
+bool input_owns(struct sunxi_ctx *ctx, const void *ptr);
+
 /* Like lseek(), but works on pipes as well. Implies SEEK_CUR. */
-int pseek(FILE *stream, long offset);
+int pseek(struct sunxi_ctx *ctx, long offset);
 
 /*
  * Copy the content of <inf> from the current position to <outf>.
  * Copy <length> bytes, unless <length> is -1, in this case copy till EOF.
  */
-off_t copy_file(FILE *inf, FILE *outf, off_t length);
+off_t copy_file(struct sunxi_ctx *ctx, FILE *outf, off_t length);
+off_t copy_file_crc(struct sunxi_ctx *ctx, FILE *outf, off_t length,
+		    uint32_t *crc);
+
+/* sunxi-sha.c */
+#define SHA_BLOCK_SIZE		64
+#define SHA1_DIGEST_SIZE	20
+#define SHA256_DIGEST_SIZE	32
+
+struct sha_ctx {
+	uint32_t state[8];
+	uint64_t length;		/* in bytes */
+	uint8_t block[SHA_BLOCK_SIZE];
+	size_t fill;
+	int digest_len;			/* tells SHA-1 and SHA-256 apart */
+};
+
+void sha_init(struct sha_ctx *sha, int bits);
+void sha_update(struct sha_ctx *sha, const void *data, size_t length);
+void sha_final(struct sha_ctx *sha, uint8_t *digest);
+
+/* sunxi-cache.c */
+struct sunxi_cache;
+struct sunxi_cache *cache_open(const char *dir, FILE *inf,
+			       const char *filename,
+			       const struct info_options *opts);
+int cache_replay(struct sunxi_cache *cache, FILE *outf);
+FILE *cache_capture(struct sunxi_cache *cache, FILE *outf);
+void cache_component(struct sunxi_ctx *ctx, enum image_type type,
+		     const void *sector);
+void cache_close(struct sunxi_cache *cache, FILE *outf);
+
+/* sunxi-stats.c */
+void stats_phase(struct sunxi_ctx *ctx, enum image_type type);
+void stats_alloc(struct sunxi_ctx *ctx, size_t size);
+const char *stats_phase_name(int phase);
+bool stats_phase_used(const struct io_stats *phase);
+void stats_report(struct sunxi_ctx *ctx, FILE *stream);
+
+/* sunxi-diff.c */
+int diff_images(const char *reference, const char *device,
+		unsigned int flags, bool direct, FILE *stream);
+
+/* sunxi-direct.c */
+FILE *input_open(const char *filename, bool direct);
+
+/* sunxi-serve.c */
+int serve_requests(const char *path, int nr_threads,
+		   const struct info_options *opts);
+
+/* sunxi-sparse.c */
+FILE *sparse_open(FILE *outf, enum sparse_format format);
+int parse_sparse_format(const char *str, enum sparse_format *format);
+
+/* sunxi-unpack.c */
+FILE *input_unpack(FILE *inf, size_t readahead);
+
+/* sunxi-readahead.c */
+#define DEFAULT_READAHEAD	(16 * 1024 * 1024)
+FILE *input_readahead(FILE *inf, size_t size);
+
+/* sunxi-scan.c */
+void *scan_sectors(struct sunxi_ctx *ctx, void *buffer);
+
+/* sunxi-checksum.c */
+uint32_t egon_sum(uint32_t sum, const void *data, size_t length);
+uint32_t egon_checksum(const void *data, size_t length);
+uint32_t egon_checksum_update(uint32_t chksum, const void *old,
+			      const void *new, size_t length);
+int egon_checksum_input(struct sunxi_ctx *ctx, const void *sector,
+			uint32_t length, uint32_t *chksum);
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t length);
+void select_checksums(void);
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
 
-/* sunxi-img.c */
-enum image_type identify_image(const void *buffer);
-int find_firmware_image(FILE *inf, enum image_type img, void *sector,
-			FILE *outf);
-int extract_image(FILE *inf, FILE *outf, const char *extract);
-void output_image_info(FILE *inf, FILE *outf, bool verbose, bool scan_all);
+/* sunxi-img.c, identify_image() is in libsunxi-fw.h */
+int find_firmware_image(struct sunxi_ctx *ctx, enum image_type img,
+			void *sector, FILE *outf);
+int extract_image(struct sunxi_ctx *ctx, FILE *outf, const char *extract);
+void output_image_info(struct sunxi_ctx *ctx, bool scan_all);
+bool want_component(const struct sunxi_ctx *ctx, enum image_type type);
+bool want_nested(const struct sunxi_ctx *ctx, enum image_type type);
+int skip_component(struct sunxi_ctx *ctx, enum image_type type,
+		   const void *sector, bool scan_all);
 
 /**
  * output_*_info(): output information about image type
+ * ctx: context, for reading further data from ctx->inf and dumping
+ *      information to ctx->out
  * sector: pointer to buffer containing the first sector (512 bytes)
- * inf: input stream, for reading further data
- * stream: output stream, for dumping information
- * verbose: whether to output more elaborate information
+ *
+ * Return: 0 if successful, negative error value otherwise. The input is
+ * left behind the part of the component that has been looked at.
  */
 
 /* sunxi-mbr.c */
-int output_mbr_info(void *sector, FILE *inf, FILE *stream, bool verbose);
+int output_mbr_info(struct sunxi_ctx *ctx, void *sector);
+void mbr_partitions(struct sunxi_ctx *ctx, const void *sector);
+int gpt_partitions(struct sunxi_ctx *ctx, const void *header);
+
+/* sunxi-pack.c */
+int pack_image(const char *manifest, const char *outfn, bool direct,
+	       bool verbose);
+
+/* sunxi-patch.c, @patch changes a header sector in memory */
+typedef int (*patch_fn)(void *sector, void *arg);
+int patch_in_place(const char *filename, patch_fn patch, void *arg);
+int patch_copy(struct sunxi_ctx *ctx, enum image_type type, patch_fn patch,
+	       void *arg, FILE *outf);
 
 /* sunxi-spl.c */
-int output_spl_info(void *sector, FILE *inf, FILE *stream, bool verbose);
-int spl_set_dtname(void *sector, FILE *inf, const char *dts, FILE *outf);
-int handle_dt_name(FILE *inf, const char *dt_name, FILE *outf);
+int output_spl_info(struct sunxi_ctx *ctx, void *sector);
+int spl_patch_dtname(void *sector, const char *dt_name);
+int spl_set_dtname(const char *filename, const char *dt_name);
+int spl_copy_dtname(struct sunxi_ctx *ctx, const char *dt_name, FILE *outf);
+int handle_dt_name(struct sunxi_ctx *ctx, const char *dt_name, FILE *outf);
+
+/* sunxi-board.c, the tables are generated from boards/boards.txt */
+#define SUNXI_BOOT_OFFSETS	3
+
+struct sunxi_soc {
+	const char *name;		/* "A64" */
+	const char *dram;		/* boot0 DRAM layout: "a31", or NULL */
+	int dram_layout;		/* enum dram_layout_id, -1 if unknown */
+	uint32_t boot_offsets[SUNXI_BOOT_OFFSETS];	/* in bytes, 0: none */
+};
+
+struct sunxi_board {
+	const char *dt_name;
+	const char *model;		/* NULL if only the SoC is known */
+	const struct sunxi_soc *soc;
+};
+const struct sunxi_board *board_lookup(const char *dt_name);
+void board_check_offset(struct sunxi_ctx *ctx, const struct sunxi_board *board,
+			uint64_t offset);
+void output_board_info(FILE *stream, const char *indent,
+		       const struct sunxi_board *board, bool verbose);
 
 /* sunxi-boot0.c */
-int output_boot0_info(void *sector, FILE *inf, FILE *stream, bool verbose);
+int output_boot0_info(struct sunxi_ctx *ctx, void *sector);
+
+enum dram_layout_id {
+	/* in order of preference, if more than one layout fits */
+	DRAM_A10,
+	DRAM_H6,			/* before A31, so .bits can rule it out */
+	DRAM_A31,
+	DRAM_H616,
+	NR_DRAM_LAYOUTS
+};
+
+/* DRAM parameters from a boot0 header, see boot0_dram_params() */
+struct boot0_dram {
+	const char *socs;		/* matching SoCs, NULL if unknown */
+	uint32_t clk;			/* MHz */
+	uint32_t type;			/* 3: DDR3, 7: LPDDR3, ... */
+	const uint32_t *params;
+	int nr_params;
+	int layout;			/* -1 if unknown */
+};
+int boot0_dram_params(const void *sector, const struct sunxi_board *board,
+		      struct boot0_dram *dram);
+const char *boot0_dram_field(const struct boot0_dram *dram, int i,
+			     uint32_t *value);
+int boot0_patch_dram(void *sector, const char **settings, int nr_settings,
+		     FILE *log);
+int boot0_set_dram(const char *filename, const char **settings,
+		   int nr_settings, FILE *log);
+int boot0_copy_dram(struct sunxi_ctx *ctx, const char **settings,
+		    int nr_settings, FILE *outf, FILE *log);
 
 /* sunxi-wty.c */
-int output_wty_info(void *sector, FILE *inf, FILE *stream, bool verbose);
-void extract_wty_image(void *sector, FILE *inf, FILE *outf, const char *imgname);
+struct wty_entry {
+	char name[256 + 1];
+	char maintype[8 + 1];
+	char subtype[16 + 1];
+	uint32_t offset;		/* relative to the start of the image */
+	uint32_t size;
+	uint32_t stored_size;		/* including padding */
+};
+
+/* the entry table of a PhoenixSuite image, with a name hash on top */
+struct wty_dir {
+	uint64_t start;			/* absolute offset of the image */
+	uint32_t size;
+	struct wty_entry *entries;
+	int nr_entries;
+	int *buckets;			/* entry indices, -1 if empty */
+	int nr_buckets;
+};
+
+int wty_dir_read(struct sunxi_ctx *ctx, const void *sector,
+		 struct wty_dir *dir);
+void wty_dir_free(struct wty_dir *dir);
+const struct wty_entry *wty_dir_find(const struct wty_dir *dir,
+				     const char *name);
+const struct wty_entry *wty_dir_boot0(const struct wty_dir *dir);
+int output_wty_info(struct sunxi_ctx *ctx, void *sector);
+void extract_wty_image(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       const char *imgname);
 
 /* sunxi-toc0.c */
-void output_toc0_info(void *sector, FILE *inf, FILE *stream, bool verbose);
+int output_toc0_info(struct sunxi_ctx *ctx, void *sector);
 
 /* sunxi-uboot.c */
-void output_uboot_info(void *sector, FILE *inf, FILE *stream, bool verbose);
-void dump_uboot_legacy(void *sector, FILE *inf, FILE *outf, bool payload);
+uint32_t uboot_header_crc(const void *sector);
+int uboot_data_crc(struct sunxi_ctx *ctx, const void *sector, uint32_t *crc);
+int output_uboot_info(struct sunxi_ctx *ctx, void *sector);
+void dump_uboot_legacy(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       bool payload);
+
+/* sunxi-layout.c, the context of an iterator, for internal users */
+struct sunxi_ctx *sunxi_iter_ctx(struct sunxi_iter *iter);
+
+/* sunxi-batch.c */
+int info_file(const char *filename, FILE *outf,
+	      const struct info_options *opts);
+int batch_image_info(const char **filenames, int nr_files, int nr_threads,
+		     FILE *outf, const struct info_options *opts);
+
+/* sunxi-emit.c */
+int parse_output_format(const char *name, enum output_format *format);
+int parse_type_list(const char *list, unsigned int *mask);
+int parse_field_list(const char *list, unsigned int *mask);
+int parse_size(const char *str, size_t *size);
+int output_image_records(FILE *inf, FILE *outf, const char *filename,
+			 const struct info_options *opts,
+			 struct sunxi_cache *cache);
+void output_stats_record(FILE *outf, const char *filename,
+			 enum output_format format, struct sunxi_ctx *ctx);
+void output_error_record(FILE *outf, const char *filename,
+			 enum output_format format, int error);
+
+/* sunxi-plan.c */
+#define PLAN_MAX_HASHES		4
+
+/*
+ * A checksum of the component, like the hash-1 node of a FIT image. Those
+ * over a header only, as the header CRC of a U-Boot image, come with the
+ * @computed value, the others are over all of the component's data.
+ */
+struct plan_hash {
+	const char *algo;		/* "crc32", "sha1", "sha256", ... */
+	const uint8_t *value;
+	const uint8_t *computed;	/* NULL if the data is to be hashed */
+	int length;
+};
+
+/*
+ * Only valid while being passed to plan_ops.open(). The hashes of a FIT
+ * image streamed from a pipe are only known once its data has passed by:
+ * they follow, in the @comp passed to plan_ops.close().
+ */
+struct plan_component {
+	const char *name;
+	uint64_t start, size;		/* in the input, in bytes */
+	struct plan_hash hashes[PLAN_MAX_HASHES];
+	int nr_hashes;
+	bool hashes_follow;
+};
+
+struct plan_ops {
+	/* Returns the output for @comp, or NULL if it cannot be opened. */
+	void *(*open)(void *arg, const struct plan_component *comp);
+	/* The data is handed over in order, and only valid for the call. */
+	void (*write)(void *arg, void *sink, const void *data, size_t len);
+	/* Only the name, start, size and any following hashes are set. */
+	void (*close)(void *arg, void *sink,
+		      const struct plan_component *comp);
+};
+
+int plan_components(struct sunxi_ctx *ctx, const char **patterns,
+		    int nr_patterns, const struct plan_ops *ops, void *arg);
+int extract_images(struct sunxi_ctx *ctx, const char **patterns,
+		   int nr_patterns, const char *outdir,
+		   enum sparse_format sparse);
+
+/* sunxi-verify.c */
+int verify_images(struct sunxi_ctx *ctx, const char **patterns,
+		  int nr_patterns);
+
+/* sunxi-fdt.c, a devicetree without the large property values */
+#define DT_INLINE_MAX	1024		/* longer values are not kept */
+
+struct dt_prop {
+	const char *name;		/* NULL until the strings are read */
+	uint32_t nameoff;
+	uint32_t length;
+	uint64_t offset;		/* absolute offset of the value */
+	void *value;			/* NUL terminated, or NULL if too long */
+};
+
+struct dt_node {
+	char *name;
+	int depth;
+	int parent, first_child, next_sibling;	/* -1 if there is none */
+	int first_prop, nr_props;
+};
+
+struct dt_tree {
+	uint64_t start;			/* absolute offset of the blob */
+	uint32_t size;			/* totalsize from the header */
+	struct dt_node *nodes;		/* the root node is nodes[0] */
+	int nr_nodes, max_nodes;	/* max_*: allocated entries */
+	struct dt_prop *props;
+	int nr_props, max_props;
+	char *strings;
+};
+
+typedef int (*dt_payload_fn)(struct sunxi_ctx *ctx, const struct dt_tree *tree,
+			     int node, const struct dt_prop *prop,
+			     const void *head, uint32_t head_len, void *arg);
+
+int dt_walk(struct sunxi_ctx *ctx, const void *sector, struct dt_tree *tree,
+	    dt_payload_fn payload, void *arg);
+void dt_free(struct dt_tree *tree);
+int dt_subnode(const struct dt_tree *tree, int parent, const char *name);
+const struct dt_prop *dt_getprop(const struct dt_tree *tree, int node,
+				 const char *name);
+const char *dt_getprop_string(const struct dt_tree *tree, int node,
+			      const char *name);
+bool dt_getprop_u32(const struct dt_tree *tree, int node, const char *name,
+		    uint32_t *value);
 
 /* sunxi-fit.c */
-void extract_fit_image(void *sector, FILE *inf, FILE *outf, const char *imgname);
-int dump_dt_info(void *sector, FILE *inf, FILE *outf, bool verbose);
-int dump_dt_names(FILE *inf, FILE *outf);
+void extract_fit_image(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       const char *imgname);
+int dump_dt_info(struct sunxi_ctx *ctx, void *sector);
+int dump_dt_names(struct sunxi_ctx *ctx, FILE *outf);
 
 #endif
@@ -16,20 +16,6 @@
 
 #include "sunxi-fw.h"
 
-#define EGON_MAGIC1	0x4e4f4765		// "eGON"
-#define EGON_MAGIC2	0x3054422e		// ".BT0"
-#define SPL_MAGIC	0x004c5053		// "SPL\0"
-#define IH_MAGIC	0x27051956
-#define FDT_MAGIC	0xd00dfeed
-#define TOC0_MAGIC1	0x30434f54		// "TOC0"
-#define TOC0_MAGIC2	0x484c472e		// ".GLH"
-#define RK_IDBL_RC4	0xfcdc8c3b		// RC4 encoded magic
-#define RK_SIG_RK32	0x32334b52		// "RK32"
-#define RK_SIG_RK33	0x33334b52		// "RK33"
-#define AML_MAGIC	0x4c4d4140		// "@AML"
-#define IMAGEWTY_MAGIC1	0x494d4147		// "IMAG"
-#define IMAGEWTY_MAGIC2	0x45575459		// "EWTY"
-
 static bool check_image_error(FILE *error, enum image_type type)
 {
 	switch (type) {
@@ -47,24 +33,140 @@ static bool check_image_error(FILE *error, enum image_type type)
 	}
 }
 
+/* Returns true if components of @type are to be decoded, see ctx->only. */
+bool want_component(const struct sunxi_ctx *ctx, enum image_type type)
+{
+	if (type == IMAGE_SPL1 || type == IMAGE_SPL2)
+		type = IMAGE_SPLx;
+
+	return !ctx->only || (ctx->only & (1U << type));
+}
+
+/*
+ * The component types a container can hold, apart from its own: the
+ * decoder of a PhoenixSuite image reports its boot0.
+ */
+static const unsigned int nested_types[] = {
+	[IMAGE_PHOENIX] = 1U << IMAGE_BOOT0,
+};
+
+/*
+ * Returns true if a container of @type can hold components that ctx->only
+ * asks for. It is decoded then, even if not asked for itself, and it leaves
+ * out its own lines or records.
+ */
+bool want_nested(const struct sunxi_ctx *ctx, enum image_type type)
+{
+	if ((unsigned int)type >= sizeof(nested_types) / sizeof(nested_types[0]))
+		return false;
+
+	return ctx->only & nested_types[type];
+}
+
+/* move forward to @end, if we are not there already */
+static int skip_to(struct sunxi_ctx *ctx, uint64_t end)
+{
+	if (ctx->pos >= end)
+		return 0;
+
+	return pseek(ctx, end - ctx->pos);
+}
+
+/*
+ * skip_component() - move over a component without decoding it
+ * @ctx: context, positioned right behind @sector
+ * @type: the component type, as returned by identify_image()
+ * @sector: first sector of the component
+ * @scan_all: whether the whole input will be scanned
+ *
+ * Only the header is looked at, to find the end of the component. That's
+ * where the input is left, like the decoders do. Partition tables are still
+ * recorded, so the scan goes on to skip over the partitions.
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int skip_component(struct sunxi_ctx *ctx, enum image_type type,
+		   const void *sector, bool scan_all)
+{
+	const uint32_t *header = sector;
+	uint64_t start = ctx->pos - 512;
+	uint32_t length;
+	int ret;
+
+	switch (type) {
+	case IMAGE_BOOT0:
+		if (header[4] < 512 || header[4] > EGON_MAX_SIZE)
+			return -EINVAL;
+		return skip_to(ctx, start + header[4]);
+	case IMAGE_SPL1:
+	case IMAGE_SPL2:
+	case IMAGE_SPLx:
+	case IMAGE_TOC0:
+		length = type == IMAGE_TOC0 ? header[7] : header[4];
+		if (length < 512 || length > EGON_MAX_SIZE)
+			return -EINVAL;
+		/* padded to 32KB, see output_spl_info() */
+		return skip_to(ctx, start + (length < 32768 ? 32768 : length));
+	case IMAGE_UBOOT:
+		length = ntohl(header[3]) + 64;	/* ih_size, plus the header */
+		return skip_to(ctx, (start + length + 511) & ~511ULL);
+	case IMAGE_FIT:
+		length = ntohl(header[1]);	/* totalsize */
+		if (length > FDT_MAX_SIZE)
+			return -EINVAL;
+		return skip_to(ctx, (start + length + 511) & ~511ULL);
+	case IMAGE_MBR:
+		mbr_partitions(ctx, sector);
+		return 0;
+	case IMAGE_GPT:
+		ret = gpt_partitions(ctx, sector);
+		if (ret || scan_all)
+			return ret;
+		return skip_to(ctx, 17408);
+	case IMAGE_PHOENIX:
+		return skip_to(ctx, start + header[6]);
+	default:
+		return 0;
+	}
+}
+
 /* iterates through an image files to find and report about components */
-void output_image_info(FILE *inf, FILE *outf, bool verbose, bool scan_all)
+void output_image_info(struct sunxi_ctx *ctx, bool scan_all)
 {
-	char sector[512];
+	FILE *outf = ctx->out;
+	char buffer[512];
+	void *sector;
 	enum image_type type;
-	size_t ret;
-	int ofs = 0;
+	int ofs;
 
 	do {
-		ret = fread(sector, 512, 1, inf);
-		if (ret == 0 && feof(inf))
+		/* skips sectors without any known magic, in place if mapped */
+		sector = scan_sectors(ctx, buffer);
+		if (!sector)
 			break;
 
+		/* the decoders keep ctx->pos up to date, so this is exact */
+		ofs = (ctx->pos - 512) / 512;
+
 		type = identify_image(sector);
+		stats_phase(ctx, type);
+		cache_component(ctx, type, sector);
+
+		/* not asked for, but U-Boot still ends the scan */
+		if (!want_component(ctx, type) && !want_nested(ctx, type)) {
+			if (skip_component(ctx, type, sector, scan_all))
+				return;
+			if (!scan_all && (type == IMAGE_UBOOT ||
+					  type == IMAGE_FIT ||
+					  type == IMAGE_PHOENIX))
+				return;
+			continue;
+		}
+
 		switch (type) {
 		case IMAGE_BOOT0:
 			fprintf(outf, "@%4d: boot0: Allwinner boot0\n", ofs);
-			ofs += output_boot0_info(sector, inf, outf, verbose);
+			output_boot0_info(ctx, sector);
 			break;
 		case IMAGE_SPL1:
 		case IMAGE_SPL2:
@@ -72,11 +174,11 @@ void output_image_info(FILE *inf, FILE *outf, bool verbose, bool scan_all)
 			fprintf(outf, "@%4d: spl: U-Boot SPLv%c\n", ofs,
 				type == IMAGE_SPL1 ? '1' :
 				(type == IMAGE_SPL2 ? '2' : 'x'));
-			ofs += output_spl_info(sector, inf, outf, verbose);
+			output_spl_info(ctx, sector);
 			break;
 		case IMAGE_TOC0:
 			fprintf(outf, "@%4d: toc0: signed boot image\n", ofs);
-			output_toc0_info(sector, inf, outf, verbose);
+			output_toc0_info(ctx, sector);
 			break;
 		case IMAGE_ROCKCHIP:
 			fprintf(outf, "@%4d: spl: Rockchip SPL image\n", ofs);
@@ -87,41 +189,43 @@ void output_image_info(FILE *inf, FILE *outf, bool verbose, bool scan_all)
 		case IMAGE_UBOOT:
 			fprintf(outf, "@%4d: u-boot.img: U-Boot legacy image\n",
 				ofs);
-			output_uboot_info(sector, inf, outf, verbose);
+			output_uboot_info(ctx, sector);
 			if (!scan_all)
 				return;
 			break;
 		case IMAGE_FIT:
 			fprintf(outf, "@%4d: fit: U-Boot FIT image\n", ofs);
-			ofs += dump_dt_info(sector, inf, outf, verbose);
+			dump_dt_info(ctx, sector);
 			if (!scan_all)
 				return;
 			break;
 		case IMAGE_MBR:
 			fprintf(outf, "@%4d: mbr: DOS MBR\n", ofs);
-			ofs += output_mbr_info(sector, inf, outf, verbose);
+			output_mbr_info(ctx, sector);
 			break;
 		case IMAGE_GPT:
 			fprintf(outf, "@%4d: gpt: UEFI GPT\n", ofs);
 			if (!scan_all)
-				pseek(inf, 17408 - 1024);
+				pseek(ctx, 17408 - 1024);
 			break;
 		case IMAGE_PHOENIX:
-			fprintf(outf, "@%4d: wty: PhoenixSuite image file\n",
-				ofs);
-			ofs += output_wty_info(sector, inf, outf, verbose);
+			if (want_component(ctx, type))
+				fprintf(outf,
+					"@%4d: wty: PhoenixSuite image file\n",
+					ofs);
+			output_wty_info(ctx, sector);
 			if (!scan_all)
 				return;
 			break;
 		case IMAGE_UNKNOWN:
 			break;
 		default:
-			fprintf(stderr, "unknown\n");
-			if (check_image_error(stderr, type))
+			/* in the report, next to the offset it is about */
+			fprintf(outf, "\tERROR: unknown\n");
+			if (check_image_error(outf, type))
 				return;
 			break;
 		}
-		ofs++;
 	} while (1);
 }
 
@@ -177,20 +281,19 @@ enum image_type identify_image(const void *buffer)
 }
 
 /* scans a file to find a specific firmware component type */
-int find_firmware_image(FILE *inf, enum image_type img, void *sector,
-			FILE *outf)
+int find_firmware_image(struct sunxi_ctx *ctx, enum image_type img,
+			void *sector, FILE *outf)
 {
 	enum image_type type;
 	size_t ret, size;
 
 	do {
-		ret = fread(sector, 512, 1, inf);
-		if (ret < 0)
-			return ret;
-		if (feof(inf))
+		ret = input_fread(ctx, sector, 512);
+		if (ret < 512)
 			return -ENOENT;
 
 		type = identify_image(sector);
+		stats_phase(ctx, type);
 		if (type == img)
 			return 0;
 		if (img == IMAGE_SPLx &&
@@ -202,20 +305,25 @@ int find_firmware_image(FILE *inf, enum image_type img, void *sector,
 		case IMAGE_MBR:
 			if (outf) {
 				fwrite(sector, 512, 1, outf);
-				copy_file(inf, outf, 8192 - 512);
+				copy_file(ctx, outf, 8192 - 512);
 			} else
-				pseek(inf, 8192 - 512);
+				pseek(ctx, 8192 - 512);
 			break;
 		case IMAGE_BOOT0:
 		case IMAGE_SPL1:
 		case IMAGE_SPL2:
 		case IMAGE_SPLx:
 			size = ((uint32_t *)sector)[4];
+			if (size < 512 || size > EGON_MAX_SIZE) {
+				fprintf(stderr, "ERROR: invalid eGON image size: "
+					"%zu bytes\n", size);
+				return -EINVAL;
+			}
 			if (outf) {
 				fwrite(sector, 512, 1, outf);
-				copy_file(inf, outf, size - 512);
+				copy_file(ctx, outf, size - 512);
 			} else
-				pseek(inf, size - 512);
+				pseek(ctx, size - 512);
 			break;
 		case IMAGE_UBOOT:
 		case IMAGE_FIT:
@@ -228,11 +336,12 @@ int find_firmware_image(FILE *inf, enum image_type img, void *sector,
 }
 
 /* find an image type identified by a string and writes it to @outf */
-int extract_image(FILE *inf, FILE *outf, const char *extract)
+int extract_image(struct sunxi_ctx *ctx, FILE *outf, const char *extract)
 {
 	char sector[512];
 	enum image_type type = IMAGE_UNKNOWN;
-	int ret, size;
+	uint32_t size;
+	int ret;
 
 	if (!strcmp(extract, "mbr"))
 		type = IMAGE_MBR;
@@ -247,7 +356,7 @@ int extract_image(FILE *inf, FILE *outf, const char *extract)
 	if (!strncmp(extract, "wty", 3))
 		type = IMAGE_PHOENIX;
 
-	ret = find_firmware_image(inf, type, sector, NULL);
+	ret = find_firmware_image(ctx, type, sector, NULL);
 	if (ret)
 		return ret;
 
@@ -260,20 +369,25 @@ int extract_image(FILE *inf, FILE *outf, const char *extract)
 	case IMAGE_SPL2:
 	case IMAGE_SPLx:
 		size = ((uint32_t *)sector)[4];
+		if (size < 512 || size > EGON_MAX_SIZE) {
+			fprintf(stderr, "ERROR: invalid eGON image size: "
+				"%u bytes\n", size);
+			return -EINVAL;
+		}
 		fwrite(sector, 1, 512, outf);
-		copy_file(inf, outf, size - 512);
+		copy_file(ctx, outf, size - 512);
 		return 0;
 	case IMAGE_UBOOT:
 		if (!strcmp(extract, "u-boot.img"))
-			dump_uboot_legacy(sector, inf, outf, 0);
+			dump_uboot_legacy(ctx, sector, outf, 0);
 		else if (!strcmp(extract, "u-boot"))
-			dump_uboot_legacy(sector, inf, outf, 1);
+			dump_uboot_legacy(ctx, sector, outf, 1);
 		return 0;
 	case IMAGE_FIT:
-		extract_fit_image(sector, inf, outf, extract);
+		extract_fit_image(ctx, sector, outf, extract);
 		return 0;
 	case IMAGE_PHOENIX:
-		extract_wty_image(sector, inf, outf, extract);
+		extract_wty_image(ctx, sector, outf, extract);
 		return 0;
 	default:
 		if (check_image_error(stderr, type))
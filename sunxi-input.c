@@ -0,0 +1,466 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-input: input backend, reading from a memory mapping for regular
+ *              files and block devices, and from a FILE* stream for pipes
+ */
+
+#define _GNU_SOURCE			/* for copy_file_range() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>			/* for BLKGETSIZE64 */
+
+#include "sunxi-fw.h"
+
+/*
+ * sunxi_ctx_init() - set up a context for reading from @inf
+ * @ctx: context to initialise
+ * @inf: input file, will be memory mapped if possible
+ * @out: output stream for the information dump
+ * @verbose: whether to output more elaborate information
+ */
+void sunxi_ctx_init(struct sunxi_ctx *ctx, FILE *inf, FILE *out, bool verbose)
+{
+	off_t pos;
+
+	/* no need to clear the scratch buffer */
+	memset(ctx, 0, offsetof(struct sunxi_ctx, scratch));
+	ctx->inf = inf;
+	ctx->out = out;
+	ctx->verbose = verbose;
+
+	pos = ftello(inf);
+	if (pos > 0)
+		ctx->pos = pos;
+
+	input_map(ctx);
+}
+
+void sunxi_ctx_release(struct sunxi_ctx *ctx)
+{
+	if (ctx->map_base)
+		munmap(ctx->map_base, ctx->map_size);
+	ctx->map_base = NULL;
+
+	free(ctx->bounce);
+	ctx->bounce = NULL;
+
+	free(ctx->parts);
+	ctx->parts = NULL;
+	ctx->nr_parts = 0;
+}
+
+/*
+ * input_map() - map the input file into memory
+ * @ctx: context with the file to map
+ *
+ * If the input refers to a regular file or a block device, map its whole
+ * content and let the input_*() helpers, pseek() and copy_file() serve
+ * data from the mapping, starting at the current file position. The FILE
+ * position is not updated anymore from then on.
+ * Pipes and other non-mappable files are left alone, and keep using stdio.
+ *
+ * Return: 0 if the file was mapped, negative error value otherwise
+ */
+int input_map(struct sunxi_ctx *ctx)
+{
+	struct stat st;
+	uint64_t size;
+	void *base;
+	int fd = fileno(ctx->inf);
+
+	if (fd < 0 || fstat(fd, &st))
+		return -errno;
+
+	if (S_ISREG(st.st_mode)) {
+		size = st.st_size;
+	} else if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size))
+			return -errno;
+	} else {
+		return -ENODEV;
+	}
+
+	if (size == 0 || size > SIZE_MAX || ctx->pos > size)
+		return -EINVAL;
+
+	/* private and writable, so parsers can treat it like their own buffer */
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+	madvise(base, size, MADV_SEQUENTIAL);
+
+	ctx->map_base = base;
+	ctx->map_size = size;
+
+	return 0;
+}
+
+/*
+ * input_window() - get a pointer into the mapping, without consuming data
+ * @ctx: context with the input file
+ * @offset: start of window, relative to the current position (can be < 0)
+ * @length: number of bytes that must be accessible
+ *
+ * Return: pointer to the data, or NULL if the input is not mapped or the
+ *         window is outside of the file
+ */
+void *input_window(struct sunxi_ctx *ctx, long offset, size_t length)
+{
+	if (!ctx->map_base)
+		return NULL;
+	if (offset < 0 && (uint64_t)-offset > ctx->pos)
+		return NULL;
+	if (ctx->pos + offset > ctx->map_size ||
+	    ctx->map_size - (ctx->pos + offset) < length)
+		return NULL;
+
+	return ctx->map_base + ctx->pos + offset;
+}
+
+/* hand data that was just consumed to ctx->tap */
+static void input_tap(struct sunxi_ctx *ctx, const void *data, size_t length)
+{
+	if (ctx->tap && length)
+		ctx->tap(ctx->tap_arg, data, ctx->pos - length, length);
+}
+
+/* Like fread(), but honours a mapping. Returns the number of bytes read. */
+size_t input_fread(struct sunxi_ctx *ctx, void *buffer, size_t length)
+{
+	if (!ctx->map_base) {
+		length = fread(buffer, 1, length, ctx->inf);
+		ctx->pos += length;
+		STATS_ADD(ctx, bytes_read, length);
+		STATS_ADD(ctx, calls, 1);
+		input_tap(ctx, buffer, length);
+		return length;
+	}
+
+	if (ctx->pos >= ctx->map_size)
+		return 0;
+	if (length > ctx->map_size - ctx->pos)
+		length = ctx->map_size - ctx->pos;
+
+	memcpy(buffer, ctx->map_base + ctx->pos, length);
+	ctx->pos += length;
+	STATS_ADD(ctx, bytes_read, length);
+	input_tap(ctx, buffer, length);
+
+	return length;
+}
+
+/*
+ * input_read() - consume data from the input, avoiding copies if possible
+ * @ctx: context with the input file
+ * @buffer: buffer of at least @length bytes, used for unmapped files
+ * @length: number of bytes to read
+ *
+ * Return: pointer to the data (either into the mapping or @buffer), or
+ *         NULL if less than @length bytes could be read
+ */
+void *input_read(struct sunxi_ctx *ctx, void *buffer, size_t length)
+{
+	void *data;
+
+	if (ctx->map_base) {
+		data = input_window(ctx, 0, length);
+		if (data) {
+			ctx->pos += length;
+			STATS_ADD(ctx, bytes_read, length);
+			input_tap(ctx, data, length);
+		}
+		return data;
+	}
+
+	if (input_fread(ctx, buffer, length) < length)
+		return NULL;
+
+	return buffer;
+}
+
+/* Returns true if @ptr points into the mapping of the input. */
+bool input_owns(struct sunxi_ctx *ctx, const void *ptr)
+{
+	if (!ctx->map_base)
+		return false;
+
+	return ptr >= ctx->map_base && ptr < ctx->map_base + ctx->map_size;
+}
+
+/*
+ * pseek() - forward-only seek, that works on pipes as well
+ * @ctx: context with the file to seek in
+ * @offset: number of bytes to skip
+ *
+ * pseek() works like fseek(), with @whence fixed to SEEK_CUR. But it also
+ * support pipes (or other non-seekable file descriptors), by dummy-reading
+ * the respective number of bytes if fseek() does not work.
+ * For inputs mapped with input_map(), this just moves the read position.
+ * With a ctx->tap, unmapped inputs are always read, so that sees the data.
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int pseek(struct sunxi_ctx *ctx, long offset)
+{
+	uint64_t pos = ctx->pos;
+	int chunk, ret;
+
+	if (ctx->map_base) {
+		ctx->pos += offset;
+		STATS_ADD(ctx, skipped_seek, offset);
+		if (ctx->tap && offset > 0 && pos < ctx->map_size)
+			ctx->tap(ctx->tap_arg, ctx->map_base + pos, pos,
+				 offset < ctx->map_size - pos ?
+				 offset : ctx->map_size - pos);
+		return 0;
+	}
+
+	if (!ctx->tap) {
+		ret = fseek(ctx->inf, offset, SEEK_CUR);
+		STATS_ADD(ctx, calls, 1);
+		if (!ret) {
+			ctx->pos += offset;
+			STATS_ADD(ctx, skipped_seek, offset);
+			return ret;
+		}
+
+		if (ret < 0 && errno != ESPIPE)
+			return -errno;
+	}
+
+	while (offset) {
+		chunk = (offset > SCRATCH_SIZE ? SCRATCH_SIZE : offset);
+		ret = fread(ctx->scratch, 1, chunk, ctx->inf);
+		ctx->pos += ret;
+		STATS_ADD(ctx, skipped_read, ret);
+		STATS_ADD(ctx, calls, 1);
+		input_tap(ctx, ctx->scratch, ret);
+		if (ret < chunk)
+			return -errno;
+
+		offset -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * copy_kernel(): let the kernel copy data between two file descriptors
+ * @ctx: context, for the statistics only
+ * @infd: input file descriptor, must be seekable
+ * @offset: absolute offset in @infd to start copying from
+ * @outf: output file pointer, will be flushed
+ * @length: length to copy, or -1 for "till EOF"
+ *
+ * Uses copy_file_range() if both sides are files, and sendfile() otherwise,
+ * for instance when writing into a pipe. The data never passes through
+ * userland. The FILE position of @outf is synchronised afterwards.
+ *
+ * Return: number of bytes copied, 0 if the kernel refused to copy anything
+ */
+#define KERNEL_CHUNK	(1 << 30)
+static off_t copy_kernel(struct sunxi_ctx *ctx, int infd, off_t offset,
+			 FILE *outf, off_t length)
+{
+	int outfd = fileno(outf);
+	bool use_cfr = true;
+	off_t counter = 0, pos;
+	ssize_t ret;
+
+	if (outfd < 0 || fflush(outf))
+		return 0;
+
+	while (length > 0 || length == -1) {
+		size_t chunk;
+
+		if (length == -1 || length > KERNEL_CHUNK)
+			chunk = KERNEL_CHUNK;
+		else
+			chunk = length;
+
+		if (use_cfr) {
+			ret = copy_file_range(infd, &offset, outfd, NULL,
+					      chunk, 0);
+			if (ret < 0 && !counter) {
+				/* cross-fs, pipes or old kernels */
+				use_cfr = false;
+				continue;
+			}
+		} else {
+			ret = sendfile(outfd, infd, &offset, chunk);
+		}
+		STATS_ADD(ctx, calls, 1);
+		if (ret <= 0)
+			break;
+
+		if (length > 0)
+			length -= ret;
+		counter += ret;
+	}
+
+	/* stdio caches the file offset, tell it what we did behind its back */
+	pos = lseek(outfd, 0, SEEK_CUR);
+	if (pos >= 0)
+		fseeko(outf, pos, SEEK_SET);
+
+	return counter;
+}
+
+/* Allocated once, and kept for the lifetime of the context. */
+#define BLOCKSIZE	(1024 * 1024)
+static void *input_bounce(struct sunxi_ctx *ctx)
+{
+	if (!ctx->bounce) {
+		if (posix_memalign(&ctx->bounce, 4096, BLOCKSIZE))
+			ctx->bounce = NULL;
+		else
+			stats_alloc(ctx, BLOCKSIZE);
+	}
+
+	return ctx->bounce;
+}
+
+/*
+ * copy_file(): copy content of the input to another FILE
+ * @ctx: context with the input file
+ * @outf: output file pointer
+ * @length: length to copy, or -1 for "the rest of the input"
+ *
+ * Copies the content of the input from the current position to @outf.
+ * Copies @length bytes, unless @length is -1, in this case copies till EOF.
+ * If the input is a regular file or block device, the copy is done in the
+ * kernel (see copy_kernel()). Mapped inputs are written straight from the
+ * mapping otherwise, and only pipes go through the bounce buffer.
+ *
+ * Return: number of bytes copied, could be 0.
+ */
+off_t copy_file(struct sunxi_ctx *ctx, FILE *outf, off_t length)
+{
+	FILE *inf = ctx->inf;
+	off_t counter = 0, pos;
+	size_t ret;
+
+	if (ctx->map_base) {
+		if (ctx->pos >= ctx->map_size)
+			return 0;
+		if (length == -1 || length > ctx->map_size - ctx->pos)
+			length = ctx->map_size - ctx->pos;
+
+		counter = copy_kernel(ctx, fileno(inf), ctx->pos, outf, length);
+		if (counter < length) {
+			counter += fwrite(ctx->map_base + ctx->pos + counter, 1,
+					  length - counter, outf);
+			STATS_ADD(ctx, calls, 1);
+		}
+		ctx->pos += counter;
+		STATS_ADD(ctx, bytes_copied, counter);
+
+		return counter;
+	}
+
+	pos = ftello(inf);
+	if (pos >= 0) {
+		/* The kernel copy bypasses stdio, so reposition @inf. */
+		counter = copy_kernel(ctx, fileno(inf), pos, outf, length);
+		if (counter)
+			fseeko(inf, pos + counter, SEEK_SET);
+		ctx->pos += counter;
+		STATS_ADD(ctx, bytes_copied, counter);
+		if (length > 0)
+			length -= counter;
+		else if (length == -1 && counter)
+			return counter;
+	}
+
+	if (!input_bounce(ctx))
+		return counter;
+
+	while (length > 0 || length == -1) {
+		size_t toread;
+
+		if (length == -1)
+			toread = BLOCKSIZE;
+		else
+			toread = length > BLOCKSIZE ? BLOCKSIZE : length;
+
+		ret = fread(ctx->bounce, 1, toread, inf);
+		STATS_ADD(ctx, calls, 1);
+		if (ret <= 0)
+			break;
+		ctx->pos += ret;
+		ret = fwrite(ctx->bounce, 1, ret, outf);
+		STATS_ADD(ctx, calls, 1);
+		STATS_ADD(ctx, bytes_copied, ret);
+		if (ret <= 0)
+			break;
+
+		if (length > 0)
+			length -= ret;
+		counter += ret;
+	}
+
+	return counter;
+}
+
+/*
+ * copy_file_crc(): copy_file(), adding the data to a CRC32 on the way
+ * @ctx: context with the input file
+ * @outf: output file pointer
+ * @length: length to copy
+ * @crc: CRC so far, updated with the data copied, see crc32_ieee()
+ *
+ * Mapped inputs are checksummed from the mapping, and then copied by the
+ * kernel from the same pages in the page cache. Everything else goes
+ * through the bounce buffer. Either way, the data is only read once.
+ *
+ * Return: number of bytes copied, could be 0.
+ */
+off_t copy_file_crc(struct sunxi_ctx *ctx, FILE *outf, off_t length,
+		    uint32_t *crc)
+{
+	off_t counter = 0;
+	size_t ret, toread;
+
+	if (ctx->map_base) {
+		if (ctx->pos >= ctx->map_size)
+			return 0;
+		if (length > ctx->map_size - ctx->pos)
+			length = ctx->map_size - ctx->pos;
+
+		*crc = crc32_ieee(*crc, ctx->map_base + ctx->pos, length);
+
+		return copy_file(ctx, outf, length);
+	}
+
+	if (!input_bounce(ctx))
+		return 0;
+
+	while (length > 0) {
+		toread = length > BLOCKSIZE ? BLOCKSIZE : length;
+
+		ret = input_fread(ctx, ctx->bounce, toread);
+		if (!ret)
+			break;
+		*crc = crc32_ieee(*crc, ctx->bounce, ret);
+		ret = fwrite(ctx->bounce, 1, ret, outf);
+		STATS_ADD(ctx, calls, 1);
+		STATS_ADD(ctx, bytes_copied, ret);
+		if (!ret)
+			break;
+
+		length -= ret;
+		counter += ret;
+	}
+
+	return counter;
+}
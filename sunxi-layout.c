@@ -0,0 +1,418 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-layout: iterator over the firmware components of an image, for
+ *               users of libsunxi-fw that want records instead of text
+ *
+ * The image is walked the same way output_image_info() does it, but each
+ * component is turned into a struct sunxi_component. Containers (FIT and
+ * WTY images) queue up their images, which are handed out one by one.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>			/* for ntohl() */
+
+#include "sunxi-fw.h"
+#include "uboot_legacy.h"
+
+struct sunxi_iter {
+	struct sunxi_ctx ctx;
+	unsigned int flags;
+	bool done;
+	struct sunxi_component *queue;
+	int nr_queued, next_queued;
+	char sector[512];
+};
+
+static struct sunxi_component *
+iter_queue(struct sunxi_iter *iter, enum image_type type, const char *name,
+	   uint64_t offset, uint64_t size, int depth)
+{
+	struct sunxi_component *comp;
+
+	comp = realloc(iter->queue, (iter->nr_queued + 1) * sizeof(*comp));
+	if (!comp)
+		return NULL;
+	iter->queue = comp;
+	comp += iter->nr_queued++;
+	stats_alloc(&iter->ctx, sizeof(*comp));
+
+	memset(comp, 0, sizeof(*comp));
+	comp->type = type;
+	comp->offset = offset;
+	comp->size = size;
+	comp->depth = depth;
+	snprintf(comp->name, sizeof(comp->name), "%s", name);
+
+	return comp;
+}
+
+/* move forward to @end, if we are not there already */
+static int iter_skip_to(struct sunxi_iter *iter, uint64_t end)
+{
+	if (iter->ctx.pos >= end)
+		return 0;
+
+	return pseek(&iter->ctx, end - iter->ctx.pos);
+}
+
+static int iter_checksum(struct sunxi_iter *iter, struct sunxi_component *comp,
+			 const uint32_t *sector, uint32_t length)
+{
+	uint32_t chksum;
+	int ret;
+
+	if (!(iter->flags & SUNXI_ITER_CHECKSUM) || !comp)
+		return 0;
+	if (length < 512 || length % 4)
+		return 0;
+
+	ret = egon_checksum_input(&iter->ctx, sector, length, &chksum);
+	if (ret)
+		return ret;
+
+	comp->checksum_value = chksum;
+	comp->checksum = chksum == sector[3] ? SUNXI_CHECKSUM_OK :
+					       SUNXI_CHECKSUM_BAD;
+
+	return 0;
+}
+
+/* boot0, SPL and TOC0: all have the image size and the checksum at the start */
+static int iter_egon(struct sunxi_iter *iter, enum image_type type,
+		     const uint32_t *sector, uint64_t start)
+{
+	struct sunxi_component *comp;
+	const char *name;
+	uint32_t length;
+	int ret;
+
+	if (type == IMAGE_TOC0) {
+		name = "toc0";
+		length = sector[7];
+	} else {
+		name = type == IMAGE_BOOT0 ? "boot0" : "spl";
+		length = sector[4];
+	}
+	if (length < 512 || length > EGON_MAX_SIZE)
+		return -EINVAL;
+
+	comp = iter_queue(iter, type, name, start, length, 0);
+	/* SPLv2 headers can point to the DT name, within the first sector */
+	if (comp && type != IMAGE_BOOT0 && type != IMAGE_TOC0 &&
+	    (sector[5] >> 24) >= 2 && sector[8] && sector[8] < 512)
+		snprintf(comp->description, sizeof(comp->description), "%.*s",
+			 512 - sector[8], (const char *)sector + sector[8]);
+	ret = iter_checksum(iter, comp, sector, length);
+	if (ret)
+		return ret;
+
+	/* SPL and TOC0 images are padded to 32KB, on an SD card at least */
+	if (type != IMAGE_BOOT0 && length < 32768)
+		length = 32768;
+
+	return iter_skip_to(iter, start + length);
+}
+
+static int iter_gpt(struct sunxi_iter *iter, const uint32_t *sector,
+		    uint64_t start)
+{
+	uint64_t sectors = ((uint64_t)sector[20] * sector[21] + 511) / 512;
+	int ret;
+
+	if (sectors * 512 > GPT_MAX_ENTRIES)
+		return -EINVAL;
+
+	iter_queue(iter, IMAGE_GPT, "gpt", start, (1 + sectors) * 512, 0);
+
+	ret = gpt_partitions(&iter->ctx, sector);
+	if (ret)
+		return ret;
+
+	if (iter->flags & SUNXI_ITER_SCAN_ALL)
+		return iter_skip_to(iter, start + (1 + sectors) * 512);
+
+	/* the first usable LBA on a standard GPT disk */
+	return iter_skip_to(iter, 17408);
+}
+
+static int iter_uboot(struct sunxi_iter *iter, void *sector, uint64_t start)
+{
+	struct legacy_image_header *header = sector;
+	uint32_t size = ntohl(header->ih_size), crc;
+	struct sunxi_component *comp;
+	int ret;
+
+	/* the header CRC goes with the image, the data CRC with the payload */
+	comp = iter_queue(iter, IMAGE_UBOOT, "u-boot.img", start,
+			  sizeof(*header) + size, 0);
+	if (comp) {
+		snprintf(comp->description, sizeof(comp->description),
+			 "%.32s", (const char *)header->ih_name);
+		if (iter->flags & SUNXI_ITER_CHECKSUM) {
+			crc = uboot_header_crc(sector);
+			comp->checksum_value = crc;
+			comp->checksum = crc == ntohl(header->ih_hcrc) ?
+				SUNXI_CHECKSUM_OK : SUNXI_CHECKSUM_BAD;
+		}
+	}
+	comp = iter_queue(iter, IMAGE_UBOOT, "u-boot", start + sizeof(*header),
+			  size, 1);
+	if (comp && (iter->flags & SUNXI_ITER_CHECKSUM)) {
+		ret = uboot_data_crc(&iter->ctx, sector, &crc);
+		if (ret)
+			return ret;
+		comp->checksum_value = crc;
+		comp->checksum = crc == ntohl(header->ih_dcrc) ?
+			SUNXI_CHECKSUM_OK : SUNXI_CHECKSUM_BAD;
+	}
+
+	return iter_skip_to(iter, (start + sizeof(*header) + size + 511) & ~511);
+}
+
+static int iter_fit(struct sunxi_iter *iter, void *sector, uint64_t start)
+{
+	struct sunxi_component *comp;
+	char name[SUNXI_NAME_LEN];
+	const struct dt_prop *prop;
+	uint32_t offset, imgsize;
+	struct dt_tree tree;
+	const char *desc;
+	int node, ret;
+
+	ret = dt_walk(&iter->ctx, sector, &tree, NULL, NULL);
+	if (ret) {
+		dt_free(&tree);
+		return ret;
+	}
+
+	iter_queue(iter, IMAGE_FIT, "fit", start, tree.size, 0);
+
+	node = dt_subnode(&tree, 0, "images");
+	for (node = node < 0 ? -1 : tree.nodes[node].first_child; node >= 0;
+	     node = tree.nodes[node].next_sibling) {
+		uint64_t imgofs;
+
+		prop = dt_getprop(&tree, node, "data");
+		if (prop) {
+			imgofs = prop->offset;
+			imgsize = prop->length;
+		} else {
+			/* external data, relative to the end of the FIT */
+			if (!dt_getprop_u32(&tree, node, "data-offset", &offset) ||
+			    !dt_getprop_u32(&tree, node, "data-size", &imgsize))
+				continue;
+			imgofs = start + tree.size + offset;
+		}
+
+		snprintf(name, sizeof(name), "fit:%s", tree.nodes[node].name);
+		comp = iter_queue(iter, IMAGE_FIT, name, imgofs, imgsize, 1);
+
+		desc = dt_getprop_string(&tree, node, "description");
+		if (comp && desc)
+			snprintf(comp->description, sizeof(comp->description),
+				 "%s", desc);
+	}
+
+	ret = iter_skip_to(iter, (start + tree.size + 511) & ~511);
+	dt_free(&tree);
+
+	return ret;
+}
+
+/*
+ * The boot0 in the image is only decoded when asked for with --only, as in
+ * output_wty_info(). The image and its entries are left out then, unless
+ * they are asked for as well.
+ */
+static int iter_wty(struct sunxi_iter *iter, const uint32_t *wty,
+		    uint64_t start)
+{
+	bool own = want_component(&iter->ctx, IMAGE_PHOENIX);
+	const struct wty_entry *boot0 = NULL;
+	char name[SUNXI_NAME_LEN];
+	uint32_t boot0_buf[512 / 4];
+	struct wty_dir dir;
+	void *sector;
+	uint64_t pos;
+	int i, ret;
+
+	if (own)
+		iter_queue(iter, IMAGE_PHOENIX, "wty", start, wty[6], 0);
+
+	ret = wty_dir_read(&iter->ctx, wty, &dir);
+	if (ret) {
+		wty_dir_free(&dir);
+		return ret;
+	}
+
+	for (i = 0; own && i < dir.nr_entries; i++) {
+		snprintf(name, sizeof(name), "wty:%s", dir.entries[i].name);
+		iter_queue(iter, IMAGE_PHOENIX, name,
+			   start + dir.entries[i].offset,
+			   dir.entries[i].size, 1);
+	}
+
+	if (want_nested(&iter->ctx, IMAGE_PHOENIX))
+		boot0 = wty_dir_boot0(&dir);
+	pos = boot0 ? start + boot0->offset : 0;
+	wty_dir_free(&dir);
+
+	if (boot0 && pos >= iter->ctx.pos) {
+		ret = iter_skip_to(iter, pos);
+		sector = ret ? NULL : input_read(&iter->ctx, boot0_buf, 512);
+		if (sector && identify_image(sector) == IMAGE_BOOT0)
+			ret = iter_egon(iter, IMAGE_BOOT0, sector, pos);
+		if (ret)
+			return ret;
+	}
+
+	return iter_skip_to(iter, start + wty[6]);
+}
+
+/* read sectors until the next component has been found and decoded */
+static int iter_scan(struct sunxi_iter *iter)
+{
+	bool scan_all = iter->flags & SUNXI_ITER_SCAN_ALL;
+	enum image_type type;
+	uint64_t start;
+	void *sector;
+	int ret;
+
+	while (!iter->nr_queued) {
+		sector = scan_sectors(&iter->ctx, iter->sector);
+		if (!sector) {
+			iter->done = true;
+			return 0;
+		}
+		start = iter->ctx.pos - 512;
+
+		type = identify_image(sector);
+		stats_phase(&iter->ctx, type);
+		cache_component(&iter->ctx, type, sector);
+
+		if (!want_component(&iter->ctx, type) &&
+		    !want_nested(&iter->ctx, type)) {
+			ret = skip_component(&iter->ctx, type, sector,
+					     scan_all);
+			if (ret)
+				return ret;
+			if (!scan_all && (type == IMAGE_UBOOT ||
+					  type == IMAGE_FIT ||
+					  type == IMAGE_PHOENIX))
+				iter->done = true;
+			if (iter->done)
+				return 0;
+			continue;
+		}
+
+		switch (type) {
+		case IMAGE_BOOT0:
+		case IMAGE_SPL1:
+		case IMAGE_SPL2:
+		case IMAGE_SPLx:
+		case IMAGE_TOC0:
+			ret = iter_egon(iter, type, sector, start);
+			break;
+		case IMAGE_ROCKCHIP:
+		case IMAGE_AML:
+			iter_queue(iter, type, "spl", start, 0, 0);
+			ret = 0;
+			break;
+		case IMAGE_UBOOT:
+			ret = iter_uboot(iter, sector, start);
+			iter->done = !scan_all;
+			break;
+		case IMAGE_FIT:
+			ret = iter_fit(iter, sector, start);
+			iter->done = !scan_all;
+			break;
+		case IMAGE_MBR:
+			iter_queue(iter, type, "mbr", start, 512, 0);
+			mbr_partitions(&iter->ctx, sector);
+			ret = 0;
+			break;
+		case IMAGE_GPT:
+			ret = iter_gpt(iter, sector, start);
+			break;
+		case IMAGE_PHOENIX:
+			ret = iter_wty(iter, sector, start);
+			iter->done = !scan_all;
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+
+		/*
+		 * The first queued entry is the container, for nested ones,
+		 * unless it has been left out (see iter_wty()).
+		 */
+		if (iter->nr_queued && iter->queue[0].offset == start)
+			iter->queue[0].header = sector;
+
+		/* still return what has been found so far */
+		if (ret)
+			iter->done = true;
+		if (ret && !iter->nr_queued)
+			return ret;
+	}
+
+	return 0;
+}
+
+struct sunxi_iter *sunxi_iter_new(FILE *inf, unsigned int flags)
+{
+	struct sunxi_iter *iter;
+
+	iter = calloc(1, sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	sunxi_ctx_init(&iter->ctx, inf, NULL, false);
+	iter->ctx.gap_only = flags & SUNXI_ITER_GAP_ONLY;
+	iter->ctx.scan_parts = flags & SUNXI_ITER_SCAN_PARTS;
+	iter->flags = flags;
+
+	return iter;
+}
+
+int sunxi_iter_next(struct sunxi_iter *iter, struct sunxi_component *comp)
+{
+	int ret;
+
+	if (iter->next_queued == iter->nr_queued) {
+		iter->nr_queued = iter->next_queued = 0;
+		if (iter->done)
+			return 0;
+
+		ret = iter_scan(iter);
+		if (ret)
+			return ret;
+		if (!iter->nr_queued)
+			return 0;
+	}
+
+	*comp = iter->queue[iter->next_queued++];
+
+	return 1;
+}
+
+struct sunxi_ctx *sunxi_iter_ctx(struct sunxi_iter *iter)
+{
+	return &iter->ctx;
+}
+
+void sunxi_iter_free(struct sunxi_iter *iter)
+{
+	if (!iter)
+		return;
+
+	sunxi_ctx_release(&iter->ctx);
+	free(iter->queue);
+	free(iter);
+}
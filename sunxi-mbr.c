@@ -10,45 +10,173 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "sunxi-fw.h"
 
-static int output_gpt_info(FILE *inf, FILE *stream, bool verbose)
+/* remember where a partition is, so scan_sectors() can jump over it */
+static void add_partition(struct sunxi_ctx *ctx, uint64_t start, uint64_t size)
 {
-	uint32_t sector[512 / 4];
-	uint64_t *arr64 = (void *)sector;
-	int ret, nr_entries, entry_size, sectors;
+	struct part_extent *part;
 
-	ret = fread(sector, 512, 1, inf);
-	if (ret == 0 && feof(inf))
-		return -1;
+	if (!start || !size)
+		return;
+
+	part = realloc(ctx->parts, (ctx->nr_parts + 1) * sizeof(*part));
+	if (!part)
+		return;
+	ctx->parts = part;
+	part += ctx->nr_parts++;
+	stats_alloc(ctx, sizeof(*part));
+
+	part->start = start;
+	part->end = start + size;
+	if (!ctx->first_part || start < ctx->first_part)
+		ctx->first_part = start;
+}
+
+/*
+ * Is this the boot sector of a FAT, exFAT or NTFS file system, spanning the
+ * whole medium? It ends in 0x55aa as well, but its boot code would be taken
+ * for partition entries. Those start with a jump, and then either name the
+ * file system (exFAT leaves the BPB empty) or have a sane BPB.
+ */
+static bool is_boot_sector(const unsigned char *sector)
+{
+	unsigned int sector_size = sector[11] | sector[12] << 8;
+	unsigned int cluster = sector[13];
+
+	if (sector[0] != 0xeb && sector[0] != 0xe9)
+		return false;
+
+	if (!memcmp(sector + 3, "EXFAT   ", 8))
+		return true;
+
+	return sector_size >= 512 && sector_size <= 4096 &&
+	       !(sector_size & (sector_size - 1)) &&
+	       cluster && !(cluster & (cluster - 1));
+}
+
+/*
+ * mbr_partitions() - record the partitions of an MBR
+ * @ctx: context, positioned right behind the MBR
+ * @sector: the MBR
+ *
+ * Only an MBR at the very beginning of the input describes its layout, one
+ * found anywhere else is ignored. So are GPT protective entries, and tables
+ * with a boot flag other than 0x00 or 0x80 in any entry, or in a file system
+ * boot sector (see is_boot_sector()).
+ */
+void mbr_partitions(struct sunxi_ctx *ctx, const void *sector)
+{
+	const unsigned char *parts = sector + 0x1be;
+	uint32_t psize, poffset;
+	int i;
+
+	if (ctx->pos != 512 || is_boot_sector(sector))
+		return;
+
+	for (i = 0; i < 4; i++)
+		if (parts[i * 16] != 0x00 && parts[i * 16] != 0x80)
+			return;
+
+	for (i = 0; i < 4; i++) {
+		if (parts[i * 16 + 4] == 0 || parts[i * 16 + 4] == 0xee)
+			continue;
+
+		memcpy(&poffset, &parts[i * 16 + 8], sizeof(poffset));
+		memcpy(&psize, &parts[i * 16 + 12], sizeof(psize));
+		add_partition(ctx, poffset * 512ULL, psize * 512ULL);
+	}
+}
+
+/*
+ * gpt_partitions() - read and record the GPT partition entries
+ * @ctx: context, positioned right behind the GPT header
+ * @header: the GPT header
+ *
+ * Consumes the partition entry array, which must follow the header. Only
+ * a GPT header in LBA 1 is taken into account, the entries of any other
+ * (like the backup GPT) are just skipped.
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int gpt_partitions(struct sunxi_ctx *ctx, const void *header)
+{
+	const uint32_t *gpt = header;
+	uint32_t nr_entries = gpt[20], entry_size = gpt[21];
+	uint64_t length = ((uint64_t)nr_entries * entry_size + 511) & ~511ULL;
+	bool record = ctx->pos == 1024;
+	uint32_t chunk, i;
+	const void *data;
+	uint64_t lba[2];
+
+	if (length > GPT_MAX_ENTRIES)
+		return -EINVAL;
+
+	/* sizes are powers of two, so the entries don't straddle chunks */
+	if (entry_size < 128 || SCRATCH_SIZE % entry_size)
+		return pseek(ctx, length);
+
+	for (; length; length -= chunk) {
+		chunk = length > SCRATCH_SIZE ? SCRATCH_SIZE : length;
+		data = input_read(ctx, ctx->scratch, chunk);
+		if (!data)
+			return -EIO;
+		if (!record)
+			continue;
+
+		/* first and last LBA at offset 32, zero for unused entries */
+		for (i = 0; i + entry_size <= chunk && nr_entries;
+		     i += entry_size, nr_entries--) {
+			memcpy(lba, data + i + 32, sizeof(lba));
+			if (lba[1] >= lba[0])
+				add_partition(ctx, lba[0] * 512,
+					      (lba[1] - lba[0] + 1) * 512);
+		}
+	}
+
+	return 0;
+}
+
+static int output_gpt_info(struct sunxi_ctx *ctx)
+{
+	FILE *stream = ctx->out;
+	uint32_t *sector;
+	uint64_t *arr64;
+	int ret;
+
+	sector = input_read(ctx, ctx->scratch, 512);
+	if (!sector)
+		return -EIO;
+	arr64 = (void *)sector;
 
 	fprintf(stream, "\tGPT version %08x\n", sector[2]);
 	fprintf(stream, "\tusable disk size: %"PRId64" MB\n",
 		(arr64[6] - arr64[5]) / 2048);
-	nr_entries = sector[20];
-	entry_size = sector[21];
-	sectors = ((nr_entries * entry_size) + 511) / 512;
 	fprintf(stream, "\tnumber of partition entries: %d\n", sector[20]);
 
-	if (!verbose) {
-		pseek(inf, sectors * 512);
-		return 1 + sectors;
-	}
+	ret = gpt_partitions(ctx, sector);
+	if (ret == -EINVAL)
+		fprintf(stream, "\tERROR: invalid partition entries\n");
 
-	pseek(inf, sectors * 512);
-	return 1 + sectors;
+	return ret;
 }
 
-int output_mbr_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+int output_mbr_info(struct sunxi_ctx *ctx, void *sector)
 {
+	FILE *stream = ctx->out;
+	bool verbose = ctx->verbose;
 	unsigned char *parts = sector + 0x1be;
 	int i;
 	uint32_t psize, poffset;
 	unsigned char ptype;
 	uint32_t first_part = ~0;
 
+	mbr_partitions(ctx, sector);
+
 	for (i = 0; i < 4; i++) {
 		ptype = parts[i * 16 + 4];
 		if (ptype == 0)			/* empty entry, skip */
@@ -64,7 +192,7 @@ int output_mbr_info(void *sector, FILE *inf, FILE *stream, bool verbose)
 			break;
 		case 0xee:
 			fprintf(stream, "\tprotective MBR, GPT used\n");
-			return output_gpt_info(inf, stream, verbose);
+			return output_gpt_info(ctx);
 		case 0xef:
 			fprintf(stream, "\tpart %d is EFI system partition\n",
 				i + 1);
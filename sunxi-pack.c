@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-pack: assemble the boot area of an SD card or eMMC image
+ *
+ * The components are listed in a manifest, one per line:
+ *
+ *	# type	file			[offset]
+ *	mbr	mbr.bin
+ *	spl	sunxi-spl.bin
+ *	fit	u-boot.itb
+ *
+ * and are laid out in memory at their offsets, which default to where the
+ * BROM and the SPL look for them on an SD card. The eGON and TOC0 checksums
+ * are computed on the way, so the SPL or boot0 can be taken straight from
+ * a build, with the checksum word left at anything. The result is written
+ * in one sequential pass, with the gaps between components left as holes
+ * in a regular file, and written as zeroes to a device. A device is written
+ * from the first component on, so without an mbr or gpt line its partition
+ * table stays as it is.
+ */
+
+#define _GNU_SOURCE			/* for O_DIRECT */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sunxi-fw.h"
+
+/* it is all in memory, so this is for the boot area only */
+#define PACK_MAX	(256 * 1024 * 1024)
+#define PACK_ALIGN	4096		/* for O_DIRECT */
+#define NO_OFFSET	UINT64_MAX
+
+struct pack_type {
+	const char *name;
+	enum image_type type;
+	uint64_t offset;		/* default, on an SD card */
+};
+
+static const struct pack_type pack_types[] = {
+	{ "mbr",	IMAGE_MBR,	0 },
+	{ "gpt",	IMAGE_GPT,	0 },	/* protective MBR and GPT */
+	{ "boot0",	IMAGE_BOOT0,	8192 },
+	{ "spl",	IMAGE_SPLx,	8192 },
+	{ "toc0",	IMAGE_TOC0,	8192 },
+	{ "fit",	IMAGE_FIT,	40960 },	/* CONFIG_SYS_MMCSD_RAW_MODE_U_BOOT_SECTOR */
+	{ "u-boot.img",	IMAGE_UBOOT,	40960 },
+	{ "raw",	IMAGE_UNKNOWN,	NO_OFFSET },
+};
+
+struct pack_entry {
+	const struct pack_type *type;
+	char *file;
+	uint64_t offset, size;		/* size as laid out, with padding */
+	void *data;
+	size_t length;			/* of the file */
+	int line;
+};
+
+struct pack {
+	struct pack_entry *entries;
+	int nr_entries;
+};
+
+static void pack_free(struct pack *pack)
+{
+	int i;
+
+	for (i = 0; i < pack->nr_entries; i++) {
+		free(pack->entries[i].file);
+		free(pack->entries[i].data);
+	}
+	free(pack->entries);
+}
+
+/* relative file names are relative to the manifest */
+static char *pack_path(const char *manifest, const char *file)
+{
+	const char *slash = manifest ? strrchr(manifest, '/') : NULL;
+	char *path;
+
+	if (file[0] == '/' || !slash)
+		return strdup(file);
+
+	path = malloc(slash - manifest + 1 + strlen(file) + 1);
+	if (path)
+		sprintf(path, "%.*s/%s", (int)(slash - manifest), manifest,
+			file);
+
+	return path;
+}
+
+static int pack_parse_line(struct pack *pack, const char *manifest,
+			   char *line, int nr)
+{
+	char *type, *file, *offset, *rest, *save;
+	struct pack_entry *entry;
+	unsigned int i;
+	size_t value;
+
+	rest = strchr(line, '#');
+	if (rest)
+		*rest = '\0';
+
+	type = strtok_r(line, " \t\n", &save);
+	if (!type)
+		return 0;
+	file = strtok_r(NULL, " \t\n", &save);
+	offset = strtok_r(NULL, " \t\n", &save);
+	rest = strtok_r(NULL, " \t\n", &save);
+	if (!file || rest) {
+		fprintf(stderr, "line %d: expecting <type> <file> [offset]\n",
+			nr);
+		return -EINVAL;
+	}
+
+	entry = realloc(pack->entries,
+			(pack->nr_entries + 1) * sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+	pack->entries = entry;
+	entry += pack->nr_entries;
+	memset(entry, 0, sizeof(*entry));
+	entry->line = nr;
+
+	for (i = 0; i < sizeof(pack_types) / sizeof(pack_types[0]); i++)
+		if (!strcmp(type, pack_types[i].name))
+			entry->type = &pack_types[i];
+	if (!entry->type) {
+		fprintf(stderr, "line %d: unknown component type \"%s\"\n",
+			nr, type);
+		return -EINVAL;
+	}
+
+	entry->offset = entry->type->offset;
+	if (offset) {
+		if (parse_size(offset, &value) || value % 512) {
+			fprintf(stderr, "line %d: invalid offset \"%s\", must be a multiple of 512\n",
+				nr, offset);
+			return -EINVAL;
+		}
+		entry->offset = value;
+	}
+	if (entry->offset == NO_OFFSET) {
+		fprintf(stderr, "line %d: %s needs an offset\n", nr, type);
+		return -EINVAL;
+	}
+
+	entry->file = pack_path(manifest, file);
+	if (!entry->file)
+		return -ENOMEM;
+	pack->nr_entries++;
+
+	return 0;
+}
+
+static int pack_parse(struct pack *pack, const char *manifest)
+{
+	char *line = NULL;
+	size_t size = 0;
+	int nr = 0, ret = 0;
+	FILE *f;
+
+	f = manifest ? fopen(manifest, "r") : stdin;
+	if (!f) {
+		perror(manifest);
+		return -errno;
+	}
+
+	while (!ret && getline(&line, &size, f) > 0)
+		ret = pack_parse_line(pack, manifest, line, ++nr);
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	if (!ret && !pack->nr_entries) {
+		fprintf(stderr, "no components in the manifest\n");
+		return -EINVAL;
+	}
+
+	return ret;
+}
+
+static int pack_read(struct pack_entry *entry)
+{
+	struct stat st;
+	FILE *f;
+
+	f = fopen(entry->file, "rb");
+	if (!f || fstat(fileno(f), &st)) {
+		perror(entry->file);
+		if (f)
+			fclose(f);
+		return -errno;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size > PACK_MAX) {
+		fprintf(stderr, "%s: not a regular file, or too large\n",
+			entry->file);
+		fclose(f);
+		return -EINVAL;
+	}
+
+	/* no less than a sector, for identify_image() */
+	entry->length = st.st_size;
+	entry->data = calloc(1, entry->length < 512 ? 512 : entry->length);
+	if (!entry->data ||
+	    fread(entry->data, 1, entry->length, f) != entry->length) {
+		fprintf(stderr, "%s: cannot read\n", entry->file);
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+
+	entry->size = (entry->length + 511) & ~511ULL;
+
+	return 0;
+}
+
+/* Returns true if the file holds what the manifest says it does. */
+static bool pack_check_type(const struct pack_entry *entry)
+{
+	enum image_type type = identify_image(entry->data);
+
+	switch (entry->type->type) {
+	case IMAGE_UNKNOWN:
+		return true;
+	case IMAGE_SPLx:
+		return type == IMAGE_SPL1 || type == IMAGE_SPL2 ||
+		       type == IMAGE_SPLx;
+	case IMAGE_GPT:
+		/* the GPT header is in the second sector */
+		return type == IMAGE_MBR && entry->length >= 1024 &&
+		       identify_image(entry->data + 512) == IMAGE_GPT;
+	default:
+		return type == entry->type->type;
+	}
+}
+
+/* the length the eGON or TOC0 checksum covers, 0 for anything else */
+static uint32_t pack_length(const struct pack_entry *entry)
+{
+	const uint32_t *header = entry->data;
+
+	switch (entry->type->type) {
+	case IMAGE_BOOT0:
+	case IMAGE_SPLx:
+		return header[4];
+	case IMAGE_TOC0:
+		return header[7];
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The length in the header covers the padding the SPL build left out,
+ * which then is zeroes in the image, and part of the checksum.
+ */
+static int pack_checksum(struct pack_entry *entry, void *image,
+			 bool verbose)
+{
+	uint32_t *dest = image + entry->offset, length, chksum;
+
+	switch (entry->type->type) {
+	case IMAGE_BOOT0:
+	case IMAGE_SPLx:
+	case IMAGE_TOC0:
+		break;
+	default:
+		return 0;
+	}
+
+	length = pack_length(entry);
+	if (length < 512 || length % 4 || length > PACK_MAX) {
+		fprintf(stderr, "%s: invalid image length %u\n", entry->file,
+			length);
+		return -EINVAL;
+	}
+
+	chksum = egon_checksum(dest, length);
+	if (verbose && chksum != dest[3])
+		fprintf(stderr, "%s: checksum 0x%08x, was 0x%08x\n",
+			entry->type->name, chksum, dest[3]);
+	dest[3] = chksum;
+
+	return 0;
+}
+
+static int pack_compare(const void *a, const void *b)
+{
+	const struct pack_entry *x = a, *y = b;
+
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* lay out the components in memory, checked for overlaps */
+static void *pack_layout(struct pack *pack, uint64_t *total, bool verbose)
+{
+	struct pack_entry *entry, *prev = NULL;
+	uint64_t end = 0, length;
+	void *image;
+	int i;
+
+	for (i = 0; i < pack->nr_entries; i++) {
+		entry = &pack->entries[i];
+		if (pack_read(entry))
+			return NULL;
+		if (!pack_check_type(entry)) {
+			fprintf(stderr, "line %d: %s is no %s image\n",
+				entry->line, entry->file, entry->type->name);
+			return NULL;
+		}
+
+		/* the checksummed length can go beyond the file */
+		length = pack_length(entry);
+		if (length > entry->size)
+			entry->size = (length + 511) & ~511ULL;
+	}
+
+	qsort(pack->entries, pack->nr_entries, sizeof(*pack->entries),
+	      pack_compare);
+
+	for (i = 0; i < pack->nr_entries; i++, prev = entry) {
+		entry = &pack->entries[i];
+		if (prev && entry->offset < prev->offset + prev->size) {
+			fprintf(stderr, "%s @ 0x%"PRIx64" overlaps %s, which ends at 0x%"PRIx64"\n",
+				entry->file, entry->offset, prev->file,
+				prev->offset + prev->size);
+			return NULL;
+		}
+		end = entry->offset + entry->size;
+	}
+	if (end > PACK_MAX) {
+		fprintf(stderr, "image would be %"PRIu64" MB, too large to pack\n",
+			end >> 20);
+		return NULL;
+	}
+
+	if (posix_memalign(&image, PACK_ALIGN,
+			   (end + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1ULL)))
+		return NULL;
+	memset(image, 0, end);
+
+	for (i = 0; i < pack->nr_entries; i++) {
+		entry = &pack->entries[i];
+		memcpy(image + entry->offset, entry->data, entry->length);
+		if (pack_checksum(entry, image, verbose)) {
+			free(image);
+			return NULL;
+		}
+		if (verbose)
+			fprintf(stderr, "%s: %"PRIu64" bytes @ 0x%08"PRIx64"\n",
+				entry->type->name, entry->size, entry->offset);
+	}
+
+	*total = end;
+
+	return image;
+}
+
+/* writes at @offset, or sequentially if it is negative, as for pipes */
+static int pack_write_all(int fd, const void *data, uint64_t length,
+			  off_t offset)
+{
+	ssize_t ret;
+
+	while (length) {
+		if (offset < 0)
+			ret = write(fd, data, length);
+		else
+			ret = pwrite(fd, data, length, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return ret < 0 ? -errno : -EIO;
+		data += ret;
+		length -= ret;
+		if (offset >= 0)
+			offset += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Regular files get the components only, in order, and the gaps become
+ * holes. Block devices get everything from the first component on in one
+ * go, with O_DIRECT for the whole blocks in there, if asked to. Pipes and
+ * other devices, which can't seek, get the whole image.
+ */
+static int pack_write(struct pack *pack, const void *image, uint64_t total,
+		      const char *outfn, bool direct)
+{
+	const struct pack_entry *entry;
+	uint64_t start = 0, first, last;
+	struct stat st;
+	int fd, i, ret = 0;
+
+	if (!outfn || !strcmp(outfn, "-")) {
+		if (fwrite(image, 1, total, stdout) != total ||
+		    fflush(stdout))
+			return -EIO;
+		return 0;
+	}
+
+	fd = open(outfn, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &st)) {
+		ret = -errno;
+		perror(outfn);
+		if (fd >= 0)
+			close(fd);
+		return ret;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		if (ftruncate(fd, 0))
+			ret = -errno;
+		for (i = 0; !ret && i < pack->nr_entries; i++) {
+			entry = &pack->entries[i];
+			ret = pack_write_all(fd, image + entry->offset,
+					     entry->size, entry->offset);
+		}
+		if (!ret && ftruncate(fd, total))
+			ret = -errno;
+	} else {
+		/* the sorted entries start with the lowest offset */
+		if (S_ISBLK(st.st_mode))
+			start = pack->entries[0].offset;
+		if (start && lseek(fd, start, SEEK_SET) < 0)
+			ret = -errno;
+
+		/* [start, first) and [last, total) are not whole blocks */
+		first = last = total;
+		if (direct && S_ISBLK(st.st_mode)) {
+			first = (start + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1ULL);
+			last = total & ~(PACK_ALIGN - 1ULL);
+			if (first >= last)
+				first = last = total;
+		}
+
+		if (!ret)
+			ret = pack_write_all(fd, image + start, first - start,
+					     -1);
+		if (!ret && first < last) {
+			/* buffered, if the device doesn't do O_DIRECT */
+			direct = !fcntl(fd, F_SETFL,
+					fcntl(fd, F_GETFL) | O_DIRECT);
+			ret = pack_write_all(fd, image + first, last - first,
+					     -1);
+			if (direct)
+				fcntl(fd, F_SETFL,
+				      fcntl(fd, F_GETFL) & ~O_DIRECT);
+		}
+		if (!ret)
+			ret = pack_write_all(fd, image + last, total - last,
+					     -1);
+	}
+
+	if (!ret && fsync(fd) && errno != EINVAL)
+		ret = -errno;
+	if (ret)
+		fprintf(stderr, "%s: %s\n", outfn, strerror(-ret));
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * pack_image() - assemble an image from the components in a manifest
+ * @manifest: manifest file name, NULL for stdin
+ * @outfn: output file or block device, NULL or "-" for stdout
+ * @direct: write to a block device with O_DIRECT
+ * @verbose: report every component and fixed checksum on stderr
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int pack_image(const char *manifest, const char *outfn, bool direct,
+	       bool verbose)
+{
+	struct pack pack = { 0 };
+	uint64_t total;
+	void *image;
+	int ret;
+
+	ret = pack_parse(&pack, manifest);
+	if (ret) {
+		pack_free(&pack);
+		return ret;
+	}
+
+	image = pack_layout(&pack, &total, verbose);
+	if (!image) {
+		pack_free(&pack);
+		return -EINVAL;
+	}
+
+	ret = pack_write(&pack, image, total, outfn, direct);
+
+	free(image);
+	pack_free(&pack);
+
+	return ret;
+}
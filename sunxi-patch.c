@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-patch: change the header of a boot image, in place or in a copy
+ *
+ * Changing the DT name of an SPL or the DRAM parameters of boot0 only
+ * touches the first sector of the image, and the eGON checksum can be
+ * corrected from the changed words alone (see egon_checksum_update()). So
+ * patching in place reads and writes just that sector, with pread() and
+ * pwrite(), which is what you want on a card or an eMMC boot partition.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sunxi-fw.h"
+
+/* eMMC boot partitions are read only, until told otherwise */
+static void patch_force_ro_hint(const char *filename)
+{
+	const char *dev = strrchr(filename, '/');
+
+	dev = dev ? dev + 1 : filename;
+	if (!strncmp(dev, "mmcblk", 6) && strstr(dev, "boot"))
+		fprintf(stderr, "try: echo 0 > /sys/block/%s/force_ro\n", dev);
+}
+
+/*
+ * patch_in_place() - change the header sector of a boot image in a file
+ * @filename: image file or block device, with the boot image at the start
+ *            or behind an MBR at 8KB, as on an SD card
+ * @patch: changes the sector in memory, returns 0 or a negative error
+ *         value, having reported the error already
+ * @arg: passed on to @patch
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int patch_in_place(const char *filename, patch_fn patch, void *arg)
+{
+	uint32_t sector[512 / 4];
+	off_t offset = 0;
+	int fd, ret;
+
+	fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		ret = -errno;
+		perror(filename);
+		if (ret == -EROFS || ret == -EACCES || ret == -EPERM)
+			patch_force_ro_hint(filename);
+		return ret;
+	}
+
+	if (pread(fd, sector, 512, offset) != 512)
+		goto short_read;
+	if (identify_image(sector) == IMAGE_MBR) {
+		offset = 8192;
+		if (pread(fd, sector, 512, offset) != 512)
+			goto short_read;
+	}
+
+	ret = patch(sector, arg);
+	if (ret) {
+		close(fd);
+		return ret;
+	}
+
+	if (pwrite(fd, sector, 512, offset) != 512 || fsync(fd)) {
+		ret = -errno;
+		perror(filename);
+		if (ret == -EPERM)
+			patch_force_ro_hint(filename);
+		close(fd);
+		return ret;
+	}
+
+	return close(fd) ? -errno : 0;
+
+short_read:
+	fprintf(stderr, "%s: cannot read the image header\n", filename);
+	close(fd);
+
+	return -EIO;
+}
+
+/*
+ * patch_copy() - copy the input, with the header sector of a boot image changed
+ * @ctx: context with the input file, which can be a pipe
+ * @type: IMAGE_SPLx or IMAGE_BOOT0, the image to change
+ * @patch: changes the sector in memory, see patch_in_place()
+ * @arg: passed on to @patch
+ * @outf: output file, gets all of the input
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int patch_copy(struct sunxi_ctx *ctx, enum image_type type, patch_fn patch,
+	       void *arg, FILE *outf)
+{
+	char sector[512];
+	int ret;
+
+	/* an MBR and the gap behind it are copied on the way */
+	ret = find_firmware_image(ctx, type, sector, outf);
+	if (ret) {
+		fprintf(stderr, "no %s found\n",
+			type == IMAGE_BOOT0 ? "boot0" : "U-Boot SPL");
+		return ret;
+	}
+
+	ret = patch(sector, arg);
+	if (ret)
+		return ret;
+
+	fwrite(sector, 1, 512, outf);
+	copy_file(ctx, outf, -1);
+
+	return fflush(outf) ? -errno : 0;
+}
@@ -0,0 +1,669 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-plan: extract many firmware components in one pass over the input
+ *
+ * The input is walked front to back exactly once. Whenever a header is
+ * decoded, the ranges of the components it describes are added to a plan,
+ * and every byte that passes by afterwards is handed to each output whose
+ * range covers it. Gaps no output is interested in are skipped with
+ * pseek(), so this works on pipes as well as on mapped files.
+ *
+ * What an output does with the data is up to the plan_ops it was opened
+ * with: extract_images() writes files, sunxi-verify.c hashes the data.
+ */
+
+#define _GNU_SOURCE			/* for asprintf() */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <arpa/inet.h>			/* for ntohl() */
+
+#include "sunxi-fw.h"
+#include "uboot_legacy.h"
+
+#define PLAN_CHUNK	(1024 * 1024)
+#define NAME_LEN	(4 + 256 + 1)	/* "wty:" plus the WTY file name */
+
+struct plan_range {
+	char name[NAME_LEN];
+	uint64_t start, end;
+	void *sink;			/* from ops->open(), NULL once closed */
+	bool held;			/* a FIT image, closed by plan_fit() */
+};
+
+struct extract_plan {
+	struct sunxi_ctx *ctx;		/* ctx->pos is the current position */
+	const char **patterns;
+	bool *matched;
+	int nr_patterns;
+	const struct plan_ops *ops;
+	void *arg;
+	struct plan_range *ranges;
+	int nr_ranges;
+	void *buffer;
+};
+
+static bool plan_wants(struct extract_plan *plan, const char *name)
+{
+	bool wanted = false;
+	int i;
+
+	for (i = 0; i < plan->nr_patterns; i++) {
+		if (fnmatch(plan->patterns[i], name, 0))
+			continue;
+		plan->matched[i] = true;
+		wanted = true;
+	}
+
+	return wanted;
+}
+
+static void plan_close(struct extract_plan *plan, struct plan_range *range)
+{
+	struct plan_component comp = {
+		.name = range->name,
+		.start = range->start,
+		.size = range->end - range->start,
+	};
+
+	if (!range->sink)
+		return;
+
+	plan->ops->close(plan->arg, range->sink, &comp);
+	range->sink = NULL;
+}
+
+/* write the part of [@pos, @pos + @len) that @range covers */
+static void plan_write(struct extract_plan *plan, struct plan_range *range,
+		       const void *data, uint64_t pos, uint64_t len)
+{
+	uint64_t start, end;
+
+	if (!range->sink)
+		return;
+
+	start = range->start > pos ? range->start : pos;
+	end = range->end < pos + len ? range->end : pos + len;
+	if (start < end)
+		plan->ops->write(plan->arg, range->sink, data + (start - pos),
+				 end - start);
+	if (range->end <= pos + len && !range->held)
+		plan_close(plan, range);
+}
+
+/*
+ * plan_add_component() - add a component to the plan, if it was asked for
+ * @comp: the component, with the name as used for the -n option, and its
+ *        absolute offset and size in the input
+ * @data: the component's data, if it starts behind the current position
+ *
+ * Components that started before the current position (because their
+ * header had to be read to learn about them) are written up to the current
+ * position from @data right away.
+ */
+static void plan_add_component(struct extract_plan *plan,
+			       const struct plan_component *comp,
+			       const void *data)
+{
+	uint64_t pos = plan->ctx->pos, start = comp->start, size = comp->size;
+	struct plan_range *range;
+
+	if (!plan_wants(plan, comp->name))
+		return;
+	if (start < pos && !data) {
+		fprintf(stderr, "ERROR: %s lies behind its header\n",
+			comp->name);
+		return;
+	}
+
+	range = realloc(plan->ranges, (plan->nr_ranges + 1) * sizeof(*range));
+	if (!range)
+		return;
+	plan->ranges = range;
+	range += plan->nr_ranges;
+
+	range->sink = plan->ops->open(plan->arg, comp);
+	if (!range->sink)
+		return;
+
+	snprintf(range->name, sizeof(range->name), "%s", comp->name);
+	range->start = start;
+	range->end = start + size;
+	range->held = comp->hashes_follow;
+	plan->nr_ranges++;
+
+	if (start < pos)
+		plan_write(plan, range, data, start, pos - start);
+	else if (!size && !range->held)
+		plan_close(plan, range);
+}
+
+static void plan_add(struct extract_plan *plan, const char *name,
+		     uint64_t start, uint64_t size, const void *data)
+{
+	struct plan_component comp = {
+		.name = name,
+		.start = start,
+		.size = size,
+	};
+
+	plan_add_component(plan, &comp, data);
+}
+
+/* pass a chunk of input data, read from offset @pos, by */
+static void plan_feed(struct extract_plan *plan, const void *data,
+		      uint64_t pos, uint64_t len)
+{
+	int i;
+
+	for (i = 0; i < plan->nr_ranges; i++)
+		plan_write(plan, &plan->ranges[i], data, pos, len);
+}
+
+static void *plan_read(struct extract_plan *plan, void *buffer, size_t len)
+{
+	uint64_t pos = plan->ctx->pos;
+	void *data = input_read(plan->ctx, buffer, len);
+
+	if (data)
+		plan_feed(plan, data, pos, len);
+
+	return data;
+}
+
+/*
+ * Returns the distance from the current position to the next range start
+ * or end, whichever comes first, and whether any output is active now.
+ */
+static uint64_t plan_next_event(struct extract_plan *plan, bool *active)
+{
+	uint64_t pos = plan->ctx->pos, next = UINT64_MAX;
+	int i;
+
+	*active = false;
+	for (i = 0; i < plan->nr_ranges; i++) {
+		struct plan_range *range = &plan->ranges[i];
+
+		if (!range->sink || range->end <= pos)
+			continue;
+		if (range->start > pos) {
+			if (range->start - pos < next)
+				next = range->start - pos;
+		} else {
+			*active = true;
+			if (range->end - pos < next)
+				next = range->end - pos;
+		}
+	}
+
+	return next;
+}
+
+/*
+ * plan_skip() - advance by @len bytes, feeding all outputs on the way
+ *
+ * Parts not covered by any output are skipped with pseek(), everything else
+ * is read in chunks and written to the outputs.
+ * Return: 0 if successful, negative error value otherwise
+ */
+static int plan_skip(struct extract_plan *plan, uint64_t len)
+{
+	while (len) {
+		uint64_t chunk;
+		bool active;
+		int ret;
+
+		chunk = plan_next_event(plan, &active);
+		if (chunk > len)
+			chunk = len;
+
+		if (!active) {
+			ret = pseek(plan->ctx, chunk);
+			if (ret)
+				return ret;
+		} else {
+			if (chunk > PLAN_CHUNK)
+				chunk = PLAN_CHUNK;
+			if (!plan_read(plan, plan->buffer, chunk))
+				return -EIO;
+		}
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/* stream the input until all outputs are complete */
+static void plan_drain(struct extract_plan *plan)
+{
+	uint64_t end = plan->ctx->pos;
+	int i;
+
+	for (i = 0; i < plan->nr_ranges; i++)
+		if (plan->ranges[i].sink && plan->ranges[i].end > end)
+			end = plan->ranges[i].end;
+
+	if (plan_skip(plan, end - plan->ctx->pos))
+		fprintf(stderr, "ERROR: image file too small\n");
+
+	for (i = 0; i < plan->nr_ranges; i++)
+		plan_close(plan, &plan->ranges[i]);
+}
+
+/* the CRCs are stored big endian, like the digests of FIT hash nodes */
+static void plan_uboot(struct extract_plan *plan, const void *sector,
+		       uint64_t start)
+{
+	const struct legacy_image_header *header = sector;
+	uint32_t hcrc = htonl(uboot_header_crc(sector));
+	struct plan_component comp = {
+		.name = "u-boot.img",
+		.start = start,
+		.size = sizeof(*header) + ntohl(header->ih_size),
+		.hashes = { {
+			.algo = "crc32",
+			.value = (const uint8_t *)&header->ih_hcrc,
+			.computed = (const uint8_t *)&hcrc,
+			.length = 4,
+		} },
+		.nr_hashes = 1,
+	};
+
+	plan_add_component(plan, &comp, sector);
+
+	comp.name = "u-boot";
+	comp.start += sizeof(*header);
+	comp.size -= sizeof(*header);
+	comp.hashes[0].value = (const uint8_t *)&header->ih_dcrc;
+	comp.hashes[0].computed = NULL;
+	plan_add_component(plan, &comp, sector + sizeof(*header));
+}
+
+/* the hash-* subnodes of a FIT image node, see U-Boot's doc/usage/fit */
+static void plan_fit_hashes(const struct dt_tree *tree, int node,
+			    struct plan_component *comp)
+{
+	const struct dt_prop *value;
+	struct plan_hash *hash;
+	int sub;
+
+	for (sub = tree->nodes[node].first_child; sub >= 0;
+	     sub = tree->nodes[sub].next_sibling) {
+		if (strncmp(tree->nodes[sub].name, "hash", 4) ||
+		    comp->nr_hashes == PLAN_MAX_HASHES)
+			continue;
+
+		hash = &comp->hashes[comp->nr_hashes];
+		hash->algo = dt_getprop_string(tree, sub, "algo");
+		value = dt_getprop(tree, sub, "value");
+		if (!hash->algo || !value || !value->value)
+			continue;
+		hash->value = value->value;
+		hash->length = value->length;
+		comp->nr_hashes++;
+	}
+}
+
+/* while dt_walk() runs, the data it reads or skips goes to the outputs */
+static void plan_tap(void *arg, const void *data, uint64_t pos, size_t len)
+{
+	plan_feed(arg, data, pos, len);
+}
+
+/*
+ * The "data" of an image node, too large to be kept by dt_walk(), passes
+ * by now. If the input is mapped, it is added later on, with the hashes
+ * that follow in the hash-* nodes. On a pipe the output has to be opened
+ * now, to be fed by plan_tap(), and gets the hashes when it's closed.
+ */
+static int plan_fit_data(struct sunxi_ctx *ctx, const struct dt_tree *tree,
+			 int node, const struct dt_prop *prop,
+			 const void *head, uint32_t head_len, void *arg)
+{
+	const struct dt_node *n = &tree->nodes[node];
+	char name[NAME_LEN];
+	struct plan_component comp = {
+		.name = name,
+		.start = prop->offset,
+		.size = prop->length,
+		.hashes_follow = true,
+	};
+
+	/* the property name is only known if the strings come first */
+	if (n->depth != 2 || strcmp(tree->nodes[n->parent].name, "images") ||
+	    (prop->name && strcmp(prop->name, "data")) ||
+	    input_window(ctx, -(long)head_len, prop->length))
+		return 0;
+
+	snprintf(name, sizeof(name), "fit:%s", n->name);
+	plan_add_component(arg, &comp, head);
+
+	return 0;
+}
+
+/* Returns the output plan_fit_data() opened for an image node, or NULL. */
+static struct plan_range *plan_fit_held(struct extract_plan *plan,
+					const char *name)
+{
+	int i;
+
+	for (i = 0; i < plan->nr_ranges; i++)
+		if (plan->ranges[i].held && plan->ranges[i].sink &&
+		    !strcmp(plan->ranges[i].name, name))
+			return &plan->ranges[i];
+
+	return NULL;
+}
+
+static void plan_fit(struct extract_plan *plan, void *sector, uint64_t start)
+{
+	struct sunxi_ctx *ctx = plan->ctx;
+	uint32_t size = ntohl(((uint32_t *)sector)[1]), offset;
+	const struct dt_prop *prop;
+	struct plan_range *range;
+	struct dt_tree tree;
+	char name[NAME_LEN];
+	const void *data;
+	int node, ret;
+
+	if (size > FDT_MAX_SIZE) {
+		fprintf(stderr, "invalid FIT image\n");
+		return;
+	}
+	plan_add(plan, "fit", start, size, sector);
+
+	ctx->tap = plan_tap;
+	ctx->tap_arg = plan;
+	ret = dt_walk(ctx, sector, &tree, plan_fit_data, plan);
+	ctx->tap = NULL;
+	if (ret) {
+		fprintf(stderr, "invalid FIT image\n");
+		goto out;
+	}
+
+	node = dt_subnode(&tree, 0, "images");
+	for (node = node < 0 ? -1 : tree.nodes[node].first_child; node >= 0;
+	     node = tree.nodes[node].next_sibling) {
+		struct plan_component comp = { .name = name };
+
+		snprintf(name, sizeof(name), "fit:%s", tree.nodes[node].name);
+		plan_fit_hashes(&tree, node, &comp);
+		prop = dt_getprop(&tree, node, "data");
+
+		range = plan_fit_held(plan, name);
+		if (range) {
+			range->held = false;
+			if (!prop || prop->offset != range->start) {
+				fprintf(stderr, "unexpected large property in "
+					"\"%s\"\n", name);
+				plan_close(plan, range);
+				continue;
+			}
+			comp.start = range->start;
+			comp.size = range->end - range->start;
+			plan->ops->close(plan->arg, range->sink, &comp);
+			range->sink = NULL;
+			continue;
+		}
+
+		if (prop) {
+			/* in the tree, or else behind us in the mapping */
+			data = prop->value;
+			if (!data)
+				data = input_window(ctx, (long)prop->offset -
+						    (long)ctx->pos, prop->length);
+			if (!data)
+				continue;
+			comp.start = prop->offset;
+			comp.size = prop->length;
+			plan_add_component(plan, &comp, data);
+			continue;
+		}
+
+		if (!dt_getprop_u32(&tree, node, "data-offset", &offset) ||
+		    !dt_getprop_u32(&tree, node, "data-size", &size))
+			continue;
+
+		/* external data, relative to the end of the FIT */
+		comp.start = tree.start + tree.size + offset;
+		comp.size = size;
+		plan_add_component(plan, &comp, NULL);
+	}
+
+out:
+	dt_free(&tree);
+}
+
+static void plan_wty(struct extract_plan *plan, void *sector, uint64_t start)
+{
+	struct sunxi_ctx *ctx = plan->ctx;
+	const struct wty_entry *entry;
+	char name[NAME_LEN];
+	struct wty_dir dir;
+	int i, ret;
+
+	/* with the same limits as output_wty_info(), and ctx->wty_index */
+	ret = wty_dir_read(ctx, sector, &dir);
+	if (ret) {
+		fprintf(stderr, "ERROR: invalid PhoenixSuite image\n");
+		goto out;
+	}
+
+	for (i = 0; i < dir.nr_entries; i++) {
+		entry = &dir.entries[i];
+		snprintf(name, sizeof(name), "wty:%s", entry->name);
+		plan_add(plan, name, start + entry->offset, entry->size, NULL);
+	}
+
+out:
+	wty_dir_free(&dir);
+}
+
+/* walk the firmware components, the same way find_firmware_image() does */
+static void plan_scan(struct extract_plan *plan)
+{
+	char buffer[512];
+	enum image_type type;
+	uint32_t *sector;
+	uint64_t start;
+	uint32_t size;
+
+	do {
+		start = plan->ctx->pos;
+		sector = plan_read(plan, buffer, 512);
+		if (!sector)
+			return;
+
+		type = identify_image(sector);
+		stats_phase(plan->ctx, type);
+		switch (type) {
+		case IMAGE_MBR:
+			plan_add(plan, "mbr", start, 512, sector);
+			if (plan_skip(plan, 8192 - 512))
+				return;
+			break;
+		case IMAGE_BOOT0:
+		case IMAGE_SPL1:
+		case IMAGE_SPL2:
+		case IMAGE_SPLx:
+			size = sector[4];
+			if (size < 512 || size > EGON_MAX_SIZE) {
+				fprintf(stderr, "ERROR: invalid eGON image size: "
+					"%u bytes\n", size);
+				return;
+			}
+			plan_add(plan, sector[5] < 0x10000 ? "boot0" : "spl",
+				 start, size, sector);
+			if (plan_skip(plan, size - 512))
+				return;
+			break;
+		case IMAGE_UBOOT:
+			plan_uboot(plan, sector, start);
+			return;
+		case IMAGE_FIT:
+			plan_fit(plan, sector, start);
+			return;
+		case IMAGE_PHOENIX:
+			plan_wty(plan, sector, start);
+			return;
+		default:
+			return;
+		}
+	} while (1);
+}
+
+/*
+ * plan_components() - hand several components to their outputs in one pass
+ * @ctx: context with the input file
+ * @patterns: component names, as shell wildcard patterns (e.g. "wty:*.fex")
+ * @nr_patterns: number of entries in @patterns
+ * @ops: how to open, write and close the output of a matching component
+ * @arg: passed on to @ops
+ *
+ * Return: 0 if every pattern matched a component, -ENOENT otherwise
+ */
+int plan_components(struct sunxi_ctx *ctx, const char **patterns,
+		    int nr_patterns, const struct plan_ops *ops, void *arg)
+{
+	struct extract_plan plan = {
+		.ctx = ctx,
+		.patterns = patterns,
+		.nr_patterns = nr_patterns,
+		.ops = ops,
+		.arg = arg,
+	};
+	int i, ret = 0;
+
+	plan.matched = calloc(nr_patterns, sizeof(*plan.matched));
+	plan.buffer = malloc(PLAN_CHUNK);
+	if (!plan.matched || !plan.buffer) {
+		free(plan.matched);
+		free(plan.buffer);
+		return -ENOMEM;
+	}
+
+	plan_scan(&plan);
+	plan_drain(&plan);
+
+	for (i = 0; i < nr_patterns; i++) {
+		if (plan.matched[i])
+			continue;
+		fprintf(stderr, "ERROR: image file \"%s\" not found\n",
+			patterns[i]);
+		ret = -ENOENT;
+	}
+
+	free(plan.ranges);
+	free(plan.matched);
+	free(plan.buffer);
+
+	return ret;
+}
+
+struct extract_files {
+	const char *outdir;
+	bool verbose;
+	enum sparse_format sparse;
+	int ret;			/* -EINVAL once an output failed */
+};
+
+/*
+ * The name comes from the image, and '*' matches '/' as well: a name that
+ * would leave @outdir ("../x", "a/b", "..") is refused.
+ */
+static bool extract_name_ok(const char *basename)
+{
+	return *basename && !strchr(basename, '/') &&
+	       strcmp(basename, ".") && strcmp(basename, "..");
+}
+
+/* one file per component, named after it, without the "fit:" prefix */
+static void *extract_open(void *arg, const struct plan_component *comp)
+{
+	struct extract_files *x = arg;
+	const char *basename;
+	char *path;
+	FILE *outf;
+
+	basename = strrchr(comp->name, ':');
+	basename = basename ? basename + 1 : comp->name;
+	if (!extract_name_ok(basename)) {
+		fprintf(stderr, "ERROR: refusing to write \"%s\"\n",
+			comp->name);
+		x->ret = -EINVAL;
+		return NULL;
+	}
+	if (asprintf(&path, "%s/%s", x->outdir, basename) < 0) {
+		x->ret = -ENOMEM;
+		return NULL;
+	}
+	outf = fopen(path, "wb");
+	if (!outf) {
+		perror(path);
+		x->ret = -EINVAL;
+	} else {
+		outf = sparse_open(outf, x->sparse);
+	}
+	free(path);
+
+	return outf;
+}
+
+static void extract_write(void *arg, void *sink, const void *data,
+			  size_t len)
+{
+	fwrite(data, 1, len, sink);
+}
+
+static void extract_close(void *arg, void *sink,
+			  const struct plan_component *comp)
+{
+	struct extract_files *x = arg;
+
+	fclose(sink);
+	if (x->verbose)
+		fprintf(stderr, "%s: %"PRIu64" bytes @ 0x%08"PRIx64"\n",
+			comp->name, comp->size, comp->start);
+}
+
+/*
+ * extract_images() - extract several components in one pass
+ * @ctx: context with the input file, ctx->verbose reports every extracted
+ *       component on stderr
+ * @patterns: component names, as shell wildcard patterns (e.g. "wty:*.fex")
+ * @nr_patterns: number of entries in @patterns
+ * @outdir: directory to create the output files in, named after the
+ *          component (without the "fit:" or "wty:" prefix)
+ * @sparse: whether to write zero blocks as holes, or Android sparse images
+ *
+ * Components whose name would put the file outside of @outdir (containing
+ * a '/', or "." or "..") are not written.
+ *
+ * Return: 0 if every pattern matched a component, -ENOENT otherwise, or
+ *         -EINVAL if a component was refused or its file not created
+ */
+int extract_images(struct sunxi_ctx *ctx, const char **patterns,
+		   int nr_patterns, const char *outdir,
+		   enum sparse_format sparse)
+{
+	static const struct plan_ops extract_ops = {
+		.open = extract_open,
+		.write = extract_write,
+		.close = extract_close,
+	};
+	struct extract_files x = {
+		.outdir = outdir,
+		.verbose = ctx->verbose,
+		.sparse = sparse,
+	};
+	int ret;
+
+	ret = plan_components(ctx, patterns, nr_patterns, &extract_ops, &x);
+
+	return ret ? ret : x.ret;
+}
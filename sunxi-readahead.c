@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-readahead: read pipes and decompressed streams ahead of the parsers
+ *
+ * Inputs that can only be read front to back are read by a thread of their
+ * own, into a ring buffer, while the decoders (and copy_file()) work on what
+ * has arrived already. This way a slow producer (a decompressor, a USB card
+ * reader behind dd, or the xz decoder in sunxi-unpack.c) keeps running
+ * while we compute checksums or write out data, instead of both sides
+ * taking turns. The ring is handed out as a stdio stream, see
+ * fopencookie(3), so nothing above the input layer notices.
+ */
+
+#define _GNU_SOURCE			/* for fopencookie() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "sunxi-fw.h"
+
+/* hand out data early, instead of waiting for a huge read to complete */
+#define READAHEAD_CHUNK		(128 * 1024)
+
+struct readahead {
+	FILE *inf;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;		/* data arrived, or EOF */
+	pthread_cond_t drained;		/* room for more data, or stop */
+	char *ring;
+	size_t size;
+	size_t head;			/* next byte to hand out */
+	size_t count;			/* bytes in the ring */
+	uint64_t pos;			/* stream position of head */
+	bool threaded;			/* false: read in lock-step after all */
+	bool eof, stop;
+	int error;			/* errno of a failed read */
+};
+
+static void *readahead_thread(void *arg)
+{
+	struct readahead *ra = arg;
+	size_t tail, chunk, len;
+
+	pthread_mutex_lock(&ra->lock);
+	while (!ra->stop && !ra->eof) {
+		if (ra->count == ra->size) {
+			pthread_cond_wait(&ra->drained, &ra->lock);
+			continue;
+		}
+
+		/* the free part up to the end of the ring, the consumer stays out */
+		tail = (ra->head + ra->count) % ra->size;
+		chunk = ra->size - ra->count;
+		if (chunk > ra->size - tail)
+			chunk = ra->size - tail;
+		if (chunk > READAHEAD_CHUNK)
+			chunk = READAHEAD_CHUNK;
+		pthread_mutex_unlock(&ra->lock);
+
+		len = fread(ra->ring + tail, 1, chunk, ra->inf);
+
+		pthread_mutex_lock(&ra->lock);
+		ra->count += len;
+		if (len < chunk) {
+			ra->eof = true;
+			if (ferror(ra->inf))
+				ra->error = errno ? errno : EIO;
+		}
+		pthread_cond_signal(&ra->filled);
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+/*
+ * readahead_take() - consume up to @size bytes from the ring
+ * @ra: read-ahead state
+ * @buf: where to copy the data to, NULL to drop it
+ * @size: maximum number of bytes
+ *
+ * Return: number of bytes consumed, 0 at EOF, -1 on a read error
+ */
+static ssize_t readahead_take(struct readahead *ra, char *buf, size_t size)
+{
+	size_t len;
+
+	if (!ra->threaded) {
+		if (!buf) {
+			buf = ra->ring;
+			if (size > ra->size)
+				size = ra->size;
+		}
+		len = fread(buf, 1, size, ra->inf);
+		ra->pos += len;
+		return len || !ferror(ra->inf) ? (ssize_t)len : -1;
+	}
+
+	pthread_mutex_lock(&ra->lock);
+	while (!ra->count && !ra->eof)
+		pthread_cond_wait(&ra->filled, &ra->lock);
+
+	if (!ra->count) {
+		pthread_mutex_unlock(&ra->lock);
+		if (ra->error) {
+			errno = ra->error;
+			return -1;
+		}
+		return 0;
+	}
+
+	len = ra->count;
+	if (len > ra->size - ra->head)
+		len = ra->size - ra->head;
+	if (len > size)
+		len = size;
+	pthread_mutex_unlock(&ra->lock);
+
+	/* the filled part is ours, the reader thread does not touch it */
+	if (buf)
+		memcpy(buf, ra->ring + ra->head, len);
+
+	pthread_mutex_lock(&ra->lock);
+	ra->head = (ra->head + len) % ra->size;
+	ra->count -= len;
+	ra->pos += len;
+	pthread_cond_signal(&ra->drained);
+	pthread_mutex_unlock(&ra->lock);
+
+	return len;
+}
+
+static ssize_t readahead_read(void *cookie, char *buf, size_t size)
+{
+	return readahead_take(cookie, buf, size);
+}
+
+/* forward only, by dropping data, like pseek() does on pipes */
+static int readahead_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct readahead *ra = cookie;
+	uint64_t target;
+	ssize_t ret;
+
+	switch (whence) {
+	case SEEK_SET:
+		target = *offset;
+		break;
+	case SEEK_CUR:
+		target = ra->pos + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (target < ra->pos) {
+		errno = ESPIPE;
+		return -1;
+	}
+
+	while (ra->pos < target) {
+		ret = readahead_take(ra, NULL, target - ra->pos);
+		if (ret < 0)
+			return -1;
+		if (!ret)
+			break;
+	}
+
+	*offset = ra->pos;
+
+	return 0;
+}
+
+static void readahead_free(struct readahead *ra)
+{
+	pthread_cond_destroy(&ra->drained);
+	pthread_cond_destroy(&ra->filled);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra->ring);
+	free(ra);
+}
+
+static int readahead_close(void *cookie)
+{
+	struct readahead *ra = cookie;
+	int ret;
+
+	if (ra->threaded) {
+		pthread_mutex_lock(&ra->lock);
+		ra->stop = true;
+		pthread_cond_signal(&ra->drained);
+		pthread_mutex_unlock(&ra->lock);
+		pthread_join(ra->thread, NULL);
+	}
+
+	ret = fclose(ra->inf);
+	readahead_free(ra);
+
+	return ret;
+}
+
+/*
+ * input_readahead() - read a stream from a thread, ahead of its consumer
+ * @inf: input stream, at the position to start reading from
+ * @size: size of the ring buffer
+ *
+ * Seeking the returned stream forward drops the data in between, backward
+ * seeks fail with ESPIPE. The reader thread stops once the ring is full, so
+ * at most @size bytes are read that are never asked for. Closing the stream
+ * waits for the read in progress, so it can block on a stalled producer.
+ *
+ * Return: a stream that reads @inf ahead, and closes it when being closed
+ *         itself, or @inf itself if out of memory
+ */
+FILE *input_readahead(FILE *inf, size_t size)
+{
+	static const cookie_io_functions_t readahead_io = {
+		.read = readahead_read,
+		.seek = readahead_seek,
+		.close = readahead_close,
+	};
+	struct readahead *ra;
+	FILE *f;
+
+	ra = calloc(1, sizeof(*ra));
+	if (!ra)
+		return inf;
+	ra->inf = inf;
+	ra->size = size;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->filled, NULL);
+	pthread_cond_init(&ra->drained, NULL);
+
+	ra->ring = malloc(size);
+	if (!ra->ring) {
+		readahead_free(ra);
+		return inf;
+	}
+
+	f = fopencookie(ra, "rb", readahead_io);
+	if (!f) {
+		readahead_free(ra);
+		return inf;
+	}
+
+	/* no thread, no overlap, but still a working stream */
+	ra->threaded = !pthread_create(&ra->thread, NULL, readahead_thread, ra);
+
+	return f;
+}
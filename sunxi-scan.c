@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-scan: skip quickly over sectors that don't hold a component header
+ *
+ * Most of a disk image is file system data. Instead of running every
+ * sector through identify_image(), a quick test compares the first word
+ * of a sector against all known magics at once, and checks the few magics
+ * at other positions. Only the sectors passing this test are handed to
+ * the decoders. Mapped inputs are searched in place.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "sunxi-fw.h"
+
+#define GPT_MAGIC	0x20494645		// "EFI "
+
+/* big endian magics, as they appear in memory (usable as case labels) */
+#define BE32(x)		__builtin_bswap32(x)
+
+typedef bool (*sector_test_fn)(const void *sector);
+
+/* everything identify_image() looks at, apart from the first word */
+static bool maybe_header_rest(const void *sector, uint32_t word0)
+{
+	const unsigned char *bytes = sector;
+	uint32_t word1, word4;
+
+	if (bytes[510] == 0x55 && bytes[511] == 0xaa)
+		return true;
+
+	memcpy(&word1, bytes + 4, sizeof(word1));
+	memcpy(&word4, bytes + 16, sizeof(word4));
+
+	return word0 == GPT_MAGIC || word1 == EGON_MAGIC1 ||
+	       word4 == AML_MAGIC;
+}
+
+static bool maybe_header_scalar(const void *sector)
+{
+	uint32_t word0;
+
+	memcpy(&word0, sector, sizeof(word0));
+
+	switch (word0) {
+	case BE32(IMAGEWTY_MAGIC1):
+	case BE32(FDT_MAGIC):
+	case BE32(IH_MAGIC):
+	case TOC0_MAGIC1:
+	case RK_IDBL_RC4:
+	case RK_SIG_RK32:
+	case RK_SIG_RK33:
+	case AML_MAGIC:
+		return true;
+	}
+
+	return maybe_header_rest(sector, word0);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static bool maybe_header_sse2(const void *sector)
+{
+	const __m128i magics_lo = _mm_set_epi32(BE32(IMAGEWTY_MAGIC1),
+						BE32(FDT_MAGIC),
+						BE32(IH_MAGIC), TOC0_MAGIC1);
+	const __m128i magics_hi = _mm_set_epi32(RK_IDBL_RC4, RK_SIG_RK32,
+						RK_SIG_RK33, AML_MAGIC);
+	uint32_t word0;
+	__m128i word, hit;
+
+	memcpy(&word0, sector, sizeof(word0));
+	word = _mm_set1_epi32(word0);
+	hit = _mm_or_si128(_mm_cmpeq_epi32(word, magics_lo),
+			   _mm_cmpeq_epi32(word, magics_hi));
+	if (_mm_movemask_epi8(hit))
+		return true;
+
+	return maybe_header_rest(sector, word0);
+}
+#elif defined(__aarch64__)
+static bool maybe_header_neon(const void *sector)
+{
+	const uint32_t magics[8] = {
+		BE32(IMAGEWTY_MAGIC1), BE32(FDT_MAGIC), BE32(IH_MAGIC),
+		TOC0_MAGIC1, RK_IDBL_RC4, RK_SIG_RK32, RK_SIG_RK33, AML_MAGIC,
+	};
+	uint32_t word0;
+	uint32x4_t word, hit;
+
+	memcpy(&word0, sector, sizeof(word0));
+	word = vdupq_n_u32(word0);
+	hit = vorrq_u32(vceqq_u32(word, vld1q_u32(magics)),
+			vceqq_u32(word, vld1q_u32(magics + 4)));
+	if (vmaxvq_u32(hit))
+		return true;
+
+	return maybe_header_rest(sector, word0);
+}
+#endif
+
+static sector_test_fn maybe_header = maybe_header_scalar;
+
+/*
+ * once at startup, not on every scan_sectors() call, and the same for the
+ * checksums: they are summed up in chunks
+ */
+static void __attribute__((constructor)) select_sector_test(void)
+{
+#ifdef HAVE_X86_SIMD
+	/* constructors may run before the libgcc one that fills this in */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		maybe_header = maybe_header_sse2;
+#elif defined(__aarch64__)
+	maybe_header = maybe_header_neon;
+#endif
+	select_checksums();
+}
+
+/*
+ * leave_partitions() - jump over the partition we are in, if any
+ * @ctx: context with the partition list
+ * @limit: set to the offset where the next partition starts, UINT64_MAX
+ *         if there is none, or if the partitions are scanned as well (and
+ *         the scan isn't limited to the gap)
+ *
+ * Return: 0 if scanning can go on, -ENOENT if the scan is limited to the
+ *         gap before the first partition and this has been left, negative
+ *         error value otherwise
+ */
+static int leave_partitions(struct sunxi_ctx *ctx, uint64_t *limit)
+{
+	bool moved;
+	int i, ret;
+
+	*limit = UINT64_MAX;
+	if (ctx->scan_parts) {
+		if (ctx->gap_only && ctx->pos < ctx->first_part)
+			*limit = ctx->first_part;
+		goto out;
+	}
+
+	do {
+		moved = false;
+		*limit = UINT64_MAX;
+		for (i = 0; i < ctx->nr_parts; i++) {
+			struct part_extent *part = &ctx->parts[i];
+
+			if (ctx->pos >= part->start && ctx->pos < part->end) {
+				ret = pseek(ctx, part->end - ctx->pos);
+				if (ret)
+					return ret;
+				moved = true;
+			} else if (part->start > ctx->pos &&
+				   part->start < *limit) {
+				*limit = part->start;
+			}
+		}
+	} while (moved);
+
+out:
+	if (ctx->gap_only && ctx->first_part && ctx->pos >= ctx->first_part)
+		return -ENOENT;
+
+	return 0;
+}
+
+/*
+ * scan_sectors() - find the next sector that might hold a component header
+ * @ctx: context, the search starts at the current position
+ * @buffer: buffer of 512 bytes, used for unmapped input
+ *
+ * Skips all sectors that certainly don't start with one of the headers
+ * identify_image() knows about, and the partitions recorded from the
+ * partition table. Sectors that pass might still turn out to be
+ * IMAGE_UNKNOWN.
+ *
+ * Return: pointer to the candidate sector, which has been consumed like
+ *         input_read() does, or NULL at the end of the input
+ */
+void *scan_sectors(struct sunxi_ctx *ctx, void *buffer)
+{
+	uint64_t limit;
+	void *sector;
+
+	stats_phase(ctx, IMAGE_UNKNOWN);
+	if (leave_partitions(ctx, &limit))
+		return NULL;
+
+	do {
+		if (ctx->pos >= limit && leave_partitions(ctx, &limit))
+			return NULL;
+
+		if (ctx->map_base) {
+			if (ctx->pos + 512 > ctx->map_size)
+				return NULL;
+			sector = ctx->map_base + ctx->pos;
+			ctx->pos += 512;
+			STATS_ADD(ctx, bytes_read, 512);
+		} else {
+			sector = input_read(ctx, buffer, 512);
+			if (!sector)
+				return NULL;
+		}
+	} while (!maybe_header(sector));
+
+	return sector;
+}
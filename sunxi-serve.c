@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-serve: answer info, verify and extract requests on a Unix socket
+ *
+ * A flashing station that runs sunxi-fw for every card plugged in pays
+ * for starting it each time, and for looking at the cards one after the
+ * other. "sunxi-fw serve" stays around instead, with the command line
+ * options applying to every request, and the result cache (--cache) and
+ * a pool of worker threads (-j) shared by all of them. Each connection
+ * carries one request, a line of whitespace separated words:
+ *
+ *	info <file>
+ *	verify <file> [name...]
+ *	extract <file> <outdir> <name>...
+ *
+ * and gets back what the command would print on stdout, followed by a
+ * "status: <exit code>" line, before the connection is closed. Requests of
+ * more than SERVE_LINE_MAX bytes or SERVE_MAX_ARGS words are refused. Errors and
+ * the files written by extract are logged on the stderr of the server.
+ */
+
+#define _GNU_SOURCE			/* for accept4() and ppoll() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "sunxi-fw.h"
+
+#define SERVE_QUEUE	64		/* accepted, but not picked up yet */
+#define SERVE_LINE_MAX	4096
+#define SERVE_MAX_ARGS	64
+#define SERVE_TIMEOUT	10		/* seconds to wait for a request */
+
+struct serve {
+	const struct info_options *opts;
+	int queue[SERVE_QUEUE];
+	int head, nr_queued;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t ready, space;
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int signal)
+{
+	serve_stop = 1;
+}
+
+/* verify and extract, on a context of their own */
+static int serve_components(struct serve *s, FILE *out, char **args,
+			    int nr_args)
+{
+	const struct info_options *opts = s->opts;
+	bool extract = !strcmp(args[0], "extract");
+	struct sunxi_ctx *ctx;
+	FILE *inf;
+	int ret;
+
+	if (extract && nr_args < 4) {
+		fprintf(out, "usage: extract <file> <outdir> <name>...\n");
+		return -EINVAL;
+	}
+
+	inf = input_open(args[1], opts->direct);
+	if (inf)
+		inf = input_unpack(inf, opts->readahead);
+	if (!inf) {
+		ret = -errno;
+		fprintf(out, "%s: %s\n", args[1], strerror(-ret));
+		return ret;
+	}
+
+	/* the scratch buffer is better off on the heap, per thread */
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx) {
+		fclose(inf);
+		return -ENOMEM;
+	}
+	sunxi_ctx_init(ctx, inf, out, opts->verbose);
+	ctx->gap_only = opts->gap_only;
+	ctx->scan_parts = opts->scan_parts;
+	ctx->only = opts->only;
+	ctx->board = board_lookup(opts->board);
+
+	if (extract)
+		ret = extract_images(ctx, (const char **)args + 3,
+				     nr_args - 3, args[2], opts->sparse);
+	else
+		ret = verify_images(ctx, (const char **)args + 2,
+				    nr_args - 2);
+
+	sunxi_ctx_release(ctx);
+	free(ctx);
+	fclose(inf);
+
+	return ret;
+}
+
+static void serve_client(struct serve *s, int fd)
+{
+	char line[SERVE_LINE_MAX], *args[SERVE_MAX_ARGS], *arg, *save;
+	struct timeval timeout = { .tv_sec = SERVE_TIMEOUT };
+	int nr_args = 0, ret = -EINVAL;
+	bool too_long = false, too_many = false;
+	FILE *in, *out;
+	int outfd;
+
+	outfd = dup(fd);
+	in = fdopen(fd, "r");
+	out = outfd >= 0 ? fdopen(outfd, "w") : NULL;
+	if (!in || !out) {
+		if (in)
+			fclose(in);
+		else
+			close(fd);
+		if (out)
+			fclose(out);
+		else if (outfd >= 0)
+			close(outfd);
+		return;
+	}
+
+	/* a client that never says anything does not keep a worker */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	/* no more than SERVE_LINE_MAX, however long the client goes on */
+	if (fgets(line, sizeof(line), in)) {
+		too_long = !strchr(line, '\n') &&
+			   strlen(line) == sizeof(line) - 1;
+		arg = too_long ? NULL : strtok_r(line, " \t\r\n", &save);
+		while (arg && nr_args < SERVE_MAX_ARGS) {
+			args[nr_args++] = arg;
+			arg = strtok_r(NULL, " \t\r\n", &save);
+		}
+		too_many = arg != NULL;
+	}
+
+	if (too_long) {
+		fprintf(out, "request too long\n");
+	} else if (too_many) {
+		fprintf(out, "too many arguments\n");
+		ret = -E2BIG;
+	} else if (nr_args < 2) {
+		fprintf(out, "usage: info|verify|extract <file> ...\n");
+	} else if (!strcmp(args[0], "info") && nr_args == 2) {
+		ret = info_file(args[1], out, s->opts);
+	} else if (!strcmp(args[0], "verify") ||
+		   !strcmp(args[0], "extract")) {
+		ret = serve_components(s, out, args, nr_args);
+	} else {
+		fprintf(out, "unknown request \"%s\"\n", args[0]);
+	}
+
+	fprintf(out, "status: %d\n", ret ? 2 : 0);
+	if (s->opts->verbose)
+		fprintf(stderr, "%s %s: %s\n", nr_args ? args[0] : "-",
+			nr_args > 1 ? args[1] : "-",
+			ret ? strerror(-ret) : "ok");
+
+	fclose(out);
+	fclose(in);
+}
+
+static void *serve_worker(void *arg)
+{
+	struct serve *s = arg;
+	int fd;
+
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		while (!s->nr_queued && !s->stop)
+			pthread_cond_wait(&s->ready, &s->lock);
+		if (!s->nr_queued) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		fd = s->queue[s->head];
+		s->head = (s->head + 1) % SERVE_QUEUE;
+		s->nr_queued--;
+		pthread_cond_signal(&s->space);
+		pthread_mutex_unlock(&s->lock);
+
+		serve_client(s, fd);
+	}
+
+	return NULL;
+}
+
+static int serve_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, path);
+
+	/* left behind by an earlier run */
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	/* accept() must not block after ppoll(), if the client is gone */
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -errno;
+	}
+
+	/* whoever can connect can read devices, and write files */
+	mask = umask(077);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (ret || listen(fd, SERVE_QUEUE)) {
+		ret = -errno;
+		perror(path);
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+/*
+ * serve_requests() - answer requests on a Unix socket, until SIGINT/SIGTERM
+ * @path: socket to create, only accessible by the owner
+ * @nr_threads: number of requests handled at the same time
+ * @opts: options for all requests, opts->verbose logs them on stderr
+ *
+ * Return: 0 when stopped by a signal, negative error value otherwise
+ */
+int serve_requests(const char *path, int nr_threads,
+		   const struct info_options *opts)
+{
+	struct serve s = { .opts = opts };
+	struct sigaction sa = { .sa_handler = serve_signal };
+	struct pollfd pfd = { .events = POLLIN };
+	pthread_t *threads;
+	sigset_t signals, unblocked, saved;
+	int i, fd, listen_fd, nr_started, ret = 0;
+
+	if (nr_threads < 1)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return -ENOMEM;
+
+	listen_fd = serve_listen(path);
+	if (listen_fd < 0) {
+		free(threads);
+		return listen_fd;
+	}
+
+	/* no SA_RESTART, so ppoll() returns on a signal */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* clients hanging up early are not our problem */
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.ready, NULL);
+	pthread_cond_init(&s.space, NULL);
+
+	/*
+	 * The signals go to this thread, which is the one in ppoll(), and
+	 * they are only let through while it waits there: one that arrives
+	 * between the check of serve_stop and ppoll() is taken by ppoll(),
+	 * instead of waiting for the next client.
+	 */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &saved);
+	for (nr_started = 0; nr_started < nr_threads; nr_started++)
+		if (pthread_create(&threads[nr_started], NULL, serve_worker,
+				   &s))
+			break;
+	if (!nr_started) {
+		ret = -EAGAIN;
+		serve_stop = 1;
+	}
+	unblocked = saved;
+	sigdelset(&unblocked, SIGINT);
+	sigdelset(&unblocked, SIGTERM);
+
+	pfd.fd = listen_fd;
+	while (!serve_stop) {
+		if (ppoll(&pfd, 1, NULL, &unblocked) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			perror("poll");
+			break;
+		}
+
+		fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED ||
+			    errno == EAGAIN)
+				continue;
+			ret = -errno;
+			perror("accept");
+			break;
+		}
+
+		pthread_mutex_lock(&s.lock);
+		while (s.nr_queued == SERVE_QUEUE)
+			pthread_cond_wait(&s.space, &s.lock);
+		s.queue[(s.head + s.nr_queued++) % SERVE_QUEUE] = fd;
+		pthread_cond_signal(&s.ready);
+		pthread_mutex_unlock(&s.lock);
+	}
+
+	/* the requests accepted so far are still answered */
+	pthread_mutex_lock(&s.lock);
+	s.stop = true;
+	pthread_cond_broadcast(&s.ready);
+	pthread_mutex_unlock(&s.lock);
+	for (i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	close(listen_fd);
+	unlink(path);
+	pthread_cond_destroy(&s.space);
+	pthread_cond_destroy(&s.ready);
+	pthread_mutex_destroy(&s.lock);
+	free(threads);
+
+	return ret;
+}
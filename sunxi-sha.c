@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-sha: SHA-1 and SHA-256, as used in the hash nodes of FIT images
+ *
+ * Plain FIPS 180-4, fed in arbitrary pieces. This is not meant to be fast
+ * or constant time, just to spare a dependency on a crypto library for
+ * checking what mkimage wrote.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sunxi-fw.h"
+
+static inline uint32_t rol32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t ror32(uint32_t x, int r)
+{
+	return (x >> r) | (x << (32 - r));
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void sha1_block(struct sha_ctx *sha, const uint8_t *block)
+{
+	uint32_t w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = load_be32(block + i * 4);
+	for (; i < 80; i++)
+		w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = sha->state[0];
+	b = sha->state[1];
+	c = sha->state[2];
+	d = sha->state[3];
+	e = sha->state[4];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = rol32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol32(b, 30);
+		b = a;
+		a = t;
+	}
+
+	sha->state[0] += a;
+	sha->state[1] += b;
+	sha->state[2] += c;
+	sha->state[3] += d;
+	sha->state[4] += e;
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_block(struct sha_ctx *sha, const uint8_t *block)
+{
+	uint32_t w[64], s[8], s0, s1, ch, maj, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = load_be32(block + i * 4);
+	for (; i < 64; i++) {
+		s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^
+		     (w[i - 15] >> 3);
+		s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^
+		     (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, sha->state, sizeof(s));
+
+	for (i = 0; i < 64; i++) {
+		s1 = ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25);
+		ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+		t1 = s[7] + s1 + ch + sha256_k[i] + w[i];
+		s0 = ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22);
+		maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+		t2 = s0 + maj;
+
+		memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		sha->state[i] += s[i];
+}
+
+/*
+ * sha_init() - start a SHA-1 or SHA-256 digest
+ * @sha: digest state
+ * @bits: 1 for SHA-1, 256 for SHA-256
+ */
+void sha_init(struct sha_ctx *sha, int bits)
+{
+	static const uint32_t sha1_iv[5] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0,
+	};
+	static const uint32_t sha256_iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memset(sha, 0, sizeof(*sha));
+	if (bits == 1) {
+		memcpy(sha->state, sha1_iv, sizeof(sha1_iv));
+		sha->digest_len = SHA1_DIGEST_SIZE;
+	} else {
+		memcpy(sha->state, sha256_iv, sizeof(sha256_iv));
+		sha->digest_len = SHA256_DIGEST_SIZE;
+	}
+}
+
+static void sha_block(struct sha_ctx *sha, const uint8_t *block)
+{
+	if (sha->digest_len == SHA1_DIGEST_SIZE)
+		sha1_block(sha, block);
+	else
+		sha256_block(sha, block);
+}
+
+void sha_update(struct sha_ctx *sha, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+	size_t chunk;
+
+	sha->length += length;
+
+	if (sha->fill) {
+		chunk = SHA_BLOCK_SIZE - sha->fill;
+		if (chunk > length)
+			chunk = length;
+		memcpy(sha->block + sha->fill, p, chunk);
+		sha->fill += chunk;
+		p += chunk;
+		length -= chunk;
+		if (sha->fill < SHA_BLOCK_SIZE)
+			return;
+		sha_block(sha, sha->block);
+		sha->fill = 0;
+	}
+
+	for (; length >= SHA_BLOCK_SIZE; length -= SHA_BLOCK_SIZE) {
+		sha_block(sha, p);
+		p += SHA_BLOCK_SIZE;
+	}
+
+	memcpy(sha->block, p, length);
+	sha->fill = length;
+}
+
+/*
+ * sha_final() - finish a digest
+ * @sha: digest state, not usable afterwards
+ * @digest: SHA1_DIGEST_SIZE or SHA256_DIGEST_SIZE bytes, see sha_init()
+ */
+void sha_final(struct sha_ctx *sha, uint8_t *digest)
+{
+	uint64_t bits = sha->length * 8;
+	int i;
+
+	sha->block[sha->fill++] = 0x80;
+	if (sha->fill > SHA_BLOCK_SIZE - 8) {
+		memset(sha->block + sha->fill, 0, SHA_BLOCK_SIZE - sha->fill);
+		sha_block(sha, sha->block);
+		sha->fill = 0;
+	}
+	memset(sha->block + sha->fill, 0, SHA_BLOCK_SIZE - 8 - sha->fill);
+	store_be32(sha->block + SHA_BLOCK_SIZE - 8, bits >> 32);
+	store_be32(sha->block + SHA_BLOCK_SIZE - 4, bits);
+	sha_block(sha, sha->block);
+
+	for (i = 0; i < sha->digest_len / 4; i++)
+		store_be32(digest + i * 4, sha->state[i]);
+}
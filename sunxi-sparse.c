@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-sparse: write extracted components as sparse files
+ *
+ * PhoenixSuite partition images (rootfs.fex, super.fex, ...) are mostly
+ * empty, and writing them out block by block fills up disks with zeroes.
+ * The output is replaced by a stdio stream (see fopencookie(3)), which
+ * looks at the data in blocks of SPARSE_BLOCK bytes, so copy_file() and
+ * the extract code don't know the difference. Zero blocks either become
+ * holes in the output file, or the whole output is written in the Android
+ * sparse format, as understood by fastboot and simg2img.
+ */
+
+#define _GNU_SOURCE			/* for fopencookie(), fallocate() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+
+#include "sunxi-fw.h"
+
+#define SPARSE_BLOCK		4096
+
+/* Android sparse format, see libsparse/sparse_format.h */
+#define ASPARSE_MAGIC		0xed26ff3a
+#define ASPARSE_RAW		0xcac1
+#define ASPARSE_FILL		0xcac2
+#define ASPARSE_HEADER_SIZE	28
+#define ASPARSE_CHUNK_SIZE	12
+/* keep the chunk size in bytes, including the header, within 32 bits */
+#define ASPARSE_MAX_RAW		((1U << 30) / SPARSE_BLOCK)
+
+struct asparse_header {
+	uint32_t magic;
+	uint16_t major_version;
+	uint16_t minor_version;
+	uint16_t file_hdr_sz;
+	uint16_t chunk_hdr_sz;
+	uint32_t blk_sz;
+	uint32_t total_blks;		/* in the output image */
+	uint32_t total_chunks;
+	uint32_t image_checksum;	/* unused, 0 */
+};
+
+struct asparse_chunk {
+	uint16_t chunk_type;
+	uint16_t reserved1;
+	uint32_t chunk_sz;		/* in blocks of the output image */
+	uint32_t total_sz;		/* in bytes, including this header */
+};
+
+struct sparse {
+	FILE *outf;			/* the wrapped stream, closed with us */
+	int fd;
+	enum sparse_format format;
+	off_t start, pos;		/* where the output started, and is */
+	off_t hole;			/* start of the pending hole, or -1 */
+	bool punch;			/* fallocate() works on this file */
+	/* Android: the chunk being written, and the totals so far */
+	uint16_t chunk_type;
+	uint32_t chunk_blocks, fill;
+	off_t chunk_pos;
+	uint32_t total_blocks, total_chunks;
+	size_t nr_block;		/* bytes in @block */
+	unsigned char block[SPARSE_BLOCK];
+};
+
+/*
+ * Returns true if the block is one 32 bit value repeated, which for holes
+ * only counts if it is zero. Comparing the block against itself shifted
+ * by a word is what memcmp() is fast at.
+ */
+static bool sparse_fill(const void *block, uint32_t *value)
+{
+	memcpy(value, block, sizeof(*value));
+
+	return !memcmp(block, block + 4, SPARSE_BLOCK - 4);
+}
+
+static int sparse_pwrite(struct sparse *s, const void *data, size_t len,
+			 off_t pos)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = pwrite(s->fd, data, len, pos);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		data += ret;
+		len -= ret;
+		pos += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * The output file may have been there before (see open_output_file()), so
+ * the hole is punched, and not just seeked over. Without fallocate(), the
+ * zeroes are written after all.
+ */
+static int sparse_flush_hole(struct sparse *s)
+{
+	static const unsigned char zeroes[SPARSE_BLOCK];
+	off_t pos;
+
+	if (s->hole < 0)
+		return 0;
+
+	if (s->punch && fallocate(s->fd, FALLOC_FL_PUNCH_HOLE |
+				  FALLOC_FL_KEEP_SIZE, s->hole,
+				  s->pos - s->hole))
+		s->punch = false;
+	if (!s->punch) {
+		for (pos = s->hole; pos < s->pos; pos += SPARSE_BLOCK)
+			if (sparse_pwrite(s, zeroes, SPARSE_BLOCK, pos))
+				return -1;
+	}
+	s->hole = -1;
+
+	return 0;
+}
+
+static int holes_write(struct sparse *s, const void *data, size_t len)
+{
+	uint32_t value;
+
+	if (len == SPARSE_BLOCK && sparse_fill(data, &value) && !value) {
+		if (s->hole < 0)
+			s->hole = s->pos;
+		s->pos += len;
+		return 0;
+	}
+
+	if (sparse_flush_hole(s) || sparse_pwrite(s, data, len, s->pos))
+		return -1;
+	s->pos += len;
+
+	return 0;
+}
+
+/* ends the current chunk, filling in its header */
+static int asparse_end_chunk(struct sparse *s)
+{
+	struct asparse_chunk chunk = {
+		.chunk_type = s->chunk_type,
+		.chunk_sz = s->chunk_blocks,
+		.total_sz = ASPARSE_CHUNK_SIZE,
+	};
+
+	if (!s->chunk_blocks)
+		return 0;
+
+	if (s->chunk_type == ASPARSE_RAW) {
+		/* the data is there already, behind the header */
+		chunk.total_sz += s->chunk_blocks * SPARSE_BLOCK;
+		if (sparse_pwrite(s, &chunk, sizeof(chunk), s->chunk_pos))
+			return -1;
+	} else {
+		chunk.total_sz += sizeof(s->fill);
+		if (sparse_pwrite(s, &chunk, sizeof(chunk), s->pos) ||
+		    sparse_pwrite(s, &s->fill, sizeof(s->fill),
+				  s->pos + sizeof(chunk)))
+			return -1;
+		s->pos += chunk.total_sz;
+	}
+	s->total_chunks++;
+	s->chunk_blocks = 0;
+
+	return 0;
+}
+
+static int asparse_write(struct sparse *s, const void *block)
+{
+	uint16_t type = ASPARSE_RAW;
+	uint32_t value;
+
+	if (sparse_fill(block, &value))
+		type = ASPARSE_FILL;
+
+	if (s->chunk_blocks && (type != s->chunk_type ||
+	    (type == ASPARSE_FILL && value != s->fill) ||
+	    (type == ASPARSE_RAW && s->chunk_blocks == ASPARSE_MAX_RAW))) {
+		if (asparse_end_chunk(s))
+			return -1;
+	}
+
+	if (!s->chunk_blocks) {
+		s->chunk_type = type;
+		s->fill = value;
+		if (type == ASPARSE_RAW) {
+			/* the header is written once the length is known */
+			s->chunk_pos = s->pos;
+			s->pos += ASPARSE_CHUNK_SIZE;
+		}
+	}
+
+	if (type == ASPARSE_RAW) {
+		if (sparse_pwrite(s, block, SPARSE_BLOCK, s->pos))
+			return -1;
+		s->pos += SPARSE_BLOCK;
+	}
+	s->chunk_blocks++;
+	s->total_blocks++;
+
+	return 0;
+}
+
+static int sparse_block(struct sparse *s, const void *data, size_t len)
+{
+	if (s->format == SPARSE_HOLES)
+		return holes_write(s, data, len);
+
+	/* Android sparse images are whole blocks, padded with zeroes */
+	if (len < SPARSE_BLOCK) {
+		memset(s->block + len, 0, SPARSE_BLOCK - len);
+		data = s->block;
+	}
+
+	return asparse_write(s, data);
+}
+
+static ssize_t sparse_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	struct sparse *s = cookie;
+	size_t done = 0, len;
+
+	while (done < size) {
+		/* complete a block started by an earlier write first */
+		if (s->nr_block || size - done < SPARSE_BLOCK) {
+			len = SPARSE_BLOCK - s->nr_block;
+			if (len > size - done)
+				len = size - done;
+			memcpy(s->block + s->nr_block, buf + done, len);
+			s->nr_block += len;
+			done += len;
+			if (s->nr_block < SPARSE_BLOCK)
+				break;
+			s->nr_block = 0;
+			if (sparse_block(s, s->block, SPARSE_BLOCK))
+				return -1;
+			continue;
+		}
+
+		if (sparse_block(s, buf + done, SPARSE_BLOCK))
+			return -1;
+		done += SPARSE_BLOCK;
+	}
+
+	return size;
+}
+
+static int sparse_cookie_close(void *cookie)
+{
+	struct sparse *s = cookie;
+	struct asparse_header header = {
+		.magic = ASPARSE_MAGIC,
+		.major_version = 1,
+		.file_hdr_sz = ASPARSE_HEADER_SIZE,
+		.chunk_hdr_sz = ASPARSE_CHUNK_SIZE,
+		.blk_sz = SPARSE_BLOCK,
+	};
+	struct stat st;
+	int ret = 0;
+
+	if (s->nr_block && sparse_block(s, s->block, s->nr_block))
+		ret = -1;
+
+	if (s->format == SPARSE_HOLES) {
+		/* a hole at the end may need the file to be extended */
+		if (!ret && (sparse_flush_hole(s) || fstat(s->fd, &st) ||
+			     (st.st_size < s->pos && ftruncate(s->fd, s->pos))))
+			ret = -1;
+	} else {
+		if (!ret && asparse_end_chunk(s))
+			ret = -1;
+		header.total_blks = s->total_blocks;
+		header.total_chunks = s->total_chunks;
+		if (!ret && (sparse_pwrite(s, &header, sizeof(header),
+					   s->start) ||
+			     ftruncate(s->fd, s->pos)))
+			ret = -1;
+	}
+
+	if (ret)
+		perror("sparse output");
+	lseek(s->fd, s->pos, SEEK_SET);
+	if (fclose(s->outf))
+		ret = -1;
+	free(s);
+
+	return ret;
+}
+
+/*
+ * sparse_open() - write a sparse file, or an Android sparse image
+ * @outf: output stream, taken over, and closed with the returned one
+ * @format: SPARSE_HOLES for holes in place of zero blocks, SPARSE_ANDROID
+ *          for an Android sparse image
+ *
+ * Holes need a regular file, anything else (a pipe, a block device) gets
+ * @outf back as it is. An Android sparse image needs to be seekable, to
+ * fill in the chunk headers, and can't go to a pipe.
+ *
+ * Return: the stream to write to, NULL if Android output isn't possible,
+ *         in which case @outf is closed
+ */
+FILE *sparse_open(FILE *outf, enum sparse_format format)
+{
+	static const cookie_io_functions_t sparse_funcs = {
+		.write = sparse_cookie_write,
+		.close = sparse_cookie_close,
+	};
+	struct sparse *s;
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	if (format == SPARSE_NONE)
+		return outf;
+
+	fd = fileno(outf);
+	if (fd < 0 || fflush(outf) || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		if (format == SPARSE_HOLES)
+			return outf;
+		fprintf(stderr, "Android sparse images need a file to write to\n");
+		fclose(outf);
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		fclose(outf);
+		return NULL;
+	}
+	s->outf = outf;
+	s->fd = fd;
+	s->format = format;
+	s->start = lseek(fd, 0, SEEK_CUR);
+	s->pos = s->start;
+	s->hole = -1;
+	s->punch = true;
+	if (format == SPARSE_ANDROID)
+		s->pos += ASPARSE_HEADER_SIZE;
+
+	f = fopencookie(s, "w", sparse_funcs);
+	if (!f) {
+		fclose(outf);
+		free(s);
+		return NULL;
+	}
+	/* whole blocks go straight through, without being copied */
+	setvbuf(f, NULL, _IOFBF, 64 * 1024);
+
+	return f;
+}
+
+/* parses the argument of --sparse, holes without one */
+int parse_sparse_format(const char *str, enum sparse_format *format)
+{
+	if (!str || !strcmp(str, "holes"))
+		*format = SPARSE_HOLES;
+	else if (!strcmp(str, "android"))
+		*format = SPARSE_ANDROID;
+	else
+		return -EINVAL;
+
+	return 0;
+}
@@ -11,11 +11,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <errno.h>
 
 #include "sunxi-fw.h"
 
-#define CHECKSUM_SEED	0x5f0a6c39
-
 struct spl_boot_file_head {
 	uint32_t  jump_instruction;
 	uint8_t	  magic[8];
@@ -45,44 +45,64 @@ static const char *memstr(const char *haystack, const char *needle, size_t size)
 	return NULL;
 }
 
-int output_spl_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+int output_spl_info(struct sunxi_ctx *ctx, void *sector)
 {
 	struct spl_boot_file_head *splhead = sector;
-	uint32_t *buffer, i, chksum = CHECKSUM_SEED;
-	const char *spl_banner;
+	const struct sunxi_board *board = NULL;
+	uint64_t start = ctx->pos - 512;
+	FILE *stream = ctx->out;
+	uint32_t *buffer, chksum;
+	const char *spl_banner, *dt_name;
 	uint32_t length;
 	size_t ret;
 
 	if (splhead->spl_signature[3] >= 2 &&
 	    splhead->offset_dt_name != 0 &&
-	    splhead->offset_dt_name < 512)
-		fprintf(stream, "\tDT: %s\n",
-			(char *)splhead + splhead->offset_dt_name);
+	    splhead->offset_dt_name < 512) {
+		dt_name = (char *)splhead + splhead->offset_dt_name;
+		fprintf(stream, "\tDT: %s\n", dt_name);
+		if (memchr(dt_name, 0, 512 - splhead->offset_dt_name))
+			board = board_lookup(dt_name);
+		if (board)
+			output_board_info(stream, "\t", board, ctx->verbose);
+		/* for a boot0 further on, see output_boot0_info() */
+		if (!ctx->board)
+			ctx->board = board;
+	}
+	board_check_offset(ctx, board ? board : ctx->board, start);
 
+	if (splhead->length < 512 || splhead->length > EGON_MAX_SIZE) {
+		fprintf(stream, "\tERROR: invalid size: %u bytes\n",
+			splhead->length);
+		return -EINVAL;
+	}
 	length = splhead->length > 32768 ? splhead->length : 32768;
 
-	if (!verbose) {
-		pseek(inf, length - 512);
-		return 63;
-	}
+	if (!ctx->verbose)
+		return pseek(ctx, length - 512);
 
 	fprintf(stream, "\tsize: %d bytes\n", splhead->length);
 
-	buffer = malloc(length);
-	if (!buffer)
-		return 0;
-	ret = fread(buffer + (512 / 4), 1, length - 512, inf);
-	if (ret < splhead->length - 512) {
-		fprintf(stream, "\tERROR: image file too small\n");
-		free(buffer);
-
-		return ret / 512;
+	/* For mapped files, use the data in place, including the sector. */
+	buffer = input_window(ctx, -512, length);
+	if (buffer) {
+		pseek(ctx, length - 512);
+	} else {
+		buffer = malloc(length);
+		if (!buffer)
+			return -ENOMEM;
+		stats_alloc(ctx, length);
+		ret = input_fread(ctx, buffer + (512 / 4), length - 512);
+		if (ret < splhead->length - 512) {
+			fprintf(stream, "\tERROR: image file too small\n");
+			free(buffer);
+
+			return -EIO;
+		}
+		memcpy(buffer, sector, 512);
 	}
-	memcpy(buffer, sector, 512);
 
-	for (i = 0; i < splhead->length / 4; i++)
-		if (i != 3)
-			chksum += buffer[i];
+	chksum = egon_checksum(buffer, splhead->length);
 	if (chksum == splhead->check_sum)
 		fprintf(stream, "\teGON checksum matches: 0x%08x\n", chksum);
 	else
@@ -93,19 +113,20 @@ int output_spl_info(void *sector, FILE *inf, FILE *stream, bool verbose)
 	if (spl_banner)
 		fprintf(stream, "\t%s\n", spl_banner);
 
-	free(buffer);
+	if (!input_owns(ctx, buffer))
+		free(buffer);
 
-	return ret / 512;
+	return 0;
 }
 
-int handle_dt_name(FILE *inf, const char *dt_name, FILE *outf)
+int handle_dt_name(struct sunxi_ctx *ctx, const char *dt_name, FILE *outf)
 {
 	struct spl_boot_file_head *splhead;
 	char sector[512];
 	size_t ret;
 	enum image_type type;
 
-	ret = fread(sector, 1, 512, inf);
+	ret = input_fread(ctx, sector, 512);
 	if (ret < 512) {
 		fprintf(stderr, "Cannot read from input file\n");
 		return -3;
@@ -113,9 +134,9 @@ int handle_dt_name(FILE *inf, const char *dt_name, FILE *outf)
 
 	type = identify_image(sector);
 	if (type == IMAGE_MBR) {
-		pseek(inf, 8192 - 512);
+		pseek(ctx, 8192 - 512);
 
-		ret = fread(sector, 1, 512, inf);
+		ret = input_fread(ctx, sector, 512);
 		if (ret < 512) {
 			fprintf(stderr, "Cannot read from input file\n");
 			return -3;
@@ -140,3 +161,91 @@ int handle_dt_name(FILE *inf, const char *dt_name, FILE *outf)
 
 	return 0;
 }
+
+/*
+ * spl_patch_dtname() - change the DT name in an SPL header, in memory
+ * @sector: first sector of a U-Boot SPL, with an eGON header v2 or later
+ * @dt_name: the new name, as in CONFIG_DEFAULT_DEVICE_TREE
+ *
+ * The name goes into the string pool at the end of the header, where
+ * mksunxiboot --default-dt puts it. A name found elsewhere in the sector
+ * is replaced in place, by one not longer than itself. Only the words of
+ * the sector change, so the eGON checksum is corrected by their difference,
+ * without looking at the rest of the SPL. A checksum that was wrong before
+ * stays wrong.
+ *
+ * Return: 0 if successful, -EINVAL if this is no SPLv2 header, or
+ *         -ENOSPC if the name does not fit
+ */
+int spl_patch_dtname(void *sector, const char *dt_name)
+{
+	const uint32_t pool = offsetof(struct spl_boot_file_head, string_pool);
+	struct spl_boot_file_head *splhead = sector;
+	uint32_t offset = splhead->offset_dt_name, space, old[512 / 4];
+
+	if ((identify_image(sector) != IMAGE_SPL2 &&
+	     identify_image(sector) != IMAGE_SPLx) ||
+	    splhead->spl_signature[3] < 2)
+		return -EINVAL;
+
+	/* not set by mksunxiboot, if the build had no default DT */
+	if (!offset)
+		offset = pool;
+	if (offset < pool || offset >= 512)
+		return -EINVAL;
+	if (offset < sizeof(*splhead))
+		space = sizeof(*splhead) - offset;
+	else
+		space = strnlen(sector + offset, 512 - offset - 1) + 1;
+	if (strlen(dt_name) >= space)
+		return -ENOSPC;
+
+	memcpy(old, sector, sizeof(old));
+
+	splhead->offset_dt_name = offset;
+	memset(sector + offset, 0, space);
+	memcpy(sector + offset, dt_name, strlen(dt_name));
+
+	/* everything behind the checksum word, whatever changed */
+	splhead->check_sum = egon_checksum_update(splhead->check_sum, old + 4,
+						  sector + 16, 512 - 16);
+
+	return 0;
+}
+
+static int spl_patch(void *sector, void *arg)
+{
+	int ret = spl_patch_dtname(sector, arg);
+
+	if (ret == -EINVAL)
+		fprintf(stderr, "expecting U-Boot SPLv2 or later\n");
+	else if (ret == -ENOSPC)
+		fprintf(stderr, "DT name too long for the SPL header\n");
+
+	return ret;
+}
+
+/*
+ * spl_set_dtname() - change the DT name in the SPL header of a file, in place
+ * @filename: image file or block device, see patch_in_place()
+ * @dt_name: the new name
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int spl_set_dtname(const char *filename, const char *dt_name)
+{
+	return patch_in_place(filename, spl_patch, (void *)dt_name);
+}
+
+/*
+ * spl_copy_dtname() - copy the input with a changed DT name in the SPL header
+ * @ctx: context with the input file, which can be a pipe
+ * @dt_name: the new name
+ * @outf: output file, gets all of the input
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int spl_copy_dtname(struct sunxi_ctx *ctx, const char *dt_name, FILE *outf)
+{
+	return patch_copy(ctx, IMAGE_SPLx, spl_patch, (void *)dt_name, outf);
+}
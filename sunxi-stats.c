@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-stats: I/O counters and timings per decoder, for "--stats"
+ *
+ * The input primitives (input_*(), pseek(), copy_file()) account every
+ * byte they hand out or skip to the current phase of a context, which is
+ * the type of the component being decoded, or scanning in between. The
+ * time is taken at phase switches only, so this costs next to nothing
+ * while enabled, and a NULL check when not.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "sunxi-fw.h"
+
+static const char *phase_names[NR_STATS_PHASES] = {
+	[IMAGE_UNKNOWN]	 = "scan",
+	[IMAGE_BOOT0]	 = "boot0",
+	[IMAGE_SPLx]	 = "spl",
+	[IMAGE_TOC0]	 = "toc0",
+	[IMAGE_UBOOT]	 = "u-boot",
+	[IMAGE_FIT]	 = "fit",
+	[IMAGE_MBR]	 = "mbr",
+	[IMAGE_GPT]	 = "gpt",
+	[IMAGE_ROCKCHIP] = "rockchip",
+	[IMAGE_AML]	 = "amlogic",
+	[IMAGE_PHOENIX]	 = "wty",
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return 0;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * stats_phase() - account what follows to the decoder for @type
+ * @ctx: context, nothing happens if it has no statistics attached
+ * @type: component type, IMAGE_UNKNOWN (or any error) for scanning
+ *
+ * The time since the last switch goes to the previous phase. The CPU time
+ * is per thread, so this works for the batch mode workers as well.
+ */
+void stats_phase(struct sunxi_ctx *ctx, enum image_type type)
+{
+	struct sunxi_stats *stats = ctx->stats;
+	struct io_stats *phase;
+	uint64_t wall, cpu;
+
+	if (!stats)
+		return;
+
+	wall = clock_ns(CLOCK_MONOTONIC);
+	cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	if (stats->wall_start) {
+		phase = &stats->phase[stats->current];
+		phase->wall_ns += wall - stats->wall_start;
+		phase->cpu_ns += cpu - stats->cpu_start;
+	}
+	stats->wall_start = wall;
+	stats->cpu_start = cpu;
+
+	/* all SPL flavours share the same decoder */
+	if (type == IMAGE_SPL1 || type == IMAGE_SPL2)
+		type = IMAGE_SPLx;
+	if (type >= NR_STATS_PHASES || !phase_names[type])
+		type = IMAGE_UNKNOWN;
+	stats->current = type;
+}
+
+/* count an allocation made on behalf of the current decoder */
+void stats_alloc(struct sunxi_ctx *ctx, size_t size)
+{
+	STATS_ADD(ctx, allocs, 1);
+	STATS_ADD(ctx, alloc_bytes, size);
+}
+
+/* Returns the name of a phase, or NULL if it is not a phase of its own. */
+const char *stats_phase_name(int phase)
+{
+	if (phase < 0 || phase >= NR_STATS_PHASES)
+		return NULL;
+
+	return phase_names[phase];
+}
+
+/* Returns true if anything has been accounted to @phase. */
+bool stats_phase_used(const struct io_stats *phase)
+{
+	return phase->bytes_read || phase->bytes_copied ||
+	       phase->skipped_seek || phase->skipped_read || phase->calls ||
+	       phase->allocs || phase->wall_ns;
+}
+
+/*
+ * stats_report() - print the statistics of a context as a table
+ * @ctx: context, the current phase is closed first
+ * @stream: where to print to, usually stderr
+ */
+void stats_report(struct sunxi_ctx *ctx, FILE *stream)
+{
+	struct sunxi_stats *stats = ctx->stats;
+	const struct io_stats *phase;
+	int i;
+
+	if (!stats)
+		return;
+
+	stats_phase(ctx, IMAGE_UNKNOWN);
+
+	fprintf(stream, "%-8s %12s %12s %12s %12s %8s %8s %10s %10s\n",
+		"phase", "read", "copied", "seeked", "read-skip", "calls",
+		"allocs", "wall ms", "cpu ms");
+	for (i = 0; i < NR_STATS_PHASES; i++) {
+		phase = &stats->phase[i];
+		if (!phase_names[i] || !stats_phase_used(phase))
+			continue;
+
+		fprintf(stream, "%-8s %12llu %12llu %12llu %12llu %8llu %8llu %10.3f %10.3f\n",
+			phase_names[i],
+			(unsigned long long)phase->bytes_read,
+			(unsigned long long)phase->bytes_copied,
+			(unsigned long long)phase->skipped_seek,
+			(unsigned long long)phase->skipped_read,
+			(unsigned long long)phase->calls,
+			(unsigned long long)phase->allocs,
+			phase->wall_ns / 1e6, phase->cpu_ns / 1e6);
+	}
+}
@@ -10,11 +10,10 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "sunxi-fw.h"
 
-#define CHECKSUM_SEED	0x5f0a6c39
-
 struct toc0_header {
 	uint8_t		magic[8];
 	uint32_t	magic2;
@@ -28,18 +27,55 @@ struct toc0_header {
 	char		end_marker[4];
 };
 
-void output_toc0_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+/* checksum the TOC0 image, of which the first sector has been read already */
+static int toc0_checksum(struct sunxi_ctx *ctx, struct toc0_header *toc0head)
+{
+	FILE *stream = ctx->out;
+	uint32_t chksum;
+	int ret;
+
+	ret = egon_checksum_input(ctx, toc0head, toc0head->length, &chksum);
+	if (ret) {
+		if (ret == -EINVAL)
+			fprintf(stream, "\tERROR: invalid size: %u bytes\n",
+				toc0head->length);
+		else
+			fprintf(stream, "\tERROR: image file too small\n");
+		return ret;
+	}
+
+	if (chksum == toc0head->check_sum)
+		fprintf(stream, "\tTOC0 checksum matches: 0x%08x\n", chksum);
+	else
+		fprintf(stream, "\tTOC0 checksum: 0x%08x, programmed: 0x%08x\n",
+			chksum, toc0head->check_sum);
+
+	return 0;
+}
+
+int output_toc0_info(struct sunxi_ctx *ctx, void *sector)
 {
 	struct toc0_header *toc0head = sector;
+	FILE *stream = ctx->out;
+	uint32_t consumed = 512;
+	int ret;
 
-	if (verbose) {
+	board_check_offset(ctx, ctx->board, ctx->pos - 512);
+
+	if (ctx->verbose) {
 		fprintf(stream, "\t%d item%s\n", toc0head->num_items,
 			toc0head->num_items > 1 ? "s" : "");
 		fprintf(stream, "\tsize: %d bytes\n", toc0head->length);
+		if (toc0head->length > 512 && toc0head->length % 4 == 0) {
+			ret = toc0_checksum(ctx, toc0head);
+			if (ret)
+				return ret;
+			consumed = toc0head->length;
+		}
 	}
 
 	if (toc0head->length > 32768)
-		pseek(inf, toc0head->length - 512);
-	else
-		pseek(inf, 32768 - 512);
+		return pseek(ctx, toc0head->length - consumed);
+
+	return pseek(ctx, 32768 - consumed);
 }
@@ -8,37 +8,140 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 #include <arpa/inet.h>			/* for ntohl() */
 
 #include "sunxi-fw.h"
 #define UBOOT_LEGACY_NEED_NAMES
 #include "uboot_legacy.h"
 
-void output_uboot_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+/* the payload bytes in the first sector, behind the header */
+#define UBOOT_HEAD	(512 - sizeof(struct legacy_image_header))
+
+/*
+ * uboot_header_crc() - compute the header CRC of a legacy U-Boot image
+ * @sector: the image header
+ *
+ * Return: the CRC, to be compared against ih_hcrc (after ntohl())
+ */
+uint32_t uboot_header_crc(const void *sector)
+{
+	struct legacy_image_header header;
+
+	/* the CRC is taken with the CRC field cleared */
+	memcpy(&header, sector, sizeof(header));
+	header.ih_hcrc = 0;
+
+	return crc32_ieee(0, &header, sizeof(header));
+}
+
+/*
+ * uboot_data_crc() - compute the data CRC of a legacy U-Boot image
+ * @ctx: context, positioned right behind the first sector of the image
+ * @sector: the first sector of the image, as read already
+ * @crc: set to the CRC, to be compared against ih_dcrc (after ntohl())
+ *
+ * Consumes the rest of the payload. Mapped images are checksummed in
+ * place, other inputs are read in chunks of SCRATCH_SIZE.
+ *
+ * Return: 0 if successful, -EIO if the image is truncated
+ */
+int uboot_data_crc(struct sunxi_ctx *ctx, const void *sector, uint32_t *crc)
+{
+	const struct legacy_image_header *header = sector;
+	uint32_t size = ntohl(header->ih_size), offset, chunk;
+	const void *data;
+
+	if (size <= UBOOT_HEAD) {
+		*crc = crc32_ieee(0, sector + sizeof(*header), size);
+		return 0;
+	}
+
+	data = input_window(ctx, -UBOOT_HEAD, size);
+	if (data) {
+		*crc = crc32_ieee(0, data, size);
+		return pseek(ctx, size - UBOOT_HEAD);
+	}
+
+	*crc = crc32_ieee(0, sector + sizeof(*header), UBOOT_HEAD);
+	for (offset = UBOOT_HEAD; offset < size; offset += chunk) {
+		chunk = size - offset;
+		if (chunk > SCRATCH_SIZE)
+			chunk = SCRATCH_SIZE;
+
+		data = input_read(ctx, ctx->scratch, chunk);
+		if (!data)
+			return -EIO;
+
+		*crc = crc32_ieee(*crc, data, chunk);
+	}
+
+	return 0;
+}
+
+static void output_crc(FILE *stream, const char *what, uint32_t crc,
+		       uint32_t programmed)
+{
+	if (crc == programmed)
+		fprintf(stream, "\t\t%s CRC matches: 0x%08x\n", what, crc);
+	else
+		fprintf(stream, "\t\t%s CRC: 0x%08x, programmed: 0x%08x\n",
+			what, crc, programmed);
+}
+
+/* the header bytes index the name tables, newer values aren't in there */
+#define UBOOT_NAME(table, index) \
+	((index) < sizeof(table) / sizeof(table[0]) ? table[index] : "unknown")
+
+int output_uboot_info(struct sunxi_ctx *ctx, void *sector)
 {
 	struct legacy_image_header *header = sector;
+	FILE *stream = ctx->out;
+	uint32_t crc;
 
 	fprintf(stream, "\t\tsize: %d bytes\n", ntohl(header->ih_size));
-	if (verbose) {
+	if (ctx->verbose) {
 		fprintf(stream, "\t\tOS: %s\n",
-			uboot_legacy_os_type[header->ih_os]);
+			UBOOT_NAME(uboot_legacy_os_type, header->ih_os));
 		fprintf(stream, "\t\tarch: %s\n",
-			uboot_legacy_arch_name[header->ih_arch]);
+			UBOOT_NAME(uboot_legacy_arch_name, header->ih_arch));
 		fprintf(stream, "\t\ttype: %s\n",
-				uboot_legacy_image_type[header->ih_type]);
+			UBOOT_NAME(uboot_legacy_image_type, header->ih_type));
 		fprintf(stream, "\t\tcomp: %d\n", header->ih_comp);
+
+		output_crc(stream, "header", uboot_header_crc(sector),
+			   ntohl(header->ih_hcrc));
+		if (uboot_data_crc(ctx, sector, &crc))
+			fprintf(stream, "\t\tERROR: image file too small\n");
+		else
+			output_crc(stream, "data", crc, ntohl(header->ih_dcrc));
 	}
 	fprintf(stream, "\tu-boot:\tname: %.32s\n", header->ih_name);
+
+	return 0;
 }
 
-void dump_uboot_legacy(void *sector, FILE *inf, FILE *outf, bool payload)
+/* The data CRC is taken on the way, so checking it costs no extra read. */
+void dump_uboot_legacy(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       bool payload)
 {
 	struct legacy_image_header *header = sector;
+	uint32_t size = ntohl(header->ih_size), head, crc;
 
-	if (payload)
-		fwrite(sector + 64, 1, 512 - 64, outf);
-	else
-		fwrite(sector, 1, 512, outf);
+	head = size < UBOOT_HEAD ? size : UBOOT_HEAD;
+	if (!payload)
+		fwrite(sector, 1, sizeof(*header), outf);
+	fwrite(sector + sizeof(*header), 1, head, outf);
+
+	crc = crc32_ieee(0, sector + sizeof(*header), head);
+	if (copy_file_crc(ctx, outf, size - head, &crc) < size - head)
+		fprintf(stderr, "WARNING: u-boot: image file too small\n");
+	else if (crc != ntohl(header->ih_dcrc))
+		fprintf(stderr, "WARNING: u-boot: data CRC 0x%08x, programmed: 0x%08x\n",
+			crc, ntohl(header->ih_dcrc));
 
-	copy_file(inf, outf, ntohl(header->ih_size) - 512 + sizeof(*header));
+	if (uboot_header_crc(sector) != ntohl(header->ih_hcrc))
+		fprintf(stderr, "WARNING: u-boot: header CRC 0x%08x, programmed: 0x%08x\n",
+			uboot_header_crc(sector), ntohl(header->ih_hcrc));
 }
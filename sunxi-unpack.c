@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-unpack: read gzip and xz compressed images, as if they were plain
+ *
+ * A compressed input is replaced by a stdio stream (see fopencookie(3))
+ * that decompresses on the fly, so all the parsers, pseek() and copy_file()
+ * work unchanged. Forward seeks in xz files with more than one block (as
+ * written by "xz -T0", for instance) jump straight to the block containing
+ * the target, using the index at the end of the file. Everything else has
+ * to be decompressed up to the target, but without being copied anywhere.
+ */
+
+#define _GNU_SOURCE			/* for fopencookie() */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include <lzma.h>
+
+#include "sunxi-fw.h"
+
+#define UNPACK_CHUNK	(64 * 1024)
+/* xz -9 needs 65MB to decode, a header asking for more is broken */
+#define UNPACK_XZ_MEMLIMIT	(256 * 1024 * 1024)
+
+enum unpack_format {
+	UNPACK_PLAIN,			/* just hands out the peeked bytes */
+	UNPACK_GZIP,
+	UNPACK_XZ,
+};
+
+struct unpack {
+	FILE *inf;
+	enum unpack_format format;
+	uint64_t pos;			/* uncompressed position */
+	bool eof;
+	unsigned char magic[6];		/* read for detection, from a pipe */
+	int nr_magic, magic_pos;
+	z_stream z;
+	lzma_stream lz;
+	lzma_index *index;		/* xz block index, NULL if unusable */
+	lzma_index_iter block;		/* the block being decoded */
+	lzma_block options;		/* updated by the block decoder */
+	lzma_filter filters[LZMA_FILTERS_MAX + 1];
+	unsigned char in[UNPACK_CHUNK];
+	char discard[UNPACK_CHUNK];	/* for skipping forward */
+};
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+static const unsigned char xz_magic[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+
+/* read compressed data, starting with what has been read for detection */
+static size_t unpack_fill(struct unpack *u, unsigned char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (u->magic_pos < u->nr_magic) {
+		len = u->nr_magic - u->magic_pos;
+		if (len > size)
+			len = size;
+		memcpy(buf, u->magic + u->magic_pos, len);
+		u->magic_pos += len;
+	}
+
+	return len + fread(buf + len, 1, size - len, u->inf);
+}
+
+static ssize_t unpack_gzip(struct unpack *u, char *buf, size_t size)
+{
+	int ret;
+
+	u->z.next_out = (unsigned char *)buf;
+	u->z.avail_out = size;
+
+	while (u->z.avail_out && !u->eof) {
+		if (!u->z.avail_in) {
+			u->z.next_in = u->in;
+			u->z.avail_in = unpack_fill(u, u->in, sizeof(u->in));
+			if (!u->z.avail_in) {
+				u->eof = true;
+				break;
+			}
+		}
+
+		ret = inflate(&u->z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			/* concatenated members, as written by "pigz" */
+			if (inflateReset(&u->z) != Z_OK)
+				return -1;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return size - u->z.avail_out;
+}
+
+/* set up the block decoder for u->block, reading its header */
+static int unpack_xz_block(struct unpack *u)
+{
+	lzma_block *block = &u->options;
+	unsigned char header[LZMA_BLOCK_HEADER_SIZE_MAX];
+
+	if (fseeko(u->inf, u->block.block.compressed_file_offset, SEEK_SET) ||
+	    fread(header, 1, 1, u->inf) != 1)
+		return -EIO;
+
+	memset(block, 0, sizeof(*block));
+	block->version = 1;
+	block->check = u->block.stream.flags->check;
+	block->filters = u->filters;
+	block->header_size = lzma_block_header_size_decode(header[0]);
+	if (fread(header + 1, 1, block->header_size - 1, u->inf) !=
+	    block->header_size - 1)
+		return -EIO;
+
+	lzma_filters_free(u->filters, NULL);
+	if (lzma_block_header_decode(block, NULL, header) != LZMA_OK ||
+	    lzma_block_decoder(&u->lz, block) != LZMA_OK)
+		return -EIO;
+
+	u->lz.avail_in = 0;
+	u->pos = u->block.block.uncompressed_file_offset;
+
+	return 0;
+}
+
+static ssize_t unpack_xz(struct unpack *u, char *buf, size_t size)
+{
+	lzma_ret ret;
+
+	u->lz.next_out = (unsigned char *)buf;
+	u->lz.avail_out = size;
+
+	while (u->lz.avail_out && !u->eof) {
+		if (!u->lz.avail_in) {
+			u->lz.next_in = u->in;
+			u->lz.avail_in = unpack_fill(u, u->in, sizeof(u->in));
+		}
+
+		ret = lzma_code(&u->lz, u->lz.avail_in ? LZMA_RUN : LZMA_FINISH);
+		if (ret == LZMA_STREAM_END && u->index) {
+			/* the next block, if there is one */
+			if (lzma_index_iter_next(&u->block,
+						 LZMA_INDEX_ITER_BLOCK)) {
+				u->eof = true;
+			} else {
+				size_t done = size - u->lz.avail_out;
+
+				if (unpack_xz_block(u)) {
+					errno = EIO;
+					return -1;
+				}
+				u->pos -= done;
+				u->lz.next_out = (unsigned char *)buf + done;
+				u->lz.avail_out = size - done;
+			}
+		} else if (ret == LZMA_STREAM_END) {
+			u->eof = true;
+		} else if (ret != LZMA_OK) {
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return size - u->lz.avail_out;
+}
+
+static ssize_t unpack_read(void *cookie, char *buf, size_t size)
+{
+	struct unpack *u = cookie;
+	ssize_t ret;
+
+	switch (u->format) {
+	case UNPACK_GZIP:
+		ret = unpack_gzip(u, buf, size);
+		break;
+	case UNPACK_XZ:
+		ret = unpack_xz(u, buf, size);
+		break;
+	default:
+		return unpack_fill(u, (unsigned char *)buf, size);
+	}
+
+	if (ret > 0)
+		u->pos += ret;
+
+	return ret;
+}
+
+/* jump to the xz block containing @target, if that gets us further */
+static int unpack_xz_locate(struct unpack *u, uint64_t target)
+{
+	lzma_index_iter iter;
+
+	if (!u->index)
+		return 0;
+
+	lzma_index_iter_init(&iter, u->index);
+	if (lzma_index_iter_locate(&iter, target))
+		return 0;			/* beyond the end */
+	if (iter.block.uncompressed_file_offset <= u->pos &&
+	    target >= u->pos)
+		return 0;			/* in the current block */
+
+	u->block = iter;
+	u->eof = false;
+
+	return unpack_xz_block(u);
+}
+
+static int unpack_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct unpack *u = cookie;
+	uint64_t target;
+	ssize_t ret;
+
+	if (u->format == UNPACK_PLAIN) {
+		errno = ESPIPE;
+		return -1;
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		target = *offset;
+		break;
+	case SEEK_CUR:
+		target = u->pos + *offset;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (u->format == UNPACK_XZ && unpack_xz_locate(u, target)) {
+		errno = EIO;
+		return -1;
+	}
+	if (target < u->pos) {
+		errno = ESPIPE;
+		return -1;
+	}
+
+	/* decompress up to the target, and drop it */
+	while (u->pos < target) {
+		size_t chunk = target - u->pos;
+
+		if (chunk > sizeof(u->discard))
+			chunk = sizeof(u->discard);
+		ret = unpack_read(u, u->discard, chunk);
+		if (ret <= 0)
+			break;
+	}
+
+	*offset = u->pos;
+
+	return 0;
+}
+
+static int unpack_close(void *cookie)
+{
+	struct unpack *u = cookie;
+	int ret;
+
+	if (u->format == UNPACK_GZIP)
+		inflateEnd(&u->z);
+	if (u->format == UNPACK_XZ) {
+		lzma_end(&u->lz);
+		lzma_filters_free(u->filters, NULL);
+		lzma_index_end(u->index, NULL);
+	}
+
+	ret = fclose(u->inf);
+	free(u);
+
+	return ret;
+}
+
+/*
+ * unpack_xz_index() - read the block index from the end of an xz file
+ *
+ * Only files with a single stream are supported, which is what xz writes,
+ * and only if the compressed file is seekable.
+ */
+static lzma_index *unpack_xz_index(FILE *inf)
+{
+	unsigned char footer[LZMA_STREAM_HEADER_SIZE], *buffer;
+	uint64_t memlimit = UNPACK_XZ_MEMLIMIT;
+	lzma_stream_flags flags;
+	lzma_index *index = NULL;
+	size_t in_pos = 0;
+	off_t file_size;
+
+	if (fseeko(inf, 0, SEEK_END))
+		return NULL;
+	file_size = ftello(inf);
+	if (file_size < 2 * LZMA_STREAM_HEADER_SIZE ||
+	    fseeko(inf, -LZMA_STREAM_HEADER_SIZE, SEEK_END) ||
+	    fread(footer, sizeof(footer), 1, inf) != 1 ||
+	    lzma_stream_footer_decode(&flags, footer) != LZMA_OK ||
+	    flags.backward_size > file_size - 2 * LZMA_STREAM_HEADER_SIZE)
+		return NULL;
+
+	buffer = malloc(flags.backward_size);
+	if (!buffer)
+		return NULL;
+	if (fseeko(inf, -LZMA_STREAM_HEADER_SIZE - flags.backward_size,
+		   SEEK_END) ||
+	    fread(buffer, flags.backward_size, 1, inf) != 1 ||
+	    lzma_index_buffer_decode(&index, &memlimit, NULL, buffer, &in_pos,
+				     flags.backward_size) != LZMA_OK)
+		index = NULL;
+	free(buffer);
+
+	if (index && (lzma_index_stream_flags(index, &flags) != LZMA_OK ||
+		      lzma_index_file_size(index) != (uint64_t)file_size ||
+		      lzma_index_block_count(index) < 1)) {
+		lzma_index_end(index, NULL);
+		index = NULL;
+	}
+
+	return index;
+}
+
+static int unpack_init(struct unpack *u)
+{
+	if (u->format == UNPACK_GZIP)
+		/* 32: detect the gzip header */
+		return inflateInit2(&u->z, 15 + 32) == Z_OK ? 0 : -EINVAL;
+
+	if (u->format != UNPACK_XZ)
+		return 0;
+
+	/* seekable xz files are decoded block by block, from the index */
+	if (u->nr_magic == 0)
+		u->index = unpack_xz_index(u->inf);
+	if (u->index) {
+		lzma_index_iter_init(&u->block, u->index);
+		if (lzma_index_iter_next(&u->block, LZMA_INDEX_ITER_BLOCK))
+			return -EINVAL;
+		return unpack_xz_block(u);
+	}
+	if (u->nr_magic == 0 && fseeko(u->inf, 0, SEEK_SET))
+		return -EIO;
+
+	return lzma_stream_decoder(&u->lz, UNPACK_XZ_MEMLIMIT,
+				   LZMA_CONCATENATED) == LZMA_OK ? 0 : -EINVAL;
+}
+
+/*
+ * input_unpack() - get a stream for reading the uncompressed input
+ * @inf: input file, at its start
+ * @readahead: size of the read-ahead buffer (see input_readahead()) for
+ *             inputs that can only be read front to back: pipes, and
+ *             compressed files apart from xz files with a block index.
+ *             0 reads them in lock-step with the parsers.
+ *
+ * Return: @inf itself if it's not compressed, a stream that decompresses
+ *         @inf, and closes it when being closed itself, otherwise. NULL if
+ *         out of memory, or if the compressed stream is broken: @inf is
+ *         closed then as well, and errno tells why.
+ */
+FILE *input_unpack(FILE *inf, size_t readahead)
+{
+	static const cookie_io_functions_t unpack_io = {
+		.read = unpack_read,
+		.seek = unpack_seek,
+		.close = unpack_close,
+	};
+	unsigned char magic[sizeof(xz_magic)];
+	struct unpack *u;
+	size_t len;
+	int ret;
+	FILE *f;
+
+	len = fread(magic, 1, sizeof(magic), inf);
+
+	u = calloc(1, sizeof(*u));
+	if (!u) {
+		fclose(inf);
+		errno = ENOMEM;
+		return NULL;
+	}
+	u->inf = inf;
+	u->lz = (lzma_stream)LZMA_STREAM_INIT;
+	u->filters[0].id = LZMA_VLI_UNKNOWN;
+
+	if (len >= sizeof(gzip_magic) &&
+	    !memcmp(magic, gzip_magic, sizeof(gzip_magic)))
+		u->format = UNPACK_GZIP;
+	else if (len == sizeof(xz_magic) &&
+		 !memcmp(magic, xz_magic, sizeof(xz_magic)))
+		u->format = UNPACK_XZ;
+
+	/* rewind if we can, otherwise hand out the magic bytes again */
+	if (fseeko(inf, 0, SEEK_SET)) {
+		memcpy(u->magic, magic, len);
+		u->nr_magic = len;
+	} else if (u->format == UNPACK_PLAIN) {
+		free(u);
+		return inf;
+	}
+
+	/* unpack_close() copes with a half initialised decoder */
+	ret = unpack_init(u);
+	if (ret) {
+		unpack_close(u);
+		errno = -ret;
+		return NULL;
+	}
+
+	f = fopencookie(u, "rb", unpack_io);
+	if (!f) {
+		unpack_close(u);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* with an xz index, forward seeks are cheaper than reading ahead */
+	if (readahead && !u->index)
+		f = input_readahead(f, readahead);
+
+	return f;
+}
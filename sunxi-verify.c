@@ -0,0 +1,544 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * sunxi-verify: check the hashes of FIT and U-Boot images, in one pass
+ *
+ * The components are found and streamed by the extraction planner (see
+ * sunxi-plan.c), which hands the data of every FIT image node, and of the
+ * payload of a legacy U-Boot image, to a job here instead of to a file.
+ * The jobs queue their data for a pool of worker threads, one per online
+ * CPU, so the subimages are hashed in parallel: with a mapped input, the
+ * planner runs through the headers in no time and the workers hash from
+ * the mapping, while on a pipe they keep going on the queued copies of the
+ * chunks while the planner reads on for the next image. A job is hashed
+ * by one worker at a time, to keep its data in order.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sunxi-fw.h"
+
+/* copied chunks the workers may fall behind by, on unmapped inputs */
+#define VERIFY_QUEUE_MAX	(16 * 1024 * 1024)
+#define VERIFY_MAX_WORKERS	64
+
+enum verify_algo {
+	ALGO_UNKNOWN,
+	ALGO_CRC32,
+	ALGO_SHA1,
+	ALGO_SHA256,
+};
+
+struct verify_hash {
+	enum verify_algo algo;
+	char name[16];
+	uint8_t expected[SHA256_DIGEST_SIZE];
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	int length;
+	bool computed;			/* by the planner, over a header */
+	uint32_t crc;
+	struct sha_ctx sha;
+};
+
+struct verify_chunk {
+	const void *data;
+	size_t len;
+	bool owned;			/* a copy, to be freed */
+	struct verify_chunk *next;
+};
+
+struct verify_job {
+	char name[4 + 256 + 1];
+	uint64_t size;
+	struct verify_hash hashes[PLAN_MAX_HASHES];
+	int nr_hashes;
+	bool follow;			/* the hashes come with the close */
+	struct verify_hash late[PLAN_MAX_HASHES];
+	int nr_late;
+
+	/* under verify.lock */
+	struct verify_chunk *head, **tail;
+	bool busy;			/* a worker is hashing the chunks */
+	bool runnable;			/* on the run queue */
+	struct verify_job *run_next;
+
+	uint64_t hashed;		/* bytes, all hashes got all of them */
+	uint64_t hash_ns;		/* time spent hashing */
+	struct verify_job *next;
+};
+
+struct verify {
+	struct sunxi_ctx *ctx;
+	bool all;			/* components without hashes are ignored */
+	struct verify_job *jobs, **tail;
+
+	pthread_t workers[VERIFY_MAX_WORKERS];
+	int nr_workers;
+	pthread_mutex_t lock;
+	pthread_cond_t more;		/* a job became runnable, or stop */
+	pthread_cond_t room;		/* chunks were hashed */
+	struct verify_job *run_head, **run_tail;
+	size_t queued;			/* copied bytes, not hashed yet */
+	bool stop;
+};
+
+static uint64_t verify_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void verify_hash_data(struct verify_job *job, const void *data,
+			     size_t len)
+{
+	uint64_t start = verify_now();
+	struct verify_hash *hash;
+	int i;
+
+	for (i = 0; i < job->nr_hashes; i++) {
+		hash = &job->hashes[i];
+		if (hash->computed)
+			continue;
+		switch (hash->algo) {
+		case ALGO_CRC32:
+			hash->crc = crc32_ieee(hash->crc, data, len);
+			break;
+		case ALGO_SHA1:
+		case ALGO_SHA256:
+			sha_update(&hash->sha, data, len);
+			break;
+		default:
+			break;
+		}
+	}
+
+	job->hashed += len;
+	job->hash_ns += verify_now() - start;
+}
+
+/* with verify.lock held */
+static void verify_runnable(struct verify *v, struct verify_job *job)
+{
+	if (job->busy || job->runnable || !job->head)
+		return;
+
+	job->runnable = true;
+	job->run_next = NULL;
+	*v->run_tail = job;
+	v->run_tail = &job->run_next;
+	pthread_cond_signal(&v->more);
+}
+
+static void *verify_worker(void *arg)
+{
+	struct verify *v = arg;
+	struct verify_chunk *chunk, *next;
+	struct verify_job *job;
+	size_t copied;
+
+	pthread_mutex_lock(&v->lock);
+	do {
+		while (!v->run_head && !v->stop)
+			pthread_cond_wait(&v->more, &v->lock);
+		job = v->run_head;
+		if (!job)
+			break;
+		v->run_head = job->run_next;
+		if (!v->run_head)
+			v->run_tail = &v->run_head;
+		job->runnable = false;
+
+		/* take all the job has so far, more may be queued meanwhile */
+		job->busy = true;
+		chunk = job->head;
+		job->head = NULL;
+		job->tail = &job->head;
+		pthread_mutex_unlock(&v->lock);
+
+		for (copied = 0; chunk; chunk = next) {
+			next = chunk->next;
+			verify_hash_data(job, chunk->data, chunk->len);
+			if (chunk->owned) {
+				copied += chunk->len;
+				free((void *)chunk->data);
+			}
+			free(chunk);
+		}
+
+		pthread_mutex_lock(&v->lock);
+		v->queued -= copied;
+		job->busy = false;
+		verify_runnable(v, job);
+		pthread_cond_broadcast(&v->room);
+	} while (1);
+	pthread_mutex_unlock(&v->lock);
+
+	return NULL;
+}
+
+static void verify_start(struct verify *v)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (nr_cpus < 1)
+		nr_cpus = 1;
+	if (nr_cpus > VERIFY_MAX_WORKERS)
+		nr_cpus = VERIFY_MAX_WORKERS;
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_cond_init(&v->more, NULL);
+	pthread_cond_init(&v->room, NULL);
+	v->run_tail = &v->run_head;
+
+	/* without any, the planner hashes the data itself */
+	for (v->nr_workers = 0; v->nr_workers < nr_cpus; v->nr_workers++)
+		if (pthread_create(&v->workers[v->nr_workers], NULL,
+				   verify_worker, v))
+			break;
+}
+
+static void verify_stop(struct verify *v)
+{
+	int i;
+
+	pthread_mutex_lock(&v->lock);
+	v->stop = true;
+	pthread_cond_broadcast(&v->more);
+	pthread_mutex_unlock(&v->lock);
+
+	for (i = 0; i < v->nr_workers; i++)
+		pthread_join(v->workers[i], NULL);
+
+	pthread_cond_destroy(&v->room);
+	pthread_cond_destroy(&v->more);
+	pthread_mutex_destroy(&v->lock);
+}
+
+/*
+ * Picks up the hash nodes we know how to check.
+ * Returns true if the data has to be hashed for it.
+ */
+static bool verify_setup_hash(struct verify_hash *hash,
+			      const struct plan_hash *node)
+{
+	snprintf(hash->name, sizeof(hash->name), "%s%s",
+		 node->computed ? "header " : "", node->algo);
+
+	if (!strcmp(node->algo, "crc32") && node->length == 4) {
+		hash->algo = ALGO_CRC32;
+		hash->crc = 0;
+	} else if (!strcmp(node->algo, "sha1") &&
+		   node->length == SHA1_DIGEST_SIZE) {
+		hash->algo = ALGO_SHA1;
+		sha_init(&hash->sha, 1);
+	} else if (!strcmp(node->algo, "sha256") &&
+		   node->length == SHA256_DIGEST_SIZE) {
+		hash->algo = ALGO_SHA256;
+		sha_init(&hash->sha, 256);
+	} else {
+		hash->algo = ALGO_UNKNOWN;
+		return false;
+	}
+
+	hash->length = node->length;
+	memcpy(hash->expected, node->value, node->length);
+	if (node->computed) {
+		hash->computed = true;
+		memcpy(hash->digest, node->computed, node->length);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Without knowing the algorithms yet, the data goes through all of them.
+ * The hash nodes that follow pick theirs, see verify_resolve().
+ */
+static void verify_follow(struct verify_job *job)
+{
+	static const uint8_t none[SHA256_DIGEST_SIZE];
+	static const struct plan_hash all[] = {
+		{ .algo = "crc32", .value = none, .length = 4 },
+		{ .algo = "sha1", .value = none, .length = SHA1_DIGEST_SIZE },
+		{ .algo = "sha256", .value = none,
+		  .length = SHA256_DIGEST_SIZE },
+	};
+	unsigned int i;
+
+	job->follow = true;
+	for (i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+		verify_setup_hash(&job->hashes[job->nr_hashes++], &all[i]);
+}
+
+/* take the hashes that followed, with the state of the same algorithm */
+static void verify_resolve(struct verify_job *job)
+{
+	struct verify_hash *late;
+	int i, j;
+
+	for (i = 0; i < job->nr_late; i++) {
+		late = &job->late[i];
+		for (j = 0; j < job->nr_hashes; j++) {
+			if (job->hashes[j].algo != late->algo)
+				continue;
+			late->crc = job->hashes[j].crc;
+			late->sha = job->hashes[j].sha;
+			break;
+		}
+	}
+
+	memcpy(job->hashes, job->late, sizeof(job->late));
+	job->nr_hashes = job->nr_late;
+}
+
+static void *verify_open(void *arg, const struct plan_component *comp)
+{
+	struct verify *v = arg;
+	struct verify_job *job;
+	bool hashing = false;
+	int i;
+
+	if (v->all && !comp->nr_hashes && !comp->hashes_follow)
+		return NULL;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return NULL;
+
+	snprintf(job->name, sizeof(job->name), "%s", comp->name);
+	job->size = comp->size;
+	for (i = 0; i < comp->nr_hashes; i++)
+		if (verify_setup_hash(&job->hashes[job->nr_hashes++],
+				      &comp->hashes[i]))
+			hashing = true;
+	if (comp->hashes_follow) {
+		verify_follow(job);
+		hashing = true;
+	}
+	job->tail = &job->head;
+
+	*v->tail = job;
+	v->tail = &job->next;
+
+	/* nothing to do for the planner, but still to be reported */
+	return hashing ? job : NULL;
+}
+
+static void verify_write(void *arg, void *sink, const void *data, size_t len)
+{
+	struct verify *v = arg;
+	struct verify_job *job = sink;
+	struct verify_chunk *chunk;
+	void *copy;
+
+	if (!v->nr_workers)
+		goto inline_hash;
+
+	chunk = malloc(sizeof(*chunk));
+	if (!chunk)
+		goto inline_hash;
+
+	/* the mapping stays, the planner's buffer is reused */
+	chunk->data = data;
+	chunk->owned = !input_owns(v->ctx, data);
+	if (chunk->owned) {
+		copy = malloc(len);
+		if (!copy) {
+			free(chunk);
+			goto inline_hash;
+		}
+		memcpy(copy, data, len);
+		stats_alloc(v->ctx, len);
+		chunk->data = copy;
+	}
+	chunk->len = len;
+	chunk->next = NULL;
+
+	pthread_mutex_lock(&v->lock);
+	while (chunk->owned && v->queued >= VERIFY_QUEUE_MAX)
+		pthread_cond_wait(&v->room, &v->lock);
+	*job->tail = chunk;
+	job->tail = &chunk->next;
+	if (chunk->owned)
+		v->queued += len;
+	verify_runnable(v, job);
+	pthread_mutex_unlock(&v->lock);
+
+	return;
+
+inline_hash:
+	/* wait for what is queued already, to keep the order */
+	if (v->nr_workers) {
+		pthread_mutex_lock(&v->lock);
+		while (job->head || job->busy)
+			pthread_cond_wait(&v->room, &v->lock);
+		pthread_mutex_unlock(&v->lock);
+	}
+	verify_hash_data(job, data, len);
+}
+
+static void verify_close(void *arg, void *sink,
+			 const struct plan_component *comp)
+{
+	struct verify_job *job = sink;
+	int i;
+
+	/* the workers finish the queue, before the report */
+	for (i = 0; job->follow && i < comp->nr_hashes; i++)
+		verify_setup_hash(&job->late[job->nr_late++], &comp->hashes[i]);
+}
+
+static void print_hex(FILE *outf, const uint8_t *data, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		fprintf(outf, "%02x", data[i]);
+}
+
+static double verify_rate(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000.0 / ns : 0.0;	/* MB/s */
+}
+
+/* Returns true if all hashes of @job match. */
+static bool verify_report(struct sunxi_ctx *ctx, struct verify_job *job)
+{
+	FILE *outf = ctx->out;
+	struct verify_hash *hash;
+	bool ok = true;
+	int i;
+
+	if (!job->nr_hashes) {
+		fprintf(outf, "%s: no hash\n", job->name);
+		return true;
+	}
+
+	for (i = 0; i < job->nr_hashes; i++) {
+		hash = &job->hashes[i];
+
+		fprintf(outf, "%s: %s ", job->name, hash->name);
+		if (hash->algo == ALGO_UNKNOWN) {
+			fprintf(outf, "not supported\n");
+			continue;
+		}
+		if (!hash->computed && job->hashed < job->size) {
+			fprintf(outf, "FAILED, image file too small\n");
+			ok = false;
+			continue;
+		}
+
+		if (hash->computed) {
+			/* taken over the header by the planner */
+		} else if (hash->algo == ALGO_CRC32) {
+			hash->digest[0] = hash->crc >> 24;
+			hash->digest[1] = hash->crc >> 16;
+			hash->digest[2] = hash->crc >> 8;
+			hash->digest[3] = hash->crc;
+		} else {
+			sha_final(&hash->sha, hash->digest);
+		}
+
+		if (memcmp(hash->digest, hash->expected, hash->length)) {
+			fprintf(outf, "FAILED");
+			ok = false;
+		} else {
+			fprintf(outf, "OK");
+		}
+		if (hash->computed)
+			fprintf(outf, "\n");
+		else
+			fprintf(outf, ", %"PRIu64" bytes, %.1f MB/s\n",
+				job->size, verify_rate(job->size, job->hash_ns));
+
+		if (ctx->verbose) {
+			fprintf(outf, "\texpected: ");
+			print_hex(outf, hash->expected, hash->length);
+			fprintf(outf, "\n\tcomputed: ");
+			print_hex(outf, hash->digest, hash->length);
+			fprintf(outf, "\n");
+		}
+	}
+
+	return ok;
+}
+
+/*
+ * verify_images() - check the hashes of FIT images and U-Boot images
+ * @ctx: context with the input file, ctx->verbose adds the hash values
+ * @patterns: component names, as shell wildcard patterns, e.g. "fit:*"
+ * @nr_patterns: number of entries in @patterns, 0 for all components that
+ *               have a hash
+ *
+ * Components asked for without a hash node are reported as such, and do
+ * not count as a failure, nor do algorithms other than crc32, sha1 and
+ * sha256. The CRCs of a legacy U-Boot image are checked as the crc32
+ * "hashes" of the u-boot.img (header) and u-boot (data) components.
+ *
+ * Return: 0 if all hashes match, -EINVAL if any does not, or another
+ *         negative error value
+ */
+int verify_images(struct sunxi_ctx *ctx, const char **patterns,
+		  int nr_patterns)
+{
+	static const struct plan_ops verify_ops = {
+		.open = verify_open,
+		.write = verify_write,
+		.close = verify_close,
+	};
+	static const char *all[] = { "*" };
+	struct verify v = { .ctx = ctx, .tail = &v.jobs };
+	struct verify_job *job, *next;
+	uint64_t start, bytes = 0;
+	int ret, nr_images = 0, nr_failed = 0;
+
+	if (!nr_patterns) {
+		patterns = all;
+		nr_patterns = 1;
+		v.all = true;
+	}
+
+	start = verify_now();
+	verify_start(&v);
+	ret = plan_components(ctx, patterns, nr_patterns, &verify_ops, &v);
+	/* the workers finish the run queue before they stop */
+	verify_stop(&v);
+
+	for (job = v.jobs; job; job = next) {
+		next = job->next;
+		if (job->follow)
+			verify_resolve(job);
+		/* a FIT image from a pipe, that turned out to have no hash */
+		if (v.all && !job->nr_hashes) {
+			free(job);
+			continue;
+		}
+		nr_images++;
+		if (!verify_report(ctx, job))
+			nr_failed++;
+		if (job->nr_hashes)
+			bytes += job->hashed;
+		free(job);
+	}
+
+	fprintf(ctx->out, "%d images, %d failed, %"PRIu64" bytes hashed, %.1f MB/s\n",
+		nr_images, nr_failed, bytes,
+		verify_rate(bytes, verify_now() - start));
+
+	if (nr_failed)
+		return -EINVAL;
+
+	return ret;
+}
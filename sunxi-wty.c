@@ -10,90 +10,369 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "sunxi-fw.h"
 
 #define ENTRY_SIZE	0x400
 
-int output_wty_info(void *sector, FILE *inf, FILE *stream, bool verbose)
+#define INDEX_MAGIC	"sunxi-fw WTY index v2\n"
+
+/* FNV-1a, good enough for a few dozen file names */
+static uint32_t wty_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+
+	return hash;
+}
+
+static int wty_dir_hash(struct sunxi_ctx *ctx, struct wty_dir *dir)
+{
+	uint32_t slot;
+	int i;
+
+	for (dir->nr_buckets = 16; dir->nr_buckets < 2 * dir->nr_entries;)
+		dir->nr_buckets *= 2;
+
+	dir->buckets = malloc(dir->nr_buckets * sizeof(*dir->buckets));
+	if (!dir->buckets)
+		return -ENOMEM;
+	stats_alloc(ctx, dir->nr_buckets * sizeof(*dir->buckets));
+	memset(dir->buckets, 0xff, dir->nr_buckets * sizeof(*dir->buckets));
+
+	/* open addressing, the first entry with a given name wins */
+	for (i = 0; i < dir->nr_entries; i++) {
+		slot = wty_hash(dir->entries[i].name) & (dir->nr_buckets - 1);
+		while (dir->buckets[slot] >= 0) {
+			if (!strcmp(dir->entries[dir->buckets[slot]].name,
+				    dir->entries[i].name))
+				break;
+			slot = (slot + 1) & (dir->nr_buckets - 1);
+		}
+		if (dir->buckets[slot] < 0)
+			dir->buckets[slot] = i;
+	}
+
+	return 0;
+}
+
+/* chained over the raw entries, as wty_dir_read() reads them one by one */
+static uint64_t wty_entry_hash(const void *raw, uint64_t hash)
+{
+	return xxh64(raw, ENTRY_SIZE, hash);
+}
+
+/*
+ * wty_table_hash() - hash the entry table, without consuming it
+ * @ctx: context, positioned right behind the image header
+ * @nr_entries: number of entries in the table
+ * @hash: set to the hash of the table
+ *
+ * Return: 0 if successful, -ENOENT if the input is not mapped (the table
+ *         can only be had by reading it then), -EIO if it is truncated
+ */
+static int wty_table_hash(struct sunxi_ctx *ctx, uint32_t nr_entries,
+			  uint64_t *hash)
+{
+	const char *table;
+	uint32_t i;
+
+	if (!ctx->map_base)
+		return -ENOENT;
+
+	table = input_window(ctx, ENTRY_SIZE - 512,
+			     (size_t)nr_entries * ENTRY_SIZE);
+	if (!table)
+		return -EIO;
+
+	for (*hash = 0, i = 0; i < nr_entries; i++)
+		*hash = wty_entry_hash(table + i * ENTRY_SIZE, *hash);
+
+	return 0;
+}
+
+/*
+ * wty_index_load() - get the directory from an index file
+ *
+ * The index is only used if it was written for an image with the very same
+ * header sector at the very same offset, and an entry table with the same
+ * @hash. The names in it are not trusted to be terminated.
+ */
+static int wty_index_load(const char *filename, const void *sector,
+			  uint64_t start, uint64_t hash, struct wty_dir *dir)
+{
+	char magic[sizeof(INDEX_MAGIC)], header[512];
+	uint64_t offset, table_hash;
+	uint32_t nr_entries, i;
+	int ret = -EINVAL;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (!f)
+		return -errno;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, INDEX_MAGIC, sizeof(magic)) ||
+	    fread(&offset, sizeof(offset), 1, f) != 1 || offset != start ||
+	    fread(header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header, sector, sizeof(header)) ||
+	    fread(&nr_entries, sizeof(nr_entries), 1, f) != 1 ||
+	    nr_entries != ((uint32_t *)sector)[15] ||
+	    fread(&table_hash, sizeof(table_hash), 1, f) != 1 ||
+	    table_hash != hash)
+		goto out;
+
+	dir->entries = calloc(nr_entries, sizeof(*dir->entries));
+	if (!dir->entries) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (fread(dir->entries, sizeof(*dir->entries), nr_entries, f) !=
+	    nr_entries) {
+		free(dir->entries);
+		dir->entries = NULL;
+		goto out;
+	}
+	for (i = 0; i < nr_entries; i++) {
+		struct wty_entry *entry = &dir->entries[i];
+
+		entry->name[sizeof(entry->name) - 1] = '\0';
+		entry->maintype[sizeof(entry->maintype) - 1] = '\0';
+		entry->subtype[sizeof(entry->subtype) - 1] = '\0';
+	}
+	dir->nr_entries = nr_entries;
+	ret = 0;
+
+out:
+	fclose(f);
+
+	return ret;
+}
+
+static int wty_index_save(const char *filename, const void *sector,
+			  uint64_t hash, const struct wty_dir *dir)
+{
+	uint32_t nr_entries = dir->nr_entries;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(filename, "wb");
+	if (!f)
+		return -errno;
+
+	if (fwrite(INDEX_MAGIC, sizeof(INDEX_MAGIC), 1, f) != 1 ||
+	    fwrite(&dir->start, sizeof(dir->start), 1, f) != 1 ||
+	    fwrite(sector, 512, 1, f) != 1 ||
+	    fwrite(&nr_entries, sizeof(nr_entries), 1, f) != 1 ||
+	    fwrite(&hash, sizeof(hash), 1, f) != 1 ||
+	    fwrite(dir->entries, sizeof(*dir->entries), nr_entries, f) !=
+	    nr_entries)
+		ret = -EIO;
+
+	if (fclose(f) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
+/*
+ * wty_dir_read() - read the directory of a PhoenixSuite image
+ * @ctx: context, positioned right behind @sector. If ctx->wty_index names
+ *       a matching index file, the directory is taken from there, and the
+ *       input is left alone. Otherwise the input is left behind the entry
+ *       table, and the index file is (re-)written. For unmapped input, the
+ *       entry table has to be read anyway, to see if the index matches, so
+ *       the index is only written then.
+ * @sector: first sector of the image
+ * @dir: filled with the directory, release with wty_dir_free()
+ *
+ * Return: 0 if successful, negative error value otherwise
+ */
+int wty_dir_read(struct sunxi_ctx *ctx, const void *sector,
+		 struct wty_dir *dir)
 {
 	const uint32_t *wty = sector;
-	int nr_images, i;
-	uint32_t *buffer;
-	size_t ret;
-	uint32_t boot0_ofs = 0;
-	bool found_boot0 = false;
-
-	nr_images = wty[15];
-	fprintf(stream, "\theader v%d.%d, %d images, %d MB\n",
-		(wty[2] & 0xff00) >> 8, wty[2] & 0xff, nr_images, wty[6] >> 20);
-	if (!verbose) {
-		pseek(inf, wty[6] - 512);
-		return (wty[6] / 512) - 1;
+	int nr_images = wty[15], i, ret;
+	struct wty_entry *entry;
+	uint64_t hash;
+	uint32_t *raw;
+
+	memset(dir, 0, sizeof(*dir));
+	dir->start = ctx->pos - 512;
+	dir->size = wty[6];
+
+	/* the entry table has to fit into the image, after the header */
+	if (nr_images < 0 || nr_images > WTY_MAX_IMAGES ||
+	    (uint64_t)(nr_images + 1) * ENTRY_SIZE > dir->size)
+		return -EINVAL;
+
+	if (ctx->wty_index && !wty_table_hash(ctx, nr_images, &hash) &&
+	    !wty_index_load(ctx->wty_index, sector, dir->start, hash, dir)) {
+		stats_alloc(ctx, dir->nr_entries * sizeof(*dir->entries));
+		return wty_dir_hash(ctx, dir);
 	}
 
-	pseek(inf, ENTRY_SIZE - 512);	// fast-forward to the first image entry
+	ret = pseek(ctx, ENTRY_SIZE - 512);	// the first image entry
+	if (ret)
+		return ret;
+
+	dir->entries = calloc(nr_images, sizeof(*dir->entries));
+	if (!dir->entries && nr_images)
+		return -ENOMEM;
+	stats_alloc(ctx, nr_images * sizeof(*dir->entries));
 
-	buffer = malloc(nr_images * ENTRY_SIZE);
-	if (!buffer)
-		return 0;
-	ret = fread(buffer, 1, nr_images * ENTRY_SIZE, inf);
-	if (ret < nr_images * ENTRY_SIZE) {
-		fprintf(stream, "\tERROR: image file too small\n");
-		free(buffer);
+	for (hash = 0, i = 0; i < nr_images; i++) {
+		raw = input_read(ctx, ctx->scratch, ENTRY_SIZE);
+		if (!raw)
+			return -EIO;
+		hash = wty_entry_hash(raw, hash);
 
-		return ret / 512;
+		entry = &dir->entries[dir->nr_entries++];
+		snprintf(entry->name, sizeof(entry->name), "%.256s",
+			 (char *)&raw[9]);
+		memcpy(entry->maintype, &raw[2], sizeof(entry->maintype) - 1);
+		memcpy(entry->subtype, &raw[4], sizeof(entry->subtype) - 1);
+		entry->stored_size = raw[73];
+		entry->size = raw[75];
+		entry->offset = raw[77];
 	}
 
-	for (i = 0; i < nr_images; i++) {
-		unsigned int ofs = i * ENTRY_SIZE / 4;
-		char *name = (char *)&buffer[ofs + 9];
+	ret = wty_dir_hash(ctx, dir);
+	if (ret)
+		return ret;
+
+	if (ctx->wty_index &&
+	    wty_index_save(ctx->wty_index, sector, hash, dir))
+		fprintf(stderr, "WARNING: cannot write index file %s\n",
+			ctx->wty_index);
+
+	return 0;
+}
+
+void wty_dir_free(struct wty_dir *dir)
+{
+	free(dir->entries);
+	free(dir->buckets);
+	memset(dir, 0, sizeof(*dir));
+}
+
+const struct wty_entry *wty_dir_find(const struct wty_dir *dir,
+				     const char *name)
+{
+	uint32_t slot;
+
+	if (!dir->nr_buckets)
+		return NULL;
+
+	slot = wty_hash(name) & (dir->nr_buckets - 1);
+	for (; dir->buckets[slot] >= 0; slot = (slot + 1) & (dir->nr_buckets - 1))
+		if (!strcmp(dir->entries[dir->buckets[slot]].name, name))
+			return &dir->entries[dir->buckets[slot]];
+
+	return NULL;
+}
 
-		fprintf(stream, "\t\twty:%-20s: %10d bytes @ +0x%08x\n", name,
-			buffer[ofs + 75], buffer[ofs + 77]);
+/* the boot0 for SD cards, if there is one, any other boot0 otherwise */
+const struct wty_entry *wty_dir_boot0(const struct wty_dir *dir)
+{
+	const struct wty_entry *boot0 = NULL;
+	int i;
 
-		if (found_boot0)
-			continue;
-		if (!strncmp(name, "boot0_", 6))
-			boot0_ofs = ofs;
-		found_boot0 = !strcmp(name, "boot0_sdcard.fex");
+	for (i = 0; i < dir->nr_entries; i++) {
+		if (!strcmp(dir->entries[i].name, "boot0_sdcard.fex"))
+			return &dir->entries[i];
+		if (!boot0 && !strncmp(dir->entries[i].name, "boot0_", 6))
+			boot0 = &dir->entries[i];
 	}
-	if (boot0_ofs) {
-		fprintf(stream, "@%4d: boot0: Allwinner boot0\n",
-			buffer[boot0_ofs + 77] / 512);
-		pseek(inf,
-		      buffer[boot0_ofs + 77] - nr_images * ENTRY_SIZE - 1024);
-		ret = fread(buffer, 1, 512, inf);
-		output_boot0_info(buffer, inf, stream, verbose);
-	} else
-		pseek(inf, wty[6] - 512 - nr_images * ENTRY_SIZE);
-
-	free(buffer);
-	return (wty[6] / 512) - 1;
+
+	return boot0;
 }
 
-void extract_wty_image(void *sector, FILE *inf, FILE *outf, const char *imgname)
+/*
+ * With --only, the image can be masked out while its boot0 is asked for:
+ * then only the boot0 is reported, even without -v.
+ */
+int output_wty_info(struct sunxi_ctx *ctx, void *sector)
 {
 	const uint32_t *wty = sector;
-	uint32_t buffer[ENTRY_SIZE / sizeof(uint32_t)];
-	int nr_images = wty[15], i, ret;
+	uint64_t start = ctx->pos - 512;
+	FILE *stream = ctx->out;
+	bool own = want_component(ctx, IMAGE_PHOENIX);
+	bool nested = ctx->only ? want_nested(ctx, IMAGE_PHOENIX) :
+				  ctx->verbose;
+	const struct wty_entry *entry, *boot0;
+	uint32_t boot0_buf[512 / 4];
+	struct wty_dir dir;
+	void *boot0_sector;
+	int i, ret;
 
-	pseek(inf, ENTRY_SIZE - 512);	// fast-forward to the first image entry
+	if (own)
+		fprintf(stream, "\theader v%d.%d, %d images, %d MB\n",
+			(wty[2] & 0xff00) >> 8, wty[2] & 0xff, wty[15],
+			wty[6] >> 20);
+	if (!ctx->verbose && !nested)
+		return pseek(ctx, wty[6] - 512);
 
-	for (i = 0; i < nr_images; i++) {
-		char *name;
+	ret = wty_dir_read(ctx, sector, &dir);
+	if (ret) {
+		if (ret == -EIO)
+			fprintf(stream, "\tERROR: image file too small\n");
+		else if (ret == -EINVAL)
+			fprintf(stream, "\tERROR: invalid number of images\n");
+		wty_dir_free(&dir);
+		return ret;
+	}
 
-		ret = fread(buffer, 1, ENTRY_SIZE, inf);
-		if (ret != ENTRY_SIZE) {
-			fprintf(stderr, "ERROR: image file too small\n");
-			return;
-		}
-		name = (char *)&buffer[9];
-		if (!strcmp(name, imgname + 4)) {
-			pseek(inf, buffer[77] - (i + 2) * ENTRY_SIZE);
-			copy_file(inf, outf, buffer[75]);
-			return;
-		}
+	for (i = 0; own && ctx->verbose && i < dir.nr_entries; i++) {
+		entry = &dir.entries[i];
+		fprintf(stream, "\t\twty:%-20s: %10d bytes @ +0x%08x\n",
+			entry->name, entry->size, entry->offset);
+	}
+
+	boot0 = nested ? wty_dir_boot0(&dir) : NULL;
+	if (boot0 && start + boot0->offset >= ctx->pos) {
+		fprintf(stream, "@%4d: boot0: Allwinner boot0\n",
+			boot0->offset / 512);
+		pseek(ctx, start + boot0->offset - ctx->pos);
+		boot0_sector = input_read(ctx, boot0_buf, 512);
+		if (boot0_sector)
+			output_boot0_info(ctx, boot0_sector);
 	}
-	fprintf(stderr, "ERROR: image file \"%s\" not found\n", imgname);
+
+	wty_dir_free(&dir);
+
+	/* skip whatever is left, boot0 might have stopped anywhere */
+	if (ctx->pos < start + wty[6])
+		return pseek(ctx, start + wty[6] - ctx->pos);
+
+	return 0;
+}
+
+void extract_wty_image(struct sunxi_ctx *ctx, void *sector, FILE *outf,
+		       const char *imgname)
+{
+	const struct wty_entry *entry;
+	struct wty_dir dir;
+	uint64_t pos;
+
+	if (wty_dir_read(ctx, sector, &dir)) {
+		fprintf(stderr, "ERROR: image file too small\n");
+		wty_dir_free(&dir);
+		return;
+	}
+
+	entry = wty_dir_find(&dir, imgname + 4);
+	if (!entry) {
+		fprintf(stderr, "ERROR: image file \"%s\" not found\n",
+			imgname);
+	} else {
+		pos = dir.start + entry->offset;
+		if (ctx->pos <= pos && !pseek(ctx, pos - ctx->pos))
+			copy_file(ctx, outf, entry->size);
+	}
+
+	wty_dir_free(&dir);
 }